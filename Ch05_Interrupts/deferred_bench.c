@@ -0,0 +1,310 @@
+/*
+ * deferred_bench.c
+ *
+ * How long does posting deferred work take from an "interrupt", and what
+ * does deferring do to the worst case latency of the other interrupts?
+ *
+ * gcc -O2 deferred_bench.c deferred_work.c -o deferred_bench -lpthread -lrt
+ * ./deferred_bench [seconds per run]
+ *
+ * Interrupts are POSIX timer signals delivered to the main thread. Each
+ * handler blocks the other signals while it runs, like interrupts at the
+ * same priority: one can't start until the one running returns.
+ *
+ * Part 1, producers: a 20 kHz timer signal posts work, alone and then with
+ * three threads posting bursts of 16 every 100 us or so. It reports how long
+ * DeferredPost takes and how long items wait before the main loop runs them.
+ * A thread can be preempted in the middle of timing a post, so the thread
+ * maximums are the scheduler's; the percentiles are the post.
+ *
+ * Part 2, Main 4 against Main 5: a 10 kHz tick interrupt that only records
+ * how late it is, and a 1 kHz data interrupt with 300 us of processing. In
+ * Main 4 the data interrupt does the processing in the handler; in Main 5 it
+ * posts it and the main loop does it. The tick latency is the time from when
+ * its timer expired to when its handler ran.
+ *
+ * On a host, signal delivery and the scheduler add their own tens of
+ * microseconds, but the difference between the two is the point.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "deferred_work.h"
+
+#define QUEUE_ITEMS 256
+#define DRAIN_BATCH 32              // items per pass of the main loop
+#define MAX_SAMPLES (1u << 20)
+#define NUM_THREADS 3
+#define THREAD_BURST 16
+#define THREAD_PAUSE_NS 100000
+#define POST_PERIOD_NS 50000        // part 1: 20 kHz
+#define TICK_PERIOD_NS 100000       // part 2: 10 kHz
+#define DATA_PERIOD_NS 1000000      // part 2: 1 kHz
+#define DATA_WORK_NS 300000
+
+struct sSamples {
+  uint32_t *ns;
+  uint32_t count;
+};
+
+static struct sDeferredItem gItems[QUEUE_ITEMS];
+static struct sDeferredQueue gQueue;
+static volatile sig_atomic_t gMain5;
+static atomic_int gThreadsRunning;
+static struct sSamples gSignalPost, gThreadPost[NUM_THREADS], gWaited, gTickLate;
+static timer_t gTickTimer;
+static uint64_t gTickFirst, gTickCount;
+static volatile uint32_t gTicksMissed, gDataDone;
+
+static uint64_t NowNs(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+static void Record(struct sSamples *samples, uint64_t ns)
+{
+  if (samples->count < MAX_SAMPLES) {
+    samples->ns[samples->count++] = ns > UINT32_MAX ? UINT32_MAX : (uint32_t)ns;
+  }
+}
+
+static int CompareU32(const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+static void Report(const char *name, struct sSamples *samples)
+{
+  uint32_t n = samples->count;
+
+  if (n == 0) {
+    printf("  %-24s no samples\n", name);
+    return;
+  }
+  qsort(samples->ns, n, sizeof(samples->ns[0]), CompareU32);
+  printf("  %-24s %8u samples  p50 %7.2f us  p99 %7.2f us  p99.9 %7.2f us  max %8.2f us\n",
+         name, n, samples->ns[n / 2] / 1e3, samples->ns[(uint64_t)n * 99 / 100] / 1e3,
+         samples->ns[(uint64_t)n * 999 / 1000] / 1e3, samples->ns[n - 1] / 1e3);
+  samples->count = 0;
+}
+
+static void BusyFor(uint64_t ns)
+{
+  uint64_t until = NowNs() + ns;
+  while (NowNs() < until) {
+  }
+}
+
+/******************************************************************************************************
+ * "Interrupts"
+*******************************************************************************************************/
+static timer_t StartTimer(int signal, uint64_t periodNs, uint64_t *firstExpiry)
+{
+  struct sigevent event;
+  struct itimerspec spec;
+  timer_t timer;
+  uint64_t first = NowNs() + periodNs;
+
+  memset(&event, 0, sizeof(event));
+  event.sigev_notify = SIGEV_SIGNAL;
+  event.sigev_signo = signal;
+  if (timer_create(CLOCK_MONOTONIC, &event, &timer) != 0) {
+    perror("timer_create");
+    exit(1);
+  }
+  spec.it_value.tv_sec = first / 1000000000u;
+  spec.it_value.tv_nsec = first % 1000000000u;
+  spec.it_interval.tv_sec = periodNs / 1000000000u;
+  spec.it_interval.tv_nsec = periodNs % 1000000000u;
+  if (firstExpiry) {
+    *firstExpiry = first;
+  }
+  timer_settime(timer, TIMER_ABSTIME, &spec, NULL);
+  return timer;
+}
+
+static void OnItem(const struct sDeferredItem *item)
+{
+  Record(&gWaited, (uint32_t)NowNs() - item->postedAt);
+}
+
+static void PostHandler(int signal)
+{
+  uint64_t start = NowNs();
+  (void)signal;
+  DeferredPost(&gQueue, OnItem, NULL, 0, (uint32_t)start);
+  Record(&gSignalPost, NowNs() - start);
+}
+
+static void TickHandler(int signal)
+{
+  uint64_t now = NowNs();
+  int overrun = timer_getoverrun(gTickTimer);
+  (void)signal;
+  // the oldest expiry this signal stands for; overruns expired while it waited
+  Record(&gTickLate, now - (gTickFirst + gTickCount * TICK_PERIOD_NS));
+  gTickCount += 1 + (overrun > 0 ? overrun : 0);
+  gTicksMissed += overrun > 0 ? overrun : 0;
+}
+
+static void ProcessData(const struct sDeferredItem *item)
+{
+  (void)item;
+  BusyFor(DATA_WORK_NS);
+  gDataDone++;
+}
+
+static void DataHandler(int signal)
+{
+  (void)signal;
+  if (gMain5) {
+    DeferredPost(&gQueue, ProcessData, NULL, 0, 0);
+  } else {
+    ProcessData(NULL);
+  }
+}
+
+static void Install(int signal, void (*handler)(int))
+{
+  struct sigaction action;
+
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = handler;
+  sigemptyset(&action.sa_mask);
+  sigaddset(&action.sa_mask, SIGRTMIN);     // all the same priority
+  sigaddset(&action.sa_mask, SIGRTMIN + 1);
+  sigaddset(&action.sa_mask, SIGRTMIN + 2);
+  action.sa_flags = SA_RESTART;
+  sigaction(signal, &action, NULL);
+}
+
+/******************************************************************************************************
+ * Part 1: producers
+*******************************************************************************************************/
+// Bursts of posts with a pause between, so the main loop can keep up
+static void *Producer(void *arg)
+{
+  struct sSamples *samples = arg;
+  struct timespec pause = {0, THREAD_PAUSE_NS};
+  uint32_t n = 0;
+  int i;
+
+  while (atomic_load_explicit(&gThreadsRunning, memory_order_relaxed)) {
+    for (i = 0; i < THREAD_BURST; i++) {
+      uint64_t start = NowNs();
+      DeferredPost(&gQueue, OnItem, NULL, n++, (uint32_t)start);
+      Record(samples, NowNs() - start);
+    }
+    nanosleep(&pause, NULL);
+  }
+  return NULL;
+}
+
+static void RunProducers(int seconds, int numThreads)
+{
+  pthread_t threads[NUM_THREADS];
+  sigset_t mask;
+  timer_t timer;
+  uint64_t until;
+  char name[32];
+  int i;
+
+  DeferredInit(&gQueue, gItems, QUEUE_ITEMS);
+  atomic_store(&gThreadsRunning, 1);
+  // the threads inherit the mask, so the signals only go to the main thread
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGRTMIN + 2);
+  pthread_sigmask(SIG_BLOCK, &mask, NULL);
+  for (i = 0; i < numThreads; i++) {
+    pthread_create(&threads[i], NULL, Producer, &gThreadPost[i]);
+  }
+  pthread_sigmask(SIG_UNBLOCK, &mask, NULL);
+  timer = StartTimer(SIGRTMIN + 2, POST_PERIOD_NS, NULL);
+  until = NowNs() + (uint64_t)seconds * 1000000000u;
+  while (NowNs() < until) {
+    DeferredDrain(&gQueue, DRAIN_BATCH);
+  }
+  timer_delete(timer);
+  atomic_store(&gThreadsRunning, 0);
+  for (i = 0; i < numThreads; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  while (DeferredDrain(&gQueue, QUEUE_ITEMS)) {
+  }
+
+  printf("Signal producer at %d kHz, %d thread producers:\n", 1000000 / POST_PERIOD_NS, numThreads);
+  Report("post from signal", &gSignalPost);
+  for (i = 0; i < numThreads; i++) {
+    snprintf(name, sizeof(name), "post from thread %d", i);
+    Report(name, &gThreadPost[i]);
+  }
+  Report("posted to run", &gWaited);
+  printf("  dropped %u (queue full), most waiting %u of %d\n",
+         atomic_load(&gQueue.dropped), gQueue.highWater, QUEUE_ITEMS);
+}
+
+/******************************************************************************************************
+ * Part 2: Main 4 (interrupts do everything) against Main 5 (interrupts send events)
+*******************************************************************************************************/
+static void RunMainLoop(int seconds, int main5)
+{
+  timer_t tick, data;
+  uint64_t until;
+
+  DeferredInit(&gQueue, gItems, QUEUE_ITEMS);
+  gMain5 = main5;
+  gTicksMissed = 0;
+  gDataDone = 0;
+  gTickCount = 0;
+  tick = StartTimer(SIGRTMIN, TICK_PERIOD_NS, &gTickFirst);
+  gTickTimer = tick;
+  data = StartTimer(SIGRTMIN + 1, DATA_PERIOD_NS, NULL);
+  until = NowNs() + (uint64_t)seconds * 1000000000u;
+  while (NowNs() < until) {
+    DeferredDrain(&gQueue, DRAIN_BATCH); // Main 4 never has anything here
+  }
+  timer_delete(data);
+  timer_delete(tick);
+  while (DeferredDrain(&gQueue, QUEUE_ITEMS)) {
+  }
+
+  printf("%s:\n", main5 ? "Main 5, data interrupt posts its processing"
+                        : "Main 4, data interrupt processes in the handler");
+  Report("tick latency", &gTickLate);
+  printf("  ticks missed %u, data blocks processed %u, dropped %u\n",
+         gTicksMissed, gDataDone, atomic_load(&gQueue.dropped));
+}
+
+int main(int argc, char *argv[])
+{
+  int seconds = argc > 1 ? atoi(argv[1]) : 2;
+  int i;
+
+  gSignalPost.ns = calloc(MAX_SAMPLES, sizeof(uint32_t));
+  gWaited.ns = calloc(MAX_SAMPLES, sizeof(uint32_t));
+  gTickLate.ns = calloc(MAX_SAMPLES, sizeof(uint32_t));
+  for (i = 0; i < NUM_THREADS; i++) {
+    gThreadPost[i].ns = calloc(MAX_SAMPLES, sizeof(uint32_t));
+  }
+  Install(SIGRTMIN, TickHandler);
+  Install(SIGRTMIN + 1, DataHandler);
+  Install(SIGRTMIN + 2, PostHandler);
+
+  printf("Queue of %d items, main loop drains %d at a time, %ld cores online\n\n",
+         QUEUE_ITEMS, DRAIN_BATCH, sysconf(_SC_NPROCESSORS_ONLN));
+  RunProducers(seconds, 0);
+  RunProducers(seconds, NUM_THREADS);
+  printf("\nTick every %d us, data every %d us with %d us of processing\n",
+         TICK_PERIOD_NS / 1000, DATA_PERIOD_NS / 1000, DATA_WORK_NS / 1000);
+  RunMainLoop(seconds, 0);
+  RunMainLoop(seconds, 1);
+  return 0;
+}
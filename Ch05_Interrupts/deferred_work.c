@@ -0,0 +1,77 @@
+/*
+ * deferred_work.c
+ *
+ * Deferred interrupt work queue, see deferred_work.h
+ */
+#include "deferred_work.h"
+
+void DeferredInit(struct sDeferredQueue *queue, struct sDeferredItem *items, uint32_t numItems)
+{
+  uint32_t i;
+
+  queue->items = items;
+  queue->mask = numItems - 1;
+  for (i = 0; i < numItems; i++) {
+    items[i].handler = 0;
+    atomic_init(&items[i].sequence, 0);
+  }
+  atomic_init(&queue->used, 0);
+  atomic_init(&queue->tail, 0);
+  queue->head = 0;
+  atomic_init(&queue->dropped, 0);
+  queue->highWater = 0;
+}
+
+int DeferredPost(struct sDeferredQueue *queue, DeferredHandler handler, void *context,
+                 uint32_t data, uint32_t postedAt)
+{
+  struct sDeferredItem *item;
+  uint32_t position;
+
+  // Reserve room first. Anyone who gets a number under the size has a slot
+  // that is free or will be by the time they reach it, because the main
+  // loop only gives the room back after it is done with a slot.
+  if (atomic_fetch_add_explicit(&queue->used, 1, memory_order_acquire) > queue->mask) {
+    atomic_fetch_sub_explicit(&queue->used, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&queue->dropped, 1, memory_order_relaxed);
+    return -1;
+  }
+  // acq_rel: another poster may have reserved after us but claimed before,
+  // and its reservation is what saw the main loop finish with our slot
+  position = atomic_fetch_add_explicit(&queue->tail, 1, memory_order_acq_rel);
+  item = &queue->items[position & queue->mask];
+  item->handler = handler;
+  item->context = context;
+  item->data = data;
+  item->postedAt = postedAt;
+  atomic_store_explicit(&item->sequence, position + 1, memory_order_release);
+  return 0;
+}
+
+uint32_t DeferredDrain(struct sDeferredQueue *queue, uint32_t maxItems)
+{
+  uint32_t ran = 0, waiting;
+
+  // a post that finds it full counts itself for a moment before backing out
+  waiting = atomic_load_explicit(&queue->used, memory_order_relaxed);
+  if (waiting > queue->mask + 1) {
+    waiting = queue->mask + 1;
+  }
+  if (waiting > queue->highWater) {
+    queue->highWater = waiting;
+  }
+  while (ran < maxItems) {
+    struct sDeferredItem *item = &queue->items[queue->head & queue->mask];
+    // A poster that claimed this slot may not have filled it in yet (a
+    // thread on a host; on a micro the interrupt finishes before the main
+    // loop runs again). Stop here, the rest keep their order.
+    if (atomic_load_explicit(&item->sequence, memory_order_acquire) != queue->head + 1) {
+      break;
+    }
+    item->handler(item);
+    queue->head++;
+    ran++;
+    atomic_fetch_sub_explicit(&queue->used, 1, memory_order_release);
+  }
+  return ran;
+}
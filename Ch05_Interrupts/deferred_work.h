@@ -0,0 +1,64 @@
+/*
+ * deferred_work.h
+ *
+ * Interrupts that send events to the main loop (Main 5 in
+ * ../Ch06_Flow/MainLoopDiagrams.md) instead of doing everything themselves
+ * (Main 4).
+ *
+ * The interrupt handler does the part that can't wait (read the data
+ * register, clear the flag), then posts a small work item: a function to
+ * call and a word of data. The main loop drains the queue and calls the
+ * functions with interrupts enabled. Handlers stay short, so the longest
+ * any interrupt waits for another one to finish is short too.
+ *
+ * Posting is wait-free: a fixed number of atomic operations, no retry
+ * loops, so a handler can never get stuck behind the main loop or another
+ * handler. One fetch-and-add reserves room (or finds the queue full and
+ * counts a drop), a second claims a slot, then the item is copied in and
+ * marked ready. The main loop is the only consumer.
+ *
+ * On a Cortex-M3/M4, C11 atomics become LDREX/STREX, which retry only if
+ * an interrupt hit between the two; on a Cortex-M0 (no LDREX) the compiler
+ * library disables interrupts around them instead. On a host, signal
+ * handlers and threads stand in for interrupts.
+ */
+#ifndef DEFERRED_WORK_H
+#define DEFERRED_WORK_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+struct sDeferredItem;
+typedef void (*DeferredHandler)(const struct sDeferredItem *item);
+
+struct sDeferredItem {
+  DeferredHandler handler;
+  void *context;
+  uint32_t data;
+  uint32_t postedAt;        // timestamp, if the poster sets one
+  atomic_uint sequence;     // == position + 1 when ready to run
+};
+
+struct sDeferredQueue {
+  struct sDeferredItem *items;
+  uint32_t mask;            // number of items (a power of two) - 1
+  atomic_uint used;         // reserved and not yet run
+  atomic_uint tail;         // next position to claim
+  uint32_t head;            // main loop only
+  atomic_uint dropped;      // posts that found the queue full
+  uint32_t highWater;       // most items waiting at once, seen by the main loop
+};
+
+// items must have numItems entries, a power of two
+void DeferredInit(struct sDeferredQueue *queue, struct sDeferredItem *items, uint32_t numItems);
+
+// From interrupts (or anywhere). Returns 0, or -1 if the queue was full and
+// the work was dropped.
+int DeferredPost(struct sDeferredQueue *queue, DeferredHandler handler, void *context,
+                 uint32_t data, uint32_t postedAt);
+
+// From the main loop: runs up to maxItems waiting items in the order they
+// were posted. Returns how many ran.
+uint32_t DeferredDrain(struct sDeferredQueue *queue, uint32_t maxItems);
+
+#endif // DEFERRED_WORK_H
@@ -0,0 +1,343 @@
+/*
+ * active.c
+ *
+ * Active objects with lock-free event queues and pooled events, see active.h
+ */
+#include <string.h>
+#include "active.h"
+
+#define NO_BLOCK 0xFFFFFFFFu
+
+static struct sEventPool gPools[ACTIVE_MAX_POOLS];
+static int gNumPools;
+
+/******************************************************************************************************
+ * Event pools
+ * A Treiber stack of free blocks. The head holds the block index in the low
+ * 32 bits and a count in the high 32 that changes on every pop, so a pop
+ * that read a stale next link (the block was popped and pushed again in
+ * between) fails its compare and exchange instead of corrupting the list.
+*******************************************************************************************************/
+static inline struct sEvent *Block(const struct sEventPool *pool, uint32_t index)
+{
+  return (struct sEvent *)(pool->memory + (size_t)index * pool->blockSize);
+}
+
+int EventPoolInit(void *memory, uint32_t blockSize, uint32_t numBlocks)
+{
+  struct sEventPool *pool;
+  uint32_t i;
+
+  if (gNumPools >= ACTIVE_MAX_POOLS || blockSize < sizeof(struct sEvent) || numBlocks == 0 ||
+      (gNumPools > 0 && gPools[gNumPools - 1].blockSize > blockSize)) {
+    return -1;
+  }
+  pool = &gPools[gNumPools];
+  pool->memory = memory;
+  pool->blockSize = blockSize;
+  pool->numBlocks = numBlocks;
+  for (i = 0; i < numBlocks; i++) {
+    struct sEvent *block = Block(pool, i);
+    block->poolId = (uint8_t)gNumPools;
+    atomic_init(&block->refCount, i + 1 < numBlocks ? i + 1 : NO_BLOCK);
+  }
+  atomic_init(&pool->freeList, 0);
+  atomic_init(&pool->numFree, numBlocks);
+  atomic_init(&pool->lowWater, numBlocks);
+  gNumPools++;
+  return 0;
+}
+
+struct sEventPool *EventPoolGet(uint8_t poolId)
+{
+  return poolId < gNumPools ? &gPools[poolId] : NULL;
+}
+
+static struct sEvent *PoolPop(struct sEventPool *pool)
+{
+  uint64_t head = atomic_load_explicit(&pool->freeList, memory_order_acquire);
+  uint64_t newHead;
+  uint32_t index, numFree, lowWater;
+
+  do {
+    index = (uint32_t)head;
+    if (index == NO_BLOCK) {
+      return NULL;
+    }
+    // while it is free, refCount is the link to the next free block
+    newHead = ((head >> 32) + 1) << 32 |
+              atomic_load_explicit(&Block(pool, index)->refCount, memory_order_relaxed);
+  } while (!atomic_compare_exchange_weak_explicit(&pool->freeList, &head, newHead,
+                                                  memory_order_acquire, memory_order_acquire));
+
+  numFree = atomic_fetch_sub_explicit(&pool->numFree, 1, memory_order_relaxed) - 1;
+  lowWater = atomic_load_explicit(&pool->lowWater, memory_order_relaxed);
+  while (numFree < lowWater &&
+         !atomic_compare_exchange_weak_explicit(&pool->lowWater, &lowWater, numFree,
+                                                memory_order_relaxed, memory_order_relaxed)) {
+  }
+  return Block(pool, index);
+}
+
+static void PoolPush(struct sEventPool *pool, struct sEvent *event)
+{
+  uint32_t index = (uint32_t)(((uint8_t *)event - pool->memory) / pool->blockSize);
+  uint64_t head = atomic_load_explicit(&pool->freeList, memory_order_relaxed);
+  uint64_t newHead;
+
+  do {
+    atomic_store_explicit(&event->refCount, (uint32_t)head, memory_order_relaxed);
+    newHead = ((head >> 32) + 1) << 32 | index;
+  } while (!atomic_compare_exchange_weak_explicit(&pool->freeList, &head, newHead,
+                                                  memory_order_release, memory_order_relaxed));
+  atomic_fetch_add_explicit(&pool->numFree, 1, memory_order_relaxed);
+}
+
+struct sEvent *EventNew(size_t size, uint16_t signal)
+{
+  struct sEvent *event;
+  int i;
+
+  for (i = 0; i < gNumPools; i++) {
+    if (gPools[i].blockSize >= size) {
+      event = PoolPop(&gPools[i]);
+      if (event) {
+        event->signal = signal;
+        event->poolId = (uint8_t)i;
+        atomic_store_explicit(&event->refCount, 0, memory_order_relaxed);
+      }
+      return event; // don't use a bigger pool: let the right one run dry visibly
+    }
+  }
+  return NULL;
+}
+
+void EventUnref(struct sEvent *event)
+{
+  if (event->poolId == EVENT_STATIC) {
+    return;
+  }
+  // acq_rel: whoever frees it must see everything the other holders did
+  if (atomic_fetch_sub_explicit(&event->refCount, 1, memory_order_acq_rel) == 1) {
+    PoolPush(&gPools[event->poolId], event);
+  }
+}
+
+// Drops count references at once
+static void EventUnrefBy(struct sEvent *event, uint32_t count)
+{
+  if (event->poolId == EVENT_STATIC || count == 0) {
+    return;
+  }
+  if (atomic_fetch_sub_explicit(&event->refCount, count, memory_order_acq_rel) == count) {
+    PoolPush(&gPools[event->poolId], event);
+  }
+}
+
+/******************************************************************************************************
+ * Event queues
+ * Slot i starts with sequence i. A producer that reserves position pos (by
+ * moving the tail) may write the slot when its sequence is pos, and then
+ * sets it to pos + 1 to hand it to the consumer. The consumer sets it to
+ * pos + size when done, which is the next lap's pos.
+*******************************************************************************************************/
+static void QueueInit(struct sEventQueue *queue, struct sQueueSlot *slots, uint32_t numSlots)
+{
+  uint32_t i;
+  queue->slots = slots;
+  queue->mask = numSlots - 1;
+  for (i = 0; i < numSlots; i++) {
+    atomic_init(&slots[i].sequence, i);
+    slots[i].event = NULL;
+  }
+  atomic_init(&queue->tail, 0);
+  queue->head = 0;
+}
+
+static int QueuePut(struct sEventQueue *queue, struct sEvent *event)
+{
+  uint32_t pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+  struct sQueueSlot *slot;
+
+  while (1) {
+    int32_t diff;
+    slot = &queue->slots[pos & queue->mask];
+    diff = (int32_t)(atomic_load_explicit(&slot->sequence, memory_order_acquire) - pos);
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&queue->tail, &pos, pos + 1,
+                                                memory_order_relaxed, memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      return -1; // the consumer hasn't emptied this slot from the last lap: full
+    } else {
+      pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    }
+  }
+  slot->event = event;
+  atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release);
+  return 0;
+}
+
+static struct sEvent *QueueGet(struct sEventQueue *queue)
+{
+  struct sQueueSlot *slot = &queue->slots[queue->head & queue->mask];
+  struct sEvent *event;
+
+  if (atomic_load_explicit(&slot->sequence, memory_order_acquire) != queue->head + 1) {
+    return NULL;
+  }
+  event = slot->event;
+  atomic_store_explicit(&slot->sequence, queue->head + queue->mask + 1, memory_order_release);
+  queue->head++;
+  return event;
+}
+
+/******************************************************************************************************
+ * Active objects and the dispatcher
+*******************************************************************************************************/
+void ActiveDispatcherInit(struct sActiveDispatcher *dispatcher)
+{
+  atomic_init(&dispatcher->ready, 0);
+  memset(dispatcher->actives, 0, sizeof(dispatcher->actives));
+}
+
+int ActiveInit(struct sActive *me, struct sQueueSlot *slots, uint32_t numSlots,
+               ActiveDispatch dispatch, void (*notify)(struct sActive *me))
+{
+  if (numSlots == 0 || (numSlots & (numSlots - 1)) != 0) {
+    return -1;
+  }
+  QueueInit(&me->queue, slots, numSlots);
+  me->dispatch = dispatch;
+  me->dispatcher = NULL;
+  me->notify = notify;
+  me->priority = 0;
+  atomic_init(&me->postFailures, 0);
+  return 0;
+}
+
+int ActiveStart(struct sActiveDispatcher *dispatcher, struct sActive *me, uint8_t priority,
+                struct sQueueSlot *slots, uint32_t numSlots, ActiveDispatch dispatch)
+{
+  if (priority >= ACTIVE_MAX_OBJECTS || dispatcher->actives[priority] != NULL ||
+      ActiveInit(me, slots, numSlots, dispatch, NULL) != 0) {
+    return -1;
+  }
+  me->dispatcher = dispatcher;
+  me->priority = priority;
+  dispatcher->actives[priority] = me;
+  return 0;
+}
+
+struct sEvent *ActiveNextEvent(struct sActive *me)
+{
+  return QueueGet(&me->queue);
+}
+
+int ActiveHasEvents(struct sActive *me)
+{
+  const struct sQueueSlot *slot = &me->queue.slots[me->queue.head & me->queue.mask];
+  return atomic_load_explicit(&slot->sequence, memory_order_acquire) == me->queue.head + 1;
+}
+
+int ActivePost(struct sActive *me, struct sEvent *event)
+{
+  EventRef(event); // before it is visible to the dispatcher
+  if (QueuePut(&me->queue, event) != 0) {
+    atomic_fetch_add_explicit(&me->postFailures, 1, memory_order_relaxed);
+    EventUnref(event);
+    return -1;
+  }
+  if (me->notify) {
+    me->notify(me);
+    return 0;
+  }
+  // Always the read-modify-write, even if the bit looks set: checking first
+  // could miss the dispatcher clearing it and then not seeing this event
+  atomic_fetch_or_explicit(&me->dispatcher->ready, (uint32_t)1 << me->priority,
+                           memory_order_acq_rel);
+  return 0;
+}
+
+int ActivePublish(struct sActive *const *actives, int count, struct sEvent *event)
+{
+  int i, posted = 0;
+
+  EventRef(event); // hold it so an early subscriber can't free it before the rest get it
+  for (i = 0; i < count; i++) {
+    posted += ActivePost(actives[i], event) == 0;
+  }
+  EventUnref(event);
+  return posted;
+}
+
+// The same as ActivePublish, with fewer atomic operations: one to take a
+// reference for every object (plus one to hold it), and one OR of the
+// ready bits for each run of objects on the same dispatcher, instead of
+// one of each per object. Each bit is still set after its event is queued.
+int ActivePublishMask(struct sActive *const *actives, uint64_t mask, struct sEvent *event)
+{
+  struct sActiveDispatcher *pending = NULL;
+  uint32_t count = (uint32_t)__builtin_popcountll(mask), failed = 0, bits = 0;
+
+  if (event->poolId != EVENT_STATIC) {
+    atomic_fetch_add_explicit(&event->refCount, count + 1, memory_order_relaxed);
+  }
+  while (mask) {
+    struct sActive *me = actives[__builtin_ctzll(mask)];
+    mask &= mask - 1;
+    if (QueuePut(&me->queue, event) != 0) {
+      atomic_fetch_add_explicit(&me->postFailures, 1, memory_order_relaxed);
+      failed++;
+      continue;
+    }
+    if (me->notify) {
+      me->notify(me);
+      continue;
+    }
+    if (me->dispatcher != pending) {
+      if (pending) {
+        atomic_fetch_or_explicit(&pending->ready, bits, memory_order_acq_rel);
+      }
+      pending = me->dispatcher;
+      bits = 0;
+    }
+    bits |= (uint32_t)1 << me->priority;
+  }
+  if (pending) {
+    atomic_fetch_or_explicit(&pending->ready, bits, memory_order_acq_rel);
+  }
+  EventUnrefBy(event, failed + 1);
+  return (int)(count - failed);
+}
+
+int ActiveDispatchOne(struct sActiveDispatcher *dispatcher)
+{
+  uint32_t ready = atomic_load_explicit(&dispatcher->ready, memory_order_acquire);
+  struct sActive *me;
+  struct sEvent *event;
+  uint32_t bit;
+
+  while (ready) {
+    uint8_t priority = (uint8_t)(31 - __builtin_clz(ready));
+    me = dispatcher->actives[priority];
+    bit = (uint32_t)1 << priority;
+    event = QueueGet(&me->queue);
+    if (event == NULL) {
+      // Looks empty: clear the bit, then look again in case a post landed
+      // between the two (its bit set would be lost otherwise)
+      atomic_fetch_and_explicit(&dispatcher->ready, ~bit, memory_order_acq_rel);
+      event = QueueGet(&me->queue);
+      if (event == NULL) {
+        ready &= ~bit;
+        continue;
+      }
+      atomic_fetch_or_explicit(&dispatcher->ready, bit, memory_order_relaxed);
+    }
+    me->dispatch(me, event);
+    EventUnref(event);
+    return 1;
+  }
+  return 0;
+}
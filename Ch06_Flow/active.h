@@ -0,0 +1,149 @@
+/*
+ * active.h
+ *
+ * Active objects (Main 7 in MainLoopDiagrams.md).
+ *
+ * An active object owns its data and an event queue, and the only way to
+ * talk to it is to post it an event. A dispatcher takes events off the
+ * queues one at a time and hands each to its object's dispatch function,
+ * which runs to completion. Nothing shares data, so nothing needs a lock,
+ * and interrupts only have to post an event and get out.
+ *
+ * Events come from fixed-size pools (no malloc) and are reference counted,
+ * so one event can be published to several objects without copying it.
+ * A new event has no references; each post adds one and the dispatcher
+ * drops one after dispatch, returning the event to its pool when the last
+ * object is done with it. Dispatch functions must treat events as read only.
+ *
+ * The queues are bounded and lock free with many producers (interrupts,
+ * other threads, other objects) and one consumer (the dispatcher). The
+ * pools' free lists are lock free too. This is the same shape as the
+ * QP framework from Miro Samek (https://www.state-machine.com/), cut down.
+ *
+ * Each object has a priority (0-31, higher first). The dispatcher keeps a
+ * bitmap of objects with events waiting and always serves the highest.
+ */
+#ifndef ACTIVE_H
+#define ACTIVE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#define ACTIVE_MAX_OBJECTS 32   // one bit each in the ready bitmap
+#define ACTIVE_MAX_POOLS 4
+
+// The header of every event. Events with data embed this as their first
+// member: struct sButtonEvent { struct sEvent super; uint8_t button; };
+struct sEvent {
+  uint16_t signal;
+  uint8_t poolId;           // which pool to return it to, 0xFF for static events
+  uint8_t reserved;
+  atomic_uint refCount;     // while in the pool, the index of the next free block
+};
+
+#define EVENT_STATIC 0xFF
+
+/******************************************************************************************************
+ * Event pools
+*******************************************************************************************************/
+struct sEventPool {
+  uint8_t *memory;
+  uint32_t blockSize;
+  uint32_t numBlocks;
+  _Atomic uint64_t freeList;  // index of the first free block, and a tag against ABA
+  atomic_uint numFree;
+  atomic_uint lowWater;       // fewest free blocks seen, to size the pool
+};
+
+// Pools must be added smallest block size first. memory must be
+// blockSize * numBlocks bytes and aligned for sEvent. Returns 0 on success.
+int EventPoolInit(void *memory, uint32_t blockSize, uint32_t numBlocks);
+
+// A new event with room for size bytes (including the header), from the
+// smallest pool that fits. Returns NULL if that pool is empty.
+struct sEvent *EventNew(size_t size, uint16_t signal);
+
+static inline void EventRef(struct sEvent *event)
+{
+  if (event->poolId != EVENT_STATIC) {
+    atomic_fetch_add_explicit(&event->refCount, 1, memory_order_relaxed);
+  }
+}
+
+// Drops a reference, returning the event to its pool after the last one
+void EventUnref(struct sEvent *event);
+
+struct sEventPool *EventPoolGet(uint8_t poolId);
+
+/******************************************************************************************************
+ * Event queues
+ * Dmitry Vyukov's bounded queue: each slot has a sequence number that says
+ * whose turn it is to use it, so producers only contend on the tail index.
+*******************************************************************************************************/
+struct sQueueSlot {
+  atomic_uint sequence;
+  struct sEvent *event;
+};
+
+struct sEventQueue {
+  struct sQueueSlot *slots;
+  uint32_t mask;              // number of slots (a power of two) - 1
+  atomic_uint tail;           // producers
+  uint32_t head;              // the dispatcher only
+};
+
+/******************************************************************************************************
+ * Active objects and the dispatcher
+*******************************************************************************************************/
+struct sActive;
+typedef void (*ActiveDispatch)(struct sActive *me, const struct sEvent *event);
+
+struct sActiveDispatcher {
+  atomic_uint ready;                          // bit per priority with events waiting
+  struct sActive *actives[ACTIVE_MAX_OBJECTS]; // by priority
+};
+
+struct sActive {
+  struct sEventQueue queue;
+  ActiveDispatch dispatch;
+  struct sActiveDispatcher *dispatcher;
+  void (*notify)(struct sActive *me);  // other dispatchers: called after each post
+  uint8_t priority;
+  atomic_uint postFailures;   // queue was full
+};
+
+void ActiveDispatcherInit(struct sActiveDispatcher *dispatcher);
+
+// numSlots must be a power of two. Returns 0 on success, -1 if the priority
+// is taken or out of range.
+int ActiveStart(struct sActiveDispatcher *dispatcher, struct sActive *me, uint8_t priority,
+                struct sQueueSlot *slots, uint32_t numSlots, ActiveDispatch dispatch);
+
+// For dispatchers other than the one here (see executor.c): notify is
+// called after every successful post, from the posting thread, and the
+// dispatcher takes events with ActiveNextEvent. Only one thread at a time
+// may take events from an object.
+int ActiveInit(struct sActive *me, struct sQueueSlot *slots, uint32_t numSlots,
+               ActiveDispatch dispatch, void (*notify)(struct sActive *me));
+struct sEvent *ActiveNextEvent(struct sActive *me);
+int ActiveHasEvents(struct sActive *me);
+
+// From anywhere: interrupts, threads, other active objects. Returns 0 on
+// success or -1 if the queue is full, in which case an event nobody else
+// holds goes back to its pool.
+int ActivePost(struct sActive *me, struct sEvent *event);
+
+// Post one event to several objects without copying it. Returns how many
+// got it.
+int ActivePublish(struct sActive *const *actives, int count, struct sEvent *event);
+
+// Post one event to each object whose bit is set in mask (bit i is
+// actives[i]), for publish and subscribe (pubsub.h). Returns how many got it.
+int ActivePublishMask(struct sActive *const *actives, uint64_t mask, struct sEvent *event);
+
+// Dispatches one event to the highest priority object that has one.
+// Returns 0 if there was nothing to do (time to sleep).
+int ActiveDispatchOne(struct sActiveDispatcher *dispatcher);
+
+#endif // ACTIVE_H
@@ -0,0 +1,241 @@
+/*
+ * active_bench.c
+ *
+ * How many events per second can the active object framework move, and how
+ * long does an event wait between being posted and being dispatched?
+ *
+ * gcc -O2 active_bench.c active.c -o active_bench -lpthread
+ * ./active_bench [millions of events]
+ *
+ * 1. One thread posts and dispatches in turn: the cost of the framework
+ *    itself (allocate, post, dispatch, free) with no contention.
+ * 2. The same, but each event is published to all four objects at once.
+ * 3. Producer threads post while a dispatcher thread drains the queues,
+ *    each event stamped with the time it was posted. On a machine with
+ *    fewer cores than threads, the latency is mostly the OS switching
+ *    between them, which is why the queues have to be deep enough to
+ *    ride out a time slice.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include "active.h"
+
+#define NUM_OBJECTS 4
+#define QUEUE_SLOTS 1024
+#define NUM_PRODUCERS 3
+#define POOL_BLOCKS 4096
+#define HISTOGRAM_BUCKETS 32    // powers of two nanoseconds
+#define SIG_SAMPLE 1
+#define SIG_STOP 2
+
+struct sSampleEvent {
+  struct sEvent super;
+  uint64_t postedNs;
+  int32_t value;
+};
+
+struct sCounter {
+  struct sActive super;   // active objects embed sActive the way events embed sEvent
+  uint64_t count;
+  int64_t sum;
+};
+
+static struct sActiveDispatcher gDispatcher;
+static struct sCounter gCounters[NUM_OBJECTS];
+static struct sActive *gSubscribers[NUM_OBJECTS];
+static struct sQueueSlot gSlots[NUM_OBJECTS][QUEUE_SLOTS];
+static struct sSampleEvent gPoolMemory[POOL_BLOCKS];
+static uint64_t gHistogram[HISTOGRAM_BUCKETS];
+static atomic_int gStopped;
+static int gMeasureLatency;
+
+static uint64_t NowNs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void CounterDispatch(struct sActive *me, const struct sEvent *event)
+{
+  struct sCounter *counter = (struct sCounter *)me;
+  const struct sSampleEvent *sample = (const struct sSampleEvent *)event;
+
+  if (event->signal == SIG_STOP) {
+    atomic_fetch_add(&gStopped, 1);
+    return;
+  }
+  counter->count++;
+  counter->sum += sample->value;
+  if (gMeasureLatency) {
+    uint64_t waited = NowNs() - sample->postedNs;
+    int bucket = 0;
+    while (bucket < HISTOGRAM_BUCKETS - 1 && (waited >> bucket) > 0) {
+      bucket++;
+    }
+    gHistogram[bucket]++;
+  }
+}
+
+static void Setup(void)
+{
+  static int pooled = 0;
+  int i;
+
+  if (!pooled) {
+    EventPoolInit(gPoolMemory, sizeof(struct sSampleEvent), POOL_BLOCKS);
+    pooled = 1;
+  }
+  ActiveDispatcherInit(&gDispatcher);
+  for (i = 0; i < NUM_OBJECTS; i++) {
+    memset(&gCounters[i], 0, sizeof(gCounters[i]));
+    ActiveStart(&gDispatcher, &gCounters[i].super, (uint8_t)(i + 1), gSlots[i], QUEUE_SLOTS,
+                CounterDispatch);
+    gSubscribers[i] = &gCounters[i].super;
+  }
+  memset(gHistogram, 0, sizeof(gHistogram));
+  atomic_store(&gStopped, 0);
+}
+
+static uint64_t Dispatched(void)
+{
+  uint64_t total = 0;
+  int i;
+  for (i = 0; i < NUM_OBJECTS; i++) {
+    total += gCounters[i].count;
+  }
+  return total;
+}
+
+static void SingleThread(uint32_t numEvents, int publish)
+{
+  uint64_t start, elapsed;
+  uint32_t i, batch = 64;
+
+  Setup();
+  gMeasureLatency = 0;
+  start = NowNs();
+  for (i = 0; i < numEvents; i += batch) {
+    uint32_t j;
+    for (j = 0; j < batch; j++) {
+      struct sSampleEvent *sample = (struct sSampleEvent *)EventNew(sizeof(*sample), SIG_SAMPLE);
+      sample->value = (int32_t)j;
+      if (publish) {
+        ActivePublish(gSubscribers, NUM_OBJECTS, &sample->super);
+      } else {
+        ActivePost(gSubscribers[j % NUM_OBJECTS], &sample->super);
+      }
+    }
+    while (ActiveDispatchOne(&gDispatcher)) {
+    }
+  }
+  elapsed = NowNs() - start;
+  printf("%-28s %6.1f M events/s, %5.1f ns per event (%llu dispatches)\n",
+         publish ? "one thread, publish to 4:" : "one thread, post:",
+         numEvents / (elapsed / 1e3), (double)elapsed / numEvents,
+         (unsigned long long)Dispatched());
+}
+
+static void *Producer(void *arg)
+{
+  uint32_t numEvents = *(uint32_t *)arg, i, retries = 0;
+
+  for (i = 0; i < numEvents; i++) {
+    struct sSampleEvent *sample;
+    while ((sample = (struct sSampleEvent *)EventNew(sizeof(*sample), SIG_SAMPLE)) == NULL) {
+      sched_yield(); // pool empty: the dispatcher is behind
+      retries++;
+    }
+    sample->value = (int32_t)i;
+    sample->postedNs = NowNs();
+    while (ActivePost(gSubscribers[i % NUM_OBJECTS], &sample->super) != 0) {
+      // the event went back to the pool, get another
+      sched_yield();
+      while ((sample = (struct sSampleEvent *)EventNew(sizeof(*sample), SIG_SAMPLE)) == NULL) {
+        sched_yield();
+      }
+      sample->value = (int32_t)i;
+      sample->postedNs = NowNs();
+      retries++;
+    }
+  }
+  return NULL;
+}
+
+static void *Dispatcher(void *arg)
+{
+  (void)arg;
+  while (atomic_load(&gStopped) < NUM_OBJECTS) {
+    if (!ActiveDispatchOne(&gDispatcher)) {
+      sched_yield(); // the host version of sleeping until an interrupt
+    }
+  }
+  return NULL;
+}
+
+// Bucket b holds waits of [2^(b-1), 2^b) ns
+static uint64_t Percentile(double fraction, uint64_t total)
+{
+  uint64_t seen = 0;
+  int bucket;
+  for (bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+    seen += gHistogram[bucket];
+    if (seen >= fraction * total) {
+      return (uint64_t)1 << bucket;
+    }
+  }
+  return 0;
+}
+
+static void Threaded(uint32_t numEvents)
+{
+  static struct sEvent stop = { SIG_STOP, EVENT_STATIC, 0, 0 };
+  pthread_t producers[NUM_PRODUCERS], dispatcher;
+  uint32_t perProducer = numEvents / NUM_PRODUCERS;
+  uint64_t start, elapsed, total, failures = 0;
+  int i;
+
+  Setup();
+  gMeasureLatency = 1;
+  start = NowNs();
+  pthread_create(&dispatcher, NULL, Dispatcher, NULL);
+  for (i = 0; i < NUM_PRODUCERS; i++) {
+    pthread_create(&producers[i], NULL, Producer, &perProducer);
+  }
+  for (i = 0; i < NUM_PRODUCERS; i++) {
+    pthread_join(producers[i], NULL);
+  }
+  ActivePublish(gSubscribers, NUM_OBJECTS, &stop); // queues are FIFO so this comes last
+  pthread_join(dispatcher, NULL);
+  elapsed = NowNs() - start;
+
+  total = Dispatched();
+  for (i = 0; i < NUM_OBJECTS; i++) {
+    failures += atomic_load(&gCounters[i].super.postFailures);
+  }
+  printf("%d producers, 1 dispatcher:    %6.1f M events/s, %llu dispatched, %llu posts to full queues\n",
+         NUM_PRODUCERS, total / (elapsed / 1e3), (unsigned long long)total,
+         (unsigned long long)failures);
+  printf("  post to dispatch: p50 < %llu ns, p99 < %llu ns, p99.9 < %llu ns\n",
+         (unsigned long long)Percentile(0.5, total), (unsigned long long)Percentile(0.99, total),
+         (unsigned long long)Percentile(0.999, total));
+  printf("  pool low water mark: %u of %u blocks free\n",
+         atomic_load(&EventPoolGet(0)->lowWater), POOL_BLOCKS);
+}
+
+int main(int argc, char *argv[])
+{
+  uint32_t numEvents = (uint32_t)((argc > 1 ? atof(argv[1]) : 10) * 1000000);
+
+  printf("%u events, %d active objects, %d slot queues, %zu byte events\n", numEvents,
+         NUM_OBJECTS, QUEUE_SLOTS, sizeof(struct sSampleEvent));
+  SingleThread(numEvents, 0);
+  SingleThread(numEvents, 1);
+  Threaded(numEvents);
+  return 0;
+}
@@ -0,0 +1,77 @@
+/*
+ * coroutine.c
+ *
+ * Stackless coroutines on the tiny scheduler, see coroutine.h
+ */
+#include "coroutine.h"
+
+void CoroutineStart(struct sCoroutine *co, struct sScheduler *scheduler, CoroutineFunction function)
+{
+  co->function = function;
+  co->scheduler = scheduler;
+  co->line = 0;
+  co->running = 0;
+  co->again = 0;
+  co->sleeping = 0;
+  co->done = 0;
+  CoroutineResume(co);
+}
+
+// A coroutine can signal an event it then waits for, or wake another that
+// wakes it back, so being resumed while it runs just makes it go round again
+// when it returns
+void CoroutineResume(struct sCoroutine *co)
+{
+  if (co->done) {
+    return;
+  }
+  if (co->running) {
+    co->again = 1;
+    return;
+  }
+  co->running = 1;
+  do {
+    co->again = 0;
+    if (co->function(co) == CO_DONE) {
+      break;
+    }
+  } while (co->again);
+  co->running = 0;
+}
+
+static void WakeFromSleep(void *context)
+{
+  struct sCoroutine *co = context;
+  co->sleeping = 0;
+  CoroutineResume(co);
+}
+
+void CoroutineSleep(struct sCoroutine *co, uint32_t ticks)
+{
+  co->sleeping = 1;
+  if (SchedulerAdd(co->scheduler, WakeFromSleep, co, ticks, 0) == SCHEDULER_NONE) {
+    co->sleeping = 0;
+  }
+}
+
+void CoEventSignal(struct sCoEvent *event)
+{
+  struct sCoroutine *waiter = event->waiter;
+
+  event->set = 1;
+  if (waiter) {
+    event->waiter = 0;
+    CoroutineResume(waiter);
+  }
+}
+
+int CoEventTake(struct sCoroutine *co, struct sCoEvent *event)
+{
+  if (event->set) {
+    event->set = 0;
+    event->waiter = 0;
+    return 1;
+  }
+  event->waiter = co;
+  return 0;
+}
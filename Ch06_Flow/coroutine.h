@@ -0,0 +1,121 @@
+/*
+ * coroutine.h
+ *
+ * Stackless coroutines that run on the tiny scheduler (scheduler.h), so a
+ * driver sequence like "start the transfer, wait for it, wait 5 ms, read
+ * the result" can be written top to bottom instead of as a state machine
+ * with a case for every wait.
+ *
+ * These are protothreads (Adam Dunkels): the coroutine is a function with
+ * a switch around its body, and each await stores __LINE__ and returns;
+ * resuming jumps back to that case label. There is no stack per coroutine
+ * and nothing is allocated. Its whole frame is the struct it lives in, so
+ * the size is known at compile time (sizeof) like any other struct.
+ *
+ * The catch is that local variables don't survive an await: keep anything
+ * needed across one in the struct. And no switch statements of your own
+ * around an await (the case labels would belong to the wrong switch).
+ *
+ *   static int Blink(struct sCoroutine *co)
+ *   {
+ *     struct sLed *me = (struct sLed *)co;  // sCoroutine first in sLed
+ *     CO_BEGIN(co);
+ *     while (1) {
+ *       LedToggle(me);
+ *       CO_SLEEP(co, 500);
+ *     }
+ *     CO_END(co);
+ *   }
+ *
+ * What can be awaited: a number of scheduler ticks (CO_SLEEP), a
+ * sCoEvent signalled by someone else (CO_AWAIT_EVENT; a transfer finishing
+ * is an event the driver signals), or any condition (CO_AWAIT, checked
+ * each time the coroutine is resumed). Awaits recheck their condition, so
+ * an extra resume is harmless.
+ *
+ * Resuming runs the coroutine right away, in the caller's context, which
+ * has to be the main loop: an interrupt should post to the deferred work
+ * queue (../Ch05_Interrupts/deferred_work.h) and signal from there.
+ */
+#ifndef COROUTINE_H
+#define COROUTINE_H
+
+#include <stdint.h>
+#include "scheduler.h"
+
+enum eCoroutineStatus { CO_WAITING, CO_DONE };
+
+struct sCoroutine;
+typedef int (*CoroutineFunction)(struct sCoroutine *co);
+
+struct sCoroutine {
+  CoroutineFunction function;
+  struct sScheduler *scheduler;
+  uint16_t line;          // the __LINE__ of the await to resume at, 0 to start
+  uint8_t running;
+  uint8_t again;          // resumed while running, run again when it returns
+  uint8_t sleeping;       // a CO_SLEEP timer is pending
+  uint8_t done;
+};
+
+// Something that happens once and that one coroutine can wait for. If it is
+// signalled with no one waiting, the next CO_AWAIT_EVENT doesn't wait.
+struct sCoEvent {
+  struct sCoroutine *waiter;
+  uint8_t set;
+};
+
+// the case labels in CO_AWAIT are meant to be fallen into
+#if defined(__GNUC__) && __GNUC__ >= 7
+#define CO_FALLTHROUGH __attribute__((fallthrough))
+#else
+#define CO_FALLTHROUGH
+#endif
+
+#define CO_BEGIN(co) switch ((co)->line) { case 0:
+
+#define CO_END(co) } (co)->line = 0; (co)->done = 1; return CO_DONE
+
+#define CO_EXIT(co) do { (co)->line = 0; (co)->done = 1; return CO_DONE; } while (0)
+
+#define CO_AWAIT(co, condition)                                   \
+  do {                                                            \
+    (co)->line = __LINE__; CO_FALLTHROUGH; case __LINE__:         \
+    if (!(condition)) {                                           \
+      return CO_WAITING;                                          \
+    }                                                             \
+  } while (0)
+
+#define CO_SLEEP(co, ticks)                                       \
+  do {                                                            \
+    CoroutineSleep((co), (ticks));                                \
+    CO_AWAIT((co), !(co)->sleeping);                              \
+  } while (0)
+
+// give everything else a turn, resume on the next tick
+#define CO_YIELD(co) CO_SLEEP((co), 0)
+
+#define CO_AWAIT_EVENT(co, event) CO_AWAIT((co), CoEventTake((co), (event)))
+
+// Runs it up to its first await
+void CoroutineStart(struct sCoroutine *co, struct sScheduler *scheduler, CoroutineFunction function);
+
+void CoroutineResume(struct sCoroutine *co);
+
+// For CO_SLEEP. If the scheduler's task table is full it doesn't sleep.
+void CoroutineSleep(struct sCoroutine *co, uint32_t ticks);
+
+static inline void CoEventInit(struct sCoEvent *event)
+{
+  event->waiter = 0;
+  event->set = 0;
+}
+
+// Sets the event and resumes whoever is waiting for it
+void CoEventSignal(struct sCoEvent *event);
+
+// For CO_AWAIT_EVENT: clears it and returns 1 if set, otherwise 0 and
+// co is resumed when it is signalled
+int CoEventTake(struct sCoroutine *co, struct sCoEvent *event);
+
+#endif // COROUTINE_H
@@ -0,0 +1,250 @@
+/*
+ * edf.c
+ *
+ * Earliest deadline first scheduler on 4-ary heaps, see edf.h
+ */
+#include <string.h>
+#include "edf.h"
+
+enum eEdfState { EDF_IDLE, EDF_WAITING, EDF_READY, EDF_RUNNING };
+
+// a before b, allowing for the times wrapping
+static inline int Before(uint32_t a, uint32_t b)
+{
+  return (int32_t)(a - b) < 0;
+}
+
+/******************************************************************************************************
+ * 4-ary min heap of task ids, keyed by a time
+*******************************************************************************************************/
+static void HeapPush(struct sEdfHeap *heap, uint8_t id, uint32_t key)
+{
+  uint32_t i = heap->count++;
+
+  while (i > 0) {
+    uint32_t parent = (i - 1) / EDF_HEAP_ARITY;
+    if (!Before(key, heap->keys[parent])) {
+      break;
+    }
+    heap->keys[i] = heap->keys[parent];
+    heap->ids[i] = heap->ids[parent];
+    i = parent;
+  }
+  heap->keys[i] = key;
+  heap->ids[i] = id;
+}
+
+static uint8_t HeapPop(struct sEdfHeap *heap)
+{
+  uint8_t top = heap->ids[0];
+  uint32_t key, i = 0, count;
+  uint8_t id;
+
+  count = --heap->count;
+  if (count == 0) {
+    return top;
+  }
+  // sift the last one down from the top
+  key = heap->keys[count];
+  id = heap->ids[count];
+  while (1) {
+    uint32_t first = i * EDF_HEAP_ARITY + 1, last, child, best;
+    if (first >= count) {
+      break;
+    }
+    last = first + EDF_HEAP_ARITY < count ? first + EDF_HEAP_ARITY : count;
+    best = first;
+    for (child = first + 1; child < last; child++) {
+      if (Before(heap->keys[child], heap->keys[best])) {
+        best = child;
+      }
+    }
+    if (!Before(heap->keys[best], key)) {
+      break;
+    }
+    heap->keys[i] = heap->keys[best];
+    heap->ids[i] = heap->ids[best];
+    i = best;
+  }
+  heap->keys[i] = key;
+  heap->ids[i] = id;
+  return top;
+}
+
+/******************************************************************************************************
+ * Statistics
+*******************************************************************************************************/
+static void Histogram(uint32_t histogram[EDF_HISTOGRAM_BUCKETS], uint32_t value)
+{
+  uint32_t bucket = value ? 32 - (uint32_t)__builtin_clz(value) : 0;
+  if (bucket >= EDF_HISTOGRAM_BUCKETS) {
+    bucket = EDF_HISTOGRAM_BUCKETS - 1;
+  }
+  histogram[bucket]++;
+}
+
+uint32_t EdfPercentile(const uint32_t histogram[EDF_HISTOGRAM_BUCKETS], double fraction)
+{
+  uint64_t total = 0, target, seen = 0;
+  uint32_t b;
+
+  for (b = 0; b < EDF_HISTOGRAM_BUCKETS; b++) {
+    total += histogram[b];
+  }
+  target = (uint64_t)(fraction * total + 0.999999);
+  if (target == 0) {
+    target = 1;
+  }
+  for (b = 0; b < EDF_HISTOGRAM_BUCKETS; b++) {
+    seen += histogram[b];
+    if (seen >= target) {
+      break;
+    }
+  }
+  if (b == 0) {
+    return 0;
+  }
+  return b >= 32 ? 0xFFFFFFFFu : (uint32_t)(((uint64_t)1 << b) - 1);
+}
+
+const struct sEdfStats *EdfGetStats(const struct sEdfScheduler *scheduler, uint32_t id)
+{
+  return id < scheduler->numTasks ? &scheduler->tasks[id].stats : NULL;
+}
+
+void EdfResetStats(struct sEdfScheduler *scheduler, uint32_t id)
+{
+  if (id < scheduler->numTasks) {
+    memset(&scheduler->tasks[id].stats, 0, sizeof(scheduler->tasks[id].stats));
+  }
+}
+
+/******************************************************************************************************
+ * Scheduling
+*******************************************************************************************************/
+void EdfInit(struct sEdfScheduler *scheduler, EdfClock clock)
+{
+  memset(scheduler, 0, sizeof(*scheduler));
+  scheduler->clock = clock;
+}
+
+uint32_t EdfAdd(struct sEdfScheduler *scheduler, EdfCallback callback, void *context,
+                uint32_t firstRelease, uint32_t period, uint32_t deadline)
+{
+  uint32_t id = scheduler->numTasks;
+  struct sEdfTask *task;
+
+  if (id >= EDF_MAX_TASKS || id > 0xFF) { // ids are a byte in the heaps
+    return EDF_NONE;
+  }
+  scheduler->numTasks++;
+  task = &scheduler->tasks[id];
+  memset(task, 0, sizeof(*task));
+  task->callback = callback;
+  task->context = context;
+  task->period = period;
+  task->relativeDeadline = deadline;
+  task->release = firstRelease;
+  if (period) {
+    task->state = EDF_WAITING;
+    HeapPush(&scheduler->waiting, (uint8_t)id, firstRelease);
+  } else {
+    task->state = EDF_IDLE;
+  }
+  return id;
+}
+
+static void MakeReady(struct sEdfScheduler *scheduler, uint32_t id)
+{
+  struct sEdfTask *task = &scheduler->tasks[id];
+
+  task->deadline = task->release + task->relativeDeadline;
+  task->state = EDF_READY;
+  task->stats.releases++;
+  HeapPush(&scheduler->ready, (uint8_t)id, task->deadline);
+}
+
+int EdfRelease(struct sEdfScheduler *scheduler, uint32_t id)
+{
+  struct sEdfTask *task;
+
+  if (id >= scheduler->numTasks) {
+    return -1;
+  }
+  task = &scheduler->tasks[id];
+  // periodic tasks release themselves; one running can be released again
+  if (task->period || (task->state != EDF_IDLE && task->state != EDF_RUNNING)) {
+    return -1;
+  }
+  task->release = scheduler->clock();
+  MakeReady(scheduler, id);
+  return 0;
+}
+
+uint32_t EdfRun(struct sEdfScheduler *scheduler)
+{
+  uint32_t ran = 0;
+
+  while (ran < scheduler->numTasks) {
+    uint32_t now = scheduler->clock(), finish, id, wait, run, release, deadline;
+    struct sEdfTask *task;
+
+    while (scheduler->waiting.count && !Before(now, scheduler->waiting.keys[0])) {
+      MakeReady(scheduler, HeapPop(&scheduler->waiting));
+    }
+    if (scheduler->ready.count == 0) {
+      break;
+    }
+    id = HeapPop(&scheduler->ready);
+    task = &scheduler->tasks[id];
+    task->state = EDF_RUNNING;
+    // the callback may release the task again, which replaces these
+    release = task->release;
+    deadline = task->deadline;
+    task->callback(task->context);
+    finish = scheduler->clock();
+    ran++;
+
+    wait = now - release;
+    run = finish - now;
+    task->stats.runs++;
+    if (wait > task->stats.maxWait) {
+      task->stats.maxWait = wait;
+    }
+    if (run > task->stats.maxRun) {
+      task->stats.maxRun = run;
+    }
+    Histogram(task->stats.waitHistogram, wait);
+    Histogram(task->stats.runHistogram, run);
+    if (Before(deadline, finish)) {
+      task->stats.misses++;
+    }
+
+    if (task->state != EDF_RUNNING) {
+      continue; // released again while it ran
+    }
+    if (task->period == 0) {
+      task->state = EDF_IDLE;
+      continue;
+    }
+    // from the last release, so it doesn't drift; if more than a period
+    // behind, skip the releases it missed
+    task->release += task->period;
+    if (!Before(finish, task->release + task->period)) {
+      uint32_t behind = (finish - task->release) / task->period;
+      task->release += behind * task->period;
+      task->stats.skipped += behind;
+    }
+    task->state = EDF_WAITING;
+    HeapPush(&scheduler->waiting, (uint8_t)id, task->release);
+  }
+  return ran;
+}
+
+uint32_t EdfNextRelease(const struct sEdfScheduler *scheduler)
+{
+  if (scheduler->ready.count) {
+    return scheduler->clock(); // something is ready now
+  }
+  return scheduler->waiting.count ? scheduler->waiting.keys[0] : EDF_NONE;
+}
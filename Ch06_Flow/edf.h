@@ -0,0 +1,111 @@
+/*
+ * edf.h
+ *
+ * Earliest deadline first, an alternative to running tasks in a fixed
+ * order (Main 2 and on in MainLoopDiagrams.md) or by fixed priority.
+ *
+ * Each task has a period (or is released by hand) and a relative deadline.
+ * When it is released, its deadline is the release time plus the relative
+ * deadline, and of all the released tasks the one with the earliest
+ * deadline runs next. Tasks still run to completion (no preemption), so a
+ * long task can make a short one late, but as long as the total load is
+ * under 100% and no task is longer than the shortest deadline's slack, every
+ * deadline is met, where a round robin loop can miss them well below that.
+ * Over 100% it is the other way around: EDF keeps running whichever task is
+ * most behind, so every task ends up late (the domino effect). Watch the
+ * statistics, and shed load before it gets there.
+ *
+ * Released tasks are kept in a 4-ary heap ordered by deadline, and tasks
+ * waiting for their next release in another ordered by release time. The
+ * keys are in their own array, so the four children compared at each level
+ * are next to each other in one cache line and the heap is half as deep as
+ * a binary one.
+ *
+ * Every task keeps histograms (log2 buckets) of how long it waited from
+ * release to start and how long it ran, and counts its deadline misses, so
+ * you can see what happens as the load goes up.
+ *
+ * Times are in whatever units the clock function returns (ticks,
+ * microseconds) and wrap like the other schedulers here.
+ */
+#ifndef EDF_H
+#define EDF_H
+
+#include <stdint.h>
+
+#ifndef EDF_MAX_TASKS
+#define EDF_MAX_TASKS 32
+#endif
+
+#define EDF_HEAP_ARITY 4          // children per heap node
+#define EDF_HISTOGRAM_BUCKETS 32  // bucket b counts times in [2^(b-1), 2^b), bucket 0 is 0
+#define EDF_NONE 0xFFFFFFFFu
+
+typedef void (*EdfCallback)(void *context);
+typedef uint32_t (*EdfClock)(void);
+
+struct sEdfStats {
+  uint32_t releases;
+  uint32_t runs;
+  uint32_t misses;            // finished after the deadline
+  uint32_t skipped;           // releases dropped because it was more than a period behind
+  uint32_t maxWait;           // release to start
+  uint32_t maxRun;            // start to finish
+  uint32_t waitHistogram[EDF_HISTOGRAM_BUCKETS];
+  uint32_t runHistogram[EDF_HISTOGRAM_BUCKETS];
+};
+
+struct sEdfTask {
+  EdfCallback callback;
+  void *context;
+  uint32_t period;            // 0: only released by EdfRelease
+  uint32_t relativeDeadline;
+  uint32_t release;           // of the current job, or the next one while waiting
+  uint32_t deadline;          // of the current job
+  uint8_t state;
+  struct sEdfStats stats;
+};
+
+struct sEdfHeap {
+  uint32_t count;
+  uint32_t keys[EDF_MAX_TASKS];
+  uint8_t ids[EDF_MAX_TASKS];
+};
+
+struct sEdfScheduler {
+  EdfClock clock;
+  uint32_t numTasks;
+  struct sEdfHeap ready;      // by deadline
+  struct sEdfHeap waiting;    // periodic tasks, by next release
+  struct sEdfTask tasks[EDF_MAX_TASKS];
+};
+
+void EdfInit(struct sEdfScheduler *scheduler, EdfClock clock);
+
+// A task released every period, starting at firstRelease, that should
+// finish within deadline of each release. A period of 0 makes a task that is
+// only released by EdfRelease. Returns the task id or EDF_NONE if full.
+uint32_t EdfAdd(struct sEdfScheduler *scheduler, EdfCallback callback, void *context,
+                uint32_t firstRelease, uint32_t period, uint32_t deadline);
+
+// Release a task with no period now (an event happened). Returns 0, or -1 if
+// it is periodic or already waiting to run.
+int EdfRelease(struct sEdfScheduler *scheduler, uint32_t id);
+
+// Releases the periodic tasks that are due and runs released tasks, earliest
+// deadline first, until none are left or it has run as many as there are
+// tasks (so an overloaded system still gets back to the main loop). Returns
+// how many ran.
+uint32_t EdfRun(struct sEdfScheduler *scheduler);
+
+// When the next periodic task is released (so the loop can sleep until then),
+// now if something is ready, or EDF_NONE if nothing is waiting.
+uint32_t EdfNextRelease(const struct sEdfScheduler *scheduler);
+
+const struct sEdfStats *EdfGetStats(const struct sEdfScheduler *scheduler, uint32_t id);
+void EdfResetStats(struct sEdfScheduler *scheduler, uint32_t id);
+
+// The upper edge of the histogram bucket the fraction (0 to 1) of samples falls in
+uint32_t EdfPercentile(const uint32_t histogram[EDF_HISTOGRAM_BUCKETS], double fraction);
+
+#endif // EDF_H
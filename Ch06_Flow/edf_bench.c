@@ -0,0 +1,272 @@
+/*
+ * edf_bench.c
+ *
+ * Does earliest deadline first miss fewer deadlines than a round robin loop
+ * as the load goes up, and what does the heap cost?
+ *
+ * gcc -O2 edf_bench.c edf.c -o edf_bench -lm
+ * ./edf_bench [seed]
+ *
+ * The tasks run on a simulated clock in microseconds: a task's callback
+ * moves the clock forward by its run time, and when nothing is ready the
+ * clock jumps to the next release. So the results are the same every run
+ * and the host's scheduler doesn't get a say.
+ *
+ * The task set is 16 periodic tasks with periods from 2 ms to 50 ms,
+ * deadlines equal to their periods, and the load split randomly among them
+ * (UUniFast, Bini and Buttazzo), scaled from 50% to 120% of the processor.
+ * The bigger shares go to the shorter periods so no task runs very long:
+ * these are run to completion, so a long one blocks everyone. Each run takes
+ * 80% to 100% of its worst case time, so the average load is 90% of the
+ * worst case load in the table.
+ *
+ * The round robin loop is Main 2 with timers: go around the tasks in order
+ * and run each one that has been released.
+ *
+ * Then, on the real clock, how long EdfRun takes per task with a full table.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "edf.h"
+
+#define NUM_TASKS 16
+#define SIM_US 20000000u          // 20 simulated seconds per run
+#define MIN_PERIOD_US 2000.0
+#define MAX_PERIOD_US 50000.0
+
+struct sSimTask {
+  uint32_t period;
+  double share;                   // of the processor at 100% load
+  uint32_t worstRun;
+  uint32_t release;               // round robin only
+  uint32_t releases, misses, skipped; // round robin only
+};
+
+static struct sSimTask gSim[NUM_TASKS];
+static struct sEdfScheduler gEdf;
+static uint32_t gNow, gSeed;
+
+static uint32_t Random(void)
+{
+  gSeed = gSeed * 1664525u + 1013904223u;
+  return gSeed >> 8;
+}
+
+static double RandomUnit(void)
+{
+  return (Random() & 0xFFFFFF) / (double)0x1000000;
+}
+
+static uint32_t SimClock(void)
+{
+  return gNow;
+}
+
+static void SimRun(void *context)
+{
+  struct sSimTask *task = context;
+  gNow += task->worstRun - Random() % (task->worstRun / 5 + 1);
+}
+
+static int CompareDescending(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static int ComparePeriod(const void *a, const void *b)
+{
+  const struct sSimTask *x = a, *y = b;
+  return x->period < y->period ? -1 : x->period > y->period;
+}
+
+static void MakeTaskSet(uint32_t seed)
+{
+  double share[NUM_TASKS], sum = 1.0;
+  int i;
+
+  gSeed = seed;
+  for (i = 0; i < NUM_TASKS - 1; i++) {
+    double next = sum * pow(RandomUnit(), 1.0 / (NUM_TASKS - 1 - i));
+    share[i] = sum - next;
+    sum = next;
+  }
+  share[NUM_TASKS - 1] = sum;
+  qsort(share, NUM_TASKS, sizeof(share[0]), CompareDescending);
+  for (i = 0; i < NUM_TASKS; i++) {
+    gSim[i].period = (uint32_t)(MIN_PERIOD_US * pow(MAX_PERIOD_US / MIN_PERIOD_US, RandomUnit()));
+  }
+  qsort(gSim, NUM_TASKS, sizeof(gSim[0]), ComparePeriod);
+  for (i = 0; i < NUM_TASKS; i++) {
+    gSim[i].share = share[i];
+  }
+}
+
+static void SetLoad(double load)
+{
+  int i;
+  for (i = 0; i < NUM_TASKS; i++) {
+    gSim[i].worstRun = (uint32_t)(gSim[i].share * load * gSim[i].period);
+  }
+}
+
+/******************************************************************************************************
+ * The two policies
+*******************************************************************************************************/
+// Misses includes skipped releases, as a fraction of all releases
+static double RunEdf(void)
+{
+  uint32_t releases = 0, misses = 0;
+  int i;
+
+  gNow = 0;
+  EdfInit(&gEdf, SimClock);
+  for (i = 0; i < NUM_TASKS; i++) {
+    EdfAdd(&gEdf, SimRun, &gSim[i], 0, gSim[i].period, gSim[i].period);
+  }
+  while (gNow < SIM_US) {
+    if (EdfRun(&gEdf) == 0) {
+      gNow = EdfNextRelease(&gEdf);
+    }
+  }
+  for (i = 0; i < NUM_TASKS; i++) {
+    const struct sEdfStats *stats = EdfGetStats(&gEdf, i);
+    releases += stats->releases + stats->skipped;
+    misses += stats->misses + stats->skipped;
+  }
+  return (double)misses / releases;
+}
+
+static double RunRoundRobin(void)
+{
+  uint32_t releases = 0, misses = 0;
+  int i;
+
+  gNow = 0;
+  for (i = 0; i < NUM_TASKS; i++) {
+    gSim[i].release = 0;
+    gSim[i].releases = gSim[i].misses = gSim[i].skipped = 0;
+  }
+  while (gNow < SIM_US) {
+    uint32_t next = UINT32_MAX;
+    int ran = 0;
+    for (i = 0; i < NUM_TASKS; i++) {
+      struct sSimTask *task = &gSim[i];
+      if (gNow >= task->release) {
+        uint32_t deadline = task->release + task->period;
+        SimRun(task);
+        task->releases++;
+        if (gNow > deadline) {
+          task->misses++;
+        }
+        // the same catching up rule as EdfRun: skipped releases are misses
+        task->release += task->period;
+        if (gNow >= task->release + task->period) {
+          uint32_t behind = (gNow - task->release) / task->period;
+          task->release += behind * task->period;
+          task->skipped += behind;
+        }
+        ran = 1;
+      }
+      if (task->release < next) {
+        next = task->release;
+      }
+    }
+    if (!ran && next > gNow) {
+      gNow = next;
+    }
+  }
+  for (i = 0; i < NUM_TASKS; i++) {
+    releases += gSim[i].releases + gSim[i].skipped;
+    misses += gSim[i].misses + gSim[i].skipped;
+  }
+  return (double)misses / releases;
+}
+
+static void PrintEdfStats(void)
+{
+  int i;
+
+  printf("\n  task  period  worst run   releases  misses skipped  wait p50    p99    max   run p99\n");
+  for (i = 0; i < NUM_TASKS; i++) {
+    const struct sEdfStats *stats = EdfGetStats(&gEdf, i);
+    printf("  %4d %7u %10u %10u %7u %7u %9u %6u %6u %9u\n", i, gSim[i].period, gSim[i].worstRun,
+           stats->releases, stats->misses, stats->skipped, EdfPercentile(stats->waitHistogram, 0.5),
+           EdfPercentile(stats->waitHistogram, 0.99), stats->maxWait,
+           EdfPercentile(stats->runHistogram, 0.99));
+  }
+  printf("  (times in us; percentiles are the top of their power of two bucket)\n\n");
+}
+
+/******************************************************************************************************
+ * Overhead on the real clock: every task is always ready
+*******************************************************************************************************/
+static uint32_t gTicks;
+
+static uint32_t TickClock(void)
+{
+  return gTicks;
+}
+
+static void Nothing(void *context)
+{
+  (void)context;
+  gTicks++;
+}
+
+static void MeasureOverhead(void)
+{
+  struct timespec start, end;
+  uint64_t jobs = 0;
+  double ns;
+  uint32_t i;
+
+  gTicks = 0;
+  EdfInit(&gEdf, TickClock);
+  for (i = 0; i < EDF_MAX_TASKS; i++) {
+    EdfAdd(&gEdf, Nothing, NULL, i, EDF_MAX_TASKS, EDF_MAX_TASKS + i % 7);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  while (jobs < 20000000) {
+    uint32_t ran = EdfRun(&gEdf);
+    if (ran == 0) {
+      gTicks = EdfNextRelease(&gEdf);
+    }
+    jobs += ran;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+  printf("EdfRun with %d tasks: %.1f ns per job (release, pick, run, stats, requeue)\n",
+         EDF_MAX_TASKS, ns / jobs);
+}
+
+int main(int argc, char *argv[])
+{
+  uint32_t seed = argc > 1 ? (uint32_t)atoi(argv[1]) : 1;
+  static const double loads[] = { 0.5, 0.8, 0.9, 1.0, 1.05, 1.1, 1.15, 1.2 };
+  unsigned i;
+
+  MakeTaskSet(seed);
+  printf("%d tasks, periods %.0f to %.0f ms, %u simulated seconds per load\n\n",
+         NUM_TASKS, MIN_PERIOD_US / 1000, MAX_PERIOD_US / 1000, SIM_US / 1000000);
+  printf("  worst case load   EDF missed   round robin missed\n");
+  for (i = 0; i < sizeof(loads) / sizeof(loads[0]); i++) {
+    double edf, roundRobin;
+    SetLoad(loads[i]);
+    edf = RunEdf();
+    roundRobin = RunRoundRobin();
+    printf("  %15.0f%%  %9.3f%%   %9.3f%%\n", loads[i] * 100, 100.0 * edf, 100.0 * roundRobin);
+  }
+  printf("  (missed: finished late or skipped, as a share of releases)\n");
+
+  printf("\nEDF at 105%% worst case load, per task:");
+  SetLoad(1.05);
+  RunEdf();
+  PrintEdfStats();
+  MeasureOverhead();
+  return 0;
+}
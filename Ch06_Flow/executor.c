@@ -0,0 +1,270 @@
+/*
+ * executor.c
+ *
+ * Work-stealing executor for active objects, see executor.h
+ */
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include "executor.h"
+
+#define RUN_MASK (EXECUTOR_MAX_OBJECTS - 1)
+#define IDLE_SPINS 64         // looks for work before going to sleep
+#define SLEEP_MS 1            // a missed wake up costs at most this
+
+/******************************************************************************************************
+ * Run queues
+ * The same sequence numbered ring as the event queues in active.c, but with
+ * many consumers too: the owner and any thieves take from the head with a
+ * compare and exchange. An object is only ever in one run queue, so with
+ * EXECUTOR_MAX_OBJECTS slots they can't fill up.
+*******************************************************************************************************/
+static void RunQueueInit(struct sRunQueue *queue)
+{
+  uint32_t i;
+  for (i = 0; i < EXECUTOR_MAX_OBJECTS; i++) {
+    atomic_init(&queue->slots[i].sequence, i);
+    queue->slots[i].object = NULL;
+  }
+  atomic_init(&queue->head, 0);
+  atomic_init(&queue->tail, 0);
+}
+
+static void RunQueuePush(struct sRunQueue *queue, struct sExecutorActive *object)
+{
+  uint32_t pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+  struct sRunSlot *slot;
+
+  while (1) {
+    int32_t diff;
+    slot = &queue->slots[pos & RUN_MASK];
+    diff = (int32_t)(atomic_load_explicit(&slot->sequence, memory_order_acquire) - pos);
+    if (diff == 0 && atomic_compare_exchange_weak_explicit(&queue->tail, &pos, pos + 1,
+                                                           memory_order_relaxed,
+                                                           memory_order_relaxed)) {
+      break;
+    }
+    if (diff != 0) {
+      pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    }
+  }
+  slot->object = object;
+  atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release);
+}
+
+static struct sExecutorActive *RunQueuePop(struct sRunQueue *queue)
+{
+  uint32_t pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+  struct sExecutorActive *object;
+  struct sRunSlot *slot;
+
+  while (1) {
+    int32_t diff;
+    slot = &queue->slots[pos & RUN_MASK];
+    diff = (int32_t)(atomic_load_explicit(&slot->sequence, memory_order_acquire) - (pos + 1));
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&queue->head, &pos, pos + 1,
+                                                memory_order_relaxed, memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      return NULL; // empty
+    } else {
+      pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    }
+  }
+  object = slot->object;
+  atomic_store_explicit(&slot->sequence, pos + RUN_MASK + 1, memory_order_release);
+  return object;
+}
+
+/******************************************************************************************************
+ * Scheduling objects
+ * scheduled is set by whoever finds it clear, and only that thread puts the
+ * object in a run queue. Posts always do the read-modify-write, as does the
+ * worker clearing it, so either the worker's final look at the event queue
+ * sees the new event or the post sees the flag clear (see ActivePost).
+*******************************************************************************************************/
+static void Wake(struct sExecutor *executor)
+{
+  if (atomic_load_explicit(&executor->numSleeping, memory_order_relaxed) > 0) {
+    pthread_mutex_lock(&executor->lock);
+    pthread_cond_signal(&executor->wake);
+    pthread_mutex_unlock(&executor->lock);
+  }
+}
+
+static void Notify(struct sActive *active)
+{
+  struct sExecutorActive *me = (struct sExecutorActive *)active;
+  struct sExecutor *executor = me->executor;
+
+  if (atomic_fetch_or_explicit(&me->scheduled, 1, memory_order_acq_rel) == 0) {
+    uint32_t home = atomic_load_explicit(&me->home, memory_order_relaxed);
+    RunQueuePush(&executor->workers[home].runQueue, me);
+    Wake(executor);
+  }
+}
+
+// Runs up to a batch of events, then either puts the object back at the end
+// of this worker's run queue or lets it go idle
+static void RunObject(struct sExecutorWorker *worker, struct sExecutorActive *me)
+{
+  struct sEvent *event;
+  int n;
+
+  atomic_store_explicit(&me->home, worker->index, memory_order_relaxed);
+  for (n = 0; n < EXECUTOR_BATCH; n++) {
+    event = ActiveNextEvent(&me->super);
+    if (event == NULL) {
+      break;
+    }
+    me->super.dispatch(&me->super, event);
+    EventUnref(event);
+  }
+  worker->dispatched += n;
+
+  if (n == EXECUTOR_BATCH && ActiveHasEvents(&me->super)) {
+    RunQueuePush(&worker->runQueue, me); // still scheduled, just not first in line
+    return;
+  }
+  atomic_exchange_explicit(&me->scheduled, 0, memory_order_acq_rel);
+  if (ActiveHasEvents(&me->super) &&
+      atomic_fetch_or_explicit(&me->scheduled, 1, memory_order_acq_rel) == 0) {
+    RunQueuePush(&worker->runQueue, me); // a post raced with going idle
+  }
+}
+
+static struct sExecutorActive *Steal(struct sExecutorWorker *worker, uint32_t *seed)
+{
+  struct sExecutor *executor = worker->executor;
+  uint32_t i, start;
+
+  *seed = *seed * 1664525u + 1013904223u;
+  start = *seed % executor->numWorkers;
+  for (i = 0; i < executor->numWorkers; i++) {
+    uint32_t victim = (start + i) % executor->numWorkers;
+    struct sExecutorActive *object;
+    if (victim == worker->index) {
+      continue;
+    }
+    object = RunQueuePop(&executor->workers[victim].runQueue);
+    if (object) {
+      worker->stolen++;
+      return object;
+    }
+  }
+  return NULL;
+}
+
+static void Sleep(struct sExecutor *executor)
+{
+  struct timespec until;
+
+  clock_gettime(CLOCK_REALTIME, &until);
+  until.tv_nsec += SLEEP_MS * 1000000L;
+  if (until.tv_nsec >= 1000000000L) {
+    until.tv_sec++;
+    until.tv_nsec -= 1000000000L;
+  }
+  pthread_mutex_lock(&executor->lock);
+  atomic_fetch_add(&executor->numSleeping, 1);
+  if (atomic_load(&executor->running)) {
+    pthread_cond_timedwait(&executor->wake, &executor->lock, &until);
+  }
+  atomic_fetch_sub(&executor->numSleeping, 1);
+  pthread_mutex_unlock(&executor->lock);
+}
+
+static void *Worker(void *arg)
+{
+  struct sExecutorWorker *worker = arg;
+  struct sExecutor *executor = worker->executor;
+  uint32_t seed = worker->index * 2654435761u + 1, idle = 0;
+
+  while (atomic_load_explicit(&executor->running, memory_order_relaxed)) {
+    struct sExecutorActive *object = RunQueuePop(&worker->runQueue);
+    if (object == NULL && executor->numWorkers > 1) {
+      object = Steal(worker, &seed);
+    }
+    if (object) {
+      RunObject(worker, object);
+      idle = 0;
+    } else if (++idle < IDLE_SPINS) {
+      sched_yield();
+    } else {
+      Sleep(executor);
+    }
+  }
+  return NULL;
+}
+
+/******************************************************************************************************
+ * Setup
+*******************************************************************************************************/
+int ExecutorInit(struct sExecutor *executor, struct sExecutorWorker *workers, uint32_t numWorkers)
+{
+  uint32_t i;
+
+  if (numWorkers == 0 || numWorkers > EXECUTOR_MAX_WORKERS) {
+    return -1;
+  }
+  executor->workers = workers;
+  executor->numWorkers = numWorkers;
+  atomic_init(&executor->numObjects, 0);
+  atomic_init(&executor->running, 0);
+  atomic_init(&executor->numSleeping, 0);
+  pthread_mutex_init(&executor->lock, NULL);
+  pthread_cond_init(&executor->wake, NULL);
+  for (i = 0; i < numWorkers; i++) {
+    RunQueueInit(&workers[i].runQueue);
+    workers[i].executor = executor;
+    workers[i].index = i;
+    workers[i].dispatched = 0;
+    workers[i].stolen = 0;
+  }
+  return 0;
+}
+
+int ExecutorAdd(struct sExecutor *executor, struct sExecutorActive *me,
+                struct sQueueSlot *slots, uint32_t numSlots, ActiveDispatch dispatch)
+{
+  uint32_t n = atomic_fetch_add(&executor->numObjects, 1);
+
+  if (n >= EXECUTOR_MAX_OBJECTS || ActiveInit(&me->super, slots, numSlots, dispatch, Notify) != 0) {
+    atomic_fetch_sub(&executor->numObjects, 1);
+    return -1;
+  }
+  me->executor = executor;
+  atomic_init(&me->scheduled, 0);
+  atomic_init(&me->home, n % executor->numWorkers); // spread them out to start with
+  return 0;
+}
+
+int ExecutorStart(struct sExecutor *executor)
+{
+  uint32_t i;
+
+  atomic_store(&executor->running, 1);
+  for (i = 0; i < executor->numWorkers; i++) {
+    if (pthread_create(&executor->workers[i].thread, NULL, Worker, &executor->workers[i]) != 0) {
+      executor->numWorkers = i;
+      ExecutorStop(executor);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void ExecutorStop(struct sExecutor *executor)
+{
+  uint32_t i;
+
+  atomic_store(&executor->running, 0);
+  pthread_mutex_lock(&executor->lock);
+  pthread_cond_broadcast(&executor->wake);
+  pthread_mutex_unlock(&executor->lock);
+  for (i = 0; i < executor->numWorkers; i++) {
+    pthread_join(executor->workers[i].thread, NULL);
+  }
+}
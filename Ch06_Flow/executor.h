@@ -0,0 +1,87 @@
+/*
+ * executor.h
+ *
+ * Runs active objects (active.h) on several worker threads, for simulating
+ * a system with a lot of active objects on a many core host where one
+ * dispatcher thread can't keep up.
+ *
+ * Each worker has a run queue of objects that have events waiting. An
+ * object is in at most one run queue at a time, and a worker that takes an
+ * object from a run queue is the only one running it until it puts it
+ * back. So each object still handles its events one at a time, in the
+ * order they were posted, exactly as with the single dispatcher: the
+ * dispatch functions don't need locks.
+ *
+ * Objects stay with the worker that last ran them (their data stays in that
+ * core's cache). A worker with nothing to do steals a whole object from
+ * another worker's run queue, never single events, which would break the
+ * ordering.
+ *
+ * There are no priorities: on a host, simulating, throughput matters more.
+ */
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "active.h"
+
+#define EXECUTOR_MAX_WORKERS 64
+#define EXECUTOR_MAX_OBJECTS 4096   // a power of two, the run queues hold this many
+#define EXECUTOR_BATCH 32           // events per turn before letting other objects run
+
+struct sExecutor;
+
+// Embed this in your object instead of sActive
+struct sExecutorActive {
+  struct sActive super;
+  struct sExecutor *executor;
+  atomic_uint scheduled;      // 1 while in a run queue or being run
+  atomic_uint home;           // worker whose run queue it goes in
+};
+
+struct sRunSlot {
+  atomic_uint sequence;
+  struct sExecutorActive *object;
+};
+
+// Many producers (posts, thieves) and many consumers (owner, thieves)
+struct sRunQueue {
+  _Alignas(64) atomic_uint head;
+  _Alignas(64) atomic_uint tail;
+  struct sRunSlot slots[EXECUTOR_MAX_OBJECTS];
+};
+
+struct sExecutorWorker {
+  struct sRunQueue runQueue;
+  struct sExecutor *executor;
+  pthread_t thread;
+  uint32_t index;
+  uint64_t dispatched;
+  uint64_t stolen;            // objects it took from other workers
+};
+
+struct sExecutor {
+  struct sExecutorWorker *workers;
+  uint32_t numWorkers;
+  atomic_uint numObjects;
+  atomic_int running;
+  atomic_int numSleeping;
+  pthread_mutex_t lock;       // only for sleeping and waking workers
+  pthread_cond_t wake;
+};
+
+// workers is memory for numWorkers workers. Returns 0 on success.
+int ExecutorInit(struct sExecutor *executor, struct sExecutorWorker *workers, uint32_t numWorkers);
+
+// Before ExecutorStart. numSlots is the event queue size (a power of two).
+int ExecutorAdd(struct sExecutor *executor, struct sExecutorActive *me,
+                struct sQueueSlot *slots, uint32_t numSlots, ActiveDispatch dispatch);
+
+int ExecutorStart(struct sExecutor *executor);
+
+// Stops the workers after they finish what they are running, and waits for them
+void ExecutorStop(struct sExecutor *executor);
+
+#endif // EXECUTOR_H
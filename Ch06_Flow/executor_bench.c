@@ -0,0 +1,169 @@
+/*
+ * executor_bench.c
+ *
+ * Does the work-stealing executor scale with cores, and does it keep each
+ * active object's events in order?
+ *
+ * gcc -O2 executor_bench.c executor.c active.c -o executor_bench -lpthread
+ * ./executor_bench [max workers] [seconds per run]
+ *
+ * 1024 active objects pass tokens to each other: each event does a little
+ * work and then posts a new event to a random object. 8192 tokens are in
+ * flight, so there is always plenty to do. The run is repeated with 1, 2,
+ * 4, ... workers up to max workers (default: the number of cores) and the
+ * events per second are compared to one worker.
+ *
+ * Every event carries its sender and a per (sender, receiver) sequence
+ * number, and each object checks they arrive in order. Each object also
+ * checks that it is never running on two workers at once.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "executor.h"
+
+#define NUM_OBJECTS 1024
+#define NUM_TOKENS 8192
+#define QUEUE_SLOTS 64
+#define WORK_ROUNDS 100     // a bit of hashing per event, like a real handler
+#define SIG_TOKEN 1
+
+struct sToken {
+  struct sEvent super;
+  uint16_t sender;
+  uint32_t sequence;
+  uint32_t hops;
+};
+
+struct sNode {
+  struct sExecutorActive super;
+  uint16_t id;
+  atomic_int inside;        // more than 1 means two workers are running it
+  uint32_t seed;
+  uint32_t hash;
+  uint32_t *sentTo;         // next sequence number for each receiver
+  uint32_t *seenFrom;       // last sequence number from each sender
+};
+
+static struct sNode gNodes[NUM_OBJECTS];
+static struct sQueueSlot gSlots[NUM_OBJECTS][QUEUE_SLOTS];
+static struct sToken gPool[NUM_TOKENS + NUM_OBJECTS * 2];
+static uint32_t gSequences[2][NUM_OBJECTS][NUM_OBJECTS];
+static atomic_uint gOutOfOrder, gOverlaps, gDropped;
+
+static void SendToken(struct sNode *from, uint32_t hops)
+{
+  struct sToken *token;
+  uint16_t to;
+  int tries;
+
+  for (tries = 0; tries < 16; tries++) {
+    from->seed = from->seed * 1664525u + 1013904223u;
+    to = (uint16_t)((from->seed >> 8) % NUM_OBJECTS);
+    token = (struct sToken *)EventNew(sizeof(*token), SIG_TOKEN);
+    if (token == NULL) {
+      break;
+    }
+    token->sender = from->id;
+    token->sequence = from->sentTo[to];
+    token->hops = hops;
+    if (ActivePost(&gNodes[to].super.super, &token->super) == 0) {
+      from->sentTo[to]++;
+      return;
+    }
+    // that queue is full (the token went back to the pool), try another object
+  }
+  atomic_fetch_add(&gDropped, 1);
+}
+
+static void NodeDispatch(struct sActive *me, const struct sEvent *event)
+{
+  struct sNode *node = (struct sNode *)me;
+  const struct sToken *token = (const struct sToken *)event;
+  int i;
+
+  if (atomic_fetch_add(&node->inside, 1) != 0) {
+    atomic_fetch_add(&gOverlaps, 1);
+  }
+  if (token->sequence != node->seenFrom[token->sender]) {
+    atomic_fetch_add(&gOutOfOrder, 1);
+  }
+  node->seenFrom[token->sender] = token->sequence + 1;
+  for (i = 0; i < WORK_ROUNDS; i++) {
+    node->hash = (node->hash ^ token->hops ^ (uint32_t)i) * 16777619u;
+  }
+  SendToken(node, token->hops + 1);
+  atomic_fetch_sub(&node->inside, 1);
+}
+
+static double Run(uint32_t numWorkers, int seconds, double baseline)
+{
+  static struct sExecutorWorker workers[EXECUTOR_MAX_WORKERS];
+  struct sExecutor executor;
+  uint64_t dispatched = 0, stolen = 0;
+  double rate;
+  uint32_t i;
+
+  memset(gSequences, 0, sizeof(gSequences));
+  ExecutorInit(&executor, workers, numWorkers);
+  for (i = 0; i < NUM_OBJECTS; i++) {
+    struct sNode *node = &gNodes[i];
+    node->id = (uint16_t)i;
+    node->seed = i + 1;
+    node->hash = 0;
+    atomic_init(&node->inside, 0);
+    node->sentTo = gSequences[0][i];
+    node->seenFrom = gSequences[1][i];
+    ExecutorAdd(&executor, &node->super, gSlots[i], QUEUE_SLOTS, NodeDispatch);
+  }
+  for (i = 0; i < NUM_TOKENS; i++) {
+    SendToken(&gNodes[i % NUM_OBJECTS], 0); // before the workers start, so no overlap
+  }
+  ExecutorStart(&executor);
+  sleep(seconds);
+  ExecutorStop(&executor);
+
+  for (i = 0; i < numWorkers; i++) {
+    dispatched += workers[i].dispatched;
+    stolen += workers[i].stolen;
+  }
+  // drain what is left so the pool is full for the next run
+  for (i = 0; i < NUM_OBJECTS; i++) {
+    struct sEvent *event;
+    while ((event = ActiveNextEvent(&gNodes[i].super.super)) != NULL) {
+      EventUnref(event);
+    }
+  }
+  rate = dispatched / (double)seconds;
+  printf("%3u workers: %6.2f M events/s  (%5.2fx one worker, %.0f%% of linear), %llu objects stolen\n",
+         numWorkers, rate / 1e6, baseline ? rate / baseline : 1.0,
+         baseline ? 100.0 * rate / (baseline * numWorkers) : 100.0, (unsigned long long)stolen);
+  return rate;
+}
+
+int main(int argc, char *argv[])
+{
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  uint32_t maxWorkers = argc > 1 ? (uint32_t)atoi(argv[1]) : (uint32_t)cores;
+  int seconds = argc > 2 ? atoi(argv[2]) : 2;
+  double baseline = 0;
+  uint32_t workers;
+
+  if (maxWorkers > EXECUTOR_MAX_WORKERS) {
+    maxWorkers = EXECUTOR_MAX_WORKERS;
+  }
+  EventPoolInit(gPool, sizeof(struct sToken), sizeof(gPool) / sizeof(gPool[0]));
+  printf("%d active objects, %d tokens, %ld cores online\n", NUM_OBJECTS, NUM_TOKENS, cores);
+  for (workers = 1; workers <= maxWorkers; workers *= 2) {
+    double rate = Run(workers, seconds, baseline);
+    if (workers == 1) {
+      baseline = rate;
+    }
+  }
+  printf("Out of order: %u, ran on two workers at once: %u, tokens dropped: %u\n",
+         atomic_load(&gOutOfOrder), atomic_load(&gOverlaps), atomic_load(&gDropped));
+  return atomic_load(&gOutOfOrder) || atomic_load(&gOverlaps) ? 1 : 0;
+}
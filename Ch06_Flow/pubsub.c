@@ -0,0 +1,63 @@
+/*
+ * pubsub.c
+ *
+ * Publish and subscribe with topic bitmasks, see pubsub.h
+ */
+#include <string.h>
+#include "pubsub.h"
+
+void PubSubInit(struct sPubSubBus *bus)
+{
+  uint32_t i;
+
+  for (i = 0; i < PUBSUB_MAX_TOPICS; i++) {
+    atomic_init(&bus->subscribers[i], 0);
+  }
+  memset(bus->actives, 0, sizeof(bus->actives));
+  bus->numSubscribers = 0;
+  atomic_init(&bus->unheard, 0);
+}
+
+int PubSubAttach(struct sPubSubBus *bus, struct sActive *me)
+{
+  if (bus->numSubscribers >= PUBSUB_MAX_SUBSCRIBERS) {
+    return -1;
+  }
+  bus->actives[bus->numSubscribers] = me;
+  return (int)bus->numSubscribers++;
+}
+
+int PubSubSubscribe(struct sPubSubBus *bus, int subscriber, uint16_t topic)
+{
+  if (topic >= PUBSUB_MAX_TOPICS || subscriber < 0 || (uint32_t)subscriber >= bus->numSubscribers) {
+    return -1;
+  }
+  atomic_fetch_or_explicit(&bus->subscribers[topic], (uint64_t)1 << subscriber,
+                           memory_order_relaxed);
+  return 0;
+}
+
+int PubSubUnsubscribe(struct sPubSubBus *bus, int subscriber, uint16_t topic)
+{
+  if (topic >= PUBSUB_MAX_TOPICS || subscriber < 0 || (uint32_t)subscriber >= bus->numSubscribers) {
+    return -1;
+  }
+  atomic_fetch_and_explicit(&bus->subscribers[topic], ~((uint64_t)1 << subscriber),
+                            memory_order_relaxed);
+  return 0;
+}
+
+int PubSubPublish(struct sPubSubBus *bus, uint16_t topic, struct sEvent *event)
+{
+  uint64_t mask;
+
+  if (topic >= PUBSUB_MAX_TOPICS) {
+    return -1;
+  }
+  mask = atomic_load_explicit(&bus->subscribers[topic], memory_order_relaxed);
+  if (mask == 0) {
+    atomic_fetch_add_explicit(&bus->unheard, 1, memory_order_relaxed);
+  }
+  // with an empty mask this still takes and drops the hold, freeing a new event
+  return ActivePublishMask(bus->actives, mask, event);
+}
@@ -0,0 +1,54 @@
+/*
+ * pubsub.h
+ *
+ * Publish and subscribe for active objects (active.h): whoever has news
+ * publishes an event on a topic, and every object subscribed to that topic
+ * gets it, without the publisher knowing who they are.
+ *
+ * Topics are small numbers fixed at compile time, an enum in your code:
+ *
+ *   enum eTopic { TOPIC_BUTTON, TOPIC_BATTERY, TOPIC_ADC_BLOCK, NUM_TOPICS };
+ *
+ * Each object attached to the bus gets a subscriber number (up to 64), and
+ * each topic has a 64 bit mask of its subscribers. Subscribing is an atomic
+ * OR, publishing reads the mask and posts the same pooled event to each
+ * subscriber: the event is reference counted, so nothing is copied however
+ * many get it (see ActivePublishMask).
+ *
+ * Subscribe and unsubscribe can happen at any time from anywhere. A publish
+ * that races with them may or may not include that subscriber.
+ */
+#ifndef PUBSUB_H
+#define PUBSUB_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include "active.h"
+
+#define PUBSUB_MAX_SUBSCRIBERS 64     // bits in a topic's mask
+
+#ifndef PUBSUB_MAX_TOPICS
+#define PUBSUB_MAX_TOPICS 64
+#endif
+
+struct sPubSubBus {
+  _Atomic uint64_t subscribers[PUBSUB_MAX_TOPICS];  // by topic
+  struct sActive *actives[PUBSUB_MAX_SUBSCRIBERS];  // by subscriber number
+  uint32_t numSubscribers;
+  atomic_uint unheard;        // publishes nobody was subscribed to
+};
+
+void PubSubInit(struct sPubSubBus *bus);
+
+// Before publishing starts. Returns the subscriber number, or -1 if full.
+int PubSubAttach(struct sPubSubBus *bus, struct sActive *me);
+
+// Return 0, or -1 if the topic or subscriber is out of range
+int PubSubSubscribe(struct sPubSubBus *bus, int subscriber, uint16_t topic);
+int PubSubUnsubscribe(struct sPubSubBus *bus, int subscriber, uint16_t topic);
+
+// From anywhere. Returns how many subscribers got it; an event nobody got
+// (no subscribers, or all their queues full) goes back to its pool.
+int PubSubPublish(struct sPubSubBus *bus, uint16_t topic, struct sEvent *event);
+
+#endif // PUBSUB_H
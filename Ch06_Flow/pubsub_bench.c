@@ -0,0 +1,136 @@
+/*
+ * pubsub_bench.c
+ *
+ * How long does it take to publish one event to 1, 8, 32 and 64
+ * subscribers?
+ *
+ * gcc -O2 pubsub_bench.c pubsub.c active.c -o pubsub_bench
+ * ./pubsub_bench [rounds]
+ *
+ * 64 active objects on two dispatchers (32 priorities each) are attached to
+ * the bus. Each round allocates and publishes a batch of events, timing only
+ * that, then dispatches everything. The same is timed with ActivePublish
+ * and a list of objects, which takes a reference and sets a ready bit for
+ * each object separately.
+ *
+ * Every subscriber counts what it got, and at the end every event must be
+ * back in its pool.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "pubsub.h"
+
+#define NUM_OBJECTS 64
+#define QUEUE_SLOTS 64
+#define BATCH 32                    // publishes per round, fits in the queues
+#define POOL_BLOCKS 256
+#define TOPIC_SAMPLE 5
+
+struct sSampleEvent {
+  struct sEvent super;
+  int32_t value;
+};
+
+struct sSubscriber {
+  struct sActive super;
+  uint64_t received;
+  int64_t sum;
+};
+
+static struct sActiveDispatcher gDispatchers[2];
+static struct sSubscriber gSubscribers[NUM_OBJECTS];
+static struct sActive *gList[NUM_OBJECTS];
+static struct sQueueSlot gSlots[NUM_OBJECTS][QUEUE_SLOTS];
+static struct sSampleEvent gPool[POOL_BLOCKS];
+static struct sPubSubBus gBus;
+
+static uint64_t NowNs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void Receive(struct sActive *me, const struct sEvent *event)
+{
+  struct sSubscriber *subscriber = (struct sSubscriber *)me;
+  subscriber->received++;
+  subscriber->sum += ((const struct sSampleEvent *)event)->value;
+}
+
+static void DrainAll(void)
+{
+  while (ActiveDispatchOne(&gDispatchers[0]) | ActiveDispatchOne(&gDispatchers[1])) {
+  }
+}
+
+// Returns ns per publish, including getting the event from the pool
+static double Measure(int fanOut, int useBus, uint32_t rounds, uint64_t *delivered)
+{
+  uint64_t total = 0;
+  uint32_t round;
+  int i;
+
+  *delivered = 0;
+  for (round = 0; round < rounds; round++) {
+    uint64_t start = NowNs();
+    for (i = 0; i < BATCH; i++) {
+      struct sSampleEvent *event = (struct sSampleEvent *)EventNew(sizeof(*event), TOPIC_SAMPLE);
+      event->value = i;
+      if (useBus) {
+        *delivered += (uint64_t)PubSubPublish(&gBus, TOPIC_SAMPLE, &event->super);
+      } else {
+        *delivered += (uint64_t)ActivePublish(gList, fanOut, &event->super);
+      }
+    }
+    total += NowNs() - start;
+    DrainAll();
+  }
+  return (double)total / ((double)rounds * BATCH);
+}
+
+int main(int argc, char *argv[])
+{
+  uint32_t rounds = argc > 1 ? (uint32_t)atoi(argv[1]) : 20000;
+  static const int fanOuts[] = { 1, 8, 32, 64 };
+  uint64_t expected = 0, received = 0;
+  struct sEventPool *pool;
+  unsigned f;
+  int i;
+
+  EventPoolInit(gPool, sizeof(gPool[0]), POOL_BLOCKS);
+  ActiveDispatcherInit(&gDispatchers[0]);
+  ActiveDispatcherInit(&gDispatchers[1]);
+  PubSubInit(&gBus);
+  for (i = 0; i < NUM_OBJECTS; i++) {
+    ActiveStart(&gDispatchers[i / 32], &gSubscribers[i].super, (uint8_t)(i % 32),
+                gSlots[i], QUEUE_SLOTS, Receive);
+    gList[i] = &gSubscribers[i].super;
+    PubSubAttach(&gBus, &gSubscribers[i].super);
+  }
+
+  printf("%u rounds of %d publishes\n", rounds, BATCH);
+  printf("  subscribers   bus (topic mask)   ActivePublish (list)\n");
+  for (f = 0; f < sizeof(fanOuts) / sizeof(fanOuts[0]); f++) {
+    uint64_t delivered;
+    double bus, list;
+    for (i = 0; i < fanOuts[f]; i++) {
+      PubSubSubscribe(&gBus, i, TOPIC_SAMPLE);
+    }
+    bus = Measure(fanOuts[f], 1, rounds, &delivered);
+    expected += delivered;
+    list = Measure(fanOuts[f], 0, rounds, &delivered);
+    expected += delivered;
+    printf("  %11d   %10.1f ns       %10.1f ns\n", fanOuts[f], bus, list);
+  }
+
+  for (i = 0; i < NUM_OBJECTS; i++) {
+    received += gSubscribers[i].received;
+  }
+  pool = EventPoolGet(0);
+  printf("delivered %llu, received %llu, pool %u of %u free\n", (unsigned long long)expected,
+         (unsigned long long)received, atomic_load(&pool->numFree), pool->numBlocks);
+  return received == expected && atomic_load(&pool->numFree) == pool->numBlocks ? 0 : 1;
+}
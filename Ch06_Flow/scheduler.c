@@ -0,0 +1,223 @@
+/*
+ * scheduler.c
+ *
+ * Tiny run-to-completion scheduler on a hashed timing wheel, see scheduler.h
+ */
+#include <string.h>
+#include "scheduler.h"
+
+#define SLOT_MASK (SCHEDULER_WHEEL_SLOTS - 1)
+#define RUN_LIST SCHEDULER_WHEEL_SLOTS   // heads[] index of the tasks being run
+
+// Due if expiry is at or before now, allowing for the tick count wrapping
+static inline int IsDue(uint32_t expiry, uint32_t now)
+{
+  return (int32_t)(expiry - now) <= 0;
+}
+
+static void Link(struct sScheduler *scheduler, uint32_t id, uint32_t slot)
+{
+  struct sSchedulerTask *task = &scheduler->tasks[id];
+  uint32_t head = scheduler->heads[slot];
+
+  task->slot = slot;
+  task->prev = SCHEDULER_NONE;
+  task->next = head;
+  if (head != SCHEDULER_NONE) {
+    scheduler->tasks[head].prev = id;
+  }
+  scheduler->heads[slot] = id;
+  if (slot != RUN_LIST) {
+    scheduler->occupied[slot / 32] |= (uint32_t)1 << (slot % 32);
+  }
+}
+
+static void Unlink(struct sScheduler *scheduler, uint32_t id)
+{
+  struct sSchedulerTask *task = &scheduler->tasks[id];
+  uint32_t slot = task->slot;
+
+  if (task->prev != SCHEDULER_NONE) {
+    scheduler->tasks[task->prev].next = task->next;
+  } else {
+    scheduler->heads[slot] = task->next;
+  }
+  if (task->next != SCHEDULER_NONE) {
+    scheduler->tasks[task->next].prev = task->prev;
+  }
+  if (slot != RUN_LIST && scheduler->heads[slot] == SCHEDULER_NONE) {
+    scheduler->occupied[slot / 32] &= ~((uint32_t)1 << (slot % 32));
+  }
+}
+
+static void Release(struct sScheduler *scheduler, uint32_t id)
+{
+  struct sSchedulerTask *task = &scheduler->tasks[id];
+  task->state = TASK_FREE;
+  task->next = scheduler->freeList;
+  scheduler->freeList = id;
+  scheduler->numTasks--;
+}
+
+void SchedulerInit(struct sScheduler *scheduler, uint32_t now)
+{
+  uint32_t i;
+
+  memset(scheduler->heads, 0xFF, sizeof(scheduler->heads));
+  memset(scheduler->occupied, 0, sizeof(scheduler->occupied));
+  for (i = 0; i < SCHEDULER_MAX_TASKS; i++) {
+    scheduler->tasks[i].state = TASK_FREE;
+    scheduler->tasks[i].next = i + 1 < SCHEDULER_MAX_TASKS ? i + 1 : SCHEDULER_NONE;
+  }
+  scheduler->freeList = 0;
+  scheduler->numTasks = 0;
+  scheduler->now = now;
+}
+
+uint32_t SchedulerAdd(struct sScheduler *scheduler, SchedulerCallback callback, void *context,
+                      uint32_t delay, uint32_t period)
+{
+  uint32_t id = scheduler->freeList;
+  struct sSchedulerTask *task;
+
+  if (id == SCHEDULER_NONE) {
+    return SCHEDULER_NONE;
+  }
+  task = &scheduler->tasks[id];
+  scheduler->freeList = task->next;
+  scheduler->numTasks++;
+
+  task->callback = callback;
+  task->context = context;
+  task->period = period;
+  // a delay of 0 means the next tick, the current one has already been run
+  task->expiry = scheduler->now + (delay ? delay : 1);
+  task->state = TASK_WAITING;
+  Link(scheduler, id, task->expiry & SLOT_MASK);
+  return id;
+}
+
+void SchedulerCancel(struct sScheduler *scheduler, uint32_t id)
+{
+  struct sSchedulerTask *task;
+
+  if (id >= SCHEDULER_MAX_TASKS) {
+    return;
+  }
+  task = &scheduler->tasks[id];
+  if (task->state == TASK_WAITING) {
+    Unlink(scheduler, id);
+    Release(scheduler, id);
+  } else if (task->state == TASK_RUNNING) {
+    task->state = TASK_CANCELLED; // SchedulerRun frees it when the callback returns
+  }
+}
+
+// Run the due tasks in one slot
+static uint32_t RunSlot(struct sScheduler *scheduler, uint32_t slot, uint32_t now)
+{
+  uint32_t id, ran = 0;
+
+  // Move the due tasks to the run list first: a callback can add or cancel
+  // tasks, including ones in this slot, so don't walk it while calling them
+  id = scheduler->heads[slot];
+  while (id != SCHEDULER_NONE) {
+    uint32_t next = scheduler->tasks[id].next;
+    if (IsDue(scheduler->tasks[id].expiry, now)) {
+      Unlink(scheduler, id);
+      Link(scheduler, id, RUN_LIST);
+    }
+    id = next;
+  }
+
+  while ((id = scheduler->heads[RUN_LIST]) != SCHEDULER_NONE) {
+    struct sSchedulerTask *task = &scheduler->tasks[id];
+    Unlink(scheduler, id);
+    task->state = TASK_RUNNING;
+    task->callback(task->context);
+    ran++;
+
+    if (task->state == TASK_CANCELLED || task->period == 0) {
+      Release(scheduler, id);
+    } else {
+      // from when it was due, not when it ran, so periodic tasks don't drift
+      task->expiry += task->period;
+      if (IsDue(task->expiry, now)) {
+        task->expiry = now + 1; // it was more than a period late, don't try to catch up
+      }
+      task->state = TASK_WAITING;
+      Link(scheduler, id, task->expiry & SLOT_MASK);
+    }
+  }
+  return ran;
+}
+
+uint32_t SchedulerRun(struct sScheduler *scheduler, uint32_t now)
+{
+  uint32_t elapsed = now - scheduler->now;
+  uint32_t tick = scheduler->now;
+  uint32_t ran = 0;
+
+  if (elapsed > SCHEDULER_WHEEL_SLOTS) {
+    elapsed = SCHEDULER_WHEEL_SLOTS; // a full lap sees every slot once
+    tick = now - SCHEDULER_WHEEL_SLOTS;
+  }
+  while (elapsed--) {
+    uint32_t slot;
+    tick++;
+    slot = tick & SLOT_MASK;
+    // skip empty slots a word at a time
+    if (scheduler->occupied[slot / 32] == 0 && elapsed >= 32 - slot % 32) {
+      uint32_t skip = 31 - slot % 32;
+      tick += skip;
+      elapsed -= skip;
+      continue;
+    }
+    if (scheduler->occupied[slot / 32] & ((uint32_t)1 << (slot % 32))) {
+      scheduler->now = tick; // so tasks added from a callback are timed from here
+      ran += RunSlot(scheduler, slot, now);
+    }
+  }
+  scheduler->now = now;
+  return ran;
+}
+
+// Walks the slots in time order from now, skipping empty ones with the
+// bitmap. The first occupied slot isn't necessarily the answer: its tasks
+// may be due a lap or more later, so keep going until the distance reaches
+// the earliest expiry found so far.
+uint32_t SchedulerNextDeadline(const struct sScheduler *scheduler)
+{
+  uint32_t best = SCHEDULER_NONE;
+  uint32_t distance = 1;
+
+  while (distance <= SCHEDULER_WHEEL_SLOTS && distance < best) {
+    uint32_t slot = (scheduler->now + distance) & SLOT_MASK;
+    uint32_t bits = scheduler->occupied[slot / 32] >> (slot % 32);
+    uint32_t id;
+
+    if (bits == 0) {
+      // to the end of this word, or of the wheel if that comes first
+      uint32_t toWordEnd = 32 - slot % 32;
+      uint32_t toWheelEnd = SCHEDULER_WHEEL_SLOTS - slot;
+      distance += toWordEnd < toWheelEnd ? toWordEnd : toWheelEnd;
+      continue;
+    }
+    distance += (uint32_t)__builtin_ctz(bits);
+    if (distance > SCHEDULER_WHEEL_SLOTS || distance >= best) {
+      break;
+    }
+    slot = (scheduler->now + distance) & SLOT_MASK;
+    for (id = scheduler->heads[slot]; id != SCHEDULER_NONE; id = scheduler->tasks[id].next) {
+      uint32_t ticks = scheduler->tasks[id].expiry - scheduler->now;
+      if ((int32_t)ticks < 1) {
+        ticks = 1; // overdue, run it on the next call
+      }
+      if (ticks < best) {
+        best = ticks;
+      }
+    }
+    distance++;
+  }
+  return best;
+}
@@ -0,0 +1,86 @@
+/*
+ * scheduler.h
+ *
+ * A tiny run-to-completion scheduler (Main 6 in MainLoopDiagrams.md).
+ *
+ * Tasks are callbacks that run after a delay, once or periodically. Each
+ * runs to completion before the next one starts, so there is no locking
+ * between tasks and they all share one stack.
+ *
+ * The pending tasks are kept in a hashed timing wheel (Varghese and Lauck,
+ * "Hashed and Hierarchical Timing Wheels", 1987): an array of slots indexed
+ * by the low bits of each task's expiry time. Adding a task puts it at the
+ * head of its slot's list, cancelling unlinks it, both O(1). Each tick, only
+ * the slot for that tick is looked at; tasks in it that are due a lap (or
+ * more) later stay put. With more slots than tasks per period, that is also
+ * O(1) per tick.
+ *
+ * The task table is fixed size and the lists are linked by index, so there
+ * is no allocation. Set SCHEDULER_MAX_TASKS and SCHEDULER_WHEEL_BITS for
+ * your system; the defaults are for a small microcontroller with a 1 ms tick.
+ */
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+
+#ifndef SCHEDULER_MAX_TASKS
+#define SCHEDULER_MAX_TASKS 32
+#endif
+
+#ifndef SCHEDULER_WHEEL_BITS
+#define SCHEDULER_WHEEL_BITS 8    // 256 slots, a lap is 256 ticks
+#endif
+
+#define SCHEDULER_WHEEL_SLOTS (1u << SCHEDULER_WHEEL_BITS)
+#define SCHEDULER_NONE 0xFFFFFFFFu
+
+typedef void (*SchedulerCallback)(void *context);
+
+enum eTaskState { TASK_FREE, TASK_WAITING, TASK_RUNNING, TASK_CANCELLED };
+
+struct sSchedulerTask {
+  SchedulerCallback callback;
+  void *context;
+  uint32_t expiry;        // absolute tick it is due
+  uint32_t period;        // 0 for one shot
+  uint32_t next;          // index links in its slot (or the free list)
+  uint32_t prev;
+  uint32_t slot;
+  uint8_t state;
+};
+
+struct sScheduler {
+  uint32_t now;           // the last tick that was run
+  uint32_t freeList;
+  uint32_t numTasks;
+  uint32_t heads[SCHEDULER_WHEEL_SLOTS + 1];  // the extra one holds tasks being run
+  uint32_t occupied[(SCHEDULER_WHEEL_SLOTS + 31) / 32]; // a bit per non-empty slot
+  struct sSchedulerTask tasks[SCHEDULER_MAX_TASKS];
+};
+
+void SchedulerInit(struct sScheduler *scheduler, uint32_t now);
+
+// Run callback after delay ticks, then every period ticks (0 for once).
+// Returns a task id for SchedulerCancel or SCHEDULER_NONE if the table is
+// full. Can be called from a task.
+uint32_t SchedulerAdd(struct sScheduler *scheduler, SchedulerCallback callback, void *context,
+                      uint32_t delay, uint32_t period);
+
+// Can be called from a task, including the one being cancelled
+void SchedulerCancel(struct sScheduler *scheduler, uint32_t id);
+
+// Runs everything due up to and including now, returns how many ran. Call
+// from the main loop whenever the tick count changes. If more than a lap of
+// ticks has passed, each late task runs once (periodic tasks don't try to
+// catch up on the runs they missed).
+uint32_t SchedulerRun(struct sScheduler *scheduler, uint32_t now);
+
+// Ticks from the last SchedulerRun until the next task is due (at least 1),
+// or SCHEDULER_NONE if nothing is waiting. For tickless main loops: sleep
+// until then instead of waking every tick, then call SchedulerRun with the
+// time it really is. An interrupt that adds a task while the loop sleeps
+// has to wake it so it can ask again.
+uint32_t SchedulerNextDeadline(const struct sScheduler *scheduler);
+
+#endif // SCHEDULER_H
@@ -0,0 +1,175 @@
+/*
+ * scheduler_bench.c
+ *
+ * How well does the timing wheel scheduler keep time with a lot of tasks?
+ * 100,000 periodic tasks (periods from 10 ms to 1 s) run on one core for a
+ * few seconds with a 1 us tick. Each task records how late it ran compared
+ * to when it was due. Then the cost of adding and cancelling tasks is timed.
+ *
+ * gcc -O2 -DSCHEDULER_MAX_TASKS=100000 -DSCHEDULER_WHEEL_BITS=16 scheduler_bench.c scheduler.c -o scheduler_bench
+ * ./scheduler_bench [seconds]
+ *
+ * Lateness comes from two places: the main loop not getting around to the
+ * tick on time, and tasks due on the same tick waiting for each other
+ * because they run to completion. On a host the first is mostly the OS
+ * taking the core away, so the stalls are counted to tell them apart:
+ * every task due during a stall is late by up to its length.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "scheduler.h"
+
+#define NUM_TASKS 100000
+#define MIN_PERIOD_US 10000
+#define MAX_PERIOD_US 1000000
+#define HISTOGRAM_BUCKETS 24   // powers of two microseconds
+#define STALL_US 100
+
+struct sBenchTask {
+  uint32_t due;
+  uint32_t period;
+};
+
+static struct sScheduler gScheduler;
+static struct sBenchTask gTasks[NUM_TASKS];
+static uint64_t gHistogram[HISTOGRAM_BUCKETS];
+static uint64_t gRuns;
+static uint32_t gMaxLate;
+static uint64_t gStartNs;
+
+static uint64_t NowNs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static uint32_t NowUs(void)
+{
+  return (uint32_t)((NowNs() - gStartNs) / 1000);
+}
+
+static void PeriodicTask(void *context)
+{
+  struct sBenchTask *task = context;
+  uint32_t late = NowUs() - task->due;
+  int bucket = 0;
+
+  while (bucket < HISTOGRAM_BUCKETS - 1 && (late >> bucket) > 0) {
+    bucket++;
+  }
+  gHistogram[bucket]++;
+  if (late > gMaxLate) {
+    gMaxLate = late;
+  }
+  gRuns++;
+  task->due += task->period;
+}
+
+// Bucket 0 is on time, bucket b is late by [2^(b-1), 2^b) us. Returns the
+// top of the bucket that fraction of the runs fall within.
+static uint32_t Percentile(double fraction)
+{
+  uint64_t target = (uint64_t)(fraction * gRuns), seen = 0;
+  int bucket;
+  for (bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+    seen += gHistogram[bucket];
+    if (seen >= target) {
+      return 1u << bucket;
+    }
+  }
+  return gMaxLate;
+}
+
+static void Jitter(int seconds)
+{
+  uint32_t end, now, last, ran, loops = 0, busy = 0, stalls = 0, stalledUs = 0;
+  int i, bucket;
+
+  srand(1);
+  SchedulerInit(&gScheduler, 0);
+  for (i = 0; i < NUM_TASKS; i++) {
+    uint32_t period = MIN_PERIOD_US + (uint32_t)rand() % (MAX_PERIOD_US - MIN_PERIOD_US);
+    uint32_t delay = 1 + (uint32_t)rand() % period; // spread the first runs out
+    gTasks[i].period = period;
+    gTasks[i].due = gScheduler.now + delay;
+    if (SchedulerAdd(&gScheduler, PeriodicTask, &gTasks[i], delay, period) == SCHEDULER_NONE) {
+      printf("Task table full at %d\n", i);
+      return;
+    }
+  }
+
+  gStartNs = NowNs(); // tick 0 is now, after the setup
+  last = NowUs();
+  end = last + seconds * 1000000u;
+  while ((int32_t)((now = NowUs()) - end) < 0) {
+    // the host version of waiting for the tick interrupt is to keep looking
+    if (now - last > STALL_US) {
+      stalls++; // the OS took the core away (or the last pass ran a lot of tasks)
+      stalledUs += now - last;
+    }
+    ran = SchedulerRun(&gScheduler, now);
+    last = now;
+    loops++;
+    busy += ran ? 1 : 0;
+  }
+
+  printf("%d tasks for %d s: %llu runs (%.0f per second), %u main loops, %u ran something\n",
+         NUM_TASKS, seconds, (unsigned long long)gRuns, (double)gRuns / seconds, loops, busy);
+  printf("Main loop stalled over %d us %u times, %u us in total\n", STALL_US, stalls, stalledUs);
+  printf("Lateness: p50 < %u us, p99 < %u us, p99.9 < %u us, p99.99 < %u us, max %u us\n",
+         Percentile(0.5), Percentile(0.99), Percentile(0.999), Percentile(0.9999), gMaxLate);
+  for (bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+    if (gHistogram[bucket]) {
+      printf("  < %7u us  %10llu\n", 1u << bucket, (unsigned long long)gHistogram[bucket]);
+    }
+  }
+}
+
+static void Nothing(void *context)
+{
+  (void)context;
+}
+
+// Add and cancel with the table nearly full, spread across the wheel
+static void AddCancel(void)
+{
+  static uint32_t ids[NUM_TASKS];
+  uint64_t start, elapsed;
+  int i, round, rounds = 20;
+
+  SchedulerInit(&gScheduler, 0);
+  for (i = 0; i < NUM_TASKS - 1000; i++) {
+    ids[i] = SchedulerAdd(&gScheduler, Nothing, NULL, 1 + (uint32_t)rand() % 1000000, 0);
+  }
+  start = NowNs();
+  for (round = 0; round < rounds; round++) {
+    for (i = 0; i < 1000; i++) {
+      ids[NUM_TASKS - 1000 + i] = SchedulerAdd(&gScheduler, Nothing, NULL,
+                                               1 + (uint32_t)rand() % 1000000, 0);
+    }
+    for (i = 0; i < 1000; i++) {
+      SchedulerCancel(&gScheduler, ids[NUM_TASKS - 1000 + i]);
+    }
+  }
+  elapsed = NowNs() - start;
+  printf("Add + cancel with %d tasks waiting: %.1f ns per pair\n", NUM_TASKS - 1000,
+         (double)elapsed / (rounds * 1000));
+}
+
+int main(int argc, char *argv[])
+{
+  int seconds = argc > 1 ? atoi(argv[1]) : 5;
+
+  if (SCHEDULER_MAX_TASKS < NUM_TASKS) {
+    printf("Build with -DSCHEDULER_MAX_TASKS=%d -DSCHEDULER_WHEEL_BITS=16\n", NUM_TASKS);
+    return 1;
+  }
+  printf("Wheel: %u slots, tick 1 us\n", SCHEDULER_WHEEL_SLOTS);
+  Jitter(seconds);
+  AddCancel();
+  return 0;
+}
@@ -0,0 +1,528 @@
+/*
+ * smgen.c
+ *
+ * Generates a table driven state machine from a CSV file (see stoplight.csv
+ * for the format). The output is one header with the state and event
+ * enums, const tables, and inline init and dispatch functions. The action
+ * functions named in the CSV are yours to write.
+ *
+ * gcc -O2 smgen.c -o smgen
+ * ./smgen stoplight.csv Stoplight > stoplight_sm.h
+ *
+ * States can be nested (UML style): a transition on a parent state applies
+ * to all of its substates that don't override it, and a transition exits
+ * states from the current one up to the common ancestor of the source and
+ * the target, then enters down to the target and its initial substates.
+ * Two dispatch functions are generated:
+ *
+ *   <Name>Dispatch()              flat: the nesting is worked out here, at
+ *                                 generation time. Every (state, event) has
+ *                                 its own row with the full list of exit,
+ *                                 transition and entry actions, so dispatch
+ *                                 is one array index and a short loop.
+ *   <Name>DispatchHierarchical()  the tables only hold what the CSV says;
+ *                                 dispatch looks for a handler up through
+ *                                 the parents and works out the exits as it
+ *                                 goes, the way a UML framework does it at
+ *                                 run time. Smaller tables, more work.
+ *
+ * Either way there is no switch statement, so adding a state or an event is
+ * a change to the CSV, not to the code.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define MAX_NAMES 254          // ids are uint8_t, 255 is NONE
+#define MAX_FIELDS 6
+#define MAX_STEPS 4096
+#define NONE 255
+
+struct sState {
+  char name[64];
+  int parent;
+  int entry;             // action ids, or NONE
+  int exit;
+  int initial;           // initial substate
+  char initialName[64];  // resolved after all states are read
+};
+
+struct sTransition {
+  int state;
+  int event;
+  int next;              // NONE for internal
+  int action;
+};
+
+static struct sState gStates[MAX_NAMES];
+static int gNumStates;
+static char gEvents[MAX_NAMES][64];
+static int gNumEvents;
+static char gActions[MAX_NAMES][64];
+static int gNumActions;
+static struct sTransition gTransitions[MAX_NAMES * 4];
+static int gNumTransitions;
+static int gInitialState = NONE;
+
+static int gSteps[MAX_STEPS];  // action ids, each transition's list is a run of these
+static int gNumSteps;
+
+static void Fail(int line, const char *message, const char *detail)
+{
+  fprintf(stderr, "line %d: %s %s\n", line, message, detail);
+  exit(1);
+}
+
+static int FindState(const char *name)
+{
+  int i;
+  for (i = 0; i < gNumStates; i++) {
+    if (strcmp(gStates[i].name, name) == 0) {
+      return i;
+    }
+  }
+  return NONE;
+}
+
+// Find name in a list, adding it if it isn't there
+static int Intern(char list[][64], int *count, const char *name)
+{
+  int i;
+  if (name[0] == '\0') {
+    return NONE;
+  }
+  for (i = 0; i < *count; i++) {
+    if (strcmp(list[i], name) == 0) {
+      return i;
+    }
+  }
+  if (*count >= MAX_NAMES) {
+    fprintf(stderr, "too many names\n");
+    exit(1);
+  }
+  strncpy(list[*count], name, 63);
+  return (*count)++;
+}
+
+// Splits a CSV line in place, trimming spaces. No quoting: names are C identifiers.
+static int SplitFields(char *line, char *fields[MAX_FIELDS])
+{
+  int n = 0;
+  char *p = line;
+
+  while (n < MAX_FIELDS) {
+    char *end;
+    while (*p == ' ' || *p == '\t') {
+      p++;
+    }
+    fields[n++] = p;
+    end = p + strcspn(p, ",\r\n");
+    p = *end == ',' ? end + 1 : NULL;
+    *end = '\0';
+    while (end > fields[n - 1] && isspace((unsigned char)end[-1])) {
+      *--end = '\0';
+    }
+    if (p == NULL) {
+      break;
+    }
+  }
+  while (n < MAX_FIELDS) {
+    fields[n++] = "";
+  }
+  return n;
+}
+
+static void ReadCsv(FILE *file)
+{
+  char line[512], *f[MAX_FIELDS];
+  char pendingParents[MAX_NAMES][64];
+  int lineNumber = 0, i;
+
+  while (fgets(line, sizeof(line), file)) {
+    lineNumber++;
+    SplitFields(line, f);
+    if (f[0][0] == '#' || f[0][0] == '\0') {
+      continue;
+    }
+    if (strcmp(f[0], "state") == 0) {
+      struct sState *state = &gStates[gNumStates];
+      if (gNumStates >= MAX_NAMES || FindState(f[1]) != NONE) {
+        Fail(lineNumber, "too many states or duplicate state", f[1]);
+      }
+      strncpy(state->name, f[1], 63);
+      strncpy(pendingParents[gNumStates], f[2], 63);
+      state->entry = Intern(gActions, &gNumActions, f[3]);
+      state->exit = Intern(gActions, &gNumActions, f[4]);
+      strncpy(state->initialName, f[5], 63);
+      gNumStates++;
+    } else if (strcmp(f[0], "on") == 0) {
+      struct sTransition *t = &gTransitions[gNumTransitions++];
+      t->state = FindState(f[1]);
+      t->next = f[3][0] ? FindState(f[3]) : NONE;
+      if (t->state == NONE || (f[3][0] && t->next == NONE)) {
+        Fail(lineNumber, "unknown state (states must come before transitions)", f[1]);
+      }
+      t->event = Intern(gEvents, &gNumEvents, f[2]);
+      t->action = Intern(gActions, &gNumActions, f[4]);
+      for (i = 0; i < gNumTransitions - 1; i++) {
+        if (gTransitions[i].state == t->state && gTransitions[i].event == t->event) {
+          Fail(lineNumber, "two transitions for the same state and event:", f[2]);
+        }
+      }
+    } else if (strcmp(f[0], "initial") == 0) {
+      gInitialState = FindState(f[1]);
+      if (gInitialState == NONE) {
+        Fail(lineNumber, "unknown initial state", f[1]);
+      }
+    } else {
+      Fail(lineNumber, "unknown row type", f[0]);
+    }
+  }
+
+  for (i = 0; i < gNumStates; i++) {
+    gStates[i].parent = pendingParents[i][0] ? FindState(pendingParents[i]) : NONE;
+    gStates[i].initial = gStates[i].initialName[0] ? FindState(gStates[i].initialName) : NONE;
+    if ((pendingParents[i][0] && gStates[i].parent == NONE) ||
+        (gStates[i].initialName[0] && gStates[i].initial == NONE)) {
+      Fail(0, "unknown parent or initial substate for", gStates[i].name);
+    }
+  }
+  if (gInitialState == NONE) {
+    gInitialState = 0;
+  }
+}
+
+/******************************************************************************************************
+ * Working out the nesting
+*******************************************************************************************************/
+static int IsAncestor(int ancestor, int state)
+{
+  for (; state != NONE; state = gStates[state].parent) {
+    if (state == ancestor) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// The state a transition from source to target happens in: everything below
+// it is exited and entered. A transition to yourself, your parent or your
+// child leaves and re-enters (UML external transitions).
+static int Domain(int source, int target)
+{
+  int domain = source;
+  while (domain != NONE && !IsAncestor(domain, target)) {
+    domain = gStates[domain].parent;
+  }
+  if (domain == source || domain == target) {
+    domain = domain == NONE ? NONE : gStates[domain].parent;
+  }
+  return domain;
+}
+
+static void AddStep(int action)
+{
+  if (action == NONE) {
+    return;
+  }
+  if (gNumSteps >= MAX_STEPS) {
+    fprintf(stderr, "too many steps\n");
+    exit(1);
+  }
+  gSteps[gNumSteps++] = action;
+}
+
+// Entry actions from just below domain down to target, then into initial
+// substates until a leaf. Returns the leaf.
+static int AddEntries(int domain, int target)
+{
+  int path[MAX_NAMES], n = 0, state;
+
+  for (state = target; state != domain && state != NONE; state = gStates[state].parent) {
+    path[n++] = state;
+  }
+  while (n > 0) {
+    AddStep(gStates[path[--n]].entry);
+  }
+  for (state = target; gStates[state].initial != NONE; ) {
+    state = gStates[state].initial;
+    AddStep(gStates[state].entry);
+  }
+  return state;
+}
+
+static const struct sTransition *Handler(int state, int event)
+{
+  int i;
+  for (; state != NONE; state = gStates[state].parent) {
+    for (i = 0; i < gNumTransitions; i++) {
+      if (gTransitions[i].state == state && gTransitions[i].event == event) {
+        return &gTransitions[i];
+      }
+    }
+  }
+  return NULL;
+}
+
+static int IsLeaf(int state)
+{
+  return gStates[state].initial == NONE;
+}
+
+/******************************************************************************************************
+ * Output
+*******************************************************************************************************/
+static char *Upper(const char *name)
+{
+  static char buffers[2][64];
+  static int which;
+  char *upper = buffers[which ^= 1];
+  int i;
+  for (i = 0; name[i] && i < 63; i++) {
+    upper[i] = (char)toupper((unsigned char)name[i]);
+  }
+  upper[i] = '\0';
+  return upper;
+}
+
+// enum eStoplightState { STOPLIGHT_STATE_RED, ... STOPLIGHT_STATE_COUNT };
+static void PrintEnum(const char *name, const char *type, char names[][64], int count)
+{
+  int i;
+  printf("enum e%s%s {\n", name, type);
+  for (i = 0; i < count; i++) {
+    printf("  %s_", Upper(name));
+    printf("%s_%s,\n", Upper(type), Upper(names[i]));
+  }
+  printf("  %s_", Upper(name));
+  printf("%s_COUNT\n};\n\n", Upper(type));
+}
+
+// A row of the generated tables
+struct sRow {
+  int internal;
+  int next;
+  int domain;
+  int first;
+  int count;
+};
+
+int main(int argc, char *argv[])
+{
+  static char stateNames[MAX_NAMES][64];
+  static struct sRow flat[MAX_NAMES][MAX_NAMES], own[MAX_NAMES][MAX_NAMES];
+  char upper[64];
+  const char *name;
+  FILE *file;
+  int s, e, i, first, leaf, initialFirst, initialCount, initialLeaf;
+
+  if (argc < 3) {
+    fprintf(stderr, "usage: smgen machine.csv Name > machine_sm.h\n");
+    return 2;
+  }
+  name = argv[2];
+  strcpy(upper, Upper(name));
+  file = fopen(argv[1], "r");
+  if (file == NULL) {
+    perror(argv[1]);
+    return 1;
+  }
+  ReadCsv(file);
+  fclose(file);
+  for (s = 0; s < gNumStates; s++) {
+    strcpy(stateNames[s], gStates[s].name);
+  }
+
+  printf("/*\n * Generated by smgen.c from %s, edit that instead.\n *\n", argv[1]);
+  printf(" * %d states, %d events, %d actions. Write the action functions:\n", gNumStates,
+         gNumEvents, gNumActions);
+  printf(" * void Action(void *context);\n */\n");
+  printf("#ifndef %s_SM_H\n#define %s_SM_H\n\n#include <stdint.h>\n\n", upper, upper);
+  PrintEnum(name, "State", stateNames, gNumStates);
+  PrintEnum(name, "Event", gEvents, gNumEvents);
+
+  for (i = 0; i < gNumActions; i++) {
+    printf("void %s(void *context);\n", gActions[i]);
+  }
+  printf("\ntypedef void (*%sAction)(void *context);\n\n", name);
+  printf("static %sAction const k%sActions[] = {\n", name, name);
+  for (i = 0; i < gNumActions; i++) {
+    printf("  %s,\n", gActions[i]);
+  }
+  printf("};\n\n");
+
+  printf("static const char *const k%sStateNames[] = {", name);
+  for (s = 0; s < gNumStates; s++) {
+    printf("%s\"%s\"", s ? ", " : " ", gStates[s].name);
+  }
+  printf(" };\n\n");
+
+  printf("struct s%s {\n  uint8_t state;  // always a leaf state\n  void *context;  // passed to the actions\n};\n\n", name);
+  printf("struct s%sTransition {\n"
+         "  uint8_t next;       // %d: no transition\n"
+         "  uint8_t domain;     // hierarchical only: exit up to here (%d for the top)\n"
+         "  uint16_t firstStep; // into k%sSteps\n"
+         "  uint8_t numSteps;\n"
+         "};\n\n", name, NONE, NONE, name);
+
+  // Flat: every (state, event) resolved here, with its full list of actions
+  initialFirst = gNumSteps;
+  initialLeaf = AddEntries(NONE, gInitialState);
+  initialCount = gNumSteps - initialFirst;
+
+  for (s = 0; s < gNumStates; s++) {
+    for (e = 0; e < gNumEvents; e++) {
+      const struct sTransition *t = IsLeaf(s) ? Handler(s, e) : NULL;
+      struct sRow *row = &flat[s][e];
+      row->next = NONE;
+      row->domain = NONE;
+      row->first = gNumSteps;
+      row->count = 0;
+      if (t == NULL) {
+        continue;
+      }
+      if (t->next == NONE) {
+        row->next = s; // internal: stay put
+        row->internal = 1;
+        AddStep(t->action);
+      } else {
+        int domain = Domain(t->state, t->next), state;
+        for (state = s; state != domain; state = gStates[state].parent) {
+          AddStep(gStates[state].exit);
+        }
+        AddStep(t->action);
+        row->next = AddEntries(domain, t->next);
+      }
+      row->count = gNumSteps - row->first;
+    }
+  }
+
+  // Hierarchical: only the transitions in the CSV. The exits depend on
+  // which substate is active so they are done at run time; the action and
+  // entries are fixed.
+  for (s = 0; s < gNumStates; s++) {
+    for (e = 0; e < gNumEvents; e++) {
+      struct sRow *row = &own[s][e];
+      row->next = NONE;
+      row->domain = NONE;
+      row->first = gNumSteps;
+      row->count = 0;
+      for (i = 0; i < gNumTransitions; i++) {
+        const struct sTransition *t = &gTransitions[i];
+        if (t->state != s || t->event != e) {
+          continue;
+        }
+        AddStep(t->action);
+        if (t->next == NONE) {
+          row->next = NONE - 1; // internal, see below
+        } else {
+          row->domain = Domain(t->state, t->next);
+          row->next = AddEntries(row->domain, t->next);
+        }
+        row->count = gNumSteps - row->first;
+      }
+    }
+  }
+
+  printf("static const uint8_t k%sSteps[] = {", name);
+  for (i = 0; i < gNumSteps; i++) {
+    printf("%s%d,", i % 16 ? " " : "\n  ", gSteps[i]);
+  }
+  printf("\n};\n\n");
+
+  printf("static const struct s%sTransition k%sTable[%d][%d] = {\n", name, name, gNumStates, gNumEvents);
+  for (s = 0; s < gNumStates; s++) {
+    printf("  { // %s\n", gStates[s].name);
+    for (e = 0; e < gNumEvents; e++) {
+      struct sRow *row = &flat[s][e];
+      printf("    { %3d, %3d, %4d, %d }, // %s", row->next, NONE, row->first, row->count, gEvents[e]);
+      if (row->internal) {
+        printf(" (internal)");
+      } else if (row->next != NONE) {
+        printf(" -> %s", gStates[row->next].name);
+      }
+      printf("\n");
+    }
+    printf("  },\n");
+  }
+  printf("};\n\n");
+
+  printf("// The CSV as written: %d means an internal transition\n", NONE - 1);
+  printf("static const struct s%sTransition k%sOwnTable[%d][%d] = {\n", name, name, gNumStates, gNumEvents);
+  for (s = 0; s < gNumStates; s++) {
+    printf("  { // %s\n", gStates[s].name);
+    for (e = 0; e < gNumEvents; e++) {
+      struct sRow *row = &own[s][e];
+      printf("    { %3d, %3d, %4d, %d }, // %s\n", row->next, row->domain, row->first, row->count,
+             gEvents[e]);
+    }
+    printf("  },\n");
+  }
+  printf("};\n\n");
+
+  printf("static const uint8_t k%sParent[%d] = {", name, gNumStates);
+  for (s = 0; s < gNumStates; s++) {
+    printf("%s%d", s ? ", " : " ", gStates[s].parent);
+  }
+  printf(" };\n");
+  printf("static const uint8_t k%sExit[%d] = {", name, gNumStates);
+  for (s = 0; s < gNumStates; s++) {
+    printf("%s%d", s ? ", " : " ", gStates[s].exit);
+  }
+  printf(" }; // action ids, %d for none\n\n", NONE);
+
+  first = initialFirst;
+  leaf = initialLeaf;
+  printf("static inline void %sRunSteps(void *context, uint16_t first, uint8_t count)\n{\n"
+         "  while (count--) {\n"
+         "    k%sActions[k%sSteps[first++]](context);\n"
+         "  }\n}\n\n", name, name, name);
+
+  printf("// Enters the initial state (running its entry actions)\n");
+  printf("static inline void %sInit(struct s%s *sm, void *context)\n{\n"
+         "  sm->context = context;\n"
+         "  sm->state = %s_STATE_%s;\n"
+         "  %sRunSteps(context, %d, %d);\n}\n\n",
+         name, name, upper, Upper(gStates[leaf].name), name, first, initialCount);
+
+  printf("// Returns 1 if the event was handled, 0 if the current state ignores it\n");
+  printf("static inline int %sDispatch(struct s%s *sm, enum e%sEvent event)\n{\n"
+         "  const struct s%sTransition *t = &k%sTable[sm->state][event];\n"
+         "  if (t->next == %d) {\n"
+         "    return 0;\n"
+         "  }\n"
+         "  %sRunSteps(sm->context, t->firstStep, t->numSteps);\n"
+         "  sm->state = t->next;\n"
+         "  return 1;\n}\n\n", name, name, name, name, name, NONE, name);
+
+  printf("static inline int %sDispatchHierarchical(struct s%s *sm, enum e%sEvent event)\n{\n"
+         "  const struct s%sTransition *t = 0;\n"
+         "  uint8_t state;\n\n"
+         "  // the innermost state that handles it\n"
+         "  for (state = sm->state; state != %d; state = k%sParent[state]) {\n"
+         "    t = &k%sOwnTable[state][event];\n"
+         "    if (t->next != %d) {\n"
+         "      break;\n"
+         "    }\n"
+         "  }\n"
+         "  if (state == %d) {\n"
+         "    return 0;\n"
+         "  }\n"
+         "  if (t->next != %d) {\n"
+         "    // exit from the current state up to the domain\n"
+         "    for (state = sm->state; state != t->domain; state = k%sParent[state]) {\n"
+         "      if (k%sExit[state] != %d) {\n"
+         "        k%sActions[k%sExit[state]](sm->context);\n"
+         "      }\n"
+         "    }\n"
+         "    sm->state = t->next;\n"
+         "  }\n"
+         "  %sRunSteps(sm->context, t->firstStep, t->numSteps);\n"
+         "  return 1;\n}\n\n",
+         name, name, name, name, NONE, name, name, NONE, NONE, NONE - 1, name, name, NONE,
+         name, name, name);
+
+  printf("#endif // %s_SM_H\n", upper);
+  return 0;
+}
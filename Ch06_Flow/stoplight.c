@@ -0,0 +1,240 @@
+/*
+ * stoplight.c
+ *
+ * The stoplight controller from the book two ways: written by hand with
+ * nested switch statements, and generated from stoplight.csv by smgen.c
+ * (stoplight_sm.h, both its flat and hierarchical dispatch). The same
+ * random events go through all three; they have to do the same actions in
+ * the same order, then each is timed.
+ *
+ * gcc -O2 smgen.c -o smgen && ./smgen stoplight.csv Stoplight > stoplight_sm.h
+ * gcc -O2 stoplight.c -o stoplight
+ * ./stoplight
+ *
+ * Operating has substates Red, Green and Yellow; a Fault in any of them
+ * goes to Flashing until a Reset. Walk makes Green go to Yellow early and
+ * (in Red) shows the walk signal.
+ *
+ * Don't expect the tables to win on a desktop processor. The switch calls
+ * its actions directly (and can inline them) while the tables call through
+ * function pointers, which a branch predictor can't guess with random
+ * events. What the tables buy is that dispatch takes the same time no
+ * matter how many states and events there are, and that the behavior is
+ * data you can review (and change) in a spreadsheet.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include "stoplight_sm.h"
+
+#define NUM_EVENTS 10000000
+
+// What the actions do: turn lights on and off, and keep a running hash of
+// the actions in order so the three versions can be compared
+struct sLights {
+  uint8_t red, yellow, green, flashing, walk;
+  uint32_t faults;
+  uint32_t trace;
+};
+
+static inline void Trace(void *context, uint32_t action)
+{
+  struct sLights *lights = context;
+  lights->trace = (lights->trace ^ action) * 16777619u;
+}
+
+void RedOn(void *c)         { ((struct sLights *)c)->red = 1; Trace(c, 1); }
+void RedOff(void *c)        { ((struct sLights *)c)->red = 0; Trace(c, 2); }
+void GreenOn(void *c)       { ((struct sLights *)c)->green = 1; Trace(c, 3); }
+void GreenOff(void *c)      { ((struct sLights *)c)->green = 0; Trace(c, 4); }
+void YellowOn(void *c)      { ((struct sLights *)c)->yellow = 1; Trace(c, 5); }
+void YellowOff(void *c)     { ((struct sLights *)c)->yellow = 0; Trace(c, 6); }
+void StartFlashing(void *c) { ((struct sLights *)c)->flashing = 1; Trace(c, 7); }
+void StopFlashing(void *c)  { ((struct sLights *)c)->flashing = 0; Trace(c, 8); }
+void WalkSignal(void *c)    { ((struct sLights *)c)->walk ^= 1; Trace(c, 9); }
+void LogFault(void *c)      { ((struct sLights *)c)->faults++; Trace(c, 10); }
+void ToggleRed(void *c)     { ((struct sLights *)c)->red ^= 1; Trace(c, 11); }
+
+/******************************************************************************************************
+ * By hand
+ * The usual way: a switch on the state with a switch on the event inside.
+ * The hierarchy is done by hand too: every Operating substate has its own
+ * copy of the Fault case.
+*******************************************************************************************************/
+struct sSwitchStoplight {
+  enum eStoplightState state;
+  struct sLights *lights;
+};
+
+static void SwitchInit(struct sSwitchStoplight *sm, struct sLights *lights)
+{
+  sm->lights = lights;
+  sm->state = STOPLIGHT_STATE_RED;
+  RedOn(lights);
+}
+
+static void SwitchFault(struct sSwitchStoplight *sm)
+{
+  LogFault(sm->lights);
+  StartFlashing(sm->lights);
+  sm->state = STOPLIGHT_STATE_FLASHING;
+}
+
+static void SwitchDispatch(struct sSwitchStoplight *sm, enum eStoplightEvent event)
+{
+  switch (sm->state) {
+    case STOPLIGHT_STATE_RED:
+      switch (event) {
+        case STOPLIGHT_EVENT_TIMER:
+          RedOff(sm->lights);
+          GreenOn(sm->lights);
+          sm->state = STOPLIGHT_STATE_GREEN;
+          break;
+        case STOPLIGHT_EVENT_WALK:
+          WalkSignal(sm->lights);
+          break;
+        case STOPLIGHT_EVENT_FAULT:
+          RedOff(sm->lights);
+          SwitchFault(sm);
+          break;
+        default:
+          break;
+      }
+      break;
+
+    case STOPLIGHT_STATE_GREEN:
+      switch (event) {
+        case STOPLIGHT_EVENT_TIMER:
+        case STOPLIGHT_EVENT_WALK:
+          GreenOff(sm->lights);
+          YellowOn(sm->lights);
+          sm->state = STOPLIGHT_STATE_YELLOW;
+          break;
+        case STOPLIGHT_EVENT_FAULT:
+          GreenOff(sm->lights);
+          SwitchFault(sm);
+          break;
+        default:
+          break;
+      }
+      break;
+
+    case STOPLIGHT_STATE_YELLOW:
+      switch (event) {
+        case STOPLIGHT_EVENT_TIMER:
+          YellowOff(sm->lights);
+          RedOn(sm->lights);
+          sm->state = STOPLIGHT_STATE_RED;
+          break;
+        case STOPLIGHT_EVENT_FAULT:
+          YellowOff(sm->lights);
+          SwitchFault(sm);
+          break;
+        default:
+          break;
+      }
+      break;
+
+    case STOPLIGHT_STATE_FLASHING:
+      switch (event) {
+        case STOPLIGHT_EVENT_TIMER:
+          ToggleRed(sm->lights);
+          break;
+        case STOPLIGHT_EVENT_RESET:
+          StopFlashing(sm->lights);
+          RedOn(sm->lights);
+          sm->state = STOPLIGHT_STATE_RED;
+          break;
+        default:
+          break;
+      }
+      break;
+
+    default:
+      break;
+  }
+}
+
+/******************************************************************************************************
+ * Comparing them
+*******************************************************************************************************/
+static uint8_t gEvents[NUM_EVENTS];
+
+// Mostly timer ticks, some walk buttons, occasional faults and resets
+static void MakeEvents(void)
+{
+  uint32_t i;
+  srand(2);
+  for (i = 0; i < NUM_EVENTS; i++) {
+    int r = rand() % 100;
+    gEvents[i] = r < 70 ? STOPLIGHT_EVENT_TIMER : r < 90 ? STOPLIGHT_EVENT_WALK :
+                 r < 95 ? STOPLIGHT_EVENT_FAULT : STOPLIGHT_EVENT_RESET;
+  }
+}
+
+static double NowNs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static uint32_t RunSwitch(double *ns)
+{
+  struct sLights lights = { 0 };
+  struct sSwitchStoplight sm;
+  double start = NowNs();
+  uint32_t i;
+
+  SwitchInit(&sm, &lights);
+  for (i = 0; i < NUM_EVENTS; i++) {
+    SwitchDispatch(&sm, (enum eStoplightEvent)gEvents[i]);
+  }
+  *ns = (NowNs() - start) / NUM_EVENTS;
+  return lights.trace;
+}
+
+static uint32_t RunTable(double *ns, int hierarchical)
+{
+  struct sLights lights = { 0 };
+  struct sStoplight sm;
+  double start = NowNs();
+  uint32_t i;
+
+  StoplightInit(&sm, &lights);
+  for (i = 0; i < NUM_EVENTS; i++) {
+    if (hierarchical) {
+      StoplightDispatchHierarchical(&sm, (enum eStoplightEvent)gEvents[i]);
+    } else {
+      StoplightDispatch(&sm, (enum eStoplightEvent)gEvents[i]);
+    }
+  }
+  *ns = (NowNs() - start) / NUM_EVENTS;
+  return lights.trace;
+}
+
+int main(void)
+{
+  uint32_t traceSwitch, traceFlat, traceHierarchical;
+  double nsSwitch, nsFlat, nsHierarchical;
+  int run;
+
+  MakeEvents();
+  for (run = 0; run < 2; run++) { // the first time around warms up the caches
+    traceSwitch = RunSwitch(&nsSwitch);
+    traceFlat = RunTable(&nsFlat, 0);
+    traceHierarchical = RunTable(&nsHierarchical, 1);
+  }
+  printf("%d events\n", NUM_EVENTS);
+  printf("  switch statements:          %5.2f ns per event, trace %08x\n", nsSwitch, traceSwitch);
+  printf("  generated, flat table:      %5.2f ns per event, trace %08x\n", nsFlat, traceFlat);
+  printf("  generated, hierarchical:    %5.2f ns per event, trace %08x\n", nsHierarchical,
+         traceHierarchical);
+  if (traceSwitch != traceFlat || traceSwitch != traceHierarchical) {
+    printf("DIFFERENT: the versions did not do the same actions\n");
+    return 1;
+  }
+  printf("All three did the same actions in the same order\n");
+  return 0;
+}
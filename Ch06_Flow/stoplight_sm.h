@@ -0,0 +1,201 @@
+/*
+ * Generated by smgen.c from stoplight.csv, edit that instead.
+ *
+ * 5 states, 4 events, 11 actions. Write the action functions:
+ * void Action(void *context);
+ */
+#ifndef STOPLIGHT_SM_H
+#define STOPLIGHT_SM_H
+
+#include <stdint.h>
+
+enum eStoplightState {
+  STOPLIGHT_STATE_OPERATING,
+  STOPLIGHT_STATE_RED,
+  STOPLIGHT_STATE_GREEN,
+  STOPLIGHT_STATE_YELLOW,
+  STOPLIGHT_STATE_FLASHING,
+  STOPLIGHT_STATE_COUNT
+};
+
+enum eStoplightEvent {
+  STOPLIGHT_EVENT_TIMER,
+  STOPLIGHT_EVENT_WALK,
+  STOPLIGHT_EVENT_FAULT,
+  STOPLIGHT_EVENT_RESET,
+  STOPLIGHT_EVENT_COUNT
+};
+
+void RedOn(void *context);
+void RedOff(void *context);
+void GreenOn(void *context);
+void GreenOff(void *context);
+void YellowOn(void *context);
+void YellowOff(void *context);
+void StartFlashing(void *context);
+void StopFlashing(void *context);
+void WalkSignal(void *context);
+void LogFault(void *context);
+void ToggleRed(void *context);
+
+typedef void (*StoplightAction)(void *context);
+
+static StoplightAction const kStoplightActions[] = {
+  RedOn,
+  RedOff,
+  GreenOn,
+  GreenOff,
+  YellowOn,
+  YellowOff,
+  StartFlashing,
+  StopFlashing,
+  WalkSignal,
+  LogFault,
+  ToggleRed,
+};
+
+static const char *const kStoplightStateNames[] = { "Operating", "Red", "Green", "Yellow", "Flashing" };
+
+struct sStoplight {
+  uint8_t state;  // always a leaf state
+  void *context;  // passed to the actions
+};
+
+struct sStoplightTransition {
+  uint8_t next;       // 255: no transition
+  uint8_t domain;     // hierarchical only: exit up to here (255 for the top)
+  uint16_t firstStep; // into kStoplightSteps
+  uint8_t numSteps;
+};
+
+static const uint8_t kStoplightSteps[] = {
+  0, 1, 2, 8, 1, 9, 6, 3, 4, 3, 4, 3, 9, 6, 5, 0,
+  5, 9, 6, 10, 7, 0, 9, 6, 2, 8, 4, 4, 0, 10, 0,
+};
+
+static const struct sStoplightTransition kStoplightTable[5][4] = {
+  { // Operating
+    { 255, 255,    1, 0 }, // Timer
+    { 255, 255,    1, 0 }, // Walk
+    { 255, 255,    1, 0 }, // Fault
+    { 255, 255,    1, 0 }, // Reset
+  },
+  { // Red
+    {   2, 255,    1, 2 }, // Timer -> Green
+    {   1, 255,    3, 1 }, // Walk (internal)
+    {   4, 255,    4, 3 }, // Fault -> Flashing
+    { 255, 255,    7, 0 }, // Reset
+  },
+  { // Green
+    {   3, 255,    7, 2 }, // Timer -> Yellow
+    {   3, 255,    9, 2 }, // Walk -> Yellow
+    {   4, 255,   11, 3 }, // Fault -> Flashing
+    { 255, 255,   14, 0 }, // Reset
+  },
+  { // Yellow
+    {   1, 255,   14, 2 }, // Timer -> Red
+    { 255, 255,   16, 0 }, // Walk
+    {   4, 255,   16, 3 }, // Fault -> Flashing
+    { 255, 255,   19, 0 }, // Reset
+  },
+  { // Flashing
+    {   4, 255,   19, 1 }, // Timer (internal)
+    { 255, 255,   20, 0 }, // Walk
+    { 255, 255,   20, 0 }, // Fault
+    {   1, 255,   20, 2 }, // Reset -> Red
+  },
+};
+
+// The CSV as written: 254 means an internal transition
+static const struct sStoplightTransition kStoplightOwnTable[5][4] = {
+  { // Operating
+    { 255, 255,   22, 0 }, // Timer
+    { 255, 255,   22, 0 }, // Walk
+    {   4, 255,   22, 2 }, // Fault
+    { 255, 255,   24, 0 }, // Reset
+  },
+  { // Red
+    {   2,   0,   24, 1 }, // Timer
+    { 254, 255,   25, 1 }, // Walk
+    { 255, 255,   26, 0 }, // Fault
+    { 255, 255,   26, 0 }, // Reset
+  },
+  { // Green
+    {   3,   0,   26, 1 }, // Timer
+    {   3,   0,   27, 1 }, // Walk
+    { 255, 255,   28, 0 }, // Fault
+    { 255, 255,   28, 0 }, // Reset
+  },
+  { // Yellow
+    {   1,   0,   28, 1 }, // Timer
+    { 255, 255,   29, 0 }, // Walk
+    { 255, 255,   29, 0 }, // Fault
+    { 255, 255,   29, 0 }, // Reset
+  },
+  { // Flashing
+    { 254, 255,   29, 1 }, // Timer
+    { 255, 255,   30, 0 }, // Walk
+    { 255, 255,   30, 0 }, // Fault
+    {   1, 255,   30, 1 }, // Reset
+  },
+};
+
+static const uint8_t kStoplightParent[5] = { 255, 0, 0, 0, 255 };
+static const uint8_t kStoplightExit[5] = { 255, 1, 3, 5, 7 }; // action ids, 255 for none
+
+static inline void StoplightRunSteps(void *context, uint16_t first, uint8_t count)
+{
+  while (count--) {
+    kStoplightActions[kStoplightSteps[first++]](context);
+  }
+}
+
+// Enters the initial state (running its entry actions)
+static inline void StoplightInit(struct sStoplight *sm, void *context)
+{
+  sm->context = context;
+  sm->state = STOPLIGHT_STATE_RED;
+  StoplightRunSteps(context, 0, 1);
+}
+
+// Returns 1 if the event was handled, 0 if the current state ignores it
+static inline int StoplightDispatch(struct sStoplight *sm, enum eStoplightEvent event)
+{
+  const struct sStoplightTransition *t = &kStoplightTable[sm->state][event];
+  if (t->next == 255) {
+    return 0;
+  }
+  StoplightRunSteps(sm->context, t->firstStep, t->numSteps);
+  sm->state = t->next;
+  return 1;
+}
+
+static inline int StoplightDispatchHierarchical(struct sStoplight *sm, enum eStoplightEvent event)
+{
+  const struct sStoplightTransition *t = 0;
+  uint8_t state;
+
+  // the innermost state that handles it
+  for (state = sm->state; state != 255; state = kStoplightParent[state]) {
+    t = &kStoplightOwnTable[state][event];
+    if (t->next != 255) {
+      break;
+    }
+  }
+  if (state == 255) {
+    return 0;
+  }
+  if (t->next != 254) {
+    // exit from the current state up to the domain
+    for (state = sm->state; state != t->domain; state = kStoplightParent[state]) {
+      if (kStoplightExit[state] != 255) {
+        kStoplightActions[kStoplightExit[state]](sm->context);
+      }
+    }
+    sm->state = t->next;
+  }
+  StoplightRunSteps(sm->context, t->firstStep, t->numSteps);
+  return 1;
+}
+
+#endif // STOPLIGHT_SM_H
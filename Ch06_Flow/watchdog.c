@@ -0,0 +1,156 @@
+/*
+ * watchdog.c
+ *
+ * Software watchdog supervisor, see watchdog.h
+ */
+#include <string.h>
+#include "watchdog.h"
+
+#ifndef __arm__
+#include <signal.h>
+#include <time.h>
+#define WATCHDOG_SNAPSHOT_SIGNAL SIGUSR1
+#define WATCHDOG_SNAPSHOT_WAIT_MS 100
+#endif
+
+void WatchdogInit(struct sWatchdog *wd, void (*restart)(void))
+{
+  memset(wd, 0, sizeof(*wd));
+  atomic_init(&wd->checkIns, 0);
+  atomic_init(&wd->ready, 0);
+  atomic_init(&wd->numTasks, 0);
+  wd->restart = restart;
+}
+
+int WatchdogRegister(struct sWatchdog *wd, const char *name, uint32_t deadlineMs, uint64_t nowMs)
+{
+  struct sWatchdogTask *task;
+  unsigned id = atomic_fetch_add(&wd->numTasks, 1);   // claim a slot
+
+  if (id >= WATCHDOG_MAX_TASKS) {
+    atomic_fetch_sub(&wd->numTasks, 1);
+    return -1;
+  }
+  task = &wd->tasks[id];
+  task->name = name;
+  task->deadlineMs = deadlineMs;
+  task->lastCheckInMs = nowMs;
+#ifndef __arm__
+  task->thread = pthread_self();
+#else
+  task->stackPointer = 0;
+#endif
+  // publish it: the supervisor's acquire load sees the fields above
+  atomic_fetch_or_explicit(&wd->ready, (uint_least32_t)1 << id, memory_order_release);
+  return id;
+}
+
+/******************************************************************************************************
+ * Stack snapshot
+ * On a host, the starved thread is sent a signal. Its handler runs on that
+ * thread's stack so it can record where the thread is stuck (pc, sp, and
+ * the top of its stack). If the thread doesn't answer (signals blocked,
+ * or really wedged), the dump goes out without the snapshot.
+ *
+ * On a target there is no way to stop a task and look, so each check in
+ * records the task's stack pointer and the snapshot is the task's stack
+ * from there: the frames that called the check in, as of the last time it
+ * got through. Where it is stuck now is further down (or in another task).
+*******************************************************************************************************/
+static struct sCoreDump gDump;
+
+#ifndef __arm__
+static atomic_int gSnapshotDone;
+
+static void SnapshotHandler(int sig, siginfo_t *info, void *context)
+{
+  uint32_t taskId = gDump.taskId;
+  (void)sig;
+  CoreDumpFromSignal(&gDump, COREDUMP_CAUSE_WATCHDOG, info, context);
+  gDump.faultAddress = 0; // there is no bad address, just a late task
+  gDump.taskId = taskId;
+  memcpy(gDump.stack, (const void *)gDump.stackPointer, sizeof(gDump.stack));
+  atomic_store(&gSnapshotDone, 1);
+}
+
+static void CaptureStack(struct sWatchdogTask *task)
+{
+  struct sigaction action, previous;
+  struct timespec pause = { 0, 1000000 };
+  int waited;
+
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = SnapshotHandler;
+  action.sa_flags = SA_SIGINFO;
+  sigemptyset(&action.sa_mask);
+  sigaction(WATCHDOG_SNAPSHOT_SIGNAL, &action, &previous);
+
+  atomic_store(&gSnapshotDone, 0);
+  if (pthread_kill(task->thread, WATCHDOG_SNAPSHOT_SIGNAL) == 0) {
+    for (waited = 0; waited < WATCHDOG_SNAPSHOT_WAIT_MS && !atomic_load(&gSnapshotDone); waited++) {
+      nanosleep(&pause, NULL);
+    }
+  }
+  sigaction(WATCHDOG_SNAPSHOT_SIGNAL, &previous, NULL);
+}
+#else
+static void CaptureStack(struct sWatchdogTask *task)
+{
+  gDump.stackPointer = task->stackPointer;
+  if (task->stackPointer != 0) {  // 0: it never checked in
+    memcpy(gDump.stack, (const void *)task->stackPointer, sizeof(gDump.stack));
+  }
+}
+#endif // __arm__
+
+static void Starved(struct sWatchdog *wd, uint32_t taskId)
+{
+  memset(&gDump, 0, sizeof(gDump));
+  gDump.key = COREDUMP_KEY;
+  gDump.cause = COREDUMP_CAUSE_WATCHDOG;
+  gDump.taskId = taskId;
+  CaptureStack(&wd->tasks[taskId]);
+#ifndef __arm__
+  CoreDumpSave(&gDump);
+#else
+  extern struct sCoreDump coreDump; // the .CoreDump section from hardfaults.c
+  // key last, as CoreDumpSave does, so a reset part way through the copy
+  // doesn't leave a valid looking key on a half written dump
+  gDump.crc = CoreDumpCrc(&gDump);
+  coreDump.key = 0;
+  __asm volatile("" ::: "memory");
+  memcpy((uint8_t *)&coreDump + sizeof(coreDump.key), (const uint8_t *)&gDump + sizeof(gDump.key),
+         sizeof(coreDump) - sizeof(coreDump.key));
+  __asm volatile("" ::: "memory");
+  coreDump.key = COREDUMP_KEY;
+#endif
+  if (wd->restart) {
+    wd->restart();
+  }
+}
+
+int WatchdogSupervise(struct sWatchdog *wd, uint64_t nowMs)
+{
+  uint32_t seen = atomic_exchange_explicit(&wd->checkIns, 0, memory_order_relaxed);
+  uint32_t ready = atomic_load_explicit(&wd->ready, memory_order_acquire);
+  uint32_t numTasks = atomic_load_explicit(&wd->numTasks, memory_order_acquire);
+  uint32_t i;
+
+  // a failed register can push the count past the end for a moment
+  if (numTasks > WATCHDOG_MAX_TASKS) {
+    numTasks = WATCHDOG_MAX_TASKS;
+  }
+  for (i = 0; i < numTasks; i++) {
+    struct sWatchdogTask *task = &wd->tasks[i];
+    if (!(ready & ((uint32_t)1 << i))) {
+      continue;                   // claimed but not filled in yet
+    }
+    if (seen & ((uint32_t)1 << i)) {
+      task->lastCheckInMs = nowMs;
+    } else if (nowMs - task->lastCheckInMs > task->deadlineMs) {
+      Starved(wd, i);
+      return 0;
+    }
+  }
+  return 1;
+}
@@ -0,0 +1,73 @@
+/*
+ * watchdog.h
+ *
+ * A software watchdog supervisor that sits in front of the hardware watchdog.
+ *
+ * Petting the hardware watchdog from the main loop (Main 3 in
+ * MainLoopDiagrams.md) only proves the main loop runs. With several tasks
+ * (or threads, or callbacks from a scheduler), one can stop while the
+ * others keep the loop going. Here each task checks in by setting its bit in
+ * a shared bitmap, one atomic OR. The supervisor runs periodically, collects
+ * the bits, and only pets the hardware watchdog if every task has checked
+ * in within its own deadline.
+ *
+ * When a task misses, the supervisor records which one and a snapshot of its
+ * stack in the core dump (see Ch09_Debugging/coredump.h) and then does a
+ * controlled restart instead of waiting for the hardware watchdog to pull
+ * the plug with no information.
+ */
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include "../Ch09_Debugging/coredump.h"
+
+#ifndef __arm__
+#include <pthread.h>
+#endif
+
+#define WATCHDOG_MAX_TASKS 32   // one bit each in the check in bitmap
+
+struct sWatchdogTask {
+  const char *name;
+  uint32_t deadlineMs;      // must check in at least this often
+  uint64_t lastCheckInMs;
+#ifndef __arm__
+  pthread_t thread;         // for the stack snapshot
+#else
+  uintptr_t stackPointer;   // at the last check in, for the stack snapshot
+#endif
+};
+
+struct sWatchdog {
+  atomic_uint_least32_t checkIns;  // set by tasks, cleared by the supervisor
+  atomic_uint_least32_t ready;     // tasks whose slot is filled in
+  atomic_uint numTasks;            // slots claimed (may briefly pass the max)
+  struct sWatchdogTask tasks[WATCHDOG_MAX_TASKS];
+  void (*restart)(void);           // controlled restart, NVIC_SystemReset on a target
+};
+
+void WatchdogInit(struct sWatchdog *wd, void (*restart)(void));
+
+// Call from the task (thread) that will check in. The supervisor may
+// already be running: it ignores a task until its slot is filled in.
+// Returns the task id to pass to WatchdogCheckIn or -1 if there is no room.
+int WatchdogRegister(struct sWatchdog *wd, const char *name, uint32_t deadlineMs, uint64_t nowMs);
+
+// A single atomic OR, cheap enough to call every time through the task's loop
+static inline void WatchdogCheckIn(struct sWatchdog *wd, int taskId)
+{
+#ifdef __arm__
+  wd->tasks[taskId].stackPointer = (uintptr_t)__builtin_frame_address(0);
+#endif
+  atomic_fetch_or_explicit(&wd->checkIns, (uint_least32_t)1 << taskId, memory_order_relaxed);
+}
+
+// Call periodically (more often than the shortest deadline). Returns 1 if
+// all tasks are healthy and the hardware watchdog can be pet. If a task has
+// starved it saves the core dump and calls restart (it only returns 0 if
+// restart returns).
+int WatchdogSupervise(struct sWatchdog *wd, uint64_t nowMs);
+
+#endif // WATCHDOG_H
@@ -0,0 +1,170 @@
+/*
+ * watchdog_demo.c
+ *
+ * Three threads check in with the software watchdog. After a while, the
+ * output thread gets stuck. The supervisor notices, saves which task starved
+ * and its stack in the core dump, and restarts the program. After the
+ * restart, the dump is read back the way a device would at boot.
+ *
+ * gcc -O1 -g -no-pie -rdynamic watchdog_demo.c watchdog.c ../Ch09_Debugging/coredump.c -o watchdog -lpthread -ldl
+ * ./watchdog
+ *
+ * -no-pie keeps the code at the same address after the restart (as it is
+ * in firmware) so the saved pc can be turned back into a function name.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <unistd.h>
+#include "watchdog.h"
+
+#define COREDUMP_FILE "watchdog.coredump"
+#define SUPERVISOR_PERIOD_MS 20
+#define STUCK_AFTER_MS 1000
+
+struct sDemoTask {
+  const char *name;
+  uint32_t loopMs;       // how long each pass through its loop takes
+  uint32_t deadlineMs;
+};
+static const struct sDemoTask gDemoTasks[] = {
+  { "input",  10, 100 },
+  { "output", 25, 200 },
+  { "led",   100, 500 },
+};
+#define NUM_DEMO_TASKS (sizeof(gDemoTasks) / sizeof(gDemoTasks[0]))
+
+static struct sWatchdog gWatchdog;
+static char **gArgv;
+static volatile int gOutputStuck = 0;
+
+static uint64_t NowMs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000u + ts.tv_nsec / 1000000u;
+}
+
+static void SleepMs(uint32_t ms)
+{
+  struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+  nanosleep(&ts, NULL);
+}
+
+// The bug: a loop waiting for something that never happens
+__attribute__((noinline))
+void WaitForOutputReady(void)
+{
+  while (gOutputStuck) {
+    ;
+  }
+}
+
+static void *TaskThread(void *arg)
+{
+  const struct sDemoTask *demo = arg;
+  int id = WatchdogRegister(&gWatchdog, demo->name, demo->deadlineMs, NowMs());
+
+  while (1) {
+    if (strcmp(demo->name, "output") == 0) {
+      WaitForOutputReady();
+    }
+    SleepMs(demo->loopMs); // pretend to work
+    WatchdogCheckIn(&gWatchdog, id);
+  }
+  return NULL;
+}
+
+// The host version of NVIC_SystemReset(): start over
+static void Restart(void)
+{
+  printf("Watchdog: restarting\n");
+  fflush(stdout);
+  execv("/proc/self/exe", gArgv);
+  exit(1);
+}
+
+// What a device does at boot: is there a dump from last time?
+static int ReportPreviousDump(void)
+{
+  struct sCoreDump dump;
+  Dl_info where;
+  int i;
+
+  if (!CoreDumpLoad(COREDUMP_FILE, &dump)) {
+    return 0;
+  }
+  printf("Core dump from before the restart: %s\n", CoreDumpCauseName(dump.cause));
+  if (dump.taskId < NUM_DEMO_TASKS) {
+    printf("  starved task: %u (%s)\n", dump.taskId, gDemoTasks[dump.taskId].name);
+  }
+  printf("  pc %#llx", (unsigned long long)dump.returnAddress);
+  if (dladdr((void *)dump.returnAddress, &where) && where.dli_sname) {
+    printf(" in %s()", where.dli_sname);
+  }
+  printf("\n  sp %#llx, stack:", (unsigned long long)dump.stackPointer);
+  for (i = 0; i < COREDUMP_STACK_WORDS; i++) {
+    printf("%s%#llx", i % 4 ? " " : "\n    ", (unsigned long long)dump.stack[i]);
+  }
+  printf("\n");
+  unlink(COREDUMP_FILE);
+  return 1;
+}
+
+// Each check in is one atomic OR, see what that costs
+static void TimeCheckIn(void)
+{
+  struct timespec start, end;
+  int i, n = 10000000;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (i = 0; i < n; i++) {
+    WatchdogCheckIn(&gWatchdog, i & 31);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  printf("WatchdogCheckIn: %.1f ns each\n",
+         ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / n);
+  atomic_store(&gWatchdog.checkIns, 0);
+}
+
+int main(int argc, char *argv[])
+{
+  pthread_t threads[NUM_DEMO_TASKS];
+  uint64_t start;
+  unsigned i, pets = 0;
+
+  (void)argc;
+  gArgv = argv;
+  if (ReportPreviousDump()) {
+    return 0; // once around is enough for a demo
+  }
+  if (CoreDumpInit(COREDUMP_FILE) != 0) {
+    printf("Could not open %s\n", COREDUMP_FILE);
+    return 1;
+  }
+
+  WatchdogInit(&gWatchdog, Restart);
+  TimeCheckIn();
+  for (i = 0; i < NUM_DEMO_TASKS; i++) {
+    pthread_create(&threads[i], NULL, TaskThread, (void *)&gDemoTasks[i]);
+  }
+  while (atomic_load(&gWatchdog.numTasks) < NUM_DEMO_TASKS) {
+    SleepMs(1);
+  }
+
+  start = NowMs();
+  while (1) {
+    SleepMs(SUPERVISOR_PERIOD_MS);
+    if (!gOutputStuck && NowMs() - start > STUCK_AFTER_MS) {
+      printf("Output task is about to get stuck (after %u healthy pets)\n", pets);
+      gOutputStuck = 1;
+    }
+    if (WatchdogSupervise(&gWatchdog, NowMs())) {
+      pets++; // this is where the hardware watchdog gets pet
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,26 @@
+/*
+ * bus.h
+ *
+ * The interface drivers use to talk over SPI or I2C, so the same driver
+ * code can run on the micro or against the bus simulator (bus_sim.h).
+ *
+ * A transfer writes txLength bytes then reads rxLength bytes, with chip
+ * select held low throughout (SPI), or as a write, a repeated start and a
+ * read (I2C). It is queued behind whatever else is using the bus, and done
+ * is called from the completion interrupt with 0, or -1 if it failed.
+ * Keep tx and rx valid until then.
+ */
+#ifndef BUS_H
+#define BUS_H
+
+#include <stdint.h>
+
+struct sBusDevice;      // one chip on a bus: which bus and chip select or address
+
+typedef void (*BusDone)(void *context, int status);
+
+// Returns 0, or -1 if the bus queue is full (nothing was started)
+int BusTransfer(struct sBusDevice *device, const uint8_t *tx, uint16_t txLength,
+                uint8_t *rx, uint16_t rxLength, BusDone done, void *context);
+
+#endif // BUS_H
@@ -0,0 +1,207 @@
+/*
+ * bus_sim.c
+ *
+ * SPI and I2C bus simulator, see bus_sim.h
+ */
+#include <string.h>
+#include "bus_sim.h"
+
+static void StartNext(struct sBusSim *sim);
+
+void BusSimInit(struct sBusSim *sim, const struct sBusConfig *config)
+{
+  memset(sim, 0, sizeof(*sim));
+  sim->config = *config;
+}
+
+void BusSimAddDevice(struct sBusSim *sim, struct sBusDevice *device, const char *name,
+                     BusRespond respond, void *model)
+{
+  memset(device, 0, sizeof(*device));
+  device->sim = sim;
+  device->name = name;
+  device->respond = respond;
+  device->model = model;
+}
+
+/******************************************************************************************************
+ * Events, a binary heap by time
+*******************************************************************************************************/
+static int Before(const struct sSimEvent *a, const struct sSimEvent *b)
+{
+  return a->at < b->at || (a->at == b->at && (int32_t)(a->order - b->order) < 0);
+}
+
+int BusSimAt(struct sBusSim *sim, uint64_t atNs, void (*function)(void *context), void *context)
+{
+  struct sSimEvent event = { atNs, sim->order++, function, context };
+  uint32_t at = sim->numEvents;
+
+  if (at >= BUS_SIM_MAX_EVENTS) {
+    return -1;
+  }
+  sim->numEvents++;
+  while (at > 0) {
+    uint32_t parent = (at - 1) / 2;
+    if (!Before(&event, &sim->events[parent])) {
+      break;
+    }
+    sim->events[at] = sim->events[parent];
+    at = parent;
+  }
+  sim->events[at] = event;
+  return 0;
+}
+
+static struct sSimEvent PopEvent(struct sBusSim *sim)
+{
+  struct sSimEvent first = sim->events[0];
+  struct sSimEvent last = sim->events[--sim->numEvents];
+  uint32_t at = 0;
+
+  for (;;) {
+    uint32_t child = 2 * at + 1;
+    if (child >= sim->numEvents) {
+      break;
+    }
+    if (child + 1 < sim->numEvents && Before(&sim->events[child + 1], &sim->events[child])) {
+      child++;
+    }
+    if (!Before(&sim->events[child], &last)) {
+      break;
+    }
+    sim->events[at] = sim->events[child];
+    at = child;
+  }
+  sim->events[at] = last;
+  return first;
+}
+
+void BusSimRun(struct sBusSim *sim, uint64_t untilNs)
+{
+  while (sim->numEvents > 0 && sim->events[0].at <= untilNs) {
+    struct sSimEvent event = PopEvent(sim);
+    sim->now = event.at;
+    event.function(event.context);
+  }
+  sim->now = untilNs;
+}
+
+/******************************************************************************************************
+ * The bus
+*******************************************************************************************************/
+static void AddStats(struct sBusStats *stats, const struct sBusRequest *request, uint64_t dataNs,
+                     uint64_t busyNs, uint64_t cpuNs, uint64_t latency)
+{
+  stats->transfers++;
+  stats->bytes += (uint64_t)request->txLength + request->rxLength;
+  stats->dataNs += dataNs;
+  stats->busyNs += busyNs;
+  stats->cpuNs += cpuNs;
+  stats->latencySumNs += latency;
+  if (latency > stats->latencyMaxNs) {
+    stats->latencyMaxNs = latency;
+  }
+}
+
+static void Complete(void *context)
+{
+  struct sBusSim *sim = context;
+  struct sBusRequest request = sim->active;
+  struct sBusDevice *device = request.device;
+  uint64_t busyNs = sim->now - sim->activeBegin, latency = sim->now - request.requestedAt;
+
+  AddStats(&device->stats, &request, sim->activeDataNs, busyNs, sim->activeCpuNs, latency);
+  AddStats(&sim->stats, &request, sim->activeDataNs, busyNs, sim->activeCpuNs, latency);
+  if (device->respond != NULL) {
+    device->respond(device->model, request.tx, request.txLength, request.rx, request.rxLength,
+                    sim->now);
+  } else if (request.rxLength > 0) {
+    memset(request.rx, 0xFF, request.rxLength);
+  }
+  sim->busy = 0;
+  sim->freeAt = sim->now + sim->config.gapNs;
+  if (request.done != NULL) {
+    request.done(request.context, 0);   // may queue the next transfer
+  }
+  StartNext(sim);
+}
+
+// Takes the oldest request off the queue and schedules its completion. If
+// there's no room for that, fails it and tries the next.
+static void StartNext(struct sBusSim *sim)
+{
+  const struct sBusConfig *config = &sim->config;
+  struct sBusRequest *request = &sim->active;
+  double bitNs = 1e9 / config->clockHz;
+  uint32_t bytes, bitsPerByte = config->type == BUS_I2C ? 9 : 8;
+  double byteNs, busyNs, gapPerByte = 0;
+  uint64_t begin, end;
+
+  while (!sim->busy && sim->queueCount > 0) {
+    *request = sim->queue[sim->queueHead];
+    sim->queueHead = (sim->queueHead + 1) % BUS_SIM_QUEUE;
+    sim->queueCount--;
+
+    bytes = (uint32_t)request->txLength + request->rxLength;
+    byteNs = bitsPerByte * bitNs;
+    if (config->type == BUS_SPI) {
+      busyNs = 2.0 * config->selectNs;
+    } else {
+      // start, address, and a repeated start and address again to read, stop
+      uint32_t phases = (request->txLength > 0) + (request->rxLength > 0);
+      busyNs = (phases + 1) * bitNs + phases * byteNs;
+    }
+    gapPerByte = 0;
+    if (config->service == SERVICE_ISR_PER_BYTE) {
+      // the next byte waits for the interrupt to load it (or, I2C, the clock
+      // is stretched) if the interrupt takes longer than a byte
+      if (config->isrNs > byteNs) {
+        gapPerByte = config->isrNs - byteNs;
+      }
+      sim->activeCpuNs = config->startNs + (uint64_t)bytes * config->isrNs;
+    } else {
+      sim->activeCpuNs = config->startNs + config->isrNs;
+    }
+    busyNs += bytes * byteNs + (bytes > 0 ? bytes - 1 : 0) * gapPerByte;
+    sim->activeDataNs = (uint64_t)(bytes * 8 * bitNs + 0.5);
+
+    begin = (sim->now > sim->freeAt ? sim->now : sim->freeAt) + config->startNs;
+    end = begin + (uint64_t)(busyNs + 0.5);
+    if (BusSimAt(sim, end, Complete, sim) == 0) {
+      sim->activeBegin = begin;
+      sim->busy = 1;
+    } else {
+      request->device->stats.failed++;
+      sim->stats.failed++;
+      if (request->done != NULL) {
+        request->done(request->context, -1);   // may queue another, which we get to next
+      }
+    }
+  }
+}
+
+int BusTransfer(struct sBusDevice *device, const uint8_t *tx, uint16_t txLength,
+                uint8_t *rx, uint16_t rxLength, BusDone done, void *context)
+{
+  struct sBusSim *sim = device->sim;
+  struct sBusRequest *request;
+
+  if (sim->queueCount >= BUS_SIM_QUEUE) {
+    device->stats.rejected++;
+    sim->stats.rejected++;
+    return -1;
+  }
+  request = &sim->queue[(sim->queueHead + sim->queueCount) % BUS_SIM_QUEUE];
+  sim->queueCount++;
+  request->device = device;
+  request->tx = tx;
+  request->txLength = txLength;
+  request->rx = rx;
+  request->rxLength = rxLength;
+  request->done = done;
+  request->context = context;
+  request->requestedAt = sim->now;
+  StartNext(sim);
+  return 0;
+}
@@ -0,0 +1,124 @@
+/*
+ * bus_sim.h
+ *
+ * An event driven simulator of an SPI or I2C bus that implements bus.h,
+ * for checking bus budgets like the ones in SPI_clock_calculations.xlsx and
+ * ../Ch08_Externals/Speeds_and_Feeds_Throughput_Calculators.xlsx.
+ *
+ * The spreadsheets divide bytes per second by the clock rate. On a real bus
+ * each transfer also costs:
+ *  - chip select setup and hold, and a minimum gap before the next transfer
+ *    (I2C: start, stop and address bytes, and a ninth bit per byte for ACK)
+ *  - CPU time to start it (driver, peripheral and DMA setup)
+ *  - interrupts: one at the end with a DMA, or one per byte without. With
+ *    one per byte the next byte can't start until the interrupt has loaded
+ *    it, so a slow interrupt leaves gaps between bytes.
+ *
+ * Simulated time is in nanoseconds and jumps from event to event (transfer
+ * completions and whatever the devices and timers schedule with BusSimAt),
+ * so a second of traffic takes milliseconds to run and thousands of
+ * configurations can be tried.
+ *
+ * Devices are modelled by a respond function that sees what was sent and
+ * fills in what is read back, when the transfer completes.
+ *
+ * A transfer's completion is an event too, so it shares BUS_SIM_MAX_EVENTS
+ * with the devices and timers. If they have filled it, the transfer fails:
+ * done gets -1 and it is counted in failed. The stats count transfers when
+ * they complete.
+ */
+#ifndef BUS_SIM_H
+#define BUS_SIM_H
+
+#include <stdint.h>
+#include "bus.h"
+
+#define BUS_SIM_MAX_EVENTS 64
+#define BUS_SIM_QUEUE 32            // transfers waiting for the bus
+
+enum eBusType { BUS_SPI, BUS_I2C };
+enum eBusService { SERVICE_ISR_PER_BYTE, SERVICE_DMA };
+
+struct sBusConfig {
+  enum eBusType type;
+  enum eBusService service;
+  uint32_t clockHz;
+  uint32_t selectNs;        // SPI: chip select to first clock, and last clock to deselect
+  uint32_t gapNs;           // least idle time between transfers
+  uint32_t startNs;         // CPU time to start a transfer
+  uint32_t isrNs;           // CPU time per interrupt, entry and exit included
+};
+
+struct sBusStats {
+  uint32_t transfers;
+  uint32_t rejected;        // queue was full
+  uint32_t failed;          // no room for the completion event: done got -1
+  uint64_t bytes;           // tx + rx, not counting I2C addresses
+  uint64_t dataNs;          // clocking those bytes: what the spreadsheets count
+  uint64_t busyNs;          // bus in use, with selects, addresses and gaps between bytes
+  uint64_t cpuNs;           // starting transfers and interrupts
+  uint64_t latencySumNs;    // asked for to done
+  uint64_t latencyMaxNs;
+};
+
+// Called when a transfer to the device completes: fill rx from tx
+typedef void (*BusRespond)(void *model, const uint8_t *tx, uint16_t txLength, uint8_t *rx,
+                           uint16_t rxLength, uint64_t nowNs);
+
+struct sBusSim;
+
+struct sBusDevice {
+  struct sBusSim *sim;
+  const char *name;
+  BusRespond respond;       // may be NULL: reads return 0xFF
+  void *model;
+  struct sBusStats stats;
+};
+
+struct sBusRequest {
+  struct sBusDevice *device;
+  const uint8_t *tx;
+  uint8_t *rx;
+  uint16_t txLength;
+  uint16_t rxLength;
+  BusDone done;
+  void *context;
+  uint64_t requestedAt;
+};
+
+struct sSimEvent {
+  uint64_t at;
+  uint32_t order;           // same time: first scheduled runs first
+  void (*function)(void *context);
+  void *context;
+};
+
+struct sBusSim {
+  struct sBusConfig config;
+  uint64_t now;
+  uint64_t freeAt;          // when the next transfer may start (after the gap)
+  struct sSimEvent events[BUS_SIM_MAX_EVENTS];   // a heap by time
+  uint32_t numEvents;
+  uint32_t order;
+  struct sBusRequest queue[BUS_SIM_QUEUE];
+  uint32_t queueHead;
+  uint32_t queueCount;
+  struct sBusRequest active;
+  int busy;
+  uint64_t activeBegin;     // the active transfer's figures, added to the stats when it completes
+  uint64_t activeDataNs;
+  uint64_t activeCpuNs;
+  struct sBusStats stats;   // the whole bus
+};
+
+void BusSimInit(struct sBusSim *sim, const struct sBusConfig *config);
+void BusSimAddDevice(struct sBusSim *sim, struct sBusDevice *device, const char *name,
+                     BusRespond respond, void *model);
+
+// Call function(context) at simulated time atNs. Returns 0, or -1 if full.
+int BusSimAt(struct sBusSim *sim, uint64_t atNs, void (*function)(void *context), void *context);
+
+// Runs events until there are none or the next is after untilNs
+void BusSimRun(struct sBusSim *sim, uint64_t untilNs);
+
+#endif // BUS_SIM_H
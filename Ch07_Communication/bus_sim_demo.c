@@ -0,0 +1,471 @@
+/*
+ * bus_sim_demo.c
+ *
+ * The buses in ../Ch08_Externals/SpeedsAndFeedsDiagram.md, simulated with
+ * bus_sim.h: an ADC (4 channels, 16 bits, 44.1 kHz: 352800 bytes/s), the
+ * data store flash (213444 bytes/s with overhead, in 256 byte pages) and a
+ * display (a 240x240 8 bit graph at 30 Hz: 1728000 bytes/s), each on a
+ * 100 MHz SPI bus. The spreadsheet says they use 3%, 2% and 14% of it.
+ *
+ * gcc -O2 bus_sim_demo.c bus_sim.c -o bus_sim_demo
+ * ./bus_sim_demo [simulated ms per what-if]
+ *
+ * The three drivers below only use bus.h, the same as they would on the
+ * micro:
+ *  - ADC: on data ready, read a batch of frames (the ADC streams them out
+ *    with no command). Data ready before the last read finished is an
+ *    overrun: samples lost.
+ *  - flash: for each page of data, read the status register; if the flash
+ *    isn't busy, write enable and program the page, otherwise try again
+ *    with the next one.
+ *  - display: at each refresh, set the window then send the frame in
+ *    chunks. A refresh while still sending the last frame drops a frame.
+ *
+ * Part 1 checks the spreadsheet with an ideal bus (no overheads), Part 2
+ * adds chip select, gaps and CPU time, with a DMA and with an interrupt per
+ * byte, on separate buses, on I2C and on one shared bus. Part 3 tries thousands of
+ * configurations of the shared bus and finds the slowest clock that works.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "bus_sim.h"
+
+#define ADC_RATE 44100
+#define ADC_FRAME_BYTES 8
+#define ADC_MAX_BATCH 64
+#define FLASH_BYTES_PER_SECOND 213444.0
+#define FLASH_PAGE 256
+#define FLASH_PROGRAM_NS 400000     // typical page program, W25Q64JV datasheet
+#define DISPLAY_FRAME (240 * 240)
+#define DISPLAY_HZ 30
+#define WINDOW_BYTES 11             // column and row address commands, then memory write
+
+/******************************************************************************************************
+ * Drivers: bus.h only
+*******************************************************************************************************/
+struct sAdcDriver {
+  struct sBusDevice *device;
+  uint8_t frames[ADC_MAX_BATCH * ADC_FRAME_BYTES];
+  uint16_t batchBytes;
+  int reading;
+  uint32_t batches;
+  uint32_t overruns;
+};
+
+static void AdcReadDone(void *context, int status)
+{
+  struct sAdcDriver *adc = context;
+  adc->reading = 0;
+  if (status == 0) {
+    adc->batches++;
+  }
+}
+
+// ADC data ready interrupt
+static void AdcDataReady(struct sAdcDriver *adc)
+{
+  if (adc->reading || BusTransfer(adc->device, NULL, 0, adc->frames, adc->batchBytes,
+                                  AdcReadDone, adc) != 0) {
+    adc->overruns++;
+    return;
+  }
+  adc->reading = 1;
+}
+
+enum eFlashState { FLASH_IDLE, FLASH_STATUS, FLASH_ENABLE, FLASH_PROGRAM };
+
+#define FLASH_READ_STATUS 0x05
+#define FLASH_WRITE_ENABLE 0x06
+#define FLASH_PAGE_PROGRAM 0x02
+#define FLASH_STATUS_BUSY 0x01
+
+struct sFlashDriver {
+  struct sBusDevice *device;
+  enum eFlashState state;
+  uint8_t command;
+  uint8_t status;
+  uint8_t page[4 + FLASH_PAGE];     // command, address, data
+  uint32_t address;
+  uint32_t pending;                 // pages waiting to be written
+  uint32_t written;
+  uint32_t foundBusy;
+};
+
+static void FlashStep(void *context, int status);
+
+static void FlashStartNext(struct sFlashDriver *flash)
+{
+  if (flash->state != FLASH_IDLE || flash->pending == 0) {
+    return;
+  }
+  flash->state = FLASH_STATUS;
+  flash->command = FLASH_READ_STATUS;
+  BusTransfer(flash->device, &flash->command, 1, &flash->status, 1, FlashStep, flash);
+}
+
+static void FlashStep(void *context, int status)
+{
+  struct sFlashDriver *flash = context;
+
+  (void)status;
+  switch (flash->state) {
+  case FLASH_STATUS:
+    if (flash->status & FLASH_STATUS_BUSY) {
+      flash->foundBusy++;
+      flash->state = FLASH_IDLE;    // try again with the next page
+      break;
+    }
+    flash->state = FLASH_ENABLE;
+    flash->command = FLASH_WRITE_ENABLE;
+    BusTransfer(flash->device, &flash->command, 1, NULL, 0, FlashStep, flash);
+    break;
+  case FLASH_ENABLE:
+    flash->state = FLASH_PROGRAM;
+    flash->page[0] = FLASH_PAGE_PROGRAM;
+    flash->page[1] = (uint8_t)(flash->address >> 16);
+    flash->page[2] = (uint8_t)(flash->address >> 8);
+    flash->page[3] = (uint8_t)flash->address;
+    BusTransfer(flash->device, flash->page, sizeof(flash->page), NULL, 0, FlashStep, flash);
+    break;
+  case FLASH_PROGRAM:
+    flash->written++;
+    flash->pending--;
+    flash->address += FLASH_PAGE;
+    flash->state = FLASH_IDLE;
+    FlashStartNext(flash);
+    break;
+  case FLASH_IDLE:
+    break;
+  }
+}
+
+// A page of data is ready to store
+static void FlashPageReady(struct sFlashDriver *flash)
+{
+  flash->pending++;
+  FlashStartNext(flash);
+}
+
+struct sDisplayDriver {
+  struct sBusDevice *device;
+  const uint8_t *frame;
+  uint8_t window[WINDOW_BYTES];
+  uint32_t chunk;
+  uint32_t sent;
+  int sending;
+  uint32_t frames;
+  uint32_t dropped;
+};
+
+static void DisplaySendMore(void *context, int status)
+{
+  struct sDisplayDriver *display = context;
+  uint32_t n = DISPLAY_FRAME - display->sent;
+
+  (void)status;
+  if (n == 0) {
+    display->sending = 0;
+    display->frames++;
+    return;
+  }
+  if (n > display->chunk) {
+    n = display->chunk;
+  }
+  BusTransfer(display->device, display->frame + display->sent, (uint16_t)n, NULL, 0,
+              DisplaySendMore, display);
+  display->sent += n;
+}
+
+// Refresh timer
+static void DisplayRefresh(struct sDisplayDriver *display)
+{
+  if (display->sending) {
+    display->dropped++;
+    return;
+  }
+  display->sending = 1;
+  display->sent = 0;
+  BusTransfer(display->device, display->window, WINDOW_BYTES, NULL, 0, DisplaySendMore, display);
+}
+
+/******************************************************************************************************
+ * Device models and timers
+*******************************************************************************************************/
+struct sFlashModel {
+  uint64_t busyUntil;
+};
+
+static void FlashRespond(void *model, const uint8_t *tx, uint16_t txLength, uint8_t *rx,
+                         uint16_t rxLength, uint64_t nowNs)
+{
+  struct sFlashModel *flash = model;
+
+  if (txLength > 0 && tx[0] == FLASH_PAGE_PROGRAM) {
+    flash->busyUntil = nowNs + FLASH_PROGRAM_NS;
+  } else if (txLength > 0 && tx[0] == FLASH_READ_STATUS && rxLength > 0) {
+    rx[0] = nowNs < flash->busyUntil ? FLASH_STATUS_BUSY : 0;
+  }
+}
+
+static void AdcRespond(void *model, const uint8_t *tx, uint16_t txLength, uint8_t *rx,
+                       uint16_t rxLength, uint64_t nowNs)
+{
+  uint32_t *sample = model;
+  uint16_t i;
+
+  (void)tx;
+  (void)txLength;
+  (void)nowNs;
+  for (i = 0; i < rxLength; i++) {
+    rx[i] = (uint8_t)(*sample)++;
+  }
+}
+
+// Calls tick(context) from time 0, every periodNs, which needn't be a whole number
+struct sPeriodic {
+  struct sBusSim *sim;
+  double periodNs;
+  uint64_t count;
+  void (*tick)(void *context);
+  void *context;
+};
+
+static void PeriodicFire(void *context)
+{
+  struct sPeriodic *timer = context;
+
+  timer->count++;
+  BusSimAt(timer->sim, (uint64_t)(timer->count * timer->periodNs), PeriodicFire, timer);
+  timer->tick(timer->context);
+}
+
+static void PeriodicStart(struct sPeriodic *timer, struct sBusSim *sim, double periodNs,
+                          void (*tick)(void *context), void *context)
+{
+  timer->sim = sim;
+  timer->periodNs = periodNs;
+  timer->count = 0;
+  timer->tick = tick;
+  timer->context = context;
+  BusSimAt(sim, 0, PeriodicFire, timer);
+}
+
+/******************************************************************************************************
+ * The system
+*******************************************************************************************************/
+enum eDevice { DEVICE_ADC, DEVICE_FLASH, DEVICE_DISPLAY, NUM_DEVICES };
+static const char *const kDeviceNames[NUM_DEVICES] = { "ADC", "flash", "display" };
+static const double kSpreadsheetPercent[NUM_DEVICES] = { 2.8224, 1.707552, 13.824 };
+
+static uint8_t gDisplayFrame[DISPLAY_FRAME];
+
+struct sSystem {
+  struct sBusSim sims[NUM_DEVICES];     // one each, or all on sims[0]
+  struct sBusDevice devices[NUM_DEVICES];
+  struct sAdcDriver adc;
+  struct sFlashDriver flash;
+  struct sDisplayDriver display;
+  struct sFlashModel flashModel;
+  uint32_t adcSample;
+  struct sPeriodic timers[NUM_DEVICES];
+  int numSims;
+  uint64_t elapsedNs;
+};
+
+static void AdcTick(void *context) { AdcDataReady(context); }
+static void FlashTick(void *context) { FlashPageReady(context); }
+static void DisplayTick(void *context) { DisplayRefresh(context); }
+
+static void SystemRun(struct sSystem *system, const struct sBusConfig *config, int shared,
+                      uint32_t adcBatch, uint32_t displayChunk, uint64_t runNs)
+{
+  struct sBusSim *sims[NUM_DEVICES];
+  int i;
+
+  memset(system, 0, sizeof(*system));
+  system->numSims = shared ? 1 : NUM_DEVICES;
+  for (i = 0; i < NUM_DEVICES; i++) {
+    sims[i] = &system->sims[shared ? 0 : i];
+    if (i < system->numSims) {
+      BusSimInit(&system->sims[i], config);
+    }
+  }
+  BusSimAddDevice(sims[DEVICE_ADC], &system->devices[DEVICE_ADC], kDeviceNames[DEVICE_ADC],
+                  AdcRespond, &system->adcSample);
+  BusSimAddDevice(sims[DEVICE_FLASH], &system->devices[DEVICE_FLASH], kDeviceNames[DEVICE_FLASH],
+                  FlashRespond, &system->flashModel);
+  BusSimAddDevice(sims[DEVICE_DISPLAY], &system->devices[DEVICE_DISPLAY],
+                  kDeviceNames[DEVICE_DISPLAY], NULL, NULL);
+
+  system->adc.device = &system->devices[DEVICE_ADC];
+  system->adc.batchBytes = (uint16_t)(adcBatch * ADC_FRAME_BYTES);
+  system->flash.device = &system->devices[DEVICE_FLASH];
+  system->display.device = &system->devices[DEVICE_DISPLAY];
+  system->display.frame = gDisplayFrame;
+  system->display.chunk = displayChunk;
+
+  PeriodicStart(&system->timers[DEVICE_ADC], sims[DEVICE_ADC], 1e9 * adcBatch / ADC_RATE,
+                AdcTick, &system->adc);
+  PeriodicStart(&system->timers[DEVICE_FLASH], sims[DEVICE_FLASH],
+                1e9 * FLASH_PAGE / FLASH_BYTES_PER_SECOND, FlashTick, &system->flash);
+  PeriodicStart(&system->timers[DEVICE_DISPLAY], sims[DEVICE_DISPLAY], 1e9 / DISPLAY_HZ,
+                DisplayTick, &system->display);
+
+  for (i = 0; i < system->numSims; i++) {
+    BusSimRun(&system->sims[i], runNs);
+  }
+  system->elapsedNs = runNs;
+}
+
+// Keeping up: no ADC samples or display frames lost, the flash not falling
+// behind, and the CPU at most half busy with the buses
+static int SystemWorks(const struct sSystem *system)
+{
+  uint64_t cpuNs = 0;
+  int i;
+
+  for (i = 0; i < system->numSims; i++) {
+    cpuNs += system->sims[i].stats.cpuNs;
+  }
+  return system->adc.overruns == 0 && system->display.dropped == 0 && system->flash.pending <= 2 &&
+         cpuNs * 2 <= system->elapsedNs;
+}
+
+static double Percent(uint64_t ns, uint64_t elapsedNs)
+{
+  return 100.0 * (double)ns / (double)elapsedNs;
+}
+
+static void PrintSystem(const char *title, const struct sSystem *system)
+{
+  int i;
+
+  printf("%s\n", title);
+  printf("  device    data %%  sheet %%   busy %%    CPU %%   mean/max latency      lost\n");
+  for (i = 0; i < NUM_DEVICES; i++) {
+    const struct sBusStats *stats = &system->devices[i].stats;
+    uint32_t lost = i == DEVICE_ADC ? system->adc.overruns
+                  : i == DEVICE_DISPLAY ? system->display.dropped : system->flash.pending;
+    printf("  %-7s %7.3f %8.3f %8.3f %8.3f %8.1f/%8.1f us %6u%s\n", kDeviceNames[i],
+           Percent(stats->dataNs, system->elapsedNs), kSpreadsheetPercent[i],
+           Percent(stats->busyNs, system->elapsedNs), Percent(stats->cpuNs, system->elapsedNs),
+           stats->transfers ? stats->latencySumNs / 1e3 / stats->transfers : 0.0,
+           stats->latencyMaxNs / 1e3, lost,
+           i == DEVICE_ADC ? " overruns" : i == DEVICE_DISPLAY ? " frames" : " pages behind");
+  }
+  if (system->numSims == 1) {
+    const struct sBusStats *stats = &system->sims[0].stats;
+    printf("  shared  %7.3f %8.3f %8.3f %8.3f\n", Percent(stats->dataNs, system->elapsedNs),
+           kSpreadsheetPercent[0] + kSpreadsheetPercent[1] + kSpreadsheetPercent[2],
+           Percent(stats->busyNs, system->elapsedNs), Percent(stats->cpuNs, system->elapsedNs));
+  }
+  printf("\n");
+}
+
+/******************************************************************************************************
+ * Part 3: what if
+*******************************************************************************************************/
+static void WhatIf(uint64_t runNs)
+{
+  static const uint32_t clocksKHz[] = { 1000, 2000, 4000, 5000, 8000, 10000, 12500, 16000, 20000,
+                                        25000, 32000, 40000, 50000, 64000, 80000, 100000 };
+  static const uint32_t isrNs[] = { 200, 400, 800 };
+  static const uint32_t batches[] = { 1, 4, 16, 64 };
+  static const uint32_t chunks[] = { 240, 960, 3840, 57600 };
+  static const uint32_t gaps[] = { 0, 100, 1000 };
+  static struct sSystem system;
+  struct sBusConfig config = { BUS_SPI, SERVICE_DMA, 0, 20, 0, 500, 0 };
+  uint32_t tried = 0, working = 0, s, i, b, c, g, k;
+  uint64_t events = 0;
+  struct timespec start, end;
+  double seconds;
+  // slowest working clock by service, interrupt time and batch, with a gap of 100 ns
+  uint32_t best[2][3][4], bestChunk[2][3][4];
+
+  memset(best, 0, sizeof(best));
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (s = 0; s < 2; s++) {
+    config.service = s == 0 ? SERVICE_ISR_PER_BYTE : SERVICE_DMA;
+    for (i = 0; i < 3; i++) {
+      config.isrNs = isrNs[i];
+      for (b = 0; b < 4; b++) {
+        for (c = 0; c < 4; c++) {
+          for (g = 0; g < 3; g++) {
+            config.gapNs = gaps[g];
+            for (k = 0; k < sizeof(clocksKHz) / sizeof(clocksKHz[0]); k++) {
+              int works;
+              config.clockHz = clocksKHz[k] * 1000u;
+              SystemRun(&system, &config, 1, batches[b], chunks[c], runNs);
+              events += system.sims[0].order;
+              tried++;
+              works = SystemWorks(&system);
+              working += (uint32_t)works;
+              if (works && gaps[g] == 100 && (best[s][i][b] == 0 || clocksKHz[k] < best[s][i][b])) {
+                best[s][i][b] = clocksKHz[k];
+                bestChunk[s][i][b] = chunks[c];
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+  printf("Part 3: %u shared bus configurations of %.0f ms each in %.2f s (%.0f events/s), %u work\n",
+         tried, runNs / 1e6, seconds, events / seconds, working);
+  printf("  slowest clock that keeps up, MHz (display chunk bytes), gap 100 ns\n");
+  printf("  service    interrupt  batch 1          batch 4          batch 16         batch 64\n");
+  for (s = 0; s < 2; s++) {
+    for (i = 0; i < 3; i++) {
+      printf("  %-10s %6u ns", s == 0 ? "per byte" : "DMA", isrNs[i]);
+      for (b = 0; b < 4; b++) {
+        if (best[s][i][b] == 0) {
+          printf("  %-15s", "none");
+        } else {
+          char cell[32];
+          snprintf(cell, sizeof(cell), "%g (%u)", best[s][i][b] / 1000.0, bestChunk[s][i][b]);
+          printf("  %-15s", cell);
+        }
+      }
+      printf("\n");
+    }
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  uint64_t whatIfNs = (uint64_t)(argc > 1 ? atoi(argv[1]) : 100) * 1000000u;
+  static struct sSystem system;
+  struct sBusConfig ideal = { BUS_SPI, SERVICE_DMA, 100000000, 0, 0, 0, 0 };
+  struct sBusConfig dma = { BUS_SPI, SERVICE_DMA, 100000000, 20, 100, 500, 400 };
+  struct sBusConfig perByte = dma, i2c = dma;
+
+  perByte.service = SERVICE_ISR_PER_BYTE;
+  i2c.type = BUS_I2C;
+  i2c.clockHz = 3400000;
+  i2c.gapNs = 160;                  // bus free time between stop and start
+
+  SystemRun(&system, &ideal, 0, 1, 240, 1000000000u);
+  PrintSystem("Part 1: 1 s on three ideal 100 MHz SPI buses (DMA, no overheads), ADC read every sample",
+              &system);
+
+  SystemRun(&system, &dma, 0, 1, 240, 1000000000u);
+  PrintSystem("Part 2: chip select 20 ns, gap 100 ns, 500 ns to start a transfer, 400 ns interrupts\n"
+              "DMA, three buses", &system);
+  SystemRun(&system, &perByte, 0, 1, 240, 1000000000u);
+  PrintSystem("interrupt per byte, three buses", &system);
+  SystemRun(&system, &i2c, 0, 16, 240, 1000000000u);
+  PrintSystem("I2C at 3.4 MHz (high speed mode), DMA, three buses, ADC read 16 samples at a time",
+              &system);
+  SystemRun(&system, &dma, 1, 1, 240, 1000000000u);
+  PrintSystem("DMA, one shared bus, display in 240 byte rows", &system);
+  SystemRun(&system, &dma, 1, 1, DISPLAY_FRAME, 1000000000u);
+  PrintSystem("DMA, one shared bus, display frame in one transfer", &system);
+
+  WhatIf(whatIfNs);
+  return 0;
+}
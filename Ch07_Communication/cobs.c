@@ -0,0 +1,292 @@
+/*
+ * cobs.c
+ *
+ * COBS framing, see cobs.h
+ *
+ * The encoder copies runs of non-zero bytes with memchr and memmove
+ * rather than a byte at a time, going back to fill in each run's code byte
+ * when it finds the zero (or 254 bytes) that ends it. The same encoder
+ * writes to a flat buffer or into the ring, wrapping at its end.
+ */
+#include <string.h>
+#include "cobs.h"
+
+#define MAX_RUN 254     // data bytes in a block with no zero, code 0xFF
+
+struct sCobsOut {
+  uint8_t *buffer;
+  size_t mask;          // SIZE_MAX for a flat buffer, the ring's mask for a ring
+  size_t at;            // next byte to write
+  size_t codeAt;        // where the current block's code byte goes
+  size_t run;           // data bytes in the current block so far
+};
+
+static void Put(struct sCobsOut *out, const uint8_t *data, size_t n)
+{
+  size_t offset = out->at & out->mask;
+
+  if (n <= out->mask - offset) {
+    memmove(out->buffer + offset, data, n);   // memmove: encoding in place overlaps
+  } else {
+    size_t first = out->mask - offset + 1;
+    memcpy(out->buffer + offset, data, first);
+    memcpy(out->buffer, data + first, n - first);
+  }
+  out->at += n;
+}
+
+static void StartBlock(struct sCobsOut *out)
+{
+  out->codeAt = out->at++;
+  out->run = 0;
+}
+
+static void EndBlock(struct sCobsOut *out)
+{
+  out->buffer[out->codeAt & out->mask] = (uint8_t)(out->run + 1);
+}
+
+// Where the first zero is in data, or length if none. Runs are often
+// short (sensor readings with zeros in them), so the first 8 bytes are
+// tested as one word before paying for a call to memchr: the lowest byte
+// flagged by (w - 0x01..) & ~w & 0x80.. is the first zero. Little endian.
+static size_t FirstZero(const uint8_t *data, size_t length)
+{
+  const uint8_t *zero;
+
+  if (length >= 8) {
+    uint64_t w, flags;
+    memcpy(&w, data, 8);
+    flags = (w - 0x0101010101010101u) & ~w & 0x8080808080808080u;
+    if (flags != 0) {
+      return (size_t)__builtin_ctzll(flags) / 8;
+    }
+    if (length == 8) {
+      return 8;
+    }
+  }
+  zero = memchr(data, COBS_DELIMITER, length);
+  return zero != NULL ? (size_t)(zero - data) : length;
+}
+
+static void Encode(struct sCobsOut *out, const uint8_t *data, size_t length)
+{
+  while (length > 0) {
+    size_t room = MAX_RUN - out->run;
+    size_t block = length < room ? length : room;
+    size_t n = FirstZero(data, block);
+
+    Put(out, data, n);
+    out->run += n;
+    data += n;
+    length -= n;
+    if (n < block) {
+      // the zero is the one the code byte stands for
+      data++;
+      length--;
+      EndBlock(out);
+      StartBlock(out);
+    } else if (out->run == MAX_RUN) {
+      EndBlock(out);
+      StartBlock(out);
+    }
+  }
+}
+
+size_t CobsEncode(const uint8_t *in, size_t length, uint8_t *out)
+{
+  struct sCobsOut o = { out, SIZE_MAX, 0, 0, 0 };
+
+  StartBlock(&o);
+  Encode(&o, in, length);
+  EndBlock(&o);
+  return o.at;
+}
+
+int32_t CobsDecode(const uint8_t *in, size_t length, uint8_t *out)
+{
+  const uint8_t *end = in + length;
+  uint8_t *start = out;
+
+  while (in < end) {
+    uint8_t code = *in++;
+    size_t run = (size_t)code - 1;
+    if (code == COBS_DELIMITER || run > (size_t)(end - in) || memchr(in, COBS_DELIMITER, run) != NULL) {
+      return -1;
+    }
+    memmove(out, in, run);
+    out += run;
+    in += run;
+    if (code != MAX_RUN + 1 && in < end) {
+      *out++ = 0;
+    }
+  }
+  return (int32_t)(out - start);
+}
+
+/******************************************************************************************************
+ * Frames on the SPSC ring
+*******************************************************************************************************/
+int CobsWriteFrame(struct sSpscRing *ring, const struct sCrc *crc, const void *payload,
+                   size_t length)
+{
+  uint32_t check = CrcCompute(crc, payload, length);
+  uint8_t trailer[4] = { (uint8_t)check, (uint8_t)(check >> 8), (uint8_t)(check >> 16),
+                         (uint8_t)(check >> 24) };
+  size_t trailerLength = crc->model->width / 8u;
+  struct sCobsOut out;
+  uint32_t tail;
+
+  // worst case, so the frame can be written without checking as it goes
+  if (SpscWriteAvailable(ring) < COBS_MAX_ENCODED(length + trailerLength) + 1) {
+    return -1;
+  }
+  tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  out.buffer = ring->buffer;
+  out.mask = ring->mask;
+  out.at = tail;
+  StartBlock(&out);
+  Encode(&out, payload, length);
+  Encode(&out, trailer, trailerLength);
+  EndBlock(&out);
+  out.buffer[out.at++ & out.mask] = COBS_DELIMITER;
+  // the consumer sees all of the frame or none of it
+  SpscWriteCommit(ring, (uint32_t)(out.at - tail));
+  return 0;
+}
+
+void CobsDecoderInit(struct sCobsDecoder *decoder, const struct sCrc *crc, uint8_t *frame,
+                     size_t capacity, CobsDeliver deliver, void *context)
+{
+  memset(decoder, 0, sizeof(*decoder));
+  decoder->crc = crc;
+  decoder->frame = frame;
+  decoder->capacity = capacity;
+  decoder->deliver = deliver;
+  decoder->context = context;
+}
+
+static void NewFrame(struct sCobsDecoder *decoder)
+{
+  decoder->length = 0;
+  decoder->code = 0;
+  decoder->remaining = 0;
+  decoder->discarding = 0;
+}
+
+// Gives up on the frame: everything up to the next delimiter is skipped
+static void Discard(struct sCobsDecoder *decoder)
+{
+  decoder->malformed++;
+  decoder->discardedBytes += decoder->length;
+  decoder->discarding = 1;
+}
+
+static int Append(struct sCobsDecoder *decoder, const uint8_t *data, size_t n)
+{
+  if (n > decoder->capacity - decoder->length) {
+    Discard(decoder);
+    return -1;
+  }
+  memcpy(decoder->frame + decoder->length, data, n);
+  decoder->length += n;
+  return 0;
+}
+
+// A delimiter after a complete block
+static void EndFrame(struct sCobsDecoder *decoder)
+{
+  size_t trailerLength = decoder->crc->model->width / 8u, payload, i;
+  uint32_t expected = 0;
+
+  if (decoder->code == 0) {
+    NewFrame(decoder);                // two delimiters in a row: an idle line
+    return;
+  }
+  if (decoder->length < trailerLength) {
+    decoder->malformed++;
+    decoder->discardedBytes += decoder->length;
+    NewFrame(decoder);
+    return;
+  }
+  payload = decoder->length - trailerLength;
+  for (i = 0; i < trailerLength; i++) {
+    expected |= (uint32_t)decoder->frame[payload + i] << (8 * i);
+  }
+  if (CrcCompute(decoder->crc, decoder->frame, payload) == expected) {
+    decoder->frames++;
+    decoder->deliver(decoder->context, decoder->frame, payload);
+  } else {
+    decoder->badCrc++;
+    decoder->discardedBytes += decoder->length;
+  }
+  NewFrame(decoder);
+}
+
+void CobsDecoderFeed(struct sCobsDecoder *decoder, const uint8_t *data, size_t length)
+{
+  while (length > 0) {
+    if (decoder->discarding) {
+      const uint8_t *zero = memchr(data, COBS_DELIMITER, length);
+      size_t skipped = zero != NULL ? (size_t)(zero - data) + 1 : length;
+      decoder->discardedBytes += skipped;
+      data += skipped;
+      length -= skipped;
+      if (zero != NULL) {
+        NewFrame(decoder);            // back in step
+      }
+    } else if (decoder->remaining == 0) {
+      // a code byte, or the end of the frame
+      uint8_t code = *data++;
+      length--;
+      if (code == COBS_DELIMITER) {
+        EndFrame(decoder);
+        continue;
+      }
+      if (decoder->code != 0 && decoder->code != MAX_RUN + 1) {
+        static const uint8_t zero = 0;
+        if (Append(decoder, &zero, 1) != 0) {
+          continue;
+        }
+      }
+      decoder->code = code;
+      decoder->remaining = (uint8_t)(code - 1);
+    } else {
+      size_t n = length < decoder->remaining ? length : decoder->remaining;
+      const uint8_t *zero = memchr(data, COBS_DELIMITER, n);
+      if (zero != NULL) {
+        // a delimiter in the middle of a block: bytes were lost. The frame
+        // is no good, but a new one starts right after the delimiter.
+        size_t before = (size_t)(zero - data);
+        decoder->malformed++;
+        decoder->discardedBytes += decoder->length + before + 1;
+        NewFrame(decoder);
+        data += before + 1;
+        length -= before + 1;
+        continue;
+      }
+      if (Append(decoder, data, n) != 0) {
+        continue;
+      }
+      decoder->remaining = (uint8_t)(decoder->remaining - n);
+      data += n;
+      length -= n;
+    }
+  }
+}
+
+size_t CobsReadFrames(struct sSpscRing *ring, struct sCobsDecoder *decoder)
+{
+  size_t total = 0;
+
+  for (;;) {
+    uint32_t span;
+    const uint8_t *data = SpscReadSpan(ring, &span);
+    if (span == 0) {
+      return total;
+    }
+    CobsDecoderFeed(decoder, data, span);
+    SpscReadRelease(ring, span);
+    total += span;
+  }
+}
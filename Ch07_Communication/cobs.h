@@ -0,0 +1,84 @@
+/*
+ * cobs.h
+ *
+ * Consistent Overhead Byte Stuffing: framing for serial links. The encoder
+ * removes every 0x00 from a packet, so 0x00 can mark the end of each frame.
+ * A receiver that starts listening part way through, or loses or mangles
+ * bytes, just waits for the next 0x00 and is back in step.
+ *
+ * Each 0x00 is replaced by a code byte giving the distance to the next one,
+ * with an extra code byte every 254 bytes that have no zeros, so the
+ * overhead is at most one byte in 254 plus the code at the start and the
+ * delimiter at the end, whatever the data. (Escaping with SLIP or HDLC
+ * doubles a packet of the unlucky bytes.)
+ *
+ * Two ways to use it:
+ *
+ *  - Buffers. CobsEncode and CobsDecode; both can work in place. To encode
+ *    in place, put the packet COBS_OVERHEAD(length) bytes into the buffer and
+ *    encode to the start of it: the output never catches up with the input.
+ *    Decoding in place just needs out == in.
+ *
+ *  - Frames on the SPSC ring (spsc_ring.h), for a UART interrupt or DMA on
+ *    the other side. CobsWriteFrame encodes a packet and a CRC (crc.h in
+ *    ../Ch10_Connected) straight into the ring and commits the whole frame
+ *    at once. A decoder reads the ring's spans straight into its frame
+ *    buffer, checks the CRC at each 0x00 and calls back with good packets.
+ */
+#ifndef COBS_H
+#define COBS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "spsc_ring.h"
+#include "crc.h"
+
+#define COBS_DELIMITER 0x00
+#define COBS_OVERHEAD(length) ((length) / 254 + 1)   // code bytes, not counting the delimiter
+#define COBS_MAX_ENCODED(length) ((length) + COBS_OVERHEAD(length))
+
+// Returns the encoded length, without a delimiter (add one yourself)
+size_t CobsEncode(const uint8_t *in, size_t length, uint8_t *out);
+
+// in is one frame without its delimiter. Returns the decoded length, or -1
+// if it isn't valid COBS (a 0x00 inside, or a code going past the end).
+int32_t CobsDecode(const uint8_t *in, size_t length, uint8_t *out);
+
+/******************************************************************************************************
+ * Frames on the SPSC ring
+*******************************************************************************************************/
+// Encodes payload then crc's CRC of it (little endian, 1 to 4 bytes by the
+// CRC's width), then the delimiter. Returns 0, or -1 if the frame didn't
+// fit in the ring (nothing is written; try again when there is room).
+int CobsWriteFrame(struct sSpscRing *ring, const struct sCrc *crc, const void *payload,
+                   size_t length);
+
+typedef void (*CobsDeliver)(void *context, const uint8_t *payload, size_t length);
+
+struct sCobsDecoder {
+  const struct sCrc *crc;
+  uint8_t *frame;             // decoded payload and CRC go here
+  size_t capacity;
+  size_t length;
+  uint8_t code;               // the code byte for this block
+  uint8_t remaining;          // bytes left in the block, 0 when a code byte is next
+  uint8_t discarding;         // something was wrong, skip to the next delimiter
+  CobsDeliver deliver;
+  void *context;
+  // counts
+  uint32_t frames;            // delivered
+  uint32_t badCrc;
+  uint32_t malformed;         // bad COBS, too short for a CRC, or too long for frame
+  uint64_t discardedBytes;
+};
+
+void CobsDecoderInit(struct sCobsDecoder *decoder, const struct sCrc *crc, uint8_t *frame,
+                     size_t capacity, CobsDeliver deliver, void *context);
+
+// Decodes bytes as they arrive, calling deliver for each good frame
+void CobsDecoderFeed(struct sCobsDecoder *decoder, const uint8_t *data, size_t length);
+
+// Feeds everything waiting in the ring to the decoder. Returns bytes read.
+size_t CobsReadFrames(struct sSpscRing *ring, struct sCobsDecoder *decoder);
+
+#endif // COBS_H
@@ -0,0 +1,316 @@
+/*
+ * cobs_bench.c
+ *
+ * Checks COBS (cobs.h), measures how fast it goes and how much it adds,
+ * then streams frames through a noisy link to see the decoder find its way
+ * back after damage.
+ *
+ * gcc -O2 -I../Ch10_Connected cobs_bench.c cobs.c ../Ch10_Connected/crc.c -o cobs_bench
+ * ./cobs_bench [MB per measurement]
+ *
+ * Checks: random packets of every length up to 1000 and some long ones
+ * encode and decode back, in place as well, with no 0x00 in the encoding and
+ * never more than COBS_OVERHEAD bytes added.
+ *
+ * Overhead: the worst case is a packet with no zeros (a code byte every 254
+ * bytes); a packet of all zeros costs one byte. Random bytes are in between.
+ *
+ * Speed, for three kinds of data: random bytes (a zero every 256 bytes or
+ * so, so long copies), no zeros at all (the longest copies), and sensor
+ * style data with a zero in every 8 bytes or so (short copies, the most code
+ * bytes), which is the hard case for the memchr and memcpy approach.
+ *
+ * The link: frames with a sequence number and a CRC go into a ring,
+ * through a "wire" that flips bits, drops bytes and adds junk, into a
+ * second ring and the streaming decoder. Every delivered packet is checked
+ * against what was sent, so any damage the CRC missed would show up.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cobs.h"
+
+#define BIG 65536
+#define RING_BYTES 4096u
+#define MAX_PACKET 300
+
+enum eData { DATA_RANDOM, DATA_NO_ZEROS, DATA_SENSOR, NUM_DATA };
+static const char *kDataNames[NUM_DATA] = { "random", "no zeros", "zero in 8" };
+
+static uint8_t gData[NUM_DATA][BIG];
+static uint8_t gEncoded[COBS_MAX_ENCODED(BIG)];
+static uint8_t gDecoded[BIG + COBS_OVERHEAD(BIG)];
+static uint32_t gSeed = 1;
+
+static uint32_t Random(void)
+{
+  gSeed = gSeed * 1664525u + 1013904223u;
+  return gSeed >> 8;
+}
+
+static uint64_t NowNs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static int RoundTrip(const uint8_t *packet, size_t length)
+{
+  size_t encoded = CobsEncode(packet, length, gEncoded);
+  size_t overhead = COBS_OVERHEAD(length);
+  int32_t decoded;
+
+  if (encoded > length + overhead || memchr(gEncoded, 0, encoded) != NULL) {
+    return -1;
+  }
+  decoded = CobsDecode(gEncoded, encoded, gDecoded);
+  if (decoded != (int32_t)length || memcmp(gDecoded, packet, length) != 0) {
+    return -1;
+  }
+  // in place both ways
+  memcpy(gDecoded + overhead, packet, length);
+  if (CobsEncode(gDecoded + overhead, length, gDecoded) != encoded ||
+      memcmp(gDecoded, gEncoded, encoded) != 0) {
+    return -1;
+  }
+  decoded = CobsDecode(gDecoded, encoded, gDecoded);
+  if (decoded != (int32_t)length || memcmp(gDecoded, packet, length) != 0) {
+    return -1;
+  }
+  return 0;
+}
+
+static int Check(void)
+{
+  static const uint8_t bad[][3] = { { 0x03, 0x11, 0x00 }, { 0x05, 0x11, 0x22 } };
+  enum eData kind;
+  int problems = 0;
+  size_t length, i;
+
+  for (kind = 0; kind < NUM_DATA; kind++) {
+    for (length = 0; length <= 1000; length++) {
+      problems += RoundTrip(gData[kind] + (length & 7), length) != 0;
+    }
+    for (i = 0; i < 50; i++) {
+      length = Random() % (BIG - 8);
+      problems += RoundTrip(gData[kind] + (i & 7), length) != 0;
+    }
+  }
+  // lengths around the 254 byte blocks, with and without a zero at the end
+  memset(gData[NUM_DATA - 1] + BIG - 1024, 0x55, 1024);
+  for (length = 250; length < 770; length++) {
+    uint8_t *packet = gData[NUM_DATA - 1] + BIG - 1024;
+    packet[length - 1] = 0;
+    problems += RoundTrip(packet, length) != 0;
+    packet[length - 1] = 0x55;
+    problems += RoundTrip(packet, length) != 0;
+  }
+  // a zero inside, and a code past the end
+  for (i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+    problems += CobsDecode(bad[i], sizeof(bad[i]), gDecoded) != -1;
+  }
+  return problems;
+}
+
+static void Overhead(void)
+{
+  static const size_t kLengths[] = { 16, 64, 253, 254, 255, 1500, 4096, BIG };
+  static uint8_t nonzero[BIG], zeros[BIG];
+  size_t i;
+
+  memset(nonzero, 0xA5, sizeof(nonzero));
+  printf("Overhead, bytes added (not counting the delimiter)\n");
+  printf("  %8s %10s %10s %10s %10s\n", "length", "no zeros", "all zeros", "random", "formula");
+  for (i = 0; i < sizeof(kLengths) / sizeof(kLengths[0]); i++) {
+    size_t length = kLengths[i];
+    printf("  %8zu %10zu %10zu %10zu %10zu\n", length,
+           CobsEncode(nonzero, length, gEncoded) - length,
+           CobsEncode(zeros, length, gEncoded) - length,
+           CobsEncode(gData[DATA_RANDOM], length, gEncoded) - length,
+           (size_t)COBS_OVERHEAD(length));
+  }
+  printf("  (worst case %.2f%% on long packets; escaping as SLIP does could be 100%%)\n\n",
+         100.0 / 254);
+}
+
+// Returns MB/s of packet bytes
+static double Measure(enum eData kind, size_t length, size_t totalBytes, int decode)
+{
+  size_t rounds = totalBytes / length, encoded, i;
+  uint64_t start, elapsed;
+  uint32_t sink = 0;
+
+  encoded = CobsEncode(gData[kind], length, gEncoded);
+  start = NowNs();
+  for (i = 0; i < rounds; i++) {
+    if (decode) {
+      sink += (uint32_t)CobsDecode(gEncoded, encoded, gDecoded);
+    } else {
+      sink += (uint32_t)CobsEncode(gData[kind] + (i & 7), length, gEncoded + 8);
+    }
+  }
+  elapsed = NowNs() - start;
+  if (sink == 1) {
+    printf(" ");                      // keep the work from being optimized away
+  }
+  return (double)rounds * length * 1000.0 / (double)elapsed;
+}
+
+/******************************************************************************************************
+ * Through a noisy link
+*******************************************************************************************************/
+struct sLink {
+  uint32_t sent;
+  uint32_t delivered;
+  uint32_t wrong;               // delivered but not what was sent
+  uint32_t lastSequence;
+};
+
+static void MakePacket(uint32_t sequence, uint8_t *packet, size_t *length)
+{
+  uint32_t seed = sequence * 2654435761u, i;
+
+  *length = 4 + sequence % (MAX_PACKET - 4);
+  memcpy(packet, &sequence, 4);
+  for (i = 4; i < *length; i++) {
+    seed = seed * 1664525u + 1013904223u;
+    packet[i] = (seed >> 24) & ((sequence & 1) ? 0xFF : 0x0F);   // odd ones with lots of zeros
+  }
+}
+
+static void Deliver(void *context, const uint8_t *payload, size_t length)
+{
+  struct sLink *link = context;
+  uint8_t expected[MAX_PACKET];
+  size_t expectedLength;
+  uint32_t sequence;
+
+  link->delivered++;
+  if (length < 4) {
+    link->wrong++;
+    return;
+  }
+  memcpy(&sequence, payload, 4);
+  MakePacket(sequence, expected, &expectedLength);
+  if (expectedLength != length || memcmp(expected, payload, length) != 0 ||
+      sequence >= link->sent || (link->delivered > 1 && sequence <= link->lastSequence)) {
+    link->wrong++;
+  }
+  link->lastSequence = sequence;
+}
+
+// Moves bytes from tx to rx, damaging about one byte in every errorEvery
+static uint32_t Wire(struct sSpscRing *tx, struct sSpscRing *rx, uint32_t errorEvery)
+{
+  uint32_t moved = 0, span, i;
+  const uint8_t *data;
+
+  while ((data = SpscReadSpan(tx, &span)) != NULL && span != 0) {
+    for (i = 0; i < span && SpscWriteAvailable(rx) >= 2; i++) {
+      uint8_t byte = data[i];
+      uint32_t dice = errorEvery ? Random() % errorEvery : 1;
+      if (dice == 0) {
+        switch (Random() % 3) {
+        case 0: byte ^= (uint8_t)(1u << (Random() % 8)); break;   // a flipped bit
+        case 1: continue;                                         // a lost byte
+        default: {                                                // junk added
+          uint8_t junk = (uint8_t)Random();
+          SpscWrite(rx, &junk, 1);
+          break;
+        }
+        }
+      }
+      SpscWrite(rx, &byte, 1);
+    }
+    SpscReadRelease(tx, i);
+    moved += i;
+    if (i < span) {
+      break;
+    }
+  }
+  return moved;
+}
+
+static void Link(enum eCrcType type, uint32_t frames, uint32_t errorEvery)
+{
+  static uint8_t txBuffer[RING_BYTES], rxBuffer[RING_BYTES], frame[MAX_PACKET + 4];
+  static struct sCrc crc;
+  struct sSpscRing tx, rx;
+  struct sCobsDecoder decoder;
+  struct sLink link = { 0 };
+  uint8_t packet[MAX_PACKET];
+  size_t length;
+  char damage[16] = "none";
+
+  CrcSetup(&crc, type, CRC_BEST);
+  SpscRingInit(&tx, txBuffer, RING_BYTES);
+  SpscRingInit(&rx, rxBuffer, RING_BYTES);
+  CobsDecoderInit(&decoder, &crc, frame, sizeof(frame), Deliver, &link);
+  while (link.sent < frames) {
+    MakePacket(link.sent, packet, &length);
+    if (CobsWriteFrame(&tx, &crc, packet, length) == 0) {
+      link.sent++;
+    }
+    Wire(&tx, &rx, errorEvery);
+    CobsReadFrames(&rx, &decoder);
+  }
+  while (SpscReadAvailable(&tx) != 0) {
+    Wire(&tx, &rx, errorEvery);
+    CobsReadFrames(&rx, &decoder);
+  }
+  if (errorEvery != 0) {
+    snprintf(damage, sizeof(damage), "1 in %u", errorEvery);
+  }
+  printf("  %-13s %-11s %9u %9u %7.2f%% %8u %8u %9u %6u\n", crc.model->name, damage,
+         link.sent, link.delivered, 100.0 * link.delivered / link.sent, decoder.badCrc,
+         decoder.malformed, (unsigned)decoder.discardedBytes, link.wrong);
+}
+
+int main(int argc, char *argv[])
+{
+  static const size_t kLengths[] = { 64, 256, 1500, BIG };
+  size_t megabytes = argc > 1 ? (size_t)atoi(argv[1]) : 256;
+  enum eData kind;
+  int problems;
+  size_t i;
+
+  for (i = 0; i < BIG; i++) {
+    gData[DATA_RANDOM][i] = (uint8_t)Random();
+    gData[DATA_NO_ZEROS][i] = (uint8_t)(1 + Random() % 255);
+    gData[DATA_SENSOR][i] = Random() % 8 == 0 ? 0 : (uint8_t)Random();
+  }
+
+  problems = Check();
+  printf("Checking\n  %s\n\n", problems ? "PROBLEMS" : "everything decodes back, in place too");
+
+  Overhead();
+
+  printf("Speed, MB/s of packet   %s\n", "encode / decode");
+  printf("  %-10s", "");
+  for (i = 0; i < sizeof(kLengths) / sizeof(kLengths[0]); i++) {
+    printf(" %8zu bytes  ", kLengths[i]);
+  }
+  printf("\n");
+  for (kind = 0; kind < NUM_DATA; kind++) {
+    printf("  %-10s", kDataNames[kind]);
+    for (i = 0; i < sizeof(kLengths) / sizeof(kLengths[0]); i++) {
+      size_t total = megabytes << 20;
+      printf(" %6.0f / %-6.0f", Measure(kind, kLengths[i], total, 0),
+             Measure(kind, kLengths[i], total, 1));
+    }
+    printf("\n");
+  }
+
+  printf("\nThrough a noisy link\n");
+  printf("  %-13s %-11s %9s %9s %8s %8s %8s %9s %6s\n", "trailer", "damage", "sent", "delivered",
+         "", "bad CRC", "bad COBS", "discarded", "wrong");
+  Link(CRC_16_CCITT, 200000, 0);
+  Link(CRC_16_CCITT, 200000, 10000);
+  Link(CRC_16_CCITT, 200000, 300);
+  Link(CRC_32C, 200000, 10000);
+  Link(CRC_32C, 200000, 300);
+  Link(CRC_32C, 200000, 30);
+  return problems != 0;
+}
@@ -0,0 +1,395 @@
+/*
+ * pingpong_bench.c
+ *
+ * The ADC stream from ../Ch08_Externals/SpeedsAndFeedsDiagram.md (4 channels
+ * of 16 bit samples at 44.1 kHz, 352800 bytes/s) received two ways, from
+ * CommunicationDiagrams.md:
+ *
+ *   per byte: an SPI receive interrupt for every byte, which stores it in
+ *             the buffer and signals the main loop at each half
+ *   DMA:      the DMA stores the bytes, and the only interrupts are half
+ *             transfer and transfer complete
+ *
+ * Both use the same ping-pong buffer (pingpong_dma.h) and the same main loop
+ * processing (a 3 sample median noise filter and a 16 sample moving average
+ * low pass on each channel), so the difference is only the interrupts.
+ *
+ * gcc -O2 pingpong_bench.c pingpong_dma.c -o pingpong_bench -lpthread
+ * ./pingpong_bench [seconds] [extra us of processing per block]
+ *
+ * Part 1 times the interrupt side for one second of data, as fast as it
+ * goes, and estimates what the interrupt entry and exit alone would cost on
+ * a micro (the host pays a function call instead).
+ *
+ * Part 2 runs in real time: an emulator thread plays the SPI peripheral or
+ * the DMA, delivering the bytes on schedule (1 ms at a time, as the host
+ * can't sleep for each one), and the main thread waits for blocks,
+ * processes and releases them. It reports how long blocks waited and
+ * whether any were overrun, and checks the results against the same data
+ * processed directly. Adding extra processing time per block shows the
+ * limit: the main loop has one half's time (5.8 ms here) per block.
+ *
+ * The emulator prints how late it woke up. A host that stalls it for more
+ * than a half leaves it with two or more halves to deliver at once, which
+ * would overrun in a way a real DMA (which doesn't stall) never would. So it
+ * delivers at most a half at a time, and before finishing a half while the
+ * main loop still has the other one, it waits until the main loop has had
+ * that block for a half's time (what a real DMA would have given it). It
+ * prints how often it had to wait. A main loop that takes longer than a
+ * half still overruns.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include "pingpong_dma.h"
+
+#define CHANNELS 4
+#define SAMPLE_RATE 44100
+#define FRAME_BYTES (CHANNELS * 2)
+#define BYTES_PER_SECOND (SAMPLE_RATE * FRAME_BYTES)    // 352800
+#define HALF_FRAMES 256
+#define HALF_BYTES (HALF_FRAMES * FRAME_BYTES)
+#define LPF_TAPS 16
+
+#define MCU_MHZ 64                  // for the estimate of interrupt overhead
+#define ISR_ENTRY_EXIT_CYCLES 24    // Cortex-M4: 12 in, about 10 out, no FPU state
+
+enum eMode { MODE_PER_BYTE, MODE_DMA };
+static const char *const kModeNames[] = { "per byte", "DMA" };
+
+static uint8_t gSource[BYTES_PER_SECOND];   // one second of ADC data, repeated
+static uint8_t gBuffer[2 * HALF_BYTES];
+static struct sPingPong gPingPong;
+
+static uint64_t NowNs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void MakeSource(void)
+{
+  uint32_t seed = 12345, frame, channel;
+
+  for (frame = 0; frame < SAMPLE_RATE; frame++) {
+    for (channel = 0; channel < CHANNELS; channel++) {
+      // a triangle wave per channel plus some noise
+      int32_t phase = (int32_t)((frame * (channel + 1) * 7) % 2000);
+      int32_t value = (phase < 1000 ? phase : 2000 - phase) * 30 - 15000;
+      seed = seed * 1664525u + 1013904223u;
+      value += (int32_t)(seed >> 28) * 64 - 512;
+      gSource[frame * FRAME_BYTES + channel * 2] = (uint8_t)value;
+      gSource[frame * FRAME_BYTES + channel * 2 + 1] = (uint8_t)(value >> 8);
+    }
+  }
+}
+
+/******************************************************************************************************
+ * Main loop processing, the same for both
+*******************************************************************************************************/
+struct sFilters {
+  int16_t last[CHANNELS][2];        // for the median
+  int32_t history[CHANNELS][LPF_TAPS];
+  int32_t sum[CHANNELS];
+  uint32_t at;
+  int64_t checksum;                 // of the filtered output
+};
+
+static int16_t Median3(int16_t a, int16_t b, int16_t c)
+{
+  if (a > b) {
+    int16_t t = a; a = b; b = t;
+  }
+  return c < a ? a : (c > b ? b : c);
+}
+
+static void ProcessBlock(struct sFilters *f, const uint8_t *block, uint32_t length)
+{
+  uint32_t i, channel;
+
+  for (i = 0; i + FRAME_BYTES <= length; i += FRAME_BYTES) {
+    for (channel = 0; channel < CHANNELS; channel++) {
+      int16_t raw = (int16_t)(block[i + channel * 2] | (block[i + channel * 2 + 1] << 8));
+      int16_t clean = Median3(f->last[channel][0], f->last[channel][1], raw);
+      f->last[channel][0] = f->last[channel][1];
+      f->last[channel][1] = raw;
+      f->sum[channel] += clean - f->history[channel][f->at];
+      f->history[channel][f->at] = clean;
+      f->checksum = f->checksum * 31 + f->sum[channel] / LPF_TAPS;
+    }
+    f->at = (f->at + 1) % LPF_TAPS;
+  }
+}
+
+// What the main loop should have got for this many blocks
+static int64_t Reference(uint32_t blocks)
+{
+  static uint8_t block[HALF_BYTES];
+  struct sFilters f = {0};
+  uint64_t position = 0;
+  uint32_t b, i;
+
+  for (b = 0; b < blocks; b++) {
+    for (i = 0; i < HALF_BYTES; i++) {
+      block[i] = gSource[position++ % BYTES_PER_SECOND];
+    }
+    ProcessBlock(&f, block, HALF_BYTES);
+  }
+  return f.checksum;
+}
+
+/******************************************************************************************************
+ * The interrupts
+*******************************************************************************************************/
+static uint32_t gRxPosition;        // where the per byte interrupt stores next
+
+// SPI receive interrupt, once per byte
+static void SpiRxIsr(uint8_t data)
+{
+  gBuffer[gRxPosition++] = data;
+  if (gRxPosition == HALF_BYTES) {
+    PingPongHalfTransfer(&gPingPong);
+  } else if (gRxPosition == 2 * HALF_BYTES) {
+    gRxPosition = 0;
+    PingPongTransferComplete(&gPingPong);
+  }
+}
+
+// The DMA controller: copies bytes without the CPU and interrupts at the
+// half and at the end. Here it is the emulator thread that does the copy.
+static uint32_t gDmaPosition;
+
+static void DmaDeliver(const uint8_t *data, uint32_t length)
+{
+  while (length > 0) {
+    uint32_t toBoundary = HALF_BYTES - gDmaPosition % HALF_BYTES;
+    uint32_t n = length < toBoundary ? length : toBoundary;
+    memcpy(gBuffer + gDmaPosition, data, n);
+    gDmaPosition += n;
+    data += n;
+    length -= n;
+    if (gDmaPosition == HALF_BYTES) {
+      PingPongHalfTransfer(&gPingPong);             // half transfer interrupt
+    } else if (gDmaPosition == 2 * HALF_BYTES) {
+      gDmaPosition = 0;
+      PingPongTransferComplete(&gPingPong);         // transfer complete interrupt
+    }
+  }
+}
+
+/******************************************************************************************************
+ * Part 1: cost of the interrupt side
+*******************************************************************************************************/
+static uint32_t gReleasedImmediately;
+
+static void ReleaseNow(void *context, uint8_t *block, uint32_t length)
+{
+  (void)context;
+  (void)length;
+  gReleasedImmediately++;
+  PingPongRelease(&gPingPong, block);
+}
+
+static void InterruptCost(void)
+{
+  enum eMode mode;
+  struct sFilters filters = {0};
+  uint64_t start, elapsed;
+  uint32_t i;
+
+  printf("Part 1: one second of ADC data (%d bytes), interrupt side only\n", BYTES_PER_SECOND);
+  for (mode = MODE_PER_BYTE; mode <= MODE_DMA; mode++) {
+    uint32_t interrupts;
+    double overhead;
+    PingPongInit(&gPingPong, gBuffer, HALF_BYTES, ReleaseNow, NULL);
+    gRxPosition = gDmaPosition = 0;
+    gReleasedImmediately = 0;
+    start = NowNs();
+    if (mode == MODE_PER_BYTE) {
+      for (i = 0; i < BYTES_PER_SECOND; i++) {
+        SpiRxIsr(gSource[i]);
+      }
+      interrupts = BYTES_PER_SECOND;
+    } else {
+      DmaDeliver(gSource, BYTES_PER_SECOND);       // on a micro the memcpy is the DMA's
+      interrupts = gReleasedImmediately;
+    }
+    elapsed = NowNs() - start;
+    overhead = (double)interrupts * ISR_ENTRY_EXIT_CYCLES / (MCU_MHZ * 1e6);
+    printf("  %-8s %6u interrupts/s, %8.1f us on the host, entry+exit alone %5.2f%% of a %d MHz micro\n",
+           kModeNames[mode], interrupts, elapsed / 1e3, overhead * 100.0, MCU_MHZ);
+  }
+  start = NowNs();
+  for (i = 0; i + HALF_BYTES <= BYTES_PER_SECOND; i += HALF_BYTES) {
+    ProcessBlock(&filters, gSource + i, HALF_BYTES);
+  }
+  elapsed = NowNs() - start;
+  printf("  main loop processing, for comparison: %.1f us per second of data\n\n", elapsed / 1e3);
+}
+
+/******************************************************************************************************
+ * Part 2: real time
+*******************************************************************************************************/
+static sem_t gBlocksReady;
+static uint64_t gReadyAt[2];
+static enum eMode gMode;
+static int gSeconds;
+static uint64_t gEmulatorLate;      // most it woke up after it asked to
+static uint32_t gCatchUpWaits;      // times it waited for the main loop to release a block
+
+static void SignalMainLoop(void *context, uint8_t *block, uint32_t length)
+{
+  (void)context;
+  (void)length;
+  gReadyAt[block == gBuffer ? 0 : 1] = NowNs();
+  sem_post(&gBlocksReady);
+}
+
+// About to finish a half while the main loop still has the other one (an
+// overrun): let it have that block for the half period a real DMA would
+// have given it, counted from when it really got it
+static void WaitForOtherHalf(uint64_t delivered)
+{
+  unsigned other = ((delivered / HALF_BYTES) & 1) ^ 1, bit = 1u << other;
+  uint64_t giveUp = gReadyAt[other] + (uint64_t)HALF_BYTES * 1000000000u / BYTES_PER_SECOND;
+
+  if (!(atomic_load(&gPingPong.inUse) & bit)) {
+    return;
+  }
+  gCatchUpWaits++;
+  while ((atomic_load(&gPingPong.inUse) & bit) && NowNs() < giveUp) {
+    sched_yield();
+  }
+}
+
+// Plays the SPI peripheral or the DMA: every millisecond, delivers the bytes
+// that have arrived since the last one
+static void *Emulator(void *arg)
+{
+  uint64_t delivered = 0, due, total = (uint64_t)gSeconds * BYTES_PER_SECOND;
+  struct timespec next, start;
+
+  (void)arg;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  next = start;
+  while (delivered < total) {
+    uint64_t elapsed, late;
+    next.tv_nsec += 1000000;
+    if (next.tv_nsec >= 1000000000) {
+      next.tv_nsec -= 1000000000;
+      next.tv_sec++;
+    }
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    late = NowNs() - ((uint64_t)next.tv_sec * 1000000000u + (uint64_t)next.tv_nsec);
+    if (late > gEmulatorLate) {
+      gEmulatorLate = late;
+    }
+    elapsed = (uint64_t)(next.tv_sec - start.tv_sec) * 1000000000u + (uint64_t)next.tv_nsec
+              - (uint64_t)start.tv_nsec;
+    due = elapsed * BYTES_PER_SECOND / 1000000000u;
+    if (due > total) {
+      due = total;
+    }
+    while (delivered < due) {
+      uint32_t offset = (uint32_t)(delivered % BYTES_PER_SECOND);
+      uint32_t n = (uint32_t)(due - delivered);
+      if (n > BYTES_PER_SECOND - offset) {
+        n = BYTES_PER_SECOND - offset;
+      }
+      // after the host was slow to wake us there is a lot to catch up on;
+      // a real DMA would have been trickling all along, so go a half at a
+      // time and let the main loop have a go at each block
+      if (n > HALF_BYTES - delivered % HALF_BYTES) {
+        n = (uint32_t)(HALF_BYTES - delivered % HALF_BYTES);
+      }
+      if ((delivered + n) % HALF_BYTES == 0) {
+        WaitForOtherHalf(delivered);
+      }
+      if (gMode == MODE_PER_BYTE) {
+        uint32_t i;
+        for (i = 0; i < n; i++) {
+          SpiRxIsr(gSource[offset + i]);
+        }
+      } else {
+        DmaDeliver(gSource + offset, n);
+      }
+      delivered += n;
+    }
+  }
+  sem_post(&gBlocksReady);          // wake the main loop to see it's over
+  return NULL;
+}
+
+static int RealTime(enum eMode mode, uint32_t extraUs)
+{
+  struct sFilters filters = {0};
+  uint32_t expected = (uint32_t)((uint64_t)gSeconds * BYTES_PER_SECOND / HALF_BYTES);
+  uint32_t processed = 0, next = 0;
+  uint64_t maxWait = 0, totalWait = 0;
+  pthread_t thread;
+  int match;
+
+  gMode = mode;
+  gEmulatorLate = 0;
+  gCatchUpWaits = 0;
+  gRxPosition = gDmaPosition = 0;
+  PingPongInit(&gPingPong, gBuffer, HALF_BYTES, SignalMainLoop, NULL);
+  sem_init(&gBlocksReady, 0, 0);
+  pthread_create(&thread, NULL, Emulator, NULL);
+
+  while (processed < expected) {
+    const uint8_t *block = gBuffer + next * HALF_BYTES;
+    uint64_t wait;
+    sem_wait(&gBlocksReady);
+    if (processed >= atomic_load(&gPingPong.blocks)) {
+      break;                        // the emulator finished
+    }
+    ProcessBlock(&filters, block, HALF_BYTES);
+    if (extraUs > 0) {
+      uint64_t until = NowNs() + extraUs * 1000u;
+      while (NowNs() < until) {
+      }
+    }
+    wait = NowNs() - gReadyAt[next];
+    totalWait += wait;
+    if (wait > maxWait) {
+      maxWait = wait;
+    }
+    PingPongRelease(&gPingPong, block);
+    next ^= 1;
+    processed++;
+  }
+  pthread_join(thread, NULL);
+  sem_destroy(&gBlocksReady);
+
+  match = filters.checksum == Reference(processed);
+  printf("  %-8s %5u blocks, ready to released: mean %6.1f us, max %7.1f us, %u overruns, data %s\n"
+         "           (the emulator woke up to %.1f us late, waited for the main loop %u times)\n",
+         kModeNames[mode], processed, processed ? totalWait / 1e3 / processed : 0.0, maxWait / 1e3,
+         atomic_load(&gPingPong.overruns), match ? "matches" : "DIFFERS", gEmulatorLate / 1e3,
+         gCatchUpWaits);
+  return match && atomic_load(&gPingPong.overruns) == 0;
+}
+
+int main(int argc, char *argv[])
+{
+  uint32_t extraUs;
+  int ok;
+
+  gSeconds = argc > 1 ? atoi(argv[1]) : 2;
+  extraUs = argc > 2 ? (uint32_t)atoi(argv[2]) : 0;
+  MakeSource();
+  InterruptCost();
+
+  printf("Part 2: %d s in real time, blocks of %d bytes (%.1f ms), %u us extra processing\n",
+         gSeconds, HALF_BYTES, HALF_BYTES * 1000.0 / BYTES_PER_SECOND, extraUs);
+  ok = RealTime(MODE_PER_BYTE, extraUs);
+  ok &= RealTime(MODE_DMA, extraUs);
+  return ok ? 0 : 1;
+}
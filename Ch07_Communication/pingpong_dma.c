@@ -0,0 +1,54 @@
+/*
+ * pingpong_dma.c
+ *
+ * Double buffering for a DMA stream, see pingpong_dma.h
+ */
+#include "pingpong_dma.h"
+
+int PingPongInit(struct sPingPong *pp, uint8_t *buffer, uint32_t halfLength,
+                 PingPongBlockReady blockReady, void *context)
+{
+  if (halfLength == 0) {
+    return -1;
+  }
+  pp->buffer = buffer;
+  pp->halfLength = halfLength;
+  pp->blockReady = blockReady;
+  pp->context = context;
+  atomic_init(&pp->inUse, 0);
+  atomic_init(&pp->blocks, 0);
+  atomic_init(&pp->overruns, 0);
+  return 0;
+}
+
+// Half number half is full and the DMA has moved on to the other one
+static void HalfDone(struct sPingPong *pp, uint32_t half)
+{
+  uint32_t other = 1u - half;
+  // release: the block's data (written by the DMA, or by the interrupt that
+  // stands in for it) is seen by whoever sees the bit
+  uint32_t was = atomic_fetch_or_explicit(&pp->inUse, 1u << half, memory_order_acq_rel);
+
+  if (was & (1u << other)) {
+    atomic_fetch_add_explicit(&pp->overruns, 1, memory_order_relaxed);
+  }
+  atomic_fetch_add_explicit(&pp->blocks, 1, memory_order_relaxed);
+  pp->blockReady(pp->context, pp->buffer + half * pp->halfLength, pp->halfLength);
+}
+
+void PingPongHalfTransfer(struct sPingPong *pp)
+{
+  HalfDone(pp, 0);
+}
+
+void PingPongTransferComplete(struct sPingPong *pp)
+{
+  HalfDone(pp, 1);
+}
+
+void PingPongRelease(struct sPingPong *pp, const uint8_t *block)
+{
+  uint32_t half = block == pp->buffer ? 0u : 1u;
+  // release: done reading before the interrupt can see the half as free
+  atomic_fetch_and_explicit(&pp->inUse, ~(1u << half), memory_order_release);
+}
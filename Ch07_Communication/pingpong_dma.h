@@ -0,0 +1,57 @@
+/*
+ * pingpong_dma.h
+ *
+ * Double buffering for a stream that a DMA (or an interrupt) fills while
+ * the main loop processes it, the "SPI with DMA" diagram in
+ * CommunicationDiagrams.md.
+ *
+ * The DMA runs in circular mode over one buffer of two halves. Most DMA
+ * controllers (STM32, SAM, nRF, RP2040 with two chained channels) can
+ * interrupt when the first half is full (half transfer) and when the second
+ * is (transfer complete), then wrap to the start on their own. Call
+ * PingPongHalfTransfer and PingPongTransferComplete from those two
+ * interrupts; each hands the full half to the blockReady callback and the
+ * DMA goes on filling the other one.
+ *
+ * blockReady runs in the interrupt, so it should only signal the main loop
+ * (set a flag, post an event or deferred work), which processes the block
+ * and calls PingPongRelease when done with it. The main loop has one half's
+ * time to do that: if the DMA finishes the other half and wraps back into a
+ * block that hasn't been released, it is writing over data being used, and
+ * that is counted as an overrun (the data already is damaged, so nothing
+ * else is done about it; make the halves bigger or the processing faster).
+ *
+ * Without a DMA, a receive interrupt can store bytes in the buffer itself
+ * and call the same two functions at the half and the end.
+ */
+#ifndef PINGPONG_DMA_H
+#define PINGPONG_DMA_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+// Called in the interrupt with a full half of the buffer
+typedef void (*PingPongBlockReady)(void *context, uint8_t *block, uint32_t length);
+
+struct sPingPong {
+  uint8_t *buffer;                // 2 * halfLength bytes, what the DMA runs over
+  uint32_t halfLength;
+  PingPongBlockReady blockReady;
+  void *context;
+  atomic_uint inUse;              // bit 0 and bit 1: that half is with the main loop
+  atomic_uint blocks;             // handed to blockReady
+  atomic_uint overruns;           // halves the DMA went into before they were released
+};
+
+// buffer has 2 * halfLength bytes. Returns 0, or -1 if halfLength is 0.
+int PingPongInit(struct sPingPong *pp, uint8_t *buffer, uint32_t halfLength,
+                 PingPongBlockReady blockReady, void *context);
+
+// From the DMA half transfer and transfer complete interrupts
+void PingPongHalfTransfer(struct sPingPong *pp);
+void PingPongTransferComplete(struct sPingPong *pp);
+
+// From the main loop, with the block blockReady was given
+void PingPongRelease(struct sPingPong *pp, const uint8_t *block);
+
+#endif // PINGPONG_DMA_H
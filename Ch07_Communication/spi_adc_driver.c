@@ -0,0 +1,234 @@
+/*
+ * spi_adc_driver.c
+ *
+ * The SPI ADC sequence from CommunicationDiagrams.md written as a coroutine
+ * (../Ch06_Flow/coroutine.h) that reads top to bottom:
+ *
+ *   reset the ADC, wait for it to come up, check its ID, start conversions,
+ *   then forever: wait for data ready, read the sample over SPI (retrying
+ *   if the transfer fails), and every 8 samples signal that a block is ready.
+ *
+ * As a state machine that is a state for each wait, plus a retry counter
+ * and a sample counter carried between them. Here the waits are just
+ * lines, and the counters are in the driver struct, which is also the
+ * coroutine's whole frame: its size is printed at the end.
+ *
+ * gcc -O2 -I../Ch06_Flow spi_adc_driver.c ../Ch06_Flow/coroutine.c ../Ch06_Flow/scheduler.c -o spi_adc_driver
+ * ./spi_adc_driver
+ *
+ * The ADC and SPI peripheral are simulated on the same scheduler, one tick
+ * per microsecond: a byte takes 8 us (1 MHz SPI), the ADC has a sample
+ * every 250 us, and one transfer in 37 fails. Their "interrupts" are
+ * scheduler callbacks, so they can signal events directly; on a micro,
+ * the interrupt would post to the deferred work queue
+ * (../Ch05_Interrupts/deferred_work.h) and signal from there.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "coroutine.h"
+
+#define SPI_BYTE_TICKS 8
+#define ADC_PERIOD_TICKS 250
+#define ADC_RESET_TICKS 500         // datasheet: wait after reset before talking to it
+#define RETRY_TICKS 20
+#define MAX_TRIES 3
+#define FAIL_EVERY 37               // transfers
+#define BLOCK_SAMPLES 8
+#define RUN_TICKS 1000000           // one simulated second
+
+#define CMD_RESET 0x06
+#define CMD_READ_ID 0x20
+#define CMD_START 0x08
+#define CMD_READ_DATA 0x12
+#define ADC_ID 0x5A
+
+/******************************************************************************************************
+ * Simulated hardware
+*******************************************************************************************************/
+struct sSpiBus {
+  const uint8_t *tx;
+  uint8_t *rx;
+  uint16_t length;
+  int status;                       // 0 or -1 if the transfer failed
+  struct sCoEvent *done;
+  uint32_t transfers;
+};
+
+static struct sScheduler gScheduler;
+static struct sSpiBus gSpi;
+static int32_t gAdcConversion = -1; // the latest sample, the ADC counts up
+static void AdcDataReadyIsr(void *context);
+
+static void SpiCompleteIsr(void *context)
+{
+  struct sSpiBus *spi = context;
+
+  memset(spi->rx, 0xFF, spi->length);
+  spi->status = 0;
+  if (++spi->transfers % FAIL_EVERY == 0) {
+    spi->status = -1;
+  } else if (spi->tx[0] == CMD_READ_ID) {
+    spi->rx[1] = ADC_ID;
+  } else if (spi->tx[0] == CMD_START) {
+    SchedulerAdd(&gScheduler, AdcDataReadyIsr, NULL, ADC_PERIOD_TICKS, ADC_PERIOD_TICKS);
+  } else if (spi->tx[0] == CMD_READ_DATA) {
+    spi->rx[1] = (uint8_t)(gAdcConversion >> 16);
+    spi->rx[2] = (uint8_t)(gAdcConversion >> 8);
+    spi->rx[3] = (uint8_t)gAdcConversion;
+  }
+  CoEventSignal(spi->done);
+}
+
+static void SpiStart(struct sSpiBus *spi, const uint8_t *tx, uint8_t *rx, uint16_t length,
+                     struct sCoEvent *done)
+{
+  spi->tx = tx;
+  spi->rx = rx;
+  spi->length = length;
+  spi->done = done;
+  SchedulerAdd(&gScheduler, SpiCompleteIsr, spi, length * SPI_BYTE_TICKS, 0);
+}
+
+/******************************************************************************************************
+ * The driver
+*******************************************************************************************************/
+struct sAdcDriver {
+  struct sCoroutine co;             // first, so the coroutine is the driver
+  struct sSpiBus *spi;
+  struct sCoEvent dataReady;
+  struct sCoEvent transferDone;
+  struct sCoEvent blockReady;
+  uint8_t tx[4];
+  uint8_t rx[4];
+  uint8_t tries;
+  uint8_t count;
+  int32_t block[BLOCK_SAMPLES];
+  uint32_t samples, retries, failed, overruns;
+  int ok;
+};
+
+static struct sAdcDriver gAdc;
+
+static void AdcDataReadyIsr(void *context)
+{
+  (void)context;
+  gAdcConversion = (gAdcConversion + 1) & 0xFFFFFF;
+  if (gAdc.dataReady.set) {
+    gAdc.overruns++; // the last sample was never read
+  }
+  CoEventSignal(&gAdc.dataReady);
+}
+
+static int AdcDriver(struct sCoroutine *co)
+{
+  struct sAdcDriver *me = (struct sAdcDriver *)co;
+
+  CO_BEGIN(co);
+  me->tx[0] = CMD_RESET;
+  SpiStart(me->spi, me->tx, me->rx, 1, &me->transferDone);
+  CO_AWAIT_EVENT(co, &me->transferDone);
+  CO_SLEEP(co, ADC_RESET_TICKS);
+
+  me->tx[0] = CMD_READ_ID;
+  SpiStart(me->spi, me->tx, me->rx, 2, &me->transferDone);
+  CO_AWAIT_EVENT(co, &me->transferDone);
+  if (me->spi->status != 0 || me->rx[1] != ADC_ID) {
+    printf("ADC not found (status %d, id %02X)\n", me->spi->status, me->rx[1]);
+    CO_EXIT(co);
+  }
+
+  me->tx[0] = CMD_START;
+  SpiStart(me->spi, me->tx, me->rx, 1, &me->transferDone);
+  CO_AWAIT_EVENT(co, &me->transferDone);
+  me->ok = 1;
+
+  while (1) {
+    CO_AWAIT_EVENT(co, &me->dataReady);
+    for (me->tries = 0; me->tries < MAX_TRIES; me->tries++) {
+      me->tx[0] = CMD_READ_DATA;
+      SpiStart(me->spi, me->tx, me->rx, 4, &me->transferDone);
+      CO_AWAIT_EVENT(co, &me->transferDone);
+      if (me->spi->status == 0) {
+        break;
+      }
+      me->retries++;
+      CO_SLEEP(co, RETRY_TICKS);
+    }
+    if (me->tries == MAX_TRIES) {
+      me->failed++;
+      continue;
+    }
+    me->block[me->count++] = ((int32_t)me->rx[1] << 16) | ((int32_t)me->rx[2] << 8) | me->rx[3];
+    me->samples++;
+    if (me->count == BLOCK_SAMPLES) {
+      me->count = 0;
+      CoEventSignal(&me->blockReady); // runs the consumer now, before the block changes
+    }
+  }
+  CO_END(co);
+}
+
+/******************************************************************************************************
+ * Something using the samples
+*******************************************************************************************************/
+struct sAverager {
+  struct sCoroutine co;
+  struct sAdcDriver *adc;
+  uint32_t blocks;
+  uint32_t gaps;                    // samples missing between or inside blocks
+  int32_t last;
+};
+
+static int Averager(struct sCoroutine *co)
+{
+  struct sAverager *me = (struct sAverager *)co;
+  int64_t sum;
+  int i;
+
+  CO_BEGIN(co);
+  me->last = -1;
+  while (1) {
+    CO_AWAIT_EVENT(co, &me->adc->blockReady);
+    sum = 0;
+    for (i = 0; i < BLOCK_SAMPLES; i++) {
+      if (me->adc->block[i] != me->last + 1) {
+        me->gaps++;
+      }
+      me->last = me->adc->block[i];
+      sum += me->adc->block[i];
+    }
+    if (me->blocks++ < 3) {
+      printf("block %u: average %.1f\n", me->blocks, (double)sum / BLOCK_SAMPLES);
+    }
+  }
+  CO_END(co);
+}
+
+int main(void)
+{
+  static struct sAverager averager;
+  uint32_t now;
+
+  SchedulerInit(&gScheduler, 0);
+  memset(&gAdc, 0, sizeof(gAdc));
+  gAdc.spi = &gSpi;
+  CoEventInit(&gAdc.dataReady);
+  CoEventInit(&gAdc.transferDone);
+  CoEventInit(&gAdc.blockReady);
+  averager.adc = &gAdc;
+  CoroutineStart(&averager.co, &gScheduler, Averager);
+  CoroutineStart(&gAdc.co, &gScheduler, AdcDriver);
+
+  for (now = 1; now <= RUN_TICKS; now++) {
+    SchedulerRun(&gScheduler, now);
+  }
+
+  printf("ADC %s, %u samples in %u blocks, %u SPI transfers\n", gAdc.ok ? "running" : "failed",
+         gAdc.samples, averager.blocks, gSpi.transfers);
+  printf("%u retries, %u samples given up on, %u overruns, %u gaps seen by the consumer\n",
+         gAdc.retries, gAdc.failed, gAdc.overruns, averager.gaps);
+  printf("frames: driver %zu bytes (of which coroutine %zu), consumer %zu bytes\n",
+         sizeof(struct sAdcDriver), sizeof(struct sCoroutine), sizeof(struct sAverager));
+  return gAdc.ok && averager.gaps == 0 ? 0 : 1;
+}
@@ -0,0 +1,163 @@
+/*
+ * spsc_bench.c
+ *
+ * How fast can bytes go through the SPSC ring between two threads?
+ *
+ * gcc -O2 spsc_bench.c -o spsc_bench -lpthread
+ * ./spsc_bench [seconds per run] [producer cpu] [consumer cpu]
+ *
+ * The producer copies from a source buffer into write spans and the
+ * consumer compares read spans against the same source, so every byte is
+ * written once, read once and checked, about what a real consumer doing a
+ * memcpy out would cost. It is run with chunks of 64 bytes to 16 KiB (how
+ * much each side moves per span) and a 256 KiB ring.
+ *
+ * Pin the threads to two cores (the last two arguments) to measure the
+ * ring between cores. With one core the two threads take turns and the
+ * number is how fast one core can memcpy and memcmp, with a context switch
+ * whenever the ring fills or empties.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "spsc_ring.h"
+
+#define RING_BYTES (256u * 1024u)
+#define SOURCE_BYTES (1u << 20)     // a multiple of the ring and of every chunk
+
+static struct sSpscRing gRing;
+static uint8_t *gRingMemory, *gSource;
+static atomic_int gRunning;
+static uint32_t gChunk;
+static int gProducerCpu = -1, gConsumerCpu = -1;
+
+struct sSide {
+  uint64_t bytes;
+  uint64_t emptyOrFull;             // spans that came back with no room or no data
+  uint64_t mismatches;
+};
+
+static void Pin(int cpu)
+{
+  cpu_set_t set;
+  if (cpu < 0) {
+    return;
+  }
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+static void *Producer(void *arg)
+{
+  struct sSide *side = arg;
+  uint32_t position = 0;            // in the source
+
+  Pin(gProducerCpu);
+  while (atomic_load_explicit(&gRunning, memory_order_relaxed)) {
+    uint32_t span;
+    uint8_t *to = SpscWriteSpan(&gRing, &span);
+    if (span == 0) {
+      side->emptyOrFull++;
+      sched_yield();
+      continue;
+    }
+    if (span > gChunk) {
+      span = gChunk;
+    }
+    // a span can't cross the end of the ring or the source, both are
+    // multiples of everything, so at most it stops short there
+    if (span > SOURCE_BYTES - position) {
+      span = SOURCE_BYTES - position;
+    }
+    memcpy(to, gSource + position, span);
+    SpscWriteCommit(&gRing, span);
+    position = (position + span) & (SOURCE_BYTES - 1);
+    side->bytes += span;
+  }
+  return NULL;
+}
+
+static void *Consumer(void *arg)
+{
+  struct sSide *side = arg;
+  uint32_t position = 0;
+
+  Pin(gConsumerCpu);
+  while (atomic_load_explicit(&gRunning, memory_order_relaxed)) {
+    uint32_t span;
+    const uint8_t *from = SpscReadSpan(&gRing, &span);
+    if (span == 0) {
+      side->emptyOrFull++;
+      sched_yield();
+      continue;
+    }
+    if (span > gChunk) {
+      span = gChunk;
+    }
+    if (span > SOURCE_BYTES - position) {
+      span = SOURCE_BYTES - position;
+    }
+    if (memcmp(from, gSource + position, span) != 0) {
+      side->mismatches++;
+    }
+    SpscReadRelease(&gRing, span);
+    position = (position + span) & (SOURCE_BYTES - 1);
+    side->bytes += span;
+  }
+  return NULL;
+}
+
+static int Run(uint32_t chunk, int seconds)
+{
+  struct sSide producer = {0}, consumer = {0};
+  pthread_t threads[2];
+  struct timespec start, end;
+  double elapsed;
+
+  SpscRingInit(&gRing, gRingMemory, RING_BYTES);
+  gChunk = chunk;
+  atomic_store(&gRunning, 1);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pthread_create(&threads[0], NULL, Producer, &producer);
+  pthread_create(&threads[1], NULL, Consumer, &consumer);
+  sleep(seconds);
+  atomic_store(&gRunning, 0);
+  pthread_join(threads[0], NULL);
+  pthread_join(threads[1], NULL);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+  printf("  %6u B chunks: %6.2f GB/s   (ring full %llu times, empty %llu times, %llu bad)\n",
+         chunk, consumer.bytes / elapsed / 1e9, (unsigned long long)producer.emptyOrFull,
+         (unsigned long long)consumer.emptyOrFull, (unsigned long long)consumer.mismatches);
+  return consumer.mismatches != 0;
+}
+
+int main(int argc, char *argv[])
+{
+  int seconds = argc > 1 ? atoi(argv[1]) : 2;
+  uint32_t chunk, i, seed = 1;
+  int bad = 0;
+
+  gProducerCpu = argc > 2 ? atoi(argv[2]) : -1;
+  gConsumerCpu = argc > 3 ? atoi(argv[3]) : -1;
+  gRingMemory = aligned_alloc(4096, RING_BYTES);
+  gSource = aligned_alloc(4096, SOURCE_BYTES);
+  for (i = 0; i < SOURCE_BYTES; i++) {
+    seed = seed * 1664525u + 1013904223u;
+    gSource[i] = (uint8_t)(seed >> 24);
+  }
+  printf("%u KiB ring, %ld cores online\n", RING_BYTES / 1024, sysconf(_SC_NPROCESSORS_ONLN));
+  for (chunk = 64; chunk <= 16384; chunk *= 4) {
+    bad |= Run(chunk, seconds);
+  }
+  free(gRingMemory);
+  free(gSource);
+  return bad;
+}
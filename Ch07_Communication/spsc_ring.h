@@ -0,0 +1,183 @@
+/*
+ * spsc_ring.h
+ *
+ * A circular buffer of bytes with one producer and one consumer, which can
+ * be on different cores, or be an interrupt and the main loop, with no locks.
+ *
+ * The producer only writes the tail and the consumer only writes the head.
+ * Each is read by the other side with acquire and written with release, so
+ * the data written before moving the tail is there when the consumer sees
+ * the new tail. The indices run freely and wrap at 2^32; the capacity is a
+ * power of two, so the position in the buffer is index & mask and the count
+ * is tail - head even after they wrap.
+ *
+ * For speed between cores:
+ *  - the head and the tail are on separate cache lines, so the two sides
+ *    don't fight over one line every time either moves
+ *  - each side keeps a copy of the other's index and only reads the real
+ *    one (a cache miss) when its copy says there is no room or no data
+ *  - spans: SpscWriteSpan gives a pointer to the contiguous free space, to
+ *    fill with memcpy or point a DMA at, then SpscWriteCommit says how much
+ *    was written. SpscReadSpan and SpscReadRelease do the same for reading.
+ *    A span stops at the end of the buffer, so a wrapped region takes two.
+ *
+ * On a single core micro the cache line alignment only costs some RAM; set
+ * SPSC_CACHE_LINE to 4 there.
+ */
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#ifndef SPSC_CACHE_LINE
+#define SPSC_CACHE_LINE 64
+#endif
+
+struct sSpscRing {
+  // set up once, then only read
+  uint8_t *buffer;
+  uint32_t mask;          // capacity - 1
+
+  // the producer's line
+  _Alignas(SPSC_CACHE_LINE) atomic_uint tail;
+  uint32_t cachedHead;    // the producer's last look at head
+
+  // the consumer's line
+  _Alignas(SPSC_CACHE_LINE) atomic_uint head;
+  uint32_t cachedTail;    // the consumer's last look at tail
+};
+
+// capacity must be a power of two; buffer has capacity bytes
+static inline int SpscRingInit(struct sSpscRing *ring, void *buffer, uint32_t capacity)
+{
+  if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+    return -1;
+  }
+  ring->buffer = buffer;
+  ring->mask = capacity - 1;
+  atomic_init(&ring->tail, 0);
+  ring->cachedHead = 0;
+  atomic_init(&ring->head, 0);
+  ring->cachedTail = 0;
+  return 0;
+}
+
+/******************************************************************************************************
+ * Producer side
+*******************************************************************************************************/
+
+// Bytes that can be written (all of them, not just up to the end of the buffer)
+static inline uint32_t SpscWriteAvailable(struct sSpscRing *ring)
+{
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+  ring->cachedHead = atomic_load_explicit(&ring->head, memory_order_acquire);
+  return ring->mask + 1 - (tail - ring->cachedHead);
+}
+
+// Where to write next, and in *length how many bytes fit there without
+// wrapping (0 if the ring is full). Write them, then SpscWriteCommit.
+static inline uint8_t *SpscWriteSpan(struct sSpscRing *ring, uint32_t *length)
+{
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  uint32_t offset = tail & ring->mask;
+  uint32_t space = ring->mask + 1 - (tail - ring->cachedHead);
+  uint32_t toEnd = ring->mask + 1 - offset;
+
+  if (space < toEnd) {
+    // maybe the consumer has moved on since we last looked
+    ring->cachedHead = atomic_load_explicit(&ring->head, memory_order_acquire);
+    space = ring->mask + 1 - (tail - ring->cachedHead);
+  }
+  *length = space < toEnd ? space : toEnd;
+  return ring->buffer + offset;
+}
+
+// count bytes of the last span are ready for the consumer
+static inline void SpscWriteCommit(struct sSpscRing *ring, uint32_t count)
+{
+  uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  atomic_store_explicit(&ring->tail, tail + count, memory_order_release);
+}
+
+// Copies in as much as fits, returns how much that was
+static inline uint32_t SpscWrite(struct sSpscRing *ring, const void *data, uint32_t length)
+{
+  const uint8_t *from = data;
+  uint32_t done = 0;
+
+  while (done < length) {
+    uint32_t span, n;
+    uint8_t *to = SpscWriteSpan(ring, &span);
+    if (span == 0) {
+      break;
+    }
+    n = length - done < span ? length - done : span;
+    memcpy(to, from + done, n);
+    done += n;
+    // commit each piece: the consumer can start on it, and the next span
+    // (after a wrap) is measured from the new tail
+    SpscWriteCommit(ring, n);
+  }
+  return done;
+}
+
+/******************************************************************************************************
+ * Consumer side
+*******************************************************************************************************/
+
+static inline uint32_t SpscReadAvailable(struct sSpscRing *ring)
+{
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+  ring->cachedTail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  return ring->cachedTail - head;
+}
+
+// Where the next data is, and in *length how much of it is there without
+// wrapping (0 if the ring is empty). Use it, then SpscReadRelease.
+static inline const uint8_t *SpscReadSpan(struct sSpscRing *ring, uint32_t *length)
+{
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  uint32_t offset = head & ring->mask;
+  uint32_t count = ring->cachedTail - head;
+  uint32_t toEnd = ring->mask + 1 - offset;
+
+  if (count < toEnd) {
+    ring->cachedTail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    count = ring->cachedTail - head;
+  }
+  *length = count < toEnd ? count : toEnd;
+  return ring->buffer + offset;
+}
+
+// Done with count bytes of the last span, the producer can have them back
+static inline void SpscReadRelease(struct sSpscRing *ring, uint32_t count)
+{
+  uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  atomic_store_explicit(&ring->head, head + count, memory_order_release);
+}
+
+// Copies out up to length bytes, returns how many
+static inline uint32_t SpscRead(struct sSpscRing *ring, void *data, uint32_t length)
+{
+  uint8_t *to = data;
+  uint32_t done = 0;
+
+  while (done < length) {
+    uint32_t span, n;
+    const uint8_t *from = SpscReadSpan(ring, &span);
+    if (span == 0) {
+      break;
+    }
+    n = length - done < span ? length - done : span;
+    memcpy(to + done, from, n);
+    done += n;
+    SpscReadRelease(ring, n);
+  }
+  return done;
+}
+
+#endif // SPSC_RING_H
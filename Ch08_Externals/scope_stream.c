@@ -0,0 +1,210 @@
+/*
+ * scope_stream.c
+ *
+ * Streaming samples to a serial oscilloscope, see scope_stream.h
+ *
+ * Points are built straight into the frame buffer as groups of samples
+ * finish, so the only copy is the COBS encode into the queue. The average
+ * divides by the group size with fastdiv.h (../Ch12_Math), since the group
+ * size is rarely a power of two and the divide would otherwise happen for
+ * every channel of every point.
+ */
+#include <errno.h>
+#include <unistd.h>
+#include "scope_stream.h"
+#include "cobs.h"
+
+static void StartGroup(struct sScopeStream *stream)
+{
+  uint8_t c;
+
+  for (c = 0; c < stream->config.channels; c++) {
+    stream->sum[c] = 0;
+    stream->min[c] = INT16_MAX;
+    stream->max[c] = INT16_MIN;
+  }
+  stream->inGroup = 0;
+}
+
+static void SetFactor(struct sScopeStream *stream)
+{
+  stream->factor = stream->baseFactor << stream->backOff;
+  stream->divide = FastDivInit(stream->factor);
+}
+
+int ScopeStreamInit(struct sScopeStream *stream, const struct sScopeConfig *config,
+                    struct sSpscRing *queue)
+{
+  uint32_t values = config->mode == SCOPE_MIN_MAX ? 2 : 1;
+  uint32_t payload = SCOPE_HEADER_BYTES + config->pointsPerFrame * config->channels * values * 2;
+
+  if (config->channels == 0 || config->channels > SCOPE_MAX_CHANNELS ||
+      config->displayRateHz == 0 || config->displayRateHz > config->sampleRateHz ||
+      config->pointsPerFrame == 0 || config->pointsPerFrame > SCOPE_MAX_POINTS ||
+      (config->sampleRateHz / config->displayRateHz) << SCOPE_MAX_BACK_OFF > 65536 ||
+      queue->mask + 1 < COBS_MAX_ENCODED(payload + 2) + 1) {
+    return -1;
+  }
+  stream->config = *config;
+  stream->queue = queue;
+  CrcSetup(&stream->crc, CRC_16_CCITT, CRC_BEST);
+  stream->baseFactor = config->sampleRateHz / config->displayRateHz;
+  stream->backOff = 0;
+  SetFactor(stream);
+  StartGroup(stream);
+  stream->points = 0;
+  stream->sequence = 0;
+  stream->sampleIndex = 0;
+  stream->frameStart = 0;
+  stream->samplesIn = 0;
+  stream->framesQueued = 0;
+  stream->framesDropped = 0;
+  stream->backOffs = 0;
+  stream->bytesWritten = 0;
+  stream->writesBlocked = 0;
+  return 0;
+}
+
+static uint8_t *Put16(uint8_t *p, uint16_t value)
+{
+  p[0] = (uint8_t)value;
+  p[1] = (uint8_t)(value >> 8);
+  return p + 2;
+}
+
+static uint8_t *Put32(uint8_t *p, uint32_t value)
+{
+  return Put16(Put16(p, (uint16_t)value), (uint16_t)(value >> 16));
+}
+
+static void SendFrame(struct sScopeStream *stream)
+{
+  uint32_t values = stream->config.mode == SCOPE_MIN_MAX ? 2 : 1;
+  uint32_t length = SCOPE_HEADER_BYTES + stream->points * stream->config.channels * values * 2;
+  uint32_t capacity = stream->queue->mask + 1, used;
+  uint8_t *p = stream->frame;
+  int queued;
+
+  *p++ = SCOPE_FRAME_VERSION;
+  *p++ = stream->config.channels;
+  *p++ = (uint8_t)stream->config.mode;
+  *p++ = stream->backOff;
+  p = Put16(p, stream->sequence++);
+  p = Put32(p, stream->factor);
+  p = Put32(p, stream->frameStart);
+  Put16(p, stream->points);
+
+  queued = CobsWriteFrame(stream->queue, &stream->crc, stream->frame, length) == 0;
+  if (queued) {
+    stream->framesQueued++;
+  } else {
+    stream->framesDropped++;
+  }
+  stream->points = 0;
+  stream->frameStart = stream->sampleIndex;
+
+  if (stream->config.policy == SCOPE_BACK_OFF) {
+    // the factor changes between frames, never within one
+    used = capacity - SpscWriteAvailable(stream->queue);
+    if ((!queued || used > capacity / 4 * 3) && stream->backOff < SCOPE_MAX_BACK_OFF) {
+      stream->backOff++;
+      stream->backOffs++;
+      SetFactor(stream);
+    } else if (queued && used < capacity / 4 && stream->backOff > 0) {
+      stream->backOff--;
+      SetFactor(stream);
+    }
+  }
+}
+
+static void EndPoint(struct sScopeStream *stream)
+{
+  uint8_t channels = stream->config.channels, c;
+  uint32_t values = stream->config.mode == SCOPE_MIN_MAX ? 2 : 1;
+  uint8_t *p = stream->frame + SCOPE_HEADER_BYTES + stream->points * channels * values * 2;
+
+  for (c = 0; c < channels; c++) {
+    if (stream->config.mode == SCOPE_MIN_MAX) {
+      p = Put16(p, (uint16_t)stream->min[c]);
+      p = Put16(p, (uint16_t)stream->max[c]);
+    } else {
+      p = Put16(p, (uint16_t)FastDivS32(stream->sum[c], &stream->divide));
+    }
+  }
+  stream->points++;
+  if (stream->points == stream->config.pointsPerFrame) {
+    SendFrame(stream);
+  }
+  StartGroup(stream);
+}
+
+void ScopeStreamPut(struct sScopeStream *stream, const int16_t *samples, uint32_t frames)
+{
+  uint8_t channels = stream->config.channels, c;
+
+  stream->samplesIn += frames;
+  while (frames > 0) {
+    uint32_t take = stream->factor - stream->inGroup, i;
+    if (take > frames) {
+      take = frames;
+    }
+    for (c = 0; c < channels; c++) {
+      const int16_t *s = samples + c;
+      if (stream->config.mode == SCOPE_MIN_MAX) {
+        int16_t low = stream->min[c], high = stream->max[c];
+        for (i = 0; i < take; i++, s += channels) {
+          low = *s < low ? *s : low;
+          high = *s > high ? *s : high;
+        }
+        stream->min[c] = low;
+        stream->max[c] = high;
+      } else {
+        int32_t sum = stream->sum[c];
+        for (i = 0; i < take; i++, s += channels) {
+          sum += *s;
+        }
+        stream->sum[c] = sum;
+      }
+    }
+    samples += take * channels;
+    frames -= take;
+    stream->inGroup += take;
+    stream->sampleIndex += take;
+    if (stream->inGroup == stream->factor) {
+      EndPoint(stream);
+    }
+  }
+}
+
+long ScopeStreamDrain(struct sScopeStream *stream, int fd)
+{
+  long total = 0;
+
+  for (;;) {
+    uint32_t span;
+    const uint8_t *data = SpscReadSpan(stream->queue, &span);
+    ssize_t written;
+
+    if (span == 0) {
+      return total;
+    }
+    written = write(fd, data, span);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        stream->writesBlocked++;
+        return total;
+      }
+      return -1;
+    }
+    SpscReadRelease(stream->queue, (uint32_t)written);
+    stream->bytesWritten += (uint64_t)written;
+    total += written;
+    if ((uint32_t)written < span) {
+      stream->writesBlocked++;
+      return total;
+    }
+  }
+}
@@ -0,0 +1,111 @@
+/*
+ * scope_stream.h
+ *
+ * Live data out of a serial port (or a pty or socket) for a serial
+ * oscilloscope on the PC. The sample path hands over blocks of
+ * multi-channel samples as they come in; they are reduced to the rate the
+ * display needs, packed into frames and queued. Something else (a lower
+ * priority task, the UART's DMA, or here a writer thread) drains the queue
+ * to the port.
+ *
+ * Reducing: the ADC in SpeedsAndFeedsDiagram.md makes 44100 samples a second
+ * on each of 4 channels, 352800 bytes/s. A UART at 115200 baud moves about
+ * 11500. The display only needs a few thousand points a second, so each
+ * group of samples becomes one point:
+ *   SCOPE_DECIMATE   the average of the group (a crude low pass, so it
+ *                    doesn't alias the way keeping every Nth sample would)
+ *   SCOPE_MIN_MAX    the smallest and biggest in the group, so a spike one
+ *                    sample wide still shows, at twice the bytes
+ *
+ * Putting samples never waits for the port. If the queue doesn't have room
+ * for a frame, the frame is dropped and counted. With SCOPE_BACK_OFF the
+ * stream also halves its point rate each time the queue gets three quarters
+ * full (or a frame is dropped), and doubles it again when the queue is down
+ * to a quarter, so a slow link gets a coarser picture instead of gaps.
+ *
+ * Frames are COBS framed with a CRC-16 (../Ch07_Communication/cobs.h), so
+ * the PC side can start listening at any time and skip damaged frames.
+ * A frame's payload, all little endian:
+ *    0  uint8   SCOPE_FRAME_VERSION
+ *    1  uint8   channels
+ *    2  uint8   mode
+ *    3  uint8   back off level
+ *    4  uint16  sequence number, counts frames dropped as well as sent
+ *    6  uint32  input samples per point
+ *   10  uint32  index of the first input sample in the frame
+ *   14  uint16  points
+ *   16  int16   the points, channels interleaved (min then max for each
+ *               channel in SCOPE_MIN_MAX)
+ */
+#ifndef SCOPE_STREAM_H
+#define SCOPE_STREAM_H
+
+#include <stdint.h>
+#include "spsc_ring.h"
+#include "crc.h"
+#include "fastdiv.h"
+
+#define SCOPE_MAX_CHANNELS 8
+#define SCOPE_MAX_POINTS 256          // per frame
+#define SCOPE_MAX_BACK_OFF 8
+#define SCOPE_FRAME_VERSION 1
+#define SCOPE_HEADER_BYTES 16
+#define SCOPE_MAX_FRAME (SCOPE_HEADER_BYTES + SCOPE_MAX_POINTS * SCOPE_MAX_CHANNELS * 2 * 2)
+
+enum eScopeMode { SCOPE_DECIMATE, SCOPE_MIN_MAX };
+enum eScopeDropPolicy { SCOPE_DROP_FRAMES, SCOPE_BACK_OFF };
+
+struct sScopeConfig {
+  uint8_t channels;
+  uint32_t sampleRateHz;        // per channel, in
+  uint32_t displayRateHz;       // points per second per channel, out
+  enum eScopeMode mode;
+  enum eScopeDropPolicy policy;
+  uint16_t pointsPerFrame;
+};
+
+struct sScopeStream {
+  struct sScopeConfig config;
+  struct sSpscRing *queue;
+  struct sCrc crc;
+  uint32_t baseFactor;          // input samples per point with no back off
+  uint32_t factor;              // now, for the frame being filled
+  struct sFastDiv divide;       // by factor
+  uint8_t backOff;
+
+  // the group being reduced to a point
+  int32_t sum[SCOPE_MAX_CHANNELS];
+  int16_t min[SCOPE_MAX_CHANNELS];
+  int16_t max[SCOPE_MAX_CHANNELS];
+  uint32_t inGroup;
+
+  uint8_t frame[SCOPE_MAX_FRAME];
+  uint16_t points;              // in frame
+  uint16_t sequence;
+  uint32_t sampleIndex;         // of the next input sample
+  uint32_t frameStart;
+
+  // counts, written by the producer
+  uint64_t samplesIn;
+  uint32_t framesQueued;
+  uint32_t framesDropped;
+  uint32_t backOffs;
+  // counts, written by the writer
+  uint64_t bytesWritten;
+  uint32_t writesBlocked;       // the port was full (EAGAIN)
+};
+
+// queue is the producer side of an SPSC ring (spsc_ring.h) that holds a few
+// frames. Returns 0, or -1 if the config doesn't make sense.
+int ScopeStreamInit(struct sScopeStream *stream, const struct sScopeConfig *config,
+                    struct sSpscRing *queue);
+
+// The producer side: samples are interleaved by channel, frames of them
+void ScopeStreamPut(struct sScopeStream *stream, const int16_t *samples, uint32_t frames);
+
+// The writer side: writes what is queued to fd (make it non-blocking) until
+// the queue is empty or the port is full. Returns bytes written, or -1 on
+// an error other than the port being full.
+long ScopeStreamDrain(struct sScopeStream *stream, int fd);
+
+#endif // SCOPE_STREAM_H
@@ -0,0 +1,406 @@
+/*
+ * scope_stream_demo.c
+ *
+ * The ADC stream from SpeedsAndFeedsDiagram.md (4 channels, 44.1 kHz)
+ * through scope_stream.h to a serial oscilloscope, in real time.
+ *
+ * gcc -O2 -I../Ch07_Communication -I../Ch10_Connected -I../Ch12_Math scope_stream_demo.c
+ *     scope_stream.c ../Ch07_Communication/cobs.c ../Ch10_Connected/crc.c -o scope_stream_demo
+ *     -lpthread -lm
+ * ./scope_stream_demo [seconds per run]        links of different speeds, simulated
+ * ./scope_stream_demo pty [seconds]            stream to a pty, the name is printed
+ * ./scope_stream_demo tcp <port> [seconds]     stream to the first TCP client
+ *
+ * Three threads, as on a device with an RTOS:
+ *   producer  makes 64 samples per channel every 1.45 ms, on schedule, and
+ *             puts them to the stream (the ADC's DMA complete interrupt)
+ *   writer    drains the stream's queue to the port when it will take
+ *             more (a low priority task feeding the UART)
+ *   link      simulated runs only: a pipe shrunk to 4 KB read at the
+ *             link's speed (the UART and the PC), decoding and checking
+ *             every frame that arrives
+ *
+ * The display rate is a tenth of the input, as in the diagram. Each run is
+ * one link speed, the average or the min and max of each group, and drop
+ * frames or back off. The table shows whether the picture got there, and
+ * that the producer was never held up: Put takes the same couple of
+ * microseconds whatever the link is doing. (Its longest, and blocks that
+ * started late, depend on the host: with one core the other threads can
+ * run in the middle of a Put.)
+ *
+ * The signals: channel 0 a ramp, 1 a sine, 2 a sine with a one sample
+ * spike every 1000 samples (look for it in min/max, gone in the average),
+ * 3 a constant 1000, which the link thread checks every point of.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <termios.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "scope_stream.h"
+#include "cobs.h"
+
+#define CHANNELS 4
+#define SAMPLE_RATE 44100
+#define BLOCK_FRAMES 64
+#define DISPLAY_RATE (SAMPLE_RATE / 10)
+#define POINTS_PER_FRAME 64
+#define QUEUE_BYTES 8192u
+#define PIPE_BYTES 4096
+#define CONSTANT 1000
+
+static const char *const kModeNames[] = { "average", "min/max" };
+static const char *const kPolicyNames[] = { "drop frames", "back off" };
+
+struct sRun {
+  struct sScopeStream stream;
+  struct sSpscRing queue;
+  uint8_t queueBuffer[QUEUE_BYTES];
+  int fd;                       // the writer writes here
+  int linkFd;                   // the link reads here, -1 if not simulated
+  uint32_t linkBytesPerSecond;
+  atomic_int linkFlush;         // read the rest as fast as it comes
+  atomic_int writing;
+
+  // producer
+  uint64_t putNsMax;
+  uint64_t putNsTotal;
+  uint32_t puts;
+  uint32_t lateWakeups;
+
+  // link, from what arrived
+  uint32_t frames;
+  uint32_t badFrames;           // CRC, COBS, or not what was sent
+  uint32_t gaps;                // frames missing by sequence number
+  uint32_t points;
+  uint8_t lastBackOff;
+  uint16_t nextSequence;
+  uint32_t nextSample;
+};
+
+static uint64_t NowNs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void SleepUntil(uint64_t ns)
+{
+  struct timespec ts = { (time_t)(ns / 1000000000u), (long)(ns % 1000000000u) };
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+  }
+}
+
+static void MakeBlock(int16_t *block, uint32_t firstSample)
+{
+  uint32_t i;
+
+  for (i = 0; i < BLOCK_FRAMES; i++) {
+    uint32_t n = firstSample + i;
+    int16_t *frame = block + i * CHANNELS;
+    frame[0] = (int16_t)((n * 16) & 0x7FFF);
+    frame[1] = (int16_t)(8000 * sin(2 * M_PI * 50 * n / SAMPLE_RATE));
+    frame[2] = (int16_t)(4000 * sin(2 * M_PI * 3 * n / SAMPLE_RATE) + (n % 1000 == 0 ? 20000 : 0));
+    frame[3] = CONSTANT;
+  }
+}
+
+/******************************************************************************************************
+ * Threads
+*******************************************************************************************************/
+static void *Writer(void *context)
+{
+  struct sRun *run = context;
+  struct pollfd port = { run->fd, POLLOUT, 0 };
+
+  while (atomic_load(&run->writing)) {
+    if (ScopeStreamDrain(&run->stream, run->fd) < 0) {
+      perror("write");
+      break;
+    }
+    if (SpscReadAvailable(&run->queue) != 0) {
+      poll(&port, 1, 5);          // the port is full: wait until it takes more
+    } else {
+      usleep(1000);
+    }
+  }
+  return NULL;
+}
+
+static void Deliver(void *context, const uint8_t *payload, size_t length)
+{
+  struct sRun *run = context;
+  uint16_t sequence, points;
+  uint32_t factor, start, i, values;
+  uint8_t mode, channels;
+  const uint8_t *p;
+
+  if (length < SCOPE_HEADER_BYTES || payload[0] != SCOPE_FRAME_VERSION) {
+    run->badFrames++;
+    return;
+  }
+  channels = payload[1];
+  mode = payload[2];
+  sequence = (uint16_t)(payload[4] | payload[5] << 8);
+  memcpy(&factor, payload + 6, 4);        // the host is little endian too
+  memcpy(&start, payload + 10, 4);
+  points = (uint16_t)(payload[14] | payload[15] << 8);
+  values = mode == SCOPE_MIN_MAX ? 2 : 1;
+  if (channels != CHANNELS || length != SCOPE_HEADER_BYTES + points * channels * values * 2u) {
+    run->badFrames++;
+    return;
+  }
+  if (sequence != run->nextSequence) {
+    run->gaps += (uint16_t)(sequence - run->nextSequence);
+  } else if (run->frames > 0 && start != run->nextSample) {
+    run->badFrames++;             // no frame missing, but the samples don't follow on
+  }
+  // every point of the constant channel is the constant, average or min/max
+  for (i = 0, p = payload + SCOPE_HEADER_BYTES; i < points; i++, p += channels * values * 2) {
+    const uint8_t *constant = p + 3 * values * 2;
+    if ((int16_t)(constant[0] | constant[1] << 8) != CONSTANT) {
+      run->badFrames++;
+      break;
+    }
+  }
+  run->frames++;
+  run->points += points;
+  run->lastBackOff = payload[3];
+  run->nextSequence = (uint16_t)(sequence + 1);
+  run->nextSample = start + points * factor;
+}
+
+// The UART and the PC: reads at the link's speed, 10 ms at a time
+static void *Link(void *context)
+{
+  static uint8_t frame[SCOPE_MAX_FRAME + 2];
+  struct sRun *run = context;
+  struct sCobsDecoder decoder;
+  struct sCrc crc;
+  uint8_t buffer[4096];
+  uint64_t next = NowNs();
+  uint32_t perTick = run->linkBytesPerSecond / 100;
+
+  CrcSetup(&crc, CRC_16_CCITT, CRC_BEST);
+  CobsDecoderInit(&decoder, &crc, frame, sizeof(frame), Deliver, run);
+  for (;;) {
+    int flushing = atomic_load(&run->linkFlush);
+    size_t want = flushing || perTick > sizeof(buffer) ? sizeof(buffer) : perTick;
+    ssize_t got = read(run->linkFd, buffer, want);
+    if (got > 0) {
+      CobsDecoderFeed(&decoder, buffer, (size_t)got);
+    } else if (got == 0 || (flushing && errno == EAGAIN)) {
+      break;
+    }
+    if (!flushing) {
+      next += 10000000u;
+      SleepUntil(next);
+    }
+  }
+  run->badFrames += decoder.badCrc + decoder.malformed;
+  return NULL;
+}
+
+// The ADC: a block of samples every 1.45 ms, on schedule
+static void Produce(struct sRun *run, double seconds)
+{
+  static int16_t block[BLOCK_FRAMES * CHANNELS];
+  uint64_t start = NowNs(), blockNs = 1000000000ull * BLOCK_FRAMES / SAMPLE_RATE;
+  uint32_t blocks = (uint32_t)(seconds * SAMPLE_RATE / BLOCK_FRAMES), b;
+
+  for (b = 0; b < blocks; b++) {
+    uint64_t due = start + b * blockNs, before, took;
+    SleepUntil(due);
+    if (NowNs() > due + blockNs) {
+      run->lateWakeups++;         // the host was busy, not the stream
+    }
+    MakeBlock(block, b * BLOCK_FRAMES);
+    before = NowNs();
+    ScopeStreamPut(&run->stream, block, BLOCK_FRAMES);
+    took = NowNs() - before;
+    run->putNsTotal += took;
+    run->putNsMax = took > run->putNsMax ? took : run->putNsMax;
+    run->puts++;
+  }
+}
+
+static int Start(struct sRun *run, enum eScopeMode mode, enum eScopeDropPolicy policy)
+{
+  struct sScopeConfig config = { CHANNELS, SAMPLE_RATE, DISPLAY_RATE, mode, policy,
+                                 POINTS_PER_FRAME };
+
+  SpscRingInit(&run->queue, run->queueBuffer, QUEUE_BYTES);
+  if (ScopeStreamInit(&run->stream, &config, &run->queue) != 0) {
+    fprintf(stderr, "bad scope config\n");
+    return -1;
+  }
+  atomic_store(&run->writing, 1);
+  return 0;
+}
+
+/******************************************************************************************************
+ * Simulated links
+*******************************************************************************************************/
+static void Simulate(uint32_t linkBytesPerSecond, enum eScopeMode mode,
+                     enum eScopeDropPolicy policy, double seconds)
+{
+  static struct sRun run;
+  pthread_t writer, link;
+  int pipeFds[2];
+  uint32_t needed = DISPLAY_RATE * CHANNELS * 2 * (mode == SCOPE_MIN_MAX ? 2 : 1);
+
+  memset(&run, 0, sizeof(run));
+  if (pipe2(pipeFds, O_NONBLOCK) != 0) {
+    perror("pipe");
+    exit(1);
+  }
+  fcntl(pipeFds[1], F_SETPIPE_SZ, PIPE_BYTES);  // a UART driver's buffer, not 64 KB
+  run.fd = pipeFds[1];
+  run.linkFd = pipeFds[0];
+  run.linkBytesPerSecond = linkBytesPerSecond;
+  if (Start(&run, mode, policy) != 0) {
+    exit(1);
+  }
+  pthread_create(&writer, NULL, Writer, &run);
+  pthread_create(&link, NULL, Link, &run);
+  Produce(&run, seconds);
+
+  // let what was queued get through, then stop
+  while (SpscReadAvailable(&run.queue) != 0) {
+    usleep(10000);
+  }
+  atomic_store(&run.writing, 0);
+  pthread_join(writer, NULL);
+  close(pipeFds[1]);
+  atomic_store(&run.linkFlush, 1);
+  pthread_join(link, NULL);
+  close(pipeFds[0]);
+
+  printf("  %7u %6.0f%%  %-8s %-12s %6u %7u %6u %6u %6.0f %4u %7.1f %7.1f %5u%s\n",
+         linkBytesPerSecond, 100.0 * needed / linkBytesPerSecond, kModeNames[mode],
+         kPolicyNames[policy], run.stream.framesQueued, run.stream.framesDropped,
+         run.lastBackOff, run.gaps, run.points / seconds, run.badFrames,
+         run.putNsTotal / 1000.0 / run.puts, run.putNsMax / 1000.0, run.lateWakeups,
+         run.frames != run.stream.framesQueued ? "  LOST" : "");
+}
+
+/******************************************************************************************************
+ * A real pty or socket
+*******************************************************************************************************/
+static int OpenPty(void)
+{
+  struct termios raw;
+  int fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+
+  if (fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0) {
+    perror("pty");
+    exit(1);
+  }
+  tcgetattr(fd, &raw);
+  cfmakeraw(&raw);                // binary: no newline translation or echo
+  tcsetattr(fd, TCSANOW, &raw);
+  printf("Streaming to %s (COBS frames, see scope_stream.h)\n", ptsname(fd));
+  fflush(stdout);
+  return fd;
+}
+
+static int OpenTcp(int port)
+{
+  struct sockaddr_in address;
+  int listener = socket(AF_INET, SOCK_STREAM, 0), fd, on = 1;
+
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons((uint16_t)port);
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  if (listener < 0 || bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+      listen(listener, 1) != 0) {
+    perror("socket");
+    exit(1);
+  }
+  printf("Waiting for a connection on port %d\n", port);
+  fflush(stdout);
+  fd = accept(listener, NULL, NULL);
+  close(listener);
+  if (fd < 0) {
+    perror("accept");
+    exit(1);
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  return fd;
+}
+
+static void Stream(int fd, double seconds)
+{
+  static struct sRun run;
+  pthread_t writer;
+
+  memset(&run, 0, sizeof(run));
+  run.fd = fd;
+  run.linkFd = -1;
+  if (Start(&run, SCOPE_MIN_MAX, SCOPE_BACK_OFF) != 0) {
+    exit(1);
+  }
+  pthread_create(&writer, NULL, Writer, &run);
+  Produce(&run, seconds);
+  atomic_store(&run.writing, 0);
+  pthread_join(writer, NULL);
+  printf("%u frames queued, %u dropped, %llu bytes written, %u times the port was full,\n"
+         "back off level %u, Put took %.1f us at most\n",
+         run.stream.framesQueued, run.stream.framesDropped,
+         (unsigned long long)run.stream.bytesWritten, run.stream.writesBlocked,
+         run.stream.backOff, run.putNsMax / 1000.0);
+  close(fd);
+}
+
+int main(int argc, char *argv[])
+{
+  static const uint32_t kLinks[] = { 11520, 100000 };   // 115200 and 1M baud, 10 bits a byte
+  double seconds = 3;
+  uint32_t l;
+  int mode, policy;
+
+  if (argc > 1 && strcmp(argv[1], "pty") == 0) {
+    Stream(OpenPty(), argc > 2 ? atof(argv[2]) : 60);
+    return 0;
+  }
+  if (argc > 2 && strcmp(argv[1], "tcp") == 0) {
+    Stream(OpenTcp(atoi(argv[2])), argc > 3 ? atof(argv[3]) : 60);
+    return 0;
+  }
+  if (argc > 1) {
+    seconds = atof(argv[1]);
+  }
+
+  printf("%d channels at %d Hz to %d points/s per channel, %d points a frame, %u byte queue\n\n",
+         CHANNELS, SAMPLE_RATE, DISPLAY_RATE, POINTS_PER_FRAME, QUEUE_BYTES);
+  printf("  %7s %7s  %-8s %-12s %6s %7s %6s %6s %6s %4s %7s %7s %5s\n", "link B/s", "needs",
+         "points", "policy", "frames", "dropped", "level", "gaps", "pts/s", "bad", "Put us",
+         "max us", "late");
+  for (l = 0; l < sizeof(kLinks) / sizeof(kLinks[0]); l++) {
+    for (mode = SCOPE_DECIMATE; mode <= SCOPE_MIN_MAX; mode++) {
+      for (policy = SCOPE_DROP_FRAMES; policy <= SCOPE_BACK_OFF; policy++) {
+        Simulate(kLinks[l], (enum eScopeMode)mode, (enum eScopeDropPolicy)policy, seconds);
+      }
+    }
+  }
+  printf("\n  needs: the bytes/s of points with no back off, as a share of the link.\n"
+         "  level: the back off at the end, each level halves the points.\n"
+         "  gaps: frames the PC side found missing; they are the drops.\n"
+         "  Put us: the producer's time in ScopeStreamPut for each block, on average and at\n"
+         "  most. late: blocks the producer started more than a block late. On a busy or\n"
+         "  one core host both of those are the scheduler, not the stream.\n");
+  return 0;
+}
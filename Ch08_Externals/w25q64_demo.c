@@ -0,0 +1,371 @@
+/*
+ * w25q64_demo.c
+ *
+ * The data store from SpeedsAndFeedsDiagram.md on a simulated W25Q64
+ * (w25q64_sim.h): 194040 bytes/s arrive in 256 byte pages, sit in a RAM
+ * buffer, and a logger writes them to the flash over a 100 MHz SPI bus
+ * (../Ch07_Communication/bus_sim.h). The diagram guesses that erasing takes
+ * about 500 ms and programming 330 ms of every second, and that a 32 KB
+ * buffer covers an erase. This checks that with the datasheet times.
+ *
+ * gcc -O2 -I../Ch07_Communication w25q64_demo.c w25q64_sim.c ../Ch07_Communication/bus_sim.c -o w25q64_demo
+ * ./w25q64_demo [flash file]
+ *
+ * The logger only uses bus.h. For each step it polls the status register
+ * until the flash isn't busy, sends write enable, then either erases the
+ * next erase unit (when it gets to one) or programs a page. The RAM buffer
+ * fills while the flash is busy; a page that arrives to a full buffer is
+ * lost.
+ *
+ * Part 1 tries each erase size with typical and maximum times. Part 2 is a
+ * logger with the erase left out, on flash it already wrote. Part 3 runs a
+ * circular log for a simulated hour in a 1 MB region and in the whole chip
+ * and works out how long the chip would last. Given a file, Part 3 uses it
+ * for the flash so the wear adds up over runs.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bus_sim.h"
+#include "w25q64_sim.h"
+
+#define BYTES_PER_SECOND 194040.0
+#define BUFFER_BYTES 32768u
+#define POLL_NS 50000
+#define MS 1000000ull
+#define SECOND 1000000000ull
+
+/******************************************************************************************************
+ * The logger, using only bus.h
+*******************************************************************************************************/
+enum eLogState { LOG_IDLE, LOG_POLL, LOG_ENABLE, LOG_COMMAND };
+
+struct sLogger {
+  struct sBusDevice *device;
+  struct sBusSim *sim;              // only for the poll timer
+  uint32_t eraseSize;               // 0: never erase (a bug)
+  uint8_t eraseCommand;
+  uint32_t regionPages;             // a circular log from address 0
+  enum eLogState state;
+  int erasing;
+
+  uint32_t buffered;                // pages in RAM
+  uint32_t bufferedMax;
+  uint32_t lost;
+  uint64_t written;                 // pages, which is also the next page's number
+  uint64_t erasedTo;                // pages from written on that are erased already
+  uint32_t polls;
+
+  uint8_t command;
+  uint8_t status;
+  uint8_t frame[4 + W25Q_PAGE];     // command, address, data
+};
+
+// Each page holds its number, so what ends up in the flash can be checked
+static void FillPage(uint8_t *page, uint64_t number)
+{
+  uint32_t i;
+
+  for (i = 0; i < W25Q_PAGE; i++) {
+    page[i] = (uint8_t)(((uint32_t)number * 2654435761u >> 24) + i * 13 + (i >> 3));
+  }
+  memcpy(page, &number, sizeof(number));
+}
+
+static void LogStep(void *context, int status);
+
+static void LogPoll(void *context)
+{
+  struct sLogger *log = context;
+
+  log->polls++;
+  log->command = W25Q_READ_STATUS;
+  BusTransfer(log->device, &log->command, 1, &log->status, 1, LogStep, log);
+}
+
+static void LogStart(struct sLogger *log)
+{
+  if (log->state != LOG_IDLE || log->buffered == 0) {
+    return;
+  }
+  log->state = LOG_POLL;
+  LogPoll(log);
+}
+
+static void LogStep(void *context, int status)
+{
+  struct sLogger *log = context;
+  uint32_t address = (uint32_t)(log->written % log->regionPages) * W25Q_PAGE;
+
+  (void)status;
+  switch (log->state) {
+  case LOG_POLL:
+    if (log->status & W25Q_STATUS_BUSY) {
+      BusSimAt(log->sim, log->sim->now + POLL_NS, LogPoll, log);
+      return;
+    }
+    log->state = LOG_ENABLE;
+    log->command = W25Q_WRITE_ENABLE;
+    BusTransfer(log->device, &log->command, 1, NULL, 0, LogStep, log);
+    break;
+  case LOG_ENABLE:
+    log->state = LOG_COMMAND;
+    log->frame[1] = (uint8_t)(address >> 16);
+    log->frame[2] = (uint8_t)(address >> 8);
+    log->frame[3] = (uint8_t)address;
+    // erase when the log gets to the start of an erase unit, before its first page
+    log->erasing = log->eraseSize != 0 && address % log->eraseSize == 0 && !log->erasing;
+    if (log->erasing) {
+      log->erasedTo = log->written + log->eraseSize / W25Q_PAGE;
+      log->frame[0] = log->eraseCommand;
+      BusTransfer(log->device, log->frame, 4, NULL, 0, LogStep, log);
+    } else {
+      log->frame[0] = W25Q_PAGE_PROGRAM;
+      FillPage(log->frame + 4, log->written);
+      BusTransfer(log->device, log->frame, sizeof(log->frame), NULL, 0, LogStep, log);
+    }
+    break;
+  case LOG_COMMAND:
+    if (!log->erasing) {
+      log->written++;
+      log->buffered--;
+    }
+    log->state = LOG_IDLE;
+    if (log->erasing) {
+      log->state = LOG_POLL;        // the page that was waiting for the erase
+      LogPoll(log);
+    } else {
+      LogStart(log);
+    }
+    break;
+  case LOG_IDLE:
+    break;
+  }
+}
+
+struct sPageTimer {
+  struct sBusSim *sim;
+  struct sLogger *log;
+  uint64_t startNs;
+  double periodNs;
+  uint64_t count;
+};
+
+static void PageArrives(void *context)
+{
+  struct sPageTimer *timer = context;
+  struct sLogger *log = timer->log;
+
+  timer->count++;
+  BusSimAt(timer->sim, timer->startNs + (uint64_t)((timer->count + 1) * timer->periodNs),
+           PageArrives, timer);
+  if ((log->buffered + 1) * W25Q_PAGE > BUFFER_BYTES) {
+    log->lost++;
+  } else {
+    log->buffered++;
+    log->bufferedMax = log->buffered > log->bufferedMax ? log->buffered : log->bufferedMax;
+  }
+  LogStart(log);
+}
+
+/******************************************************************************************************
+ * Running it
+*******************************************************************************************************/
+struct sRun {
+  struct sBusSim sim;
+  struct sBusDevice device;
+  struct sLogger log;
+  struct sPageTimer timer;
+  uint64_t elapsedNs;
+  uint64_t overrunNs;               // busy time counted that falls after the end
+};
+
+static const struct sBusConfig kSpi = { BUS_SPI, SERVICE_DMA, 100000000, 20, 100, 500, 400 };
+
+static void LogRun(struct sRun *run, struct sW25q64 *flash, uint32_t eraseSize, uint8_t eraseCommand,
+                   uint32_t regionBytes, uint64_t runNs)
+{
+  memset(run, 0, sizeof(*run));
+  BusSimInit(&run->sim, &kSpi);
+  BusSimAddDevice(&run->sim, &run->device, "W25Q64", W25qRespond, flash);
+  run->log.device = &run->device;
+  run->log.sim = &run->sim;
+  run->log.eraseSize = eraseSize;
+  run->log.eraseCommand = eraseCommand;
+  run->log.regionPages = regionBytes / W25Q_PAGE;
+  run->timer.sim = &run->sim;
+  run->timer.log = &run->log;
+  run->timer.periodNs = 1e9 * W25Q_PAGE / BYTES_PER_SECOND;
+
+  // carry on from a flash that is part way through something
+  run->sim.now = flash->busyUntil;
+  run->timer.startNs = run->sim.now;
+  BusSimAt(&run->sim, run->sim.now + (uint64_t)run->timer.periodNs, PageArrives, &run->timer);
+  BusSimRun(&run->sim, run->timer.startNs + runNs);
+  run->elapsedNs = runNs;
+  run->overrunNs = flash->busyUntil > run->timer.startNs + runNs
+                 ? flash->busyUntil - run->timer.startNs - runNs : 0;
+}
+
+// Pages that don't hold what the logger last wrote there, leaving out the
+// oldest ones that were erased to make room
+static uint32_t Verify(const struct sW25q64 *flash, const struct sLogger *log)
+{
+  uint8_t expected[W25Q_PAGE];
+  uint64_t end = log->erasedTo > log->written ? log->erasedTo : log->written;
+  uint64_t first = end > log->regionPages ? end - log->regionPages : 0, n;
+  uint32_t bad = 0;
+
+  for (n = first; n < log->written; n++) {
+    FillPage(expected, n);
+    bad += memcmp(flash->memory + (n % log->regionPages) * W25Q_PAGE, expected, W25Q_PAGE) != 0;
+  }
+  return bad;
+}
+
+static double PerSecond(uint64_t ns, uint64_t elapsedNs)
+{
+  return (double)ns / MS / ((double)elapsedNs / SECOND);
+}
+
+static void PrintRunHeader(void)
+{
+  printf("  erase  timing   erase ms/s  program ms/s  busy %%  bus %%  buffer max     lost  "
+         "bad pages  polls/s\n");
+}
+
+static void PrintRun(const char *erase, const char *timing, const struct sRun *run,
+                     const struct sW25q64 *flash)
+{
+  double eraseMs = PerSecond(flash->stats.eraseNs, run->elapsedNs);
+  double programMs = PerSecond(flash->stats.programNs, run->elapsedNs);
+  double busyMs = PerSecond(flash->stats.eraseNs + flash->stats.programNs - run->overrunNs,
+                            run->elapsedNs);
+
+  printf("  %-5s  %-7s %10.0f %13.0f %7.0f %6.2f %8u B %8u %10u %8.0f\n", erase, timing, eraseMs,
+         programMs, busyMs / 10, 100.0 * run->sim.stats.busyNs / run->elapsedNs,
+         run->log.bufferedMax * W25Q_PAGE, run->log.lost, Verify(flash, &run->log),
+         run->log.polls / ((double)run->elapsedNs / SECOND));
+}
+
+static struct sRun gRun;
+
+static void OpenOrExit(struct sW25q64 *flash, const char *path, const struct sW25qTiming *timing)
+{
+  if (W25qOpen(flash, path, timing) < 0) {
+    perror(path != NULL ? path : "flash");
+    exit(1);
+  }
+}
+
+static void CheckId(struct sW25q64 *flash)
+{
+  static const uint8_t command = W25Q_JEDEC_ID;
+  uint8_t id[3];
+
+  BusSimInit(&gRun.sim, &kSpi);
+  BusSimAddDevice(&gRun.sim, &gRun.device, "W25Q64", W25qRespond, flash);
+  BusTransfer(&gRun.device, &command, 1, id, sizeof(id), NULL, NULL);
+  BusSimRun(&gRun.sim, MS);
+  printf("JEDEC ID %02X %02X %02X\n\n", id[0], id[1], id[2]);
+}
+
+/******************************************************************************************************
+ * Part 1: which erase size keeps up
+*******************************************************************************************************/
+static void EraseSizes(void)
+{
+  static const uint32_t sizes[] = { W25Q_SECTOR, W25Q_BLOCK_32K, W25Q_BLOCK_64K };
+  static const uint8_t commands[] = { W25Q_SECTOR_ERASE, W25Q_BLOCK_32K_ERASE, W25Q_BLOCK_64K_ERASE };
+  static const char *const names[] = { "4K", "32K", "64K" };
+  const struct sW25qTiming *timings[] = { &kW25qTypical, &kW25qMax };
+  const char *timingNames[] = { "typical", "max" };
+  struct sW25q64 flash;
+  int s, t;
+
+  printf("Part 1: logging %.0f bytes/s for 10 s through a %u byte buffer\n", BYTES_PER_SECOND,
+         BUFFER_BYTES);
+  PrintRunHeader();
+  for (t = 0; t < 2; t++) {
+    for (s = 0; s < 3; s++) {
+      OpenOrExit(&flash, NULL, timings[t]);
+      LogRun(&gRun, &flash, sizes[s], commands[s], W25Q_SIZE, 10 * SECOND);
+      PrintRun(names[s], timingNames[t], &gRun, &flash);
+      W25qClose(&flash);
+    }
+  }
+  printf("  (busy %% is the flash's, bus %% the SPI bus's; lost pages are gone for good)\n\n");
+}
+
+/******************************************************************************************************
+ * Part 2: forgetting to erase
+*******************************************************************************************************/
+static void NoErase(void)
+{
+  struct sW25q64 flash;
+
+  printf("Part 2: a 1 MB circular log (once round is 5.4 s): 10 s with erases, then 5 s with\n"
+         "        and 10 s more without\n");
+  PrintRunHeader();
+  OpenOrExit(&flash, NULL, &kW25qTypical);
+  LogRun(&gRun, &flash, W25Q_BLOCK_64K, W25Q_BLOCK_64K_ERASE, 1024 * 1024, 10 * SECOND);
+  PrintRun("64K", "typical", &gRun, &flash);
+  printf("  bits programmed 1 over 0: %llu\n", (unsigned long long)flash.stats.bitsNotSet);
+  W25qClose(&flash);
+
+  OpenOrExit(&flash, NULL, &kW25qTypical);
+  LogRun(&gRun, &flash, W25Q_BLOCK_64K, W25Q_BLOCK_64K_ERASE, 1024 * 1024, 5 * SECOND);
+  memset(&flash.stats, 0, sizeof(flash.stats));
+  LogRun(&gRun, &flash, 0, 0, 1024 * 1024, 10 * SECOND);
+  PrintRun("none", "typical", &gRun, &flash);
+  printf("  bits programmed 1 over 0: %llu (the logger saw no errors)\n\n",
+         (unsigned long long)flash.stats.bitsNotSet);
+  W25qClose(&flash);
+}
+
+/******************************************************************************************************
+ * Part 3: wear
+*******************************************************************************************************/
+static void Wear(const char *path)
+{
+  static const uint32_t regions[] = { 1024 * 1024, W25Q_SIZE };
+  struct sW25q64 flash;
+  uint32_t least, most, before;
+  uint64_t total;
+  int r;
+
+  printf("Part 3: a circular log for a simulated hour, 64 KB erases%s%s\n",
+         path != NULL ? ", flash in " : "", path != NULL ? path : "");
+  printf("  region   erases  sector wear least/most   lifetime at %u cycles\n", W25Q_ENDURANCE);
+  for (r = 0; r < 2; r++) {
+    OpenOrExit(&flash, path, &kW25qTypical);
+    W25qWear(&flash, &least, &before, &total);
+    LogRun(&gRun, &flash, W25Q_BLOCK_64K, W25Q_BLOCK_64K_ERASE, regions[r], 3600 * SECOND);
+    W25qWear(&flash, &least, &most, &total);
+    printf("  %4u KB %8u %12u/%-10u", regions[r] / 1024, flash.stats.block64Erases, least, most);
+    if (most >= W25Q_ENDURANCE) {
+      printf(" worn out\n");
+    } else {
+      // the hour just run sets the rate, what is already worn sets the start
+      printf(" %8.1f days\n", (double)(W25Q_ENDURANCE - most) / (most - before) / 24);
+    }
+    if (Verify(&flash, &gRun.log) != 0 || gRun.log.lost != 0) {
+      printf("    %u bad pages, %u lost\n", Verify(&flash, &gRun.log), gRun.log.lost);
+    }
+    W25qClose(&flash);
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  struct sW25q64 flash;
+
+  OpenOrExit(&flash, NULL, &kW25qTypical);
+  CheckId(&flash);
+  W25qClose(&flash);
+
+  EraseSizes();
+  NoErase();
+  Wear(argc > 1 ? argv[1] : NULL);
+  return 0;
+}
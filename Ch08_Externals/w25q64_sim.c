@@ -0,0 +1,254 @@
+/*
+ * w25q64_sim.c
+ *
+ * A simulated W25Q64 NOR flash, see w25q64_sim.h
+ *
+ * The file is mmap'd so a run that crashes still leaves what was written,
+ * as the chip would, and a big read is a memcpy. Erasing is a memset, which
+ * means the model is far faster than the part: the time it should take only
+ * shows up in the busy flag, which is the point.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "w25q64_sim.h"
+
+const struct sW25qTiming kW25qTypical = {
+  400000, 45000000, 120000000, 150000000, 20000000000ull
+};
+const struct sW25qTiming kW25qMax = {
+  3000000, 400000000, 1600000000, 2000000000, 100000000000ull
+};
+
+static const uint8_t kJedecId[] = { 0xEF, 0x40, 0x17 };    // Winbond, SPI NOR, 64 Mbit
+
+#define MAP_LENGTH (W25Q_SIZE + W25Q_SECTORS * sizeof(uint32_t))
+
+int W25qOpen(struct sW25q64 *flash, const char *path, const struct sW25qTiming *timing)
+{
+  struct stat info;
+  void *map;
+  int fd = -1, fresh = 1;
+
+  memset(flash, 0, sizeof(*flash));
+  flash->fd = -1;
+  if (path == NULL) {
+    map = mmap(NULL, MAP_LENGTH, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  } else {
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+      return -1;
+    }
+    if (fstat(fd, &info) < 0) {
+      close(fd);
+      return -1;
+    }
+    if (info.st_size != 0 && (size_t)info.st_size != MAP_LENGTH) {
+      close(fd);
+      errno = EINVAL;               // something else, don't scribble on it
+      return -1;
+    }
+    fresh = info.st_size == 0;
+    if (fresh && ftruncate(fd, (off_t)MAP_LENGTH) < 0) {
+      close(fd);
+      return -1;
+    }
+    map = mmap(NULL, MAP_LENGTH, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  if (map == MAP_FAILED) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    return -1;
+  }
+  flash->memory = map;
+  flash->wear = (uint32_t *)(flash->memory + W25Q_SIZE);
+  flash->mapLength = MAP_LENGTH;
+  flash->fd = fd;
+  flash->timing = *timing;
+  if (fresh) {
+    memset(flash->memory, 0xFF, W25Q_SIZE);     // shipped erased; the wear is already 0
+  }
+  return 0;
+}
+
+void W25qClose(struct sW25q64 *flash)
+{
+  if (flash->memory != NULL) {
+    munmap(flash->memory, flash->mapLength);
+    flash->memory = NULL;
+  }
+  if (flash->fd >= 0) {
+    close(flash->fd);
+    flash->fd = -1;
+  }
+}
+
+static uint32_t Address(const uint8_t *tx)
+{
+  return ((uint32_t)tx[1] << 16 | (uint32_t)tx[2] << 8 | tx[3]) & (W25Q_SIZE - 1);
+}
+
+static void Read(struct sW25q64 *flash, uint32_t address, uint8_t *rx, uint16_t rxLength)
+{
+  uint32_t first = W25Q_SIZE - address;
+
+  flash->stats.reads++;
+  flash->stats.bytesRead += rxLength;
+  // a read keeps going, and wraps from the top of the array to the bottom
+  while (rxLength > 0) {
+    if (first > rxLength) {
+      first = rxLength;
+    }
+    memcpy(rx, flash->memory + address, first);
+    rx += first;
+    rxLength -= (uint16_t)first;
+    address = 0;
+    first = W25Q_SIZE;
+  }
+}
+
+static void Program(struct sW25q64 *flash, uint32_t address, const uint8_t *data, uint16_t length,
+                    uint64_t nowNs)
+{
+  uint8_t latch[W25Q_PAGE], sent[W25Q_PAGE];
+  uint8_t *page = flash->memory + (address & ~(W25Q_PAGE - 1));
+  uint32_t offset = address & (W25Q_PAGE - 1), i;
+
+  // the page buffer starts all ones, and later bytes overwrite earlier ones
+  // when the address wraps around the page
+  memset(latch, 0xFF, sizeof(latch));
+  memset(sent, 0, sizeof(sent));
+  for (i = 0; i < length; i++) {
+    latch[(offset + i) & (W25Q_PAGE - 1)] = data[i];
+    sent[(offset + i) & (W25Q_PAGE - 1)] = 1;
+  }
+  for (i = 0; i < W25Q_PAGE; i++) {
+    if (sent[i]) {              // the 0xFF left in the rest of the latch isn't asking for a 1
+      flash->stats.bitsNotSet += (uint32_t)__builtin_popcount(latch[i] & ~page[i] & 0xFF);
+    }
+    page[i] &= latch[i];
+  }
+  flash->stats.programs++;
+  flash->stats.bytesProgrammed += length;
+  flash->stats.programNs += flash->timing.pageProgramNs;
+  flash->busyUntil = nowNs + flash->timing.pageProgramNs;
+}
+
+static void Erase(struct sW25q64 *flash, uint32_t address, uint32_t size, uint64_t busyNs,
+                  uint64_t nowNs)
+{
+  uint32_t sector;
+
+  address &= ~(size - 1);
+  memset(flash->memory + address, 0xFF, size);
+  for (sector = address / W25Q_SECTOR; sector < (address + size) / W25Q_SECTOR; sector++) {
+    flash->wear[sector]++;
+  }
+  flash->stats.eraseNs += busyNs;
+  flash->busyUntil = nowNs + busyNs;
+}
+
+void W25qRespond(void *model, const uint8_t *tx, uint16_t txLength, uint8_t *rx,
+                 uint16_t rxLength, uint64_t nowNs)
+{
+  struct sW25q64 *flash = model;
+  int busy = nowNs < flash->busyUntil, erase = 0;
+  uint8_t command;
+
+  if (txLength == 0) {
+    memset(rx, 0xFF, rxLength);
+    return;
+  }
+  command = tx[0];
+  if (command == W25Q_READ_STATUS) {
+    // WEL stays set until the program or erase finishes
+    memset(rx, busy ? W25Q_STATUS_BUSY | W25Q_STATUS_WEL
+                    : (flash->writeEnabled ? W25Q_STATUS_WEL : 0), rxLength);
+    return;
+  }
+  memset(rx, 0xFF, rxLength);
+  if (busy) {
+    flash->stats.ignoredBusy++;
+    return;
+  }
+
+  switch (command) {
+  case W25Q_WRITE_ENABLE:
+    flash->writeEnabled = 1;
+    break;
+  case W25Q_WRITE_DISABLE:
+    flash->writeEnabled = 0;
+    break;
+  case W25Q_JEDEC_ID:
+    memcpy(rx, kJedecId, rxLength < sizeof(kJedecId) ? rxLength : sizeof(kJedecId));
+    break;
+  case W25Q_READ:
+    if (txLength >= 4) {
+      Read(flash, Address(tx), rx, rxLength);
+    }
+    break;
+  case W25Q_FAST_READ:
+    if (txLength >= 5) {                // and a dummy byte
+      Read(flash, Address(tx), rx, rxLength);
+    }
+    break;
+  case W25Q_PAGE_PROGRAM:
+  case W25Q_SECTOR_ERASE:
+  case W25Q_BLOCK_32K_ERASE:
+  case W25Q_BLOCK_64K_ERASE:
+    erase = command != W25Q_PAGE_PROGRAM;
+    if (txLength < 4 || (!erase && txLength < 5)) {
+      break;                            // chip select went up too early: no effect
+    }
+    if (!flash->writeEnabled) {
+      flash->stats.ignoredNotEnabled++;
+      break;
+    }
+    flash->writeEnabled = 0;
+    if (command == W25Q_PAGE_PROGRAM) {
+      Program(flash, Address(tx), tx + 4, (uint16_t)(txLength - 4), nowNs);
+    } else if (command == W25Q_SECTOR_ERASE) {
+      Erase(flash, Address(tx), W25Q_SECTOR, flash->timing.sectorEraseNs, nowNs);
+      flash->stats.sectorErases++;
+    } else if (command == W25Q_BLOCK_32K_ERASE) {
+      Erase(flash, Address(tx), W25Q_BLOCK_32K, flash->timing.block32EraseNs, nowNs);
+      flash->stats.block32Erases++;
+    } else {
+      Erase(flash, Address(tx), W25Q_BLOCK_64K, flash->timing.block64EraseNs, nowNs);
+      flash->stats.block64Erases++;
+    }
+    break;
+  case W25Q_CHIP_ERASE:
+  case W25Q_CHIP_ERASE_ALT:
+    if (!flash->writeEnabled) {
+      flash->stats.ignoredNotEnabled++;
+      break;
+    }
+    flash->writeEnabled = 0;
+    Erase(flash, 0, W25Q_SIZE, flash->timing.chipEraseNs, nowNs);
+    flash->stats.chipErases++;
+    break;
+  default:
+    flash->stats.unknown++;
+    break;
+  }
+}
+
+void W25qWear(const struct sW25q64 *flash, uint32_t *least, uint32_t *most, uint64_t *total)
+{
+  uint32_t i;
+
+  *least = UINT32_MAX;
+  *most = 0;
+  *total = 0;
+  for (i = 0; i < W25Q_SECTORS; i++) {
+    uint32_t wear = flash->wear[i];
+    *least = wear < *least ? wear : *least;
+    *most = wear > *most ? wear : *most;
+    *total += wear;
+  }
+}
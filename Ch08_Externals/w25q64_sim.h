@@ -0,0 +1,114 @@
+/*
+ * w25q64_sim.h
+ *
+ * A W25Q64 (8 MB SPI NOR flash) to test storage code against without the
+ * chip: a device model for bus_sim.h (../Ch07_Communication) that answers
+ * the commands a data logger or file system uses, takes as long as the
+ * datasheet says, and keeps the contents and the wear in a file so they
+ * last between runs.
+ *
+ * It behaves the way NOR flash does, which is what storage code gets wrong:
+ *  - Programming can only clear bits. Each byte written is ANDed into the
+ *    array; a 1 written over a 0 stays 0 and is counted (bitsNotSet), so a
+ *    missing erase shows up as a number instead of as odd data later.
+ *  - Erase sets a whole 4 KB sector, 32 KB or 64 KB block, or the chip, back
+ *    to 0xFF and adds one to the wear count of each sector it covers.
+ *  - Page program wraps within its 256 byte page: past the end of the page
+ *    goes back to the start of it, and only the last 256 bytes sent count.
+ *  - Program and erase need a write enable first and clear it when done.
+ *  - While a program or erase runs, the chip ignores everything except read
+ *    status (BUSY, bit 0). Ignored commands are counted; reads return 0xFF.
+ *
+ * Commands: 06 write enable, 04 write disable, 05 read status 1, 03 read,
+ * 0B fast read, 02 page program, 20 sector erase, 52 32 KB block erase,
+ * D8 64 KB block erase, C7 or 60 chip erase, 9F JEDEC ID. Not modelled:
+ * the dual and quad commands, suspend and resume, the status register
+ * protection bits, the security registers and the power down modes.
+ *
+ * The times start when chip select goes high, which in bus_sim.h is when
+ * the transfer completes and the model is called.
+ */
+#ifndef W25Q64_SIM_H
+#define W25Q64_SIM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define W25Q_SIZE (8u * 1024 * 1024)
+#define W25Q_PAGE 256u
+#define W25Q_SECTOR 4096u
+#define W25Q_BLOCK_32K 32768u
+#define W25Q_BLOCK_64K 65536u
+#define W25Q_SECTORS (W25Q_SIZE / W25Q_SECTOR)
+#define W25Q_ENDURANCE 100000u          // erase cycles per sector, minimum
+
+#define W25Q_WRITE_ENABLE 0x06
+#define W25Q_WRITE_DISABLE 0x04
+#define W25Q_READ_STATUS 0x05
+#define W25Q_READ 0x03
+#define W25Q_FAST_READ 0x0B
+#define W25Q_PAGE_PROGRAM 0x02
+#define W25Q_SECTOR_ERASE 0x20
+#define W25Q_BLOCK_32K_ERASE 0x52
+#define W25Q_BLOCK_64K_ERASE 0xD8
+#define W25Q_CHIP_ERASE 0xC7
+#define W25Q_CHIP_ERASE_ALT 0x60
+#define W25Q_JEDEC_ID 0x9F
+
+#define W25Q_STATUS_BUSY 0x01
+#define W25Q_STATUS_WEL 0x02
+
+// From the W25Q64JV datasheet's AC electrical characteristics
+struct sW25qTiming {
+  uint32_t pageProgramNs;       // tPP
+  uint32_t sectorEraseNs;       // tSE, 4 KB
+  uint32_t block32EraseNs;      // tBE1
+  uint32_t block64EraseNs;      // tBE2
+  uint64_t chipEraseNs;         // tCE
+};
+
+extern const struct sW25qTiming kW25qTypical;
+extern const struct sW25qTiming kW25qMax;
+
+struct sW25qStats {
+  uint32_t reads;
+  uint64_t bytesRead;
+  uint32_t programs;
+  uint64_t bytesProgrammed;
+  uint64_t bitsNotSet;          // programmed a 1 over a 0: missing erase
+  uint32_t sectorErases;
+  uint32_t block32Erases;
+  uint32_t block64Erases;
+  uint32_t chipErases;
+  uint32_t ignoredBusy;         // commands sent while busy
+  uint32_t ignoredNotEnabled;   // program or erase without write enable
+  uint32_t unknown;             // commands not modelled
+  uint64_t programNs;           // time busy programming
+  uint64_t eraseNs;             // time busy erasing
+};
+
+struct sW25q64 {
+  uint8_t *memory;              // W25Q_SIZE bytes
+  uint32_t *wear;               // erases per sector, W25Q_SECTORS of them
+  size_t mapLength;
+  int fd;
+  struct sW25qTiming timing;
+  uint64_t busyUntil;
+  uint8_t writeEnabled;
+  struct sW25qStats stats;
+};
+
+// Maps path as the flash contents followed by the wear counts, creating it
+// (erased, no wear) if it doesn't exist. A NULL path starts a fresh one in
+// memory. Returns 0, or -1 with errno set.
+int W25qOpen(struct sW25q64 *flash, const char *path, const struct sW25qTiming *timing);
+void W25qClose(struct sW25q64 *flash);
+
+// The BusRespond for BusSimAddDevice, with the sW25q64 as the model
+void W25qRespond(void *model, const uint8_t *tx, uint16_t txLength, uint8_t *rx,
+                 uint16_t rxLength, uint64_t nowNs);
+
+// Most and least worn sectors, and the total erases
+void W25qWear(const struct sW25q64 *flash, uint32_t *least, uint32_t *most, uint64_t *total);
+
+#endif // W25Q64_SIM_H
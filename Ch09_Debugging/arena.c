@@ -0,0 +1,58 @@
+/*
+ * arena.c
+ *
+ * Region allocator, see arena.h. Allocation, mark and reset are inline in
+ * the header since they are only a few instructions each.
+ */
+
+#include "arena.h"
+
+#ifdef ARENA_GUARD_PAGE
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+void ArenaInit(struct sArena *arena, void *memory, size_t size)
+{
+  arena->base = memory;
+  arena->size = size;
+  arena->used = 0;
+  arena->highWater = 0;
+  arena->mapping = NULL;
+  arena->mappingSize = 0;
+}
+
+#ifdef ARENA_GUARD_PAGE
+// The arena is placed so it ends exactly where the guard page starts. The
+// start is rounded to ARENA_ALIGN, so the size is rounded down to keep
+// the end against the guard.
+int ArenaCreateGuarded(struct sArena *arena, size_t size)
+{
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t usable = (size + page - 1) & ~(page - 1);
+  uint8_t *mapping;
+
+  mapping = mmap(NULL, usable + page, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapping == MAP_FAILED) {
+    return -1;
+  }
+  if (mprotect(mapping + usable, page, PROT_NONE) != 0) {
+    munmap(mapping, usable + page);
+    return -1;
+  }
+  size &= ~(size_t)(ARENA_ALIGN - 1);
+  ArenaInit(arena, mapping + usable - size, size);
+  arena->mapping = mapping;
+  arena->mappingSize = usable + page;
+  return 0;
+}
+
+void ArenaDestroy(struct sArena *arena)
+{
+  if (arena->mapping) {
+    munmap(arena->mapping, arena->mappingSize);
+  }
+  ArenaInit(arena, NULL, 0);
+}
+#endif // ARENA_GUARD_PAGE
@@ -0,0 +1,87 @@
+/*
+ * arena.h
+ *
+ * A region (arena) allocator for per-frame scratch memory.
+ *
+ * dont_return_stack_memory() in hardfaults.c shows why temporary buffers
+ * can't live on the stack of the function that makes them. The heap works
+ * but every malloc and free has bookkeeping. An arena is a block of memory
+ * with a pointer that moves up as things are allocated. Nothing is freed
+ * one at a time: at the end of a frame (one ADC block, one packet) the
+ * pointer goes back to where it was, freeing everything at once.
+ *
+ * Compile time options:
+ *  ARENA_GUARD_PAGE  (hosts) ArenaCreateGuarded() puts an inaccessible page
+ *                    right after the arena so running off the end faults
+ *                    immediately instead of quietly corrupting other data.
+ *                    On an MCU, the MPU can do the same thing.
+ */
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ARENA_ALIGN  8   // every allocation is aligned to this
+
+struct sArena {
+  uint8_t *base;
+  size_t size;
+  size_t used;           // offset of the next allocation
+  size_t highWater;      // most ever used, size your arena with this
+  void *mapping;         // non-NULL if ArenaCreateGuarded made the memory
+  size_t mappingSize;
+};
+
+// A scope remembers where the arena was so everything allocated inside
+// the scope can be released together
+struct sArenaScope {
+  struct sArena *arena;
+  size_t mark;
+};
+
+void ArenaInit(struct sArena *arena, void *memory, size_t size);
+
+#ifdef ARENA_GUARD_PAGE
+// returns 0 on success, -1 if the memory couldn't be mapped
+int ArenaCreateGuarded(struct sArena *arena, size_t size);
+void ArenaDestroy(struct sArena *arena);
+#endif
+
+// returns NULL if there isn't room
+static inline void *ArenaAlloc(struct sArena *arena, size_t size)
+{
+  size_t start = (arena->used + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+  if (size > arena->size || start > arena->size - size) {
+    return NULL;
+  }
+  arena->used = start + size;
+  if (arena->used > arena->highWater) {
+    arena->highWater = arena->used;
+  }
+  return arena->base + start;
+}
+
+static inline size_t ArenaMark(struct sArena *arena)
+{
+  return arena->used;
+}
+
+// Frees everything allocated since the mark was taken
+static inline void ArenaReset(struct sArena *arena, size_t mark)
+{
+  arena->used = mark;
+}
+
+static inline struct sArenaScope ArenaScopeBegin(struct sArena *arena)
+{
+  struct sArenaScope scope = { arena, arena->used };
+  return scope;
+}
+
+static inline void ArenaScopeEnd(struct sArenaScope scope)
+{
+  ArenaReset(scope.arena, scope.mark);
+}
+
+#endif // ARENA_H
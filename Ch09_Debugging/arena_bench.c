@@ -0,0 +1,172 @@
+/*
+ * arena_bench.c
+ *
+ * Per-frame scratch memory: arena versus malloc/free
+ *
+ * gcc -O2 -DARENA_GUARD_PAGE arena_bench.c arena.c -o arenabench
+ * ./arenabench
+ * ./arenabench overflow     (runs off the end of the arena into the guard page)
+ *
+ * Each frame is one block of ADC samples. Processing it needs a handful of
+ * temporary buffers of different sizes, some only for part of the frame.
+ * Everything is gone at the end of the frame.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "arena.h"
+
+#define NUM_CHANNELS      4
+#define SAMPLES_PER_FRAME 256
+#define NUM_FRAMES        200000
+#define ARENA_SIZE        (16 * 1024)
+
+static uint64_t NowNs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+struct sStats {
+  int32_t sum;
+  int16_t min;
+  int16_t max;
+};
+
+// The allocator is the only difference between the two versions
+enum eAllocator { USE_MALLOC, USE_ARENA };
+static struct sArena gArena;
+
+static void *ScratchAlloc(enum eAllocator which, size_t size)
+{
+  return which == USE_ARENA ? ArenaAlloc(&gArena, size) : malloc(size);
+}
+static void ScratchFree(enum eAllocator which, void *p)
+{
+  if (which == USE_MALLOC) {
+    free(p); // the arena frees everything at the end of the frame instead
+  }
+}
+
+// One frame of work: de-interleave, per-channel stats, a temporary filter
+// buffer, and a packet whose size depends on the data. With numSamples = 1
+// the allocation pattern is the same but there is almost no work, which
+// shows the allocator cost on its own.
+static int32_t ProcessFrame(enum eAllocator which, const int16_t *adc, uint32_t frame,
+                            int numSamples)
+{
+  int16_t *channel[NUM_CHANNELS];
+  struct sStats *stats[NUM_CHANNELS];
+  int32_t result = 0;
+  size_t mark = ArenaMark(&gArena);
+  int c, i;
+
+  for (c = 0; c < NUM_CHANNELS; c++) {
+    channel[c] = ScratchAlloc(which, SAMPLES_PER_FRAME * sizeof(int16_t));
+    stats[c] = ScratchAlloc(which, sizeof(struct sStats));
+    stats[c]->sum = 0; stats[c]->min = INT16_MAX; stats[c]->max = INT16_MIN;
+    for (i = 0; i < numSamples; i++) {
+      int16_t s = adc[i * NUM_CHANNELS + c];
+      channel[c][i] = s;
+      stats[c]->sum += s;
+      if (s < stats[c]->min) stats[c]->min = s;
+      if (s > stats[c]->max) stats[c]->max = s;
+    }
+  }
+
+  for (c = 0; c < NUM_CHANNELS; c++) {
+    // filter scratch only lives for this channel
+    struct sArenaScope scope = ArenaScopeBegin(&gArena);
+    int32_t *filtered = ScratchAlloc(which, SAMPLES_PER_FRAME * sizeof(int32_t));
+    filtered[0] = channel[c][0];
+    for (i = 1; i < numSamples; i++) {
+      filtered[i] = (filtered[i - 1] * 3 + channel[c][i]) / 4;
+    }
+    result += filtered[numSamples - 1];
+    ScratchFree(which, filtered);
+    if (which == USE_ARENA) {
+      ArenaScopeEnd(scope);
+    }
+  }
+
+  {
+    // a packet of a data dependent size
+    size_t packetSize = 64 + (frame * 37u) % 512;
+    uint8_t *packet = ScratchAlloc(which, packetSize);
+    memcpy(packet, stats[0], sizeof(struct sStats));
+    packet[packetSize - 1] = (uint8_t)frame;
+    result += packet[0] + packet[packetSize - 1];
+    ScratchFree(which, packet);
+  }
+
+  for (c = 0; c < NUM_CHANNELS; c++) {
+    result += stats[c]->sum + stats[c]->max - stats[c]->min;
+    ScratchFree(which, stats[c]);
+    ScratchFree(which, channel[c]);
+  }
+  ArenaReset(&gArena, mark); // the whole frame's scratch, gone in one store
+  return result;
+}
+
+static void Bench(enum eAllocator which, const int16_t *adc, int numSamples)
+{
+  uint64_t start, t0, t1, worst = 0;
+  volatile int32_t sink = 0;
+  uint32_t frame;
+
+  start = NowNs();
+  for (frame = 0; frame < NUM_FRAMES; frame++) {
+    t0 = NowNs();
+    sink += ProcessFrame(which, adc, frame, numSamples);
+    t1 = NowNs();
+    if (t1 - t0 > worst) {
+      worst = t1 - t0;
+    }
+  }
+  printf("  %-6s %-10s %7.1f ns per frame, worst frame %8llu ns\n",
+         which == USE_ARENA ? "arena" : "malloc",
+         numSamples == 1 ? "alloc only" : "full frame",
+         (double)(NowNs() - start) / NUM_FRAMES, (unsigned long long)worst);
+  (void)sink;
+}
+
+int main(int argc, char *argv[])
+{
+  static int16_t adc[SAMPLES_PER_FRAME * NUM_CHANNELS];
+  static uint8_t arenaMemory[ARENA_SIZE] __attribute__((aligned(ARENA_ALIGN)));
+  int i;
+
+  for (i = 0; i < SAMPLES_PER_FRAME * NUM_CHANNELS; i++) {
+    adc[i] = (int16_t)((i * 7919) % 4096 - 2048);
+  }
+
+#ifdef ARENA_GUARD_PAGE
+  if (ArenaCreateGuarded(&gArena, ARENA_SIZE) != 0) {
+    printf("Could not create guarded arena\n");
+    return 1;
+  }
+  if (argc > 1 && strcmp(argv[1], "overflow") == 0) {
+    uint8_t *p = ArenaAlloc(&gArena, ARENA_SIZE);
+    printf("Writing one byte past the end of the arena, expect a segfault\n");
+    fflush(stdout);
+    p[ARENA_SIZE] = 1;
+    printf("Not caught!\n");
+    return 1;
+  }
+  (void)arenaMemory;
+#else
+  (void)argc; (void)argv;
+  ArenaInit(&gArena, arenaMemory, sizeof(arenaMemory));
+#endif
+
+  printf("%d frames of %d samples x %d channels\n", NUM_FRAMES, SAMPLES_PER_FRAME, NUM_CHANNELS);
+  Bench(USE_MALLOC, adc, SAMPLES_PER_FRAME);
+  Bench(USE_ARENA, adc, SAMPLES_PER_FRAME);
+  Bench(USE_MALLOC, adc, 1);
+  Bench(USE_ARENA, adc, 1);
+  printf("Arena high water mark: %zu of %zu bytes\n", gArena.highWater, gArena.size);
+  return 0;
+}
@@ -0,0 +1,560 @@
+/*
+ * blockpool.c
+ *
+ * Fixed-size block pool, see blockpool.h
+ *
+ * The free list is threaded through the free blocks: the first word of a
+ * free block points to the next free block. Taking the head of the list
+ * and pushing onto it are both constant time, no searching and no
+ * fragmentation, which is why pools are so common in embedded systems.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "blockpool.h"
+#ifndef __arm__
+#include <sched.h>
+#endif
+
+#ifdef BLOCKPOOL_THREAD_CACHE
+#include <pthread.h>
+#endif
+#ifdef BLOCKPOOL_QUARANTINE
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "coredump.h"
+#endif
+
+// ids index the thread caches; they are handed out once and never reused
+static atomic_uint gNumPools = 0;
+
+#define SPINS_BEFORE_YIELD 64
+
+// The critical sections are a handful of instructions, so spin. On the
+// single core target an interrupt can't be preempted by the thread holding
+// the lock, so a bare flag is enough; on a host the holder can be preempted
+// mid section, and spinning on would burn the rest of the timeslice it
+// needs, so after a short spin give the CPU away.
+static void SpinLock(atomic_flag *lock)
+{
+#ifndef __arm__
+  uint32_t spins = 0;
+#endif
+  while (atomic_flag_test_and_set_explicit(lock, memory_order_acquire)) {
+#ifndef __arm__
+    if (++spins >= SPINS_BEFORE_YIELD) {
+      sched_yield();
+      spins = 0;
+    }
+#endif
+  }
+}
+
+static void Lock(struct sBlockPool *pool)
+{
+  SpinLock(&pool->lock);
+}
+static void Unlock(struct sBlockPool *pool)
+{
+  atomic_flag_clear_explicit(&pool->lock, memory_order_release);
+}
+
+__attribute__((weak))
+void BlockPoolCorruption(struct sBlockPool *pool, void *block, const char *what)
+{
+  fprintf(stderr, "BlockPool %d: %s at %p\n", pool->id, what, block);
+  abort();
+}
+
+/******************************************************************************************************
+ * Debug poisoning
+ * A freed block gets filled with BLOCKPOOL_POISON (except the first word which
+ * is the free list link). When it is handed out again the poison must still
+ * be there, if it isn't, someone wrote to the block after freeing it.
+*******************************************************************************************************/
+#ifdef BLOCKPOOL_DEBUG
+static void PoisonBlock(struct sBlockPool *pool, struct sFreeBlock *block)
+{
+  uint32_t *word = (uint32_t *)(block + 1);
+  uint32_t *end = (uint32_t *)((uint8_t *)block + pool->blockSize);
+  while (word < end) {
+    *word++ = BLOCKPOOL_POISON;
+  }
+}
+
+static int IsPoisoned(struct sBlockPool *pool, struct sFreeBlock *block)
+{
+  uint32_t *word = (uint32_t *)(block + 1);
+  uint32_t *end = (uint32_t *)((uint8_t *)block + pool->blockSize);
+  while (word < end) {
+    if (*word++ != BLOCKPOOL_POISON) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// The word after the link is overwritten when the block is handed out so
+// freeing a block that still has it poisoned means it was freed twice.
+static void CheckOnAlloc(struct sBlockPool *pool, struct sFreeBlock *block)
+{
+  if (!IsPoisoned(pool, block)) {
+    BlockPoolCorruption(pool, block, "write after free");
+  }
+  if (pool->blockSize > sizeof(struct sFreeBlock)) {
+    *(uint32_t *)(block + 1) = ~BLOCKPOOL_POISON;
+  }
+}
+
+static void CheckOnFree(struct sBlockPool *pool, struct sFreeBlock *block)
+{
+  uint8_t *p = (uint8_t *)block;
+  if (p < pool->memory || p >= pool->memoryEnd ||
+      ((size_t)(p - pool->memory) % pool->blockSize) != 0) {
+    BlockPoolCorruption(pool, block, "free of a block not from this pool");
+  }
+  // (a block that only holds the link has no room for poison to check)
+  if (pool->blockSize > sizeof(struct sFreeBlock) &&
+      *(uint32_t *)(block + 1) == BLOCKPOOL_POISON) {
+    BlockPoolCorruption(pool, block, "double free");
+  }
+  PoisonBlock(pool, block);
+}
+#else
+#define CheckOnAlloc(pool, block)
+#define CheckOnFree(pool, block)
+#endif // BLOCKPOOL_DEBUG
+
+/******************************************************************************************************
+ * Quarantine
+ * A sampled block is placed at the end of its own page so the guard page
+ * after it catches overflows. Freeing it makes its page inaccessible and puts
+ * it at the back of a FIFO; it only becomes available again after
+ * BLOCKPOOL_QUARANTINE_DELAY more quarantined frees. Any access in between
+ * faults and the SIGSEGV handler writes the core dump.
+ *
+ * The mprotect calls are expensive (a microsecond or so) but only happen on
+ * sampled blocks. Everything else pays a countdown on alloc and a range
+ * check on free.
+*******************************************************************************************************/
+#ifdef BLOCKPOOL_QUARANTINE
+enum eSlotState { SLOT_AVAILABLE, SLOT_IN_USE, SLOT_QUARANTINED };
+
+static struct {
+  uint8_t *region;           // slots of (data page, guard page)
+  uint8_t *regionEnd;
+  size_t page;
+  uint32_t oneInN;
+  uint8_t state[BLOCKPOOL_QUARANTINE_SLOTS];
+  uint16_t available[BLOCKPOOL_QUARANTINE_SLOTS];
+  uint32_t numAvailable;
+  uint16_t fifo[BLOCKPOOL_QUARANTINE_DELAY + 1];
+  uint32_t fifoHead;
+  uint32_t fifoCount;
+  atomic_flag lock;
+  struct sigaction previous;
+} gQuarantine;
+
+static _Thread_local uint32_t tSampleCountdown;
+static _Thread_local uint8_t tSampleSeeded;
+static atomic_uint gSampleSeed;
+
+// Where a thread's first sample lands, somewhere in the first oneInN
+// allocations. Starting every thread at 0 would sample the first allocation
+// on each one, which skews the rate and costs a page per thread.
+static uint32_t FirstCountdown(void)
+{
+  uint32_t x = atomic_fetch_add(&gSampleSeed, 0x9E3779B9u);
+
+  x ^= x >> 16;                 // spread the sequence out (a 32 bit hash mix)
+  x *= 0x7FEB352Du;
+  x ^= x >> 15;
+  return x % gQuarantine.oneInN;
+}
+
+static int IsQuarantineBlock(const void *p)
+{
+  return (const uint8_t *)p >= gQuarantine.region && (const uint8_t *)p < gQuarantine.regionEnd;
+}
+
+static uint8_t *SlotPage(uint32_t slot)
+{
+  return gQuarantine.region + slot * 2 * gQuarantine.page;
+}
+
+static void QuarantineLock(void)
+{
+  SpinLock(&gQuarantine.lock);
+}
+static void QuarantineUnlock(void)
+{
+  atomic_flag_clear_explicit(&gQuarantine.lock, memory_order_release);
+}
+
+// returns NULL if this allocation isn't sampled (or no slot is free)
+static void *QuarantineAlloc(struct sBlockPool *pool)
+{
+  uint32_t slot;
+  uint8_t *page;
+
+  if (gQuarantine.oneInN == 0) {
+    return NULL;
+  }
+  if (!tSampleSeeded) {
+    tSampleSeeded = 1;
+    tSampleCountdown = FirstCountdown();
+  }
+  if (tSampleCountdown != 0) {
+    tSampleCountdown--;
+    return NULL;
+  }
+  tSampleCountdown = gQuarantine.oneInN - 1;
+  if (pool->blockSize > gQuarantine.page) {
+    return NULL;
+  }
+
+  QuarantineLock();
+  if (gQuarantine.numAvailable == 0) {
+    QuarantineUnlock();
+    return NULL;
+  }
+  slot = gQuarantine.available[--gQuarantine.numAvailable];
+  gQuarantine.state[slot] = SLOT_IN_USE;
+  QuarantineUnlock();
+
+  page = SlotPage(slot);
+  mprotect(page, gQuarantine.page, PROT_READ | PROT_WRITE);
+  return page + gQuarantine.page - pool->blockSize; // up against the guard page
+}
+
+static void QuarantineFree(struct sBlockPool *pool, void *block)
+{
+  uint32_t slot = ((uint8_t *)block - gQuarantine.region) / (2 * gQuarantine.page);
+  uint32_t tail;
+
+  // claim it under the lock so two threads freeing it can't both get past
+  QuarantineLock();
+  if (gQuarantine.state[slot] != SLOT_IN_USE) {
+    QuarantineUnlock();
+    BlockPoolCorruption(pool, block, "double free");
+    return;
+  }
+  gQuarantine.state[slot] = SLOT_QUARANTINED;
+  QuarantineUnlock();
+  mprotect(SlotPage(slot), gQuarantine.page, PROT_NONE);
+
+  // only then queue it, so it can't be handed out again while still open
+  QuarantineLock();
+  tail = (gQuarantine.fifoHead + gQuarantine.fifoCount) % (BLOCKPOOL_QUARANTINE_DELAY + 1);
+  gQuarantine.fifo[tail] = slot;
+  gQuarantine.fifoCount++;
+  if (gQuarantine.fifoCount > BLOCKPOOL_QUARANTINE_DELAY) {
+    // the oldest has waited long enough, it can be handed out again
+    slot = gQuarantine.fifo[gQuarantine.fifoHead];
+    gQuarantine.fifoHead = (gQuarantine.fifoHead + 1) % (BLOCKPOOL_QUARANTINE_DELAY + 1);
+    gQuarantine.fifoCount--;
+    gQuarantine.state[slot] = SLOT_AVAILABLE;
+    gQuarantine.available[gQuarantine.numAvailable++] = slot;
+  }
+  QuarantineUnlock();
+}
+
+static void QuarantineSignalHandler(int sig, siginfo_t *info, void *context)
+{
+  const uint8_t *addr = info->si_addr;
+
+  if (IsQuarantineBlock(addr)) {
+    struct sCoreDump dump;
+    size_t offset = (size_t)(addr - gQuarantine.region) % (2 * gQuarantine.page);
+    CoreDumpFromSignal(&dump, offset < gQuarantine.page ?
+                       COREDUMP_CAUSE_USE_AFTER_FREE : COREDUMP_CAUSE_BLOCK_OVERFLOW,
+                       info, context);
+    CoreDumpSave(&dump);
+    // return with the default action so the access faults again and the
+    // process dies the way it would have (the "controlled reboot")
+    signal(sig, SIG_DFL);
+    return;
+  }
+
+  // not ours, pass it along
+  if (gQuarantine.previous.sa_flags & SA_SIGINFO) {
+    gQuarantine.previous.sa_sigaction(sig, info, context);
+  } else if (gQuarantine.previous.sa_handler == SIG_DFL ||
+             gQuarantine.previous.sa_handler == SIG_IGN) {
+    signal(sig, SIG_DFL);
+  } else {
+    gQuarantine.previous.sa_handler(sig);
+  }
+}
+
+int BlockPoolQuarantineInit(uint32_t oneInN)
+{
+  struct sigaction action;
+  uint32_t i;
+
+  if (gQuarantine.region == NULL) {
+    gQuarantine.page = (size_t)sysconf(_SC_PAGESIZE);
+    gQuarantine.region = mmap(NULL, BLOCKPOOL_QUARANTINE_SLOTS * 2 * gQuarantine.page,
+                              PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (gQuarantine.region == MAP_FAILED) {
+      gQuarantine.region = NULL;
+      return -1;
+    }
+    gQuarantine.regionEnd = gQuarantine.region + BLOCKPOOL_QUARANTINE_SLOTS * 2 * gQuarantine.page;
+    for (i = 0; i < BLOCKPOOL_QUARANTINE_SLOTS; i++) {
+      gQuarantine.state[i] = SLOT_AVAILABLE;
+      gQuarantine.available[i] = BLOCKPOOL_QUARANTINE_SLOTS - 1 - i;
+    }
+    gQuarantine.numAvailable = BLOCKPOOL_QUARANTINE_SLOTS;
+    atomic_flag_clear(&gQuarantine.lock);
+
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = QuarantineSignalHandler;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGSEGV, &action, &gQuarantine.previous) != 0) {
+      return -1;
+    }
+  }
+  gQuarantine.oneInN = oneInN;
+  return 0;
+}
+#else
+#define IsQuarantineBlock(block) 0
+#define QuarantineAlloc(pool) NULL
+#define QuarantineFree(pool, block)
+#endif // BLOCKPOOL_QUARANTINE
+
+int BlockPoolInit(struct sBlockPool *pool, void *memory, size_t blockSize, uint32_t numBlocks)
+{
+  uint32_t i;
+  unsigned id;
+  uint8_t *block;
+
+  if (pool == NULL || memory == NULL || numBlocks == 0 ||
+      ((uintptr_t)memory % sizeof(void*)) != 0) {
+    return -1;
+  }
+  id = atomic_load(&gNumPools);
+  do {
+    if (id >= BLOCKPOOL_MAX_POOLS) {
+      return -1;
+    }
+  } while (!atomic_compare_exchange_weak(&gNumPools, &id, id + 1));
+  pool->memory = memory;
+  pool->blockSize = BLOCKPOOL_BLOCK_SIZE(blockSize);
+  pool->numBlocks = numBlocks;
+  pool->memoryEnd = pool->memory + pool->blockSize * numBlocks;
+  pool->numFree = numBlocks;
+  atomic_flag_clear(&pool->lock);
+  pool->id = (uint8_t)id;
+
+  // link every block to the one after it, in address order
+  pool->freeList = NULL;
+  block = pool->memoryEnd;
+  for (i = 0; i < numBlocks; i++) {
+    block -= pool->blockSize;
+    ((struct sFreeBlock *)block)->next = pool->freeList;
+    pool->freeList = (struct sFreeBlock *)block;
+#ifdef BLOCKPOOL_DEBUG
+    PoisonBlock(pool, pool->freeList);
+#endif
+  }
+  return 0;
+}
+
+static void SharedFree(struct sBlockPool *pool, struct sFreeBlock *first,
+                       struct sFreeBlock *last, uint32_t count)
+{
+  Lock(pool);
+  last->next = pool->freeList;
+  pool->freeList = first;
+  pool->numFree += count;
+  Unlock(pool);
+}
+
+#ifndef BLOCKPOOL_THREAD_CACHE
+
+static void *SharedAlloc(struct sBlockPool *pool)
+{
+  struct sFreeBlock *block;
+  Lock(pool);
+  block = pool->freeList;
+  if (block) {
+    pool->freeList = block->next;
+    pool->numFree--;
+  }
+  Unlock(pool);
+  return block;
+}
+
+void *BlockPoolAlloc(struct sBlockPool *pool)
+{
+  struct sFreeBlock *block = QuarantineAlloc(pool);
+  if (block) {
+    return block;
+  }
+  block = SharedAlloc(pool);
+  if (block) {
+    CheckOnAlloc(pool, block);
+  }
+  return block;
+}
+
+void BlockPoolFree(struct sBlockPool *pool, void *block)
+{
+  if (block == NULL) {
+    return;
+  }
+  if (IsQuarantineBlock(block)) {
+    QuarantineFree(pool, block);
+    return;
+  }
+  CheckOnFree(pool, block);
+  SharedFree(pool, block, block, 1);
+}
+
+void BlockPoolFlushThreadCache(struct sBlockPool *pool)
+{
+  (void)pool; // nothing cached
+}
+
+#else
+/******************************************************************************************************
+ * Per-thread caches
+ * Each thread keeps up to 2*BLOCKPOOL_CACHE_BATCH blocks of its own. Alloc
+ * and free only take the pool lock to move a whole batch, so threads on
+ * different cores mostly stay out of each other's way (and cache lines).
+*******************************************************************************************************/
+struct sBlockCache {
+  struct sBlockPool *pool;
+  struct sFreeBlock *head;
+  uint32_t count;
+};
+
+static _Thread_local struct sBlockCache tCache[BLOCKPOOL_MAX_POOLS];
+static pthread_key_t gExitKey;
+static pthread_once_t gExitKeyOnce = PTHREAD_ONCE_INIT;
+
+static void FlushAllOnThreadExit(void *unused)
+{
+  int i;
+  (void)unused;
+  for (i = 0; i < BLOCKPOOL_MAX_POOLS; i++) {
+    if (tCache[i].pool) {
+      BlockPoolFlushThreadCache(tCache[i].pool);
+    }
+  }
+}
+static void MakeExitKey(void)
+{
+  pthread_key_create(&gExitKey, FlushAllOnThreadExit);
+}
+
+// First use of the pool on this thread, alloc or free: make sure the cache
+// is flushed when the thread exits (a consumer thread may only ever free)
+static struct sBlockCache *ThreadCache(struct sBlockPool *pool)
+{
+  struct sBlockCache *cache = &tCache[pool->id];
+
+  if (cache->pool == NULL) {
+    cache->pool = pool;
+    pthread_once(&gExitKeyOnce, MakeExitKey);
+    pthread_setspecific(gExitKey, tCache);
+  }
+  return cache;
+}
+
+static void Refill(struct sBlockPool *pool, struct sBlockCache *cache)
+{
+  struct sFreeBlock *block;
+  uint32_t n = 0;
+
+  Lock(pool);
+  block = pool->freeList;
+  cache->head = block;
+  while (block && n < BLOCKPOOL_CACHE_BATCH) {
+    n++;
+    if (n == BLOCKPOOL_CACHE_BATCH || block->next == NULL) {
+      pool->freeList = block->next;
+      block->next = NULL;
+      break;
+    }
+    block = block->next;
+  }
+  pool->numFree -= n;
+  Unlock(pool);
+  cache->count = n;
+}
+
+void *BlockPoolAlloc(struct sBlockPool *pool)
+{
+  struct sBlockCache *cache = ThreadCache(pool);
+  struct sFreeBlock *block = QuarantineAlloc(pool);
+
+  if (block) {
+    return block;
+  }
+  if (cache->head == NULL) {
+    Refill(pool, cache);
+  }
+  block = cache->head;
+  if (block) {
+    cache->head = block->next;
+    cache->count--;
+    CheckOnAlloc(pool, block);
+  }
+  return block;
+}
+
+void BlockPoolFree(struct sBlockPool *pool, void *block)
+{
+  struct sBlockCache *cache;
+  struct sFreeBlock *freed = block;
+
+  if (block == NULL) {
+    return;
+  }
+  if (IsQuarantineBlock(block)) {
+    QuarantineFree(pool, block);
+    return;
+  }
+  cache = ThreadCache(pool);
+  CheckOnFree(pool, freed);
+  freed->next = cache->head;
+  cache->head = freed;
+  cache->count++;
+
+  // too many? give a batch back so other threads can use them
+  if (cache->count >= 2 * BLOCKPOOL_CACHE_BATCH) {
+    struct sFreeBlock *first = cache->head;
+    struct sFreeBlock *last = first;
+    uint32_t i;
+    for (i = 1; i < BLOCKPOOL_CACHE_BATCH; i++) {
+      last = last->next;
+    }
+    cache->head = last->next;
+    cache->count -= BLOCKPOOL_CACHE_BATCH;
+    SharedFree(pool, first, last, BLOCKPOOL_CACHE_BATCH);
+  }
+}
+
+void BlockPoolFlushThreadCache(struct sBlockPool *pool)
+{
+  struct sBlockCache *cache = &tCache[pool->id];
+  struct sFreeBlock *last = cache->head;
+
+  if (last == NULL) {
+    return;
+  }
+  while (last->next) {
+    last = last->next;
+  }
+  SharedFree(pool, cache->head, last, cache->count);
+  cache->head = NULL;
+  cache->count = 0;
+}
+
+#endif // BLOCKPOOL_THREAD_CACHE
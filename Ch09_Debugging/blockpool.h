@@ -0,0 +1,85 @@
+/*
+ * blockpool.h
+ *
+ * A fixed-size block pool: an alternative to malloc/free for the hot path.
+ *
+ * Every block in a pool is the same size so allocation and free are O(1):
+ * the free blocks are kept in a singly linked list that lives inside the
+ * free blocks themselves (an intrusive free list), no extra bookkeeping RAM.
+ *
+ * Compile time options:
+ *  BLOCKPOOL_THREAD_CACHE  each thread keeps a small stash of blocks so most
+ *                          alloc/free calls never touch the shared lock
+ *                          (for multi-core hosts, leave off on an MCU)
+ *  BLOCKPOOL_DEBUG         poison freed blocks and check the poison on reuse
+ *                          to catch code writing through stale pointers like
+ *                          dont_return_malloc_and_freed_memory() in hardfaults.c
+ *  BLOCKPOOL_QUARANTINE    (hosts) 1 in N allocations gets its own page with a
+ *                          guard page after it. When freed, the page is made
+ *                          inaccessible and isn't reused for a while, so a
+ *                          stale pointer faults and is saved in the core dump
+ *                          (coredump.h). Cheap enough to leave on in the field.
+ */
+#ifndef BLOCKPOOL_H
+#define BLOCKPOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define BLOCKPOOL_MAX_POOLS    8     // BlockPoolInit calls per process (ids index the thread caches)
+#define BLOCKPOOL_CACHE_BATCH  32    // blocks moved between cache and pool at once
+#define BLOCKPOOL_POISON       0xDEADBEEFu
+#define BLOCKPOOL_QUARANTINE_SLOTS  256  // sampled blocks live at once (in use + quarantined)
+#define BLOCKPOOL_QUARANTINE_DELAY  128  // frees before a quarantined page is reused
+
+struct sFreeBlock {
+  struct sFreeBlock *next;
+};
+
+struct sBlockPool {
+  uint8_t *memory;            // start of the block storage
+  uint8_t *memoryEnd;
+  size_t blockSize;           // rounded up to hold a pointer and keep alignment
+  uint32_t numBlocks;
+  uint32_t numFree;           // in the shared list, not counting thread caches
+  struct sFreeBlock *freeList;
+  atomic_flag lock;
+  uint8_t id;                 // index into the per-thread caches
+};
+
+// Size of the memory needed to hold numBlocks of blockSize
+#define BLOCKPOOL_BLOCK_SIZE(blockSize) \
+  ((((blockSize) < sizeof(void*) ? sizeof(void*) : (blockSize)) + sizeof(void*) - 1) \
+    & ~(sizeof(void*) - 1))
+#define BLOCKPOOL_MEMORY_SIZE(blockSize, numBlocks) \
+  (BLOCKPOOL_BLOCK_SIZE(blockSize) * (numBlocks))
+
+// memory must be at least BLOCKPOOL_MEMORY_SIZE() bytes and pointer aligned
+// returns 0 on success, -1 if the arguments are bad or there are too many pools:
+// each call uses up one of BLOCKPOOL_MAX_POOLS ids for the life of the process,
+// so set pools up once at startup rather than making and dropping them
+int BlockPoolInit(struct sBlockPool *pool, void *memory, size_t blockSize, uint32_t numBlocks);
+
+// O(1), returns NULL when the pool is empty
+void *BlockPoolAlloc(struct sBlockPool *pool);
+
+// O(1), block must have come from this pool
+void BlockPoolFree(struct sBlockPool *pool, void *block);
+
+// Return this thread's cached blocks to the shared list (done automatically
+// at thread exit when BLOCKPOOL_THREAD_CACHE is on)
+void BlockPoolFlushThreadCache(struct sBlockPool *pool);
+
+#ifdef BLOCKPOOL_QUARANTINE
+// Sample one in oneInN allocations (0 turns sampling off) and install the
+// SIGSEGV handler that reports faults on quarantined blocks through
+// CoreDumpSave(). Call CoreDumpInit() first. Returns 0 on success.
+int BlockPoolQuarantineInit(uint32_t oneInN);
+#endif
+
+// Called by BLOCKPOOL_DEBUG checks when something is wrong with a block.
+// The default prints and aborts; it is weak so you can log it your own way.
+void BlockPoolCorruption(struct sBlockPool *pool, void *block, const char *what);
+
+#endif // BLOCKPOOL_H
@@ -0,0 +1,167 @@
+/*
+ * coredump.c
+ *
+ * Host side storage for the mini core dump, see coredump.h
+ *
+ * A shared file mapping acts like the target's non-cleared RAM section: the
+ * dump is written with plain stores (nothing that isn't safe in a signal
+ * handler), msync pushes it to the file so it is still there after the
+ * process dies.
+ */
+
+#ifndef __arm__
+#define _GNU_SOURCE   // for the register names in ucontext.h
+#endif
+#include <string.h>
+#include "coredump.h"
+
+#ifndef __arm__
+#include <ucontext.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static struct sCoreDump *gCoreDump = NULL;
+
+int CoreDumpInit(const char *path)
+{
+  int fd = open(path, O_RDWR | O_CREAT, 0644);
+  void *mapping;
+
+  if (fd < 0) {
+    return -1;
+  }
+  if (ftruncate(fd, sizeof(struct sCoreDump)) != 0) {
+    close(fd);
+    return -1;
+  }
+  mapping = mmap(NULL, sizeof(struct sCoreDump), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    return -1;
+  }
+  gCoreDump = mapping;
+  return 0;
+}
+
+void CoreDumpSave(const struct sCoreDump *dump)
+{
+  if (gCoreDump == NULL) {
+    return;
+  }
+  // key last so a dump interrupted part way through isn't mistaken for valid
+  gCoreDump->key = 0;
+  memcpy((uint8_t *)gCoreDump + sizeof(dump->key), (const uint8_t *)dump + sizeof(dump->key),
+         sizeof(struct sCoreDump) - sizeof(dump->key));
+  gCoreDump->crc = CoreDumpCrc(dump);
+  gCoreDump->key = COREDUMP_KEY;
+  msync(gCoreDump, sizeof(struct sCoreDump), MS_SYNC);
+}
+
+int CoreDumpLoad(const char *path, struct sCoreDump *dump)
+{
+  int fd = open(path, O_RDONLY);
+  ssize_t n;
+
+  if (fd < 0) {
+    return 0;
+  }
+  n = read(fd, dump, sizeof(*dump));
+  close(fd);
+  return n == (ssize_t)sizeof(*dump) && dump->key == COREDUMP_KEY && dump->crc == CoreDumpCrc(dump);
+}
+
+static uintptr_t ProgramCounter(const ucontext_t *uc)
+{
+#if defined(__x86_64__)
+  return uc->uc_mcontext.gregs[REG_RIP];
+#elif defined(__aarch64__)
+  return uc->uc_mcontext.pc;
+#else
+  (void)uc;
+  return 0;
+#endif
+}
+
+uint32_t CoreDumpCauseFromSignal(int sig, const siginfo_t *info, const void *ucontext)
+{
+  switch (sig) {
+    case SIGFPE:
+      return info->si_code == FPE_INTDIV ? COREDUMP_CAUSE_DIVIDE_BY_ZERO : COREDUMP_CAUSE_HARDFAULT;
+    case SIGBUS:
+      return info->si_code == BUS_ADRALN ? COREDUMP_CAUSE_UNALIGNED : COREDUMP_CAUSE_DATA_ACCESS;
+    case SIGILL:
+      return COREDUMP_CAUSE_UNDEFINED_INSTR;
+    case SIGSEGV:
+      // faulting while fetching the instruction itself: the pc is the bad address
+      return (uintptr_t)info->si_addr == ProgramCounter(ucontext) ?
+             COREDUMP_CAUSE_INSTR_ACCESS : COREDUMP_CAUSE_DATA_ACCESS;
+    default:
+      return COREDUMP_CAUSE_HARDFAULT;
+  }
+}
+
+void CoreDumpFromSignal(struct sCoreDump *dump, uint32_t cause,
+                        const siginfo_t *info, const void *ucontext)
+{
+  const ucontext_t *uc = ucontext;
+
+  memset(dump, 0, sizeof(*dump));
+  dump->key = COREDUMP_KEY;
+  dump->cause = cause;
+  dump->faultAddress = (uintptr_t)info->si_addr;
+  dump->taskId = COREDUMP_NO_TASK;
+#if defined(__x86_64__)
+  dump->r0 = uc->uc_mcontext.gregs[REG_RDI];
+  dump->r1 = uc->uc_mcontext.gregs[REG_RSI];
+  dump->r2 = uc->uc_mcontext.gregs[REG_RDX];
+  dump->r3 = uc->uc_mcontext.gregs[REG_RCX];
+  dump->returnAddress = ProgramCounter(uc);
+  dump->stackPointer = uc->uc_mcontext.gregs[REG_RSP];
+#elif defined(__aarch64__)
+  dump->r0 = uc->uc_mcontext.regs[0];
+  dump->r1 = uc->uc_mcontext.regs[1];
+  dump->r2 = uc->uc_mcontext.regs[2];
+  dump->r3 = uc->uc_mcontext.regs[3];
+  dump->returnAddress = ProgramCounter(uc);
+  dump->stackPointer = uc->uc_mcontext.sp;
+#else
+  (void)uc; // registers unknown on this host, the fault address is still useful
+#endif
+}
+#endif // __arm__
+
+// CRC-32C (../Ch10_Connected/crc.h) a bit at a time: no table, nothing to
+// set up, so it is safe in a fault handler. The dump is about 100 bytes.
+uint32_t CoreDumpCrc(const struct sCoreDump *dump)
+{
+  const uint8_t *data = (const uint8_t *)dump + sizeof(dump->key);
+  size_t length = sizeof(*dump) - sizeof(dump->key) - sizeof(dump->crc);
+  uint32_t crc = 0xFFFFFFFF;
+  int bit;
+
+  while (length--) {
+    crc ^= *data++;
+    for (bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (0x82F63B78 & (0u - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
+const char *CoreDumpCauseName(uint32_t cause)
+{
+  switch (cause) {
+    case COREDUMP_CAUSE_NONE:           return "none";
+    case COREDUMP_CAUSE_HARDFAULT:      return "hard fault";
+    case COREDUMP_CAUSE_USE_AFTER_FREE: return "use after free";
+    case COREDUMP_CAUSE_BLOCK_OVERFLOW: return "block overflow";
+    case COREDUMP_CAUSE_DIVIDE_BY_ZERO: return "divide by zero";
+    case COREDUMP_CAUSE_UNALIGNED:      return "unaligned access";
+    case COREDUMP_CAUSE_UNDEFINED_INSTR: return "undefined instruction";
+    case COREDUMP_CAUSE_INSTR_ACCESS:   return "instruction access";
+    case COREDUMP_CAUSE_DATA_ACCESS:    return "data access";
+    case COREDUMP_CAUSE_WATCHDOG:       return "watchdog";
+    default:                            return "unknown";
+  }
+}
@@ -0,0 +1,87 @@
+/*
+ * coredump.h
+ *
+ * The mini core dump from hardfaults.c (NEW_HANDLER_MEMFAULT), pulled out so
+ * other fault detectors can report through the same path.
+ *
+ * On the target, the dump lives in a RAM section that isn't cleared at
+ * boot (.CoreDump in the linker file) so it survives the reset. On a host,
+ * CoreDumpInit() maps a file to stand in for that section.
+ */
+#ifndef COREDUMP_H
+#define COREDUMP_H
+
+#include <stdint.h>
+#ifndef __arm__
+#include <signal.h>
+#endif
+
+#define COREDUMP_KEY 0xE0C2024
+
+enum eCoreDumpCause {
+  COREDUMP_CAUSE_NONE = 0,
+  COREDUMP_CAUSE_HARDFAULT,       // from HardFault_Handler, reason unknown
+  COREDUMP_CAUSE_USE_AFTER_FREE,  // quarantined block touched after free
+  COREDUMP_CAUSE_BLOCK_OVERFLOW,  // quarantined block's guard page touched
+  // These follow the Cortex-M CFSR bits (and the host signal equivalents)
+  COREDUMP_CAUSE_DIVIDE_BY_ZERO,  // UFSR DIVBYZERO, SIGFPE
+  COREDUMP_CAUSE_UNALIGNED,       // UFSR UNALIGNED, SIGBUS
+  COREDUMP_CAUSE_UNDEFINED_INSTR, // UFSR UNDEFINSTR, SIGILL
+  COREDUMP_CAUSE_INSTR_ACCESS,    // IACCVIOL/IBUSERR/INVSTATE, SIGSEGV at the pc
+  COREDUMP_CAUSE_DATA_ACCESS,     // DACCVIOL/PRECISERR, other SIGSEGV
+  COREDUMP_CAUSE_WATCHDOG,        // a task missed its watchdog check in
+};
+
+#define COREDUMP_STACK_WORDS 16
+#define COREDUMP_NO_TASK     0xFFFFFFFF
+
+// uintptr_t so the registers are 32 bits on a Cortex-M and big enough for
+// addresses on a 64-bit host
+struct __attribute__((packed)) sCoreDump {
+  uint32_t key; // must equal COREDUMP_KEY for this to be valid
+  uint32_t cause;
+  uintptr_t r0;
+  uintptr_t r1;
+  uintptr_t r2;
+  uintptr_t r3;
+  uintptr_t returnAddress;
+  uintptr_t stackPointer;
+  uintptr_t faultAddress;  // MMFAR/BFAR on the target, si_addr on a host
+  int32_t lastBattReading;
+  uint32_t taskId;         // which task starved, COREDUMP_NO_TASK if none
+  uintptr_t stack[COREDUMP_STACK_WORDS]; // words from the stack pointer up
+  uint32_t crc;            // CRC-32C from cause to the end of stack, see CoreDumpCrc
+};
+
+#ifndef __arm__
+// Host only: map path as the persistent core dump, returns 0 on success
+int CoreDumpInit(const char *path);
+
+// Host only: copy the dump into the persistent area and flush it.
+// Safe to call from a signal handler.
+void CoreDumpSave(const struct sCoreDump *dump);
+
+// Host only: read a saved dump, returns 1 if there is a valid one
+int CoreDumpLoad(const char *path, struct sCoreDump *dump);
+
+// Host only: which cause a fault signal corresponds to
+uint32_t CoreDumpCauseFromSignal(int sig, const siginfo_t *info, const void *ucontext);
+
+// Host only: fill in a dump from inside a SA_SIGINFO signal handler. The
+// first four argument registers stand in for r0-r3.
+void CoreDumpFromSignal(struct sCoreDump *dump, uint32_t cause,
+                        const siginfo_t *info, const void *ucontext);
+#else
+// Target only (hardfaults.c): at boot, returns 1 if coreDump holds a valid
+// dump from before the reset, otherwise clears its key
+int CoreDumpCheckAtBoot(void);
+#endif
+
+const char *CoreDumpCauseName(uint32_t cause);
+
+// The CRC for the crc field. RAM that isn't cleared at boot holds whatever
+// it held, a dump half written when the power went, or bits flipped while
+// it sat there; the key alone doesn't catch those.
+uint32_t CoreDumpCrc(const struct sCoreDump *dump);
+
+#endif // COREDUMP_H
@@ -0,0 +1,296 @@
+/*
+ * fault_harness.c
+ *
+ * do_some_hardfaults() in hardfaults.c calls one faulting function after
+ * another, but only the first one ever runs. This harness runs each fault
+ * on its own in a forked child process (the host version of a reset),
+ * catches it the way a fault handler would, and saves the core dump. The
+ * parent then checks the dump has the expected cause and the pc is in the
+ * function that faulted.
+ *
+ * gcc -O0 -g -rdynamic -DFAULT_HARNESS fault_harness.c hardfaults.c coredump.c -o faultharness
+ * ./faultharness [iterations per fault] [children at once]
+ *
+ * -O0 keeps the compiler from "fixing" the bad code, -rdynamic lets dladdr()
+ * turn the saved pc back into a function name.
+ *
+ * It also reports how long it takes from the fault to the core dump being
+ * saved to the file, which is the window where a second fault or a power
+ * loss would cost you the dump. The clock starts when the handler is
+ * entered, the first moment the fault can be seen from user space (the
+ * kernel's part in delivering the signal isn't counted).
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "coredump.h"
+
+// from hardfaults.c
+int divide_by_zero(void);
+int write_to_null(void);
+int illegal_instruction_execution(void);
+int illegal_address_execution(void);
+void call_null_pointer_function(void);
+uint32_t unaligned_access_bad(int index);
+
+#define MAX_CHILDREN   64
+#define DUMP_NAME      "faultharness.%d.coredump"
+
+// Where the pc should end up
+enum eExpectedPc {
+  PC_IN_FUNCTION,     // the faulting instruction is in the function itself
+  PC_IS_FAULT_ADDR,   // tried to execute something that isn't code
+  PC_IS_ZERO,         // called a null function pointer
+};
+
+struct sFaultScenario {
+  const char *name;
+  void (*run)(void);
+  void *function;     // for PC_IN_FUNCTION
+  uint32_t expectedCause;
+  enum eExpectedPc expectedPc;
+};
+
+static void RunDivideByZero(void) { divide_by_zero(); }
+static void RunWriteToNull(void) { write_to_null(); }
+static void RunIllegalInstruction(void) { illegal_instruction_execution(); }
+static void RunIllegalAddress(void) { illegal_address_execution(); }
+static void RunNullFunctionPointer(void) { call_null_pointer_function(); }
+
+// The host equivalent of setting CCR.UNALIGN_TRP: the x86 alignment check
+// flag makes unaligned loads and stores in user mode raise SIGBUS
+static void RunUnalignedAccess(void)
+{
+#if defined(__x86_64__)
+  __asm volatile("pushf\n orl $0x40000, (%rsp)\n popf");
+  unaligned_access_bad(1);
+  __asm volatile("pushf\n andl $~0x40000, (%rsp)\n popf");
+#endif
+}
+
+static const struct sFaultScenario gScenarios[] = {
+  { "divide by zero",       RunDivideByZero,        (void *)divide_by_zero,
+    COREDUMP_CAUSE_DIVIDE_BY_ZERO, PC_IN_FUNCTION },
+  { "write to null",        RunWriteToNull,         (void *)write_to_null,
+    COREDUMP_CAUSE_DATA_ACCESS, PC_IN_FUNCTION },
+  { "illegal instruction",  RunIllegalInstruction,  NULL,
+    COREDUMP_CAUSE_INSTR_ACCESS, PC_IS_FAULT_ADDR },  // the stack isn't executable
+  { "illegal address",      RunIllegalAddress,      NULL,
+    COREDUMP_CAUSE_INSTR_ACCESS, PC_IS_FAULT_ADDR },
+  { "null function pointer", RunNullFunctionPointer, NULL,
+    COREDUMP_CAUSE_INSTR_ACCESS, PC_IS_ZERO },
+#if defined(__x86_64__)
+  { "unaligned access",     RunUnalignedAccess,     (void *)unaligned_access_bad,
+    COREDUMP_CAUSE_UNALIGNED, PC_IN_FUNCTION },
+#endif
+};
+#define NUM_SCENARIOS (sizeof(gScenarios) / sizeof(gScenarios[0]))
+
+// Shared with the children so they can report timing without the dump
+struct sTiming {
+  uint64_t faultStartNs;
+  uint64_t dumpSavedNs;
+};
+static struct sTiming *gTiming;   // one per child slot
+static int gSlot;                 // which slot this child is
+
+static uint64_t NowNs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+// The child's fault handler: what my_fault_handler_c() does on the target
+static void FaultHandler(int sig, siginfo_t *info, void *context)
+{
+  struct sCoreDump dump;
+
+#if defined(__x86_64__)
+  __asm volatile("pushf\n andl $~0x40000, (%rsp)\n popf"); // alignment checks off
+#endif
+  gTiming[gSlot].faultStartNs = NowNs();
+  CoreDumpFromSignal(&dump, CoreDumpCauseFromSignal(sig, info, context), info, context);
+  CoreDumpSave(&dump);
+  gTiming[gSlot].dumpSavedNs = NowNs();
+  _exit(0);
+}
+
+static void RunChild(const struct sFaultScenario *scenario, int slot)
+{
+  static const int signals[] = { SIGFPE, SIGSEGV, SIGILL, SIGBUS };
+  struct sigaction action;
+  char path[64];
+  unsigned i;
+
+  gSlot = slot;
+  snprintf(path, sizeof(path), DUMP_NAME, slot);
+  if (CoreDumpInit(path) != 0) {
+    _exit(2);
+  }
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = FaultHandler;
+  action.sa_flags = SA_SIGINFO;
+  sigfillset(&action.sa_mask);
+  for (i = 0; i < sizeof(signals) / sizeof(signals[0]); i++) {
+    sigaction(signals[i], &action, NULL);
+  }
+
+  scenario->run();
+  _exit(1); // didn't fault
+}
+
+// Returns NULL if the dump is what we expected, otherwise what was wrong
+static const char *CheckDump(const struct sFaultScenario *scenario, int slot)
+{
+  struct sCoreDump dump;
+  char path[64];
+  Dl_info where;
+
+  snprintf(path, sizeof(path), DUMP_NAME, slot);
+  if (!CoreDumpLoad(path, &dump)) {
+    return "no core dump";
+  }
+  if (dump.cause != scenario->expectedCause) {
+    return "wrong cause";
+  }
+  switch (scenario->expectedPc) {
+    case PC_IN_FUNCTION:
+      if (!dladdr((void *)dump.returnAddress, &where) || where.dli_saddr != scenario->function) {
+        return "pc not in the faulting function";
+      }
+      break;
+    case PC_IS_FAULT_ADDR:
+      if (dump.returnAddress != dump.faultAddress) {
+        return "pc is not the bad address";
+      }
+      break;
+    case PC_IS_ZERO:
+      if (dump.returnAddress != 0) {
+        return "pc is not zero";
+      }
+      break;
+  }
+  return NULL;
+}
+
+static int CompareU64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+// Run one scenario many times with up to numParallel children at once
+static int RunScenario(const struct sFaultScenario *scenario, int iterations, int numParallel)
+{
+  pid_t slotPid[MAX_CHILDREN] = { 0 };
+  uint64_t *latency = malloc(iterations * sizeof(uint64_t));
+  const char *firstProblem = NULL;
+  int requested = iterations, started = 0, finished = 0, passed = 0, numLatency = 0;
+  int slot, status;
+  pid_t pid;
+
+  while (finished < iterations) {
+    // fill every free slot
+    for (slot = 0; slot < numParallel && started < iterations; slot++) {
+      if (slotPid[slot] == 0) {
+        char path[64];
+        snprintf(path, sizeof(path), DUMP_NAME, slot);
+        unlink(path);
+        memset(&gTiming[slot], 0, sizeof(gTiming[slot]));
+        pid = fork();
+        if (pid == 0) {
+          RunChild(scenario, slot);
+        }
+        if (pid < 0) {
+          // stop starting children and let the running ones finish
+          perror("fork");
+          if (firstProblem == NULL) {
+            firstProblem = "fork failed";
+          }
+          iterations = started;
+          break;
+        }
+        slotPid[slot] = pid;
+        started++;
+      }
+    }
+
+    pid = wait(&status);
+    for (slot = 0; slot < numParallel && slotPid[slot] != pid; slot++) {
+      ;
+    }
+    if (slot == numParallel) {
+      continue;
+    }
+    slotPid[slot] = 0;
+    finished++;
+
+    {
+      const char *problem = NULL;
+      if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        problem = WIFEXITED(status) && WEXITSTATUS(status) == 1 ?
+                  "did not fault" : "handler did not finish";
+      } else {
+        problem = CheckDump(scenario, slot);
+      }
+      if (problem == NULL) {
+        passed++;
+        latency[numLatency++] = gTiming[slot].dumpSavedNs - gTiming[slot].faultStartNs;
+      } else if (firstProblem == NULL) {
+        firstProblem = problem;
+      }
+    }
+  }
+
+  printf("%-22s %5d/%-5d pass", scenario->name, passed, requested);
+  if (numLatency > 0) {
+    qsort(latency, numLatency, sizeof(uint64_t), CompareU64);
+    printf("  fault to saved dump: median %6.1f us, p99 %7.1f us, max %7.1f us",
+           latency[numLatency / 2] / 1000.0, latency[numLatency * 99 / 100] / 1000.0,
+           latency[numLatency - 1] / 1000.0);
+  }
+  if (firstProblem) {
+    printf("  FAIL: %s", firstProblem);
+  }
+  printf("\n");
+  free(latency);
+  return passed == requested;
+}
+
+int main(int argc, char *argv[])
+{
+  int iterations = argc > 1 ? atoi(argv[1]) : 1000;
+  int numParallel = argc > 2 ? atoi(argv[2]) : (int)sysconf(_SC_NPROCESSORS_ONLN) * 2;
+  int allPassed = 1;
+  unsigned i;
+  int slot;
+
+  if (numParallel < 1) numParallel = 1;
+  if (numParallel > MAX_CHILDREN) numParallel = MAX_CHILDREN;
+  gTiming = mmap(NULL, MAX_CHILDREN * sizeof(struct sTiming), PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (gTiming == MAP_FAILED) {
+    perror("mmap");
+    return 1;
+  }
+
+  printf("%d runs of each fault, %d at a time\n", iterations, numParallel);
+  for (i = 0; i < NUM_SCENARIOS; i++) {
+    allPassed &= RunScenario(&gScenarios[i], iterations, numParallel);
+  }
+  for (slot = 0; slot < numParallel; slot++) {
+    char path[64];
+    snprintf(path, sizeof(path), DUMP_NAME, slot);
+    unlink(path);
+  }
+  return allPassed ? 0 : 1;
+}
@@ -26,7 +26,11 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#ifndef FAULT_HARNESS
 #include "stm32l4xx.h"
+#endif
+// With FAULT_HARNESS defined this builds on a host so fault_harness.c can
+// run each of these in its own process and check what gets caught.
 
 int divide_by_zero(void)
 {
@@ -144,7 +148,9 @@ void do_some_hardfaults(void)
     /* UNALIGNED ACCESS */
 	unaligned_access_bad(1);
 	unaligned_access_ok();
+#ifndef FAULT_HARNESS
 	SCB->CCR |= (1<<3);			  	// turn on the hard fault that disallows unaligned access
+#endif
 	unaligned_access_ok();			// works
 	unaligned_access_bad(0);		// works
 	unaligned_access_bad(1);		// hardfault
@@ -279,18 +285,25 @@ void HardFault_Handler(void)
 //  .CoreDump :
 //  {
  // } > RAM2
-#define COREDUMP_KEY 0xE0C2024
-__attribute__((packed)) struct sCoreDump {
-uint32_t key; // must equal COREDUMP_KEY for this to be valid
-uint32_t cause;
-uint32_t r0;
-uint32_t r1;
-uint32_t r2;
-uint32_t r3;
-uint32_t returnAddress;
-uint32_t stackPointer;
-int32_t lastBattReading;
-} __attribute__((section(".CoreDump"))) coreDump;
+// The structure is in coredump.h so other fault detectors (like the
+// quarantine in blockpool.c) can fill in the same dump
+#include "coredump.h"
+struct sCoreDump coreDump __attribute__((section(".CoreDump")));
+
+// Turn the Configurable Fault Status Register bits into a cause
+static uint32_t CauseFromCfsr(uint32_t cfsr)
+{
+  if (cfsr & (1u << 25)) return COREDUMP_CAUSE_DIVIDE_BY_ZERO;  // DIVBYZERO
+  if (cfsr & (1u << 24)) return COREDUMP_CAUSE_UNALIGNED;       // UNALIGNED
+  if (cfsr & (1u << 16)) return COREDUMP_CAUSE_UNDEFINED_INSTR; // UNDEFINSTR
+  if (cfsr & ((1u << 17) | (1u << 8) | (1u << 0))) {            // INVSTATE, IBUSERR, IACCVIOL
+    return COREDUMP_CAUSE_INSTR_ACCESS;
+  }
+  if (cfsr & ((1u << 10) | (1u << 9) | (1u << 1))) {            // IMPRECISERR, PRECISERR, DACCVIOL
+    return COREDUMP_CAUSE_DATA_ACCESS;
+  }
+  return COREDUMP_CAUSE_HARDFAULT;
+}
 
 // Disable optimizations for this function so "frame" argument
 // does not get optimized away
@@ -298,14 +311,25 @@ __attribute__((optimize("O0")))
 
 void my_fault_handler_c(sContextStateFrame *frame)
 {
-    coreDump.key = COREDUMP_KEY;
+    coreDump.key = 0;  // not valid until it's all written, a reset could land anywhere in here
+    coreDump.cause = CauseFromCfsr(SCB->CFSR);
     coreDump.r0 = frame->r0;
     coreDump.r1 = frame->r1;
     coreDump.r2 = frame->r2;
     coreDump.r3 = frame->r3;
     coreDump.returnAddress = frame->return_address;
     coreDump.stackPointer = frame->xpsr;
+    coreDump.faultAddress = SCB->MMFAR; // valid if CFSR MMARVALID is set
     coreDump.lastBattReading = 0; // get this from a variable, not by running code
+    coreDump.taskId = COREDUMP_NO_TASK;
+    // no stack words are captured here, and the CRC covers them: clear out
+    // whatever the last boot left
+    for (int i = 0; i < COREDUMP_STACK_WORDS; i++) {
+        coreDump.stack[i] = 0;
+    }
+    coreDump.crc = CoreDumpCrc(&coreDump);
+    __asm volatile("" ::: "memory");
+    coreDump.key = COREDUMP_KEY;
 
 // If and only if a debugger is attached, execute a breakpoint
   // instruction so we can take a look at what triggered the fault
@@ -319,4 +343,16 @@ void my_fault_handler_c(sContextStateFrame *frame)
   //    - reboot system
 }
 
+// Call once at boot, before anything that could fault. Returns 1 if the
+// reset left a dump (key and CRC good) to report; otherwise clears the key
+// so leftover RAM isn't taken for one later.
+int CoreDumpCheckAtBoot(void)
+{
+  if (coreDump.key == COREDUMP_KEY && coreDump.crc == CoreDumpCrc(&coreDump)) {
+    return 1;
+  }
+  coreDump.key = 0;
+  return 0;
+}
+
 #endif // NEW_HANDLER_MEMFAULT
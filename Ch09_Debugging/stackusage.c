@@ -0,0 +1,646 @@
+/*
+ * stackusage.c
+ *
+ * Static worst case stack estimate. stackoverflow.c shows what happens when
+ * the stack runs out; this is how to find out before it does.
+ *
+ * GCC can report each function's stack frame (-fstack-usage writes a .su
+ * file per source file) and what each function calls (-fcallgraph-info
+ * writes a .ci file). This reads them for a whole build, walks the call
+ * graph from each entry point (main, each thread, each interrupt handler)
+ * and adds up the frames along the deepest path.
+ *
+ * Compile the firmware with:
+ *   -fstack-usage -fcallgraph-info=su,da
+ * then:
+ *   gcc -O2 stackusage.c -o stackusage
+ *   ./stackusage [--budget budget.txt] [--nested-isrs] [--strict] build/
+ *
+ * Directories are searched for .ci and .su files. The budget file says which
+ * functions are entry points and how much stack each one has (there is an
+ * example in stack_budget.txt):
+ *   # what    name             bytes
+ *   entry     main             2048
+ *   entry     SensorThread     1024
+ *   isr       *_IRQHandler     0       (budget 0: counted in main's stack)
+ *   frame     printf           512     (library functions with no .ci file)
+ *   skip      Reset_Handler    0       (not an entry or interrupt at all)
+ * Names can use shell wildcards. Without a budget file, main and anything
+ * that ends in _IRQHandler or _Handler are entry points, except
+ * Reset_Handler. A handler that calls an entry point (the way Reset_Handler
+ * calls main) isn't counted as an interrupt either, or main would be
+ * counted twice.
+ *
+ * Interrupts run on the main stack on a Cortex-M, so main's total includes
+ * the deepest handler (or, with --nested-isrs, all of them) plus the
+ * exception frame the hardware pushes.
+ *
+ * The exit code is 1 if anything is over budget, or an entry point has no
+ * budget (always the case without a budget file), so this can gate a build.
+ * Recursion, alloca/VLAs, calls through function pointers and functions
+ * with unknown frames make the answer a lower bound; they are reported and
+ * with --strict they fail the build too.
+ */
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fnmatch.h>
+#include <ftw.h>
+
+#define NO_ID               0xFFFFFFFFu
+#define MAX_RULES           256
+#define EXCEPTION_FRAME     32      // Cortex-M pushes r0-r3, r12, lr, pc, xPSR (104 with FP state)
+#define INDIRECT_CALL       "__indirect_call"
+
+// Why an estimate can't be trusted
+enum eFlags {
+  FLAG_RECURSIVE = 1,
+  FLAG_DYNAMIC   = 2,   // alloca or variable length arrays
+  FLAG_INDIRECT  = 4,   // calls through a function pointer
+  FLAG_UNKNOWN   = 8,   // calls a function with no stack information
+};
+
+struct sFunction {
+  const char *name;       // as GCC titles it: static functions are "file.c:name"
+  uint32_t frame;
+  uint8_t hasFrame;
+  uint8_t flags;          // its own, before adding callees
+  // filled in by the walk
+  uint8_t state;          // 0 not visited, 1 on the current path, 2 done
+  uint8_t pathFlags;      // its own and everything it calls
+  uint32_t worst;         // deepest stack from here down
+  uint32_t worstCallee;
+  uint32_t firstEdge;     // into the sorted edge array
+  uint32_t numEdges;
+};
+
+struct sEdge {
+  uint32_t from;
+  uint32_t to;
+};
+
+enum eRuleType { RULE_ENTRY, RULE_ISR, RULE_FRAME, RULE_SKIP };
+
+struct sRule {
+  enum eRuleType type;
+  char pattern[128];
+  uint32_t bytes;
+};
+
+/******************************************************************************************************
+ * Functions by name
+ * An open addressing hash table from name to index in gFunctions.
+*******************************************************************************************************/
+static struct sFunction *gFunctions;
+static uint32_t gNumFunctions, gCapFunctions;
+static uint32_t *gTable;
+static uint32_t gTableSize;
+static struct sEdge *gEdges;
+static uint32_t gNumEdges, gCapEdges;
+static struct sRule gRules[MAX_RULES];
+static int gNumRules;
+
+static void *CheckedRealloc(void *p, size_t size)
+{
+  p = realloc(p, size);
+  if (p == NULL) {
+    fprintf(stderr, "out of memory\n");
+    exit(2);
+  }
+  return p;
+}
+
+static uint32_t HashString(const char *s, size_t n)
+{
+  uint32_t h = 2166136261u; // FNV-1a
+  while (n--) {
+    h = (h ^ (uint8_t)*s++) * 16777619u;
+  }
+  return h;
+}
+
+static void GrowTable(void)
+{
+  uint32_t i, newSize = gTableSize ? gTableSize * 2 : 4096;
+  uint32_t *table = CheckedRealloc(NULL, newSize * sizeof(uint32_t));
+
+  memset(table, 0xFF, newSize * sizeof(uint32_t));
+  for (i = 0; i < gNumFunctions; i++) {
+    uint32_t slot = HashString(gFunctions[i].name, strlen(gFunctions[i].name)) & (newSize - 1);
+    while (table[slot] != NO_ID) {
+      slot = (slot + 1) & (newSize - 1);
+    }
+    table[slot] = i;
+  }
+  free(gTable);
+  gTable = table;
+  gTableSize = newSize;
+}
+
+// Looks up name[0..n), adding it if create is set
+static uint32_t FindFunction(const char *name, size_t n, int create)
+{
+  uint32_t slot;
+  char *copy;
+
+  if (gNumFunctions * 2 >= gTableSize) {
+    GrowTable();
+  }
+  slot = HashString(name, n) & (gTableSize - 1);
+  while (gTable[slot] != NO_ID) {
+    const char *existing = gFunctions[gTable[slot]].name;
+    if (strncmp(existing, name, n) == 0 && existing[n] == '\0') {
+      return gTable[slot];
+    }
+    slot = (slot + 1) & (gTableSize - 1);
+  }
+  if (!create) {
+    return NO_ID;
+  }
+  if (gNumFunctions == gCapFunctions) {
+    gCapFunctions = gCapFunctions ? gCapFunctions * 2 : 4096;
+    gFunctions = CheckedRealloc(gFunctions, gCapFunctions * sizeof(struct sFunction));
+  }
+  copy = CheckedRealloc(NULL, n + 1);
+  memcpy(copy, name, n);
+  copy[n] = '\0';
+  memset(&gFunctions[gNumFunctions], 0, sizeof(struct sFunction));
+  gFunctions[gNumFunctions].name = copy;
+  gTable[slot] = gNumFunctions;
+  return gNumFunctions++;
+}
+
+static void SetFrame(uint32_t id, uint32_t frame, const char *qualifier)
+{
+  struct sFunction *f = &gFunctions[id];
+  // an inline function may be emitted in several files, keep the biggest
+  if (!f->hasFrame || frame > f->frame) {
+    f->frame = frame;
+  }
+  f->hasFrame = 1;
+  // "dynamic,bounded" means GCC worked out the limit and it is in the number
+  if (strncmp(qualifier, "dynamic", 7) == 0 && strncmp(qualifier, "dynamic,bounded", 15) != 0) {
+    f->flags |= FLAG_DYNAMIC;
+  }
+}
+
+/******************************************************************************************************
+ * Reading the compiler output
+ *
+ * .ci files are VCG graphs, one node or edge per line:
+ *   node: { title: "a.c:mid" label: "mid\na.c:3:13\n224 bytes (static)\n0 dynamic objects" }
+ *   edge: { sourcename: "a.c:mid" targetname: "leaf" label: "a.c:3:38" }
+ * (the \n are a backslash and an n). Functions that are only declared have
+ * no "bytes" in their label; their frame comes from another file or a
+ * frame rule.
+ *
+ * .su files have one function per line:
+ *   a.c:3:13:mid	224	static
+ * They are used for functions compiled without -fcallgraph-info, which
+ * then look like they call nothing.
+*******************************************************************************************************/
+// Finds key"...", returns the start of the quoted text and sets its length
+static const char *Quoted(const char *line, const char *key, size_t *length)
+{
+  const char *start = strstr(line, key);
+  const char *end;
+  if (start == NULL) {
+    return NULL;
+  }
+  start += strlen(key);
+  end = strchr(start, '"');
+  if (end == NULL) {
+    return NULL;
+  }
+  *length = (size_t)(end - start);
+  return start;
+}
+
+static void AddEdge(uint32_t from, uint32_t to)
+{
+  if (gNumEdges == gCapEdges) {
+    gCapEdges = gCapEdges ? gCapEdges * 2 : 16384;
+    gEdges = CheckedRealloc(gEdges, gCapEdges * sizeof(struct sEdge));
+  }
+  gEdges[gNumEdges].from = from;
+  gEdges[gNumEdges].to = to;
+  gNumEdges++;
+}
+
+static void ReadCallGraph(FILE *file)
+{
+  char line[4096];
+  size_t n, m;
+  const char *title, *label, *target;
+
+  while (fgets(line, sizeof(line), file)) {
+    if (strncmp(line, "node:", 5) == 0) {
+      title = Quoted(line, "title: \"", &n);
+      label = Quoted(line, "label: \"", &m);
+      if (title) {
+        uint32_t id = FindFunction(title, n, 1);
+        const char *bytes = label ? strstr(label, " bytes (") : NULL;
+        if (bytes && bytes < label + m) {
+          // the number is after the second \n
+          const char *number = bytes;
+          while (number > label && number[-1] >= '0' && number[-1] <= '9') {
+            number--;
+          }
+          SetFrame(id, (uint32_t)strtoul(number, NULL, 10), bytes + 8);
+        }
+      }
+    } else if (strncmp(line, "edge:", 5) == 0) {
+      title = Quoted(line, "sourcename: \"", &n);
+      target = Quoted(line, "targetname: \"", &m);
+      if (title && target) {
+        AddEdge(FindFunction(title, n, 1), FindFunction(target, m, 1));
+      }
+    }
+  }
+}
+
+static void ReadStackUsage(FILE *file)
+{
+  char line[4096];
+
+  while (fgets(line, sizeof(line), file)) {
+    // file:line:column:name<tab>bytes<tab>qualifier
+    char *tab = strchr(line, '\t');
+    char *name, *qualifier;
+    uint32_t id, frame;
+    if (tab == NULL) {
+      continue;
+    }
+    *tab = '\0';
+    name = strrchr(line, ':');
+    name = name ? name + 1 : line;
+    frame = (uint32_t)strtoul(tab + 1, &qualifier, 10);
+    while (*qualifier == '\t' || *qualifier == ' ') {
+      qualifier++;
+    }
+    id = FindFunction(name, strlen(name), 0);
+    if (id != NO_ID && gFunctions[id].hasFrame) {
+      continue; // the .ci file already said
+    }
+    // a static function would be "file.c:name" in the .ci files; if there are
+    // none, the plain name is as good as it gets
+    SetFrame(FindFunction(name, strlen(name), 1), frame, qualifier);
+  }
+}
+
+static char **gSuFiles;
+static size_t gNumSuFiles, gCapSuFiles;
+
+static int EndsWith(const char *s, const char *suffix)
+{
+  size_t n = strlen(s), m = strlen(suffix);
+  return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+static int VisitFile(const char *path, const struct stat *sb, int type, struct FTW *ftw)
+{
+  FILE *file;
+  (void)sb;
+  (void)ftw;
+  if (type != FTW_F) {
+    return 0;
+  }
+  if (EndsWith(path, ".ci")) {
+    file = fopen(path, "r");
+    if (file) {
+      ReadCallGraph(file);
+      fclose(file);
+    }
+  } else if (EndsWith(path, ".su")) {
+    // after all the .ci files, which know more
+    if (gNumSuFiles == gCapSuFiles) {
+      gCapSuFiles = gCapSuFiles ? gCapSuFiles * 2 : 256;
+      gSuFiles = CheckedRealloc(gSuFiles, gCapSuFiles * sizeof(char *));
+    }
+    gSuFiles[gNumSuFiles++] = strdup(path);
+  }
+  return 0;
+}
+
+static int ReadBudget(const char *path)
+{
+  FILE *file = fopen(path, "r");
+  char line[512], type[16], pattern[128];
+  unsigned bytes;
+
+  if (file == NULL) {
+    perror(path);
+    return -1;
+  }
+  while (fgets(line, sizeof(line), file) && gNumRules < MAX_RULES) {
+    struct sRule *rule = &gRules[gNumRules];
+    if (line[0] == '#' || sscanf(line, "%15s %127s %u", type, pattern, &bytes) != 3) {
+      continue;
+    }
+    if (strcmp(type, "entry") == 0) {
+      rule->type = RULE_ENTRY;
+    } else if (strcmp(type, "isr") == 0) {
+      rule->type = RULE_ISR;
+    } else if (strcmp(type, "frame") == 0) {
+      rule->type = RULE_FRAME;
+    } else if (strcmp(type, "skip") == 0) {
+      rule->type = RULE_SKIP;
+    } else {
+      fprintf(stderr, "%s: unknown rule '%s'\n", path, type);
+      continue;
+    }
+    strcpy(rule->pattern, pattern);
+    rule->bytes = bytes;
+    gNumRules++;
+  }
+  fclose(file);
+  return 0;
+}
+
+static void DefaultRules(void)
+{
+  static const struct sRule defaults[] = {
+    { RULE_SKIP, "Reset_Handler", 0 },
+    { RULE_ENTRY, "main", 0 },
+    { RULE_ISR, "*_IRQHandler", 0 },
+    { RULE_ISR, "*_Handler", 0 },
+  };
+  memcpy(gRules, defaults, sizeof(defaults));
+  gNumRules = sizeof(defaults) / sizeof(defaults[0]);
+}
+
+// Static functions are titled "file.c:name", rules match on the name part
+static const char *PlainName(const char *name)
+{
+  const char *colon = strrchr(name, ':');
+  return colon ? colon + 1 : name;
+}
+
+static const struct sRule *MatchRule(const char *name, enum eRuleType type)
+{
+  int i;
+  for (i = 0; i < gNumRules; i++) {
+    if (gRules[i].type == RULE_SKIP && type != RULE_FRAME &&
+        fnmatch(gRules[i].pattern, PlainName(name), 0) == 0) {
+      return NULL;
+    }
+    if (gRules[i].type == type && fnmatch(gRules[i].pattern, PlainName(name), 0) == 0) {
+      return &gRules[i];
+    }
+  }
+  return NULL;
+}
+
+/******************************************************************************************************
+ * The walk
+ * A depth first search that remembers the answer for each function, so each
+ * is worked out once no matter how many callers it has. A call back to a
+ * function still on the current path is recursion: it is flagged and
+ * counted once, as there is no way to know how deep it goes.
+*******************************************************************************************************/
+static int CompareEdges(const void *a, const void *b)
+{
+  const struct sEdge *x = a, *y = b;
+  if (x->from != y->from) {
+    return x->from < y->from ? -1 : 1;
+  }
+  return (x->to > y->to) - (x->to < y->to);
+}
+
+static void IndexEdges(void)
+{
+  uint32_t i;
+  qsort(gEdges, gNumEdges, sizeof(struct sEdge), CompareEdges);
+  for (i = 0; i < gNumEdges; i++) {
+    struct sFunction *f = &gFunctions[gEdges[i].from];
+    if (f->numEdges == 0) {
+      f->firstEdge = i;
+    }
+    f->numEdges++;
+  }
+}
+
+static void Walk(uint32_t id)
+{
+  struct sFunction *f = &gFunctions[id];
+  uint32_t i, deepest = 0;
+
+  f->state = 1;
+  f->pathFlags = f->flags;
+  f->worstCallee = NO_ID;
+  for (i = f->firstEdge; i < f->firstEdge + f->numEdges; i++) {
+    uint32_t callee = gEdges[i].to;
+    struct sFunction *c = &gFunctions[callee];
+    if (i > f->firstEdge && callee == gEdges[i - 1].to) {
+      continue; // called from more than one place
+    }
+    if (c->state == 1) {
+      c->flags |= FLAG_RECURSIVE;
+      f->pathFlags |= FLAG_RECURSIVE;
+      continue;
+    }
+    if (c->state == 0) {
+      Walk(callee);
+    }
+    f->pathFlags |= c->pathFlags;
+    if (c->worst > deepest || f->worstCallee == NO_ID) {
+      deepest = c->worst;
+      f->worstCallee = callee;
+    }
+  }
+  f->worst = f->frame + deepest;
+  f->state = 2;
+}
+
+// Does anything called from id match an entry rule? An "interrupt" that
+// does is really startup code (Reset_Handler calling main).
+static int ReachesEntry(uint32_t id, uint32_t *seen, uint32_t stamp)
+{
+  const struct sFunction *f = &gFunctions[id];
+  uint32_t i;
+
+  seen[id] = stamp;
+  for (i = f->firstEdge; i < f->firstEdge + f->numEdges; i++) {
+    uint32_t callee = gEdges[i].to;
+    if (seen[callee] == stamp) {
+      continue;
+    }
+    if (MatchRule(gFunctions[callee].name, RULE_ENTRY) != NULL ||
+        ReachesEntry(callee, seen, stamp)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void PrepareFunctions(void)
+{
+  uint32_t i;
+  for (i = 0; i < gNumFunctions; i++) {
+    struct sFunction *f = &gFunctions[i];
+    const struct sRule *rule;
+    if (strcmp(f->name, INDIRECT_CALL) == 0) {
+      f->flags |= FLAG_INDIRECT;
+      f->hasFrame = 1;
+    } else if (!f->hasFrame && (rule = MatchRule(f->name, RULE_FRAME)) != NULL) {
+      f->frame = rule->bytes;
+      f->hasFrame = 1;
+    }
+    if (!f->hasFrame) {
+      f->flags |= FLAG_UNKNOWN;
+    }
+  }
+}
+
+static void PrintFlags(uint8_t flags)
+{
+  if (flags & FLAG_RECURSIVE) printf(" recursion");
+  if (flags & FLAG_DYNAMIC) printf(" alloca/VLA");
+  if (flags & FLAG_INDIRECT) printf(" function-pointer");
+  if (flags & FLAG_UNKNOWN) printf(" unknown-frame");
+}
+
+// The deepest path, and which functions along it make it a guess
+static void PrintPath(uint32_t id)
+{
+  uint32_t depth = 0;
+  while (id != NO_ID && depth++ < 64) {
+    const struct sFunction *f = &gFunctions[id];
+    printf("      %6u  %s", f->frame, f->name);
+    if (f->flags) {
+      printf("  <-");
+      PrintFlags(f->flags);
+    }
+    printf("\n");
+    id = f->worstCallee;
+  }
+}
+
+// Returns 1 if it fails the gate. Entry points need a budget; an interrupt
+// with budget 0 is only counted in main's stack.
+static int Check(const char *label, uint32_t id, uint32_t total, uint8_t flags,
+                 uint32_t budget, int needBudget, int strict)
+{
+  int over = budget && total > budget;
+  int failed = over || (strict && flags) || (needBudget && budget == 0);
+
+  printf("%-4s %-28s %s%7u", failed ? "FAIL" : "ok", label, flags ? ">=" : "  ", total);
+  if (budget) {
+    printf(" of %6u bytes (%3u%%)", budget, (unsigned)(100ull * total / budget));
+  } else if (needBudget) {
+    printf(" bytes, no budget");
+  } else {
+    printf(" bytes");
+  }
+  if (flags) {
+    printf("  lower bound:");
+    PrintFlags(flags);
+  }
+  printf("\n");
+  if (failed || flags) {
+    PrintPath(id);
+  }
+  return failed;
+}
+
+int main(int argc, char *argv[])
+{
+  uint32_t i, worstIsr = 0, sumIsrs = 0, mainId = NO_ID, *seen;
+  uint8_t isrFlags = 0;
+  int nested = 0, strict = 0, failed = 0, haveBudget = 0, arg;
+
+  for (arg = 1; arg < argc && argv[arg][0] == '-'; arg++) {
+    if (strcmp(argv[arg], "--budget") == 0 && arg + 1 < argc) {
+      if (ReadBudget(argv[++arg]) != 0) {
+        return 2;
+      }
+      haveBudget = 1;
+    } else if (strcmp(argv[arg], "--nested-isrs") == 0) {
+      nested = 1;
+    } else if (strcmp(argv[arg], "--strict") == 0) {
+      strict = 1;
+    } else {
+      break;
+    }
+  }
+  if (arg >= argc) {
+    printf("usage: stackusage [--budget budget.txt] [--nested-isrs] [--strict] dir|file...\n");
+    return 2;
+  }
+  if (!haveBudget) {
+    DefaultRules();
+  }
+  for (; arg < argc; arg++) {
+    if (nftw(argv[arg], VisitFile, 32, FTW_PHYS) != 0) {
+      perror(argv[arg]);
+      return 2;
+    }
+  }
+  for (i = 0; i < gNumSuFiles; i++) {
+    FILE *file = fopen(gSuFiles[i], "r");
+    if (file) {
+      ReadStackUsage(file);
+      fclose(file);
+    }
+  }
+  PrepareFunctions();
+  IndexEdges();
+  printf("%u functions, %u calls\n\n", gNumFunctions, gNumEdges);
+
+  // interrupt handlers first: they add to main's stack
+  seen = calloc(gNumFunctions + 1, sizeof(uint32_t));
+  for (i = 0; i < gNumFunctions; i++) {
+    const struct sRule *rule = MatchRule(gFunctions[i].name, RULE_ISR);
+    if (rule == NULL || gFunctions[i].numEdges + gFunctions[i].hasFrame == 0) {
+      continue;
+    }
+    if (ReachesEntry(i, seen, i + 1)) {
+      printf("%-4s %-28s   calls an entry point, not counted as an interrupt\n", "",
+             gFunctions[i].name);
+      continue;
+    }
+    Walk(i);
+    failed |= Check(gFunctions[i].name, i, gFunctions[i].worst + EXCEPTION_FRAME,
+                    gFunctions[i].pathFlags, rule->bytes, 0, strict);
+    if (gFunctions[i].worst + EXCEPTION_FRAME > worstIsr) {
+      worstIsr = gFunctions[i].worst + EXCEPTION_FRAME;
+    }
+    sumIsrs += gFunctions[i].worst + EXCEPTION_FRAME;
+    isrFlags |= gFunctions[i].pathFlags;
+  }
+
+  for (i = 0; i < gNumFunctions; i++) {
+    const struct sRule *rule = MatchRule(gFunctions[i].name, RULE_ENTRY);
+    uint32_t total;
+    uint8_t flags;
+    if (rule == NULL) {
+      continue;
+    }
+    if (gFunctions[i].state == 0) {
+      Walk(i);
+    }
+    total = gFunctions[i].worst;
+    flags = gFunctions[i].pathFlags;
+    if (strcmp(PlainName(gFunctions[i].name), "main") == 0) {
+      mainId = i;
+      total += nested ? sumIsrs : worstIsr;
+      flags |= isrFlags;
+      printf("%-4s %-28s   %7u bytes without interrupts\n", "", "main", gFunctions[i].worst);
+      failed |= Check(nested ? "main + nested interrupts" : "main + deepest interrupt",
+                      i, total, flags, rule->bytes, 1, strict);
+    } else {
+      failed |= Check(gFunctions[i].name, i, total, flags, rule->bytes, 1, strict);
+    }
+  }
+  free(seen);
+  if (!haveBudget) {
+    printf("\nNo budget file: the numbers above are a report, give --budget to pass the gate\n");
+  }
+  if (mainId == NO_ID && worstIsr) {
+    printf("No main: interrupts alone need %u bytes\n", nested ? sumIsrs : worstIsr);
+  }
+  printf("\n%s\n", failed ? "STACK CHECK FAILED" : "Within budget");
+  return failed;
+}
@@ -0,0 +1,415 @@
+/*
+ * crc.c
+ *
+ * CRC-8, CRC-16/CCITT, CRC-32 and CRC-32C, see crc.h
+ *
+ * Inside, the running CRC is kept so one piece of code works for all of
+ * them: reflected CRCs shift right with the reflected polynomial, the
+ * others are moved up to the top of 32 bits and shift left, so an 8 or 16
+ * bit CRC works the same as a 32 bit one. CrcStart and CrcFinish move
+ * between that and the real value.
+ *
+ * Everything is linear: moving a CRC past n zero bytes is multiplying it
+ * by a 32x32 bit matrix, and that matrix for 2n is the one for n squared.
+ * CrcCombine and the three stream CRC-32C are built on that.
+ */
+#include <string.h>
+#include "crc.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CRC_X86 1
+#endif
+
+const struct sCrcModel kCrcModels[NUM_CRC_TYPES] = {
+  [CRC_8]        = { "CRC-8",        8,  0, 0x07,       0x00,       0x00,       0xF4 },
+  [CRC_16_CCITT] = { "CRC-16/CCITT", 16, 0, 0x1021,     0xFFFF,     0x0000,     0x29B1 },
+  [CRC_32]       = { "CRC-32",       32, 1, 0x04C11DB7, 0xFFFFFFFF, 0xFFFFFFFF, 0xCBF43926 },
+  [CRC_32C]      = { "CRC-32C",      32, 1, 0x1EDC6F41, 0xFFFFFFFF, 0xFFFFFFFF, 0xE3069283 },
+};
+
+static uint32_t Reflect(uint32_t value, int bits)
+{
+  uint32_t result = 0;
+  int i;
+
+  for (i = 0; i < bits; i++) {
+    result = (result << 1) | ((value >> i) & 1);
+  }
+  return result;
+}
+
+static int Shift(const struct sCrc *crc)
+{
+  return 32 - crc->model->width;
+}
+
+/******************************************************************************************************
+ * The ways to work it out
+*******************************************************************************************************/
+static uint32_t UpdateBitwise(const struct sCrc *crc, uint32_t running, const uint8_t *data,
+                              size_t length)
+{
+  int bit;
+
+  while (length--) {
+    if (crc->model->reflected) {
+      running ^= *data++;
+      for (bit = 0; bit < 8; bit++) {
+        running = (running >> 1) ^ (crc->poly & (0u - (running & 1)));
+      }
+    } else {
+      running ^= (uint32_t)*data++ << 24;
+      for (bit = 0; bit < 8; bit++) {
+        running = (running << 1) ^ (crc->poly & (0u - (running >> 31)));
+      }
+    }
+  }
+  return running;
+}
+
+static uint32_t UpdateTable(const struct sCrc *crc, uint32_t running, const uint8_t *data,
+                            size_t length)
+{
+  const uint32_t *table = crc->table[0];
+
+  if (crc->model->reflected) {
+    while (length--) {
+      running = (running >> 8) ^ table[(running ^ *data++) & 0xFF];
+    }
+  } else {
+    while (length--) {
+      running = (running << 8) ^ table[(running >> 24) ^ *data++];
+    }
+  }
+  return running;
+}
+
+static uint32_t Load32(const uint8_t *p, int bigEndian)
+{
+  if (bigEndian) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+  }
+  return (uint32_t)p[3] << 24 | (uint32_t)p[2] << 16 | (uint32_t)p[1] << 8 | p[0];
+}
+
+static uint32_t UpdateSlice8(const struct sCrc *crc, uint32_t running, const uint8_t *data,
+                             size_t length)
+{
+  const uint32_t (*t)[256] = crc->table;
+
+  if (crc->model->reflected) {
+    for (; length >= 8; data += 8, length -= 8) {
+      uint32_t a = running ^ Load32(data, 0), b = Load32(data + 4, 0);
+      running = t[7][a & 0xFF] ^ t[6][(a >> 8) & 0xFF] ^ t[5][(a >> 16) & 0xFF] ^ t[4][a >> 24] ^
+                t[3][b & 0xFF] ^ t[2][(b >> 8) & 0xFF] ^ t[1][(b >> 16) & 0xFF] ^ t[0][b >> 24];
+    }
+  } else {
+    for (; length >= 8; data += 8, length -= 8) {
+      uint32_t a = running ^ Load32(data, 1), b = Load32(data + 4, 1);
+      running = t[7][a >> 24] ^ t[6][(a >> 16) & 0xFF] ^ t[5][(a >> 8) & 0xFF] ^ t[4][a & 0xFF] ^
+                t[3][b >> 24] ^ t[2][(b >> 16) & 0xFF] ^ t[1][(b >> 8) & 0xFF] ^ t[0][b & 0xFF];
+    }
+  }
+  return UpdateTable(crc, running, data, length);
+}
+
+#ifdef CRC_X86
+static uint32_t LaneShift(const struct sCrc *crc, uint32_t running)
+{
+  return crc->laneShift[0][running & 0xFF] ^ crc->laneShift[1][(running >> 8) & 0xFF] ^
+         crc->laneShift[2][(running >> 16) & 0xFF] ^ crc->laneShift[3][running >> 24];
+}
+
+// The crc32 instruction takes 3 cycles but can start one every cycle, so
+// three independent streams keep it busy: the block is split into three
+// lanes, each lane's CRC is worked out separately, and they are joined by
+// moving the first past the second and that past the third.
+__attribute__((target("sse4.2")))
+static uint32_t UpdateHardware32C(const struct sCrc *crc, uint32_t running, const uint8_t *data,
+                                  size_t length)
+{
+  uint64_t a, b, c;
+
+  for (; length >= 3 * CRC_LANE; data += 3 * CRC_LANE, length -= 3 * CRC_LANE) {
+    const uint8_t *end = data + CRC_LANE;
+    const uint8_t *p;
+    a = running;
+    b = 0;
+    c = 0;
+    for (p = data; p < end; p += 8) {
+      uint64_t x, y, z;
+      memcpy(&x, p, 8);
+      memcpy(&y, p + CRC_LANE, 8);
+      memcpy(&z, p + 2 * CRC_LANE, 8);
+      a = _mm_crc32_u64(a, x);
+      b = _mm_crc32_u64(b, y);
+      c = _mm_crc32_u64(c, z);
+    }
+    running = LaneShift(crc, LaneShift(crc, (uint32_t)a) ^ (uint32_t)b) ^ (uint32_t)c;
+  }
+  a = running;
+  for (; length >= 8; data += 8, length -= 8) {
+    uint64_t x;
+    memcpy(&x, data, 8);
+    a = _mm_crc32_u64(a, x);
+  }
+  running = (uint32_t)a;
+  while (length--) {
+    running = _mm_crc32_u8(running, *data++);
+  }
+  return running;
+}
+
+// Folding 64 bytes at a time with carry-less multiplies, then a Barrett
+// reduction down to 32 bits, from Intel's "Fast CRC Computation for Generic
+// Polynomials Using PCLMULQDQ Instruction". The constants are powers of x
+// modulo the CRC-32 polynomial, bit reflected. Needs length >= 64 and a
+// multiple of 16.
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t Fold32(uint32_t running, const uint8_t *data, size_t length)
+{
+  const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+  const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+  const __m128i k5 = _mm_set_epi64x(0, 0x0163cd6124);
+  const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+  const __m128i low32 = _mm_setr_epi32(~0, 0, ~0, 0);
+  __m128i x1, x2, x3, x4, t;
+
+  x1 = _mm_loadu_si128((const __m128i *)data);
+  x2 = _mm_loadu_si128((const __m128i *)(data + 16));
+  x3 = _mm_loadu_si128((const __m128i *)(data + 32));
+  x4 = _mm_loadu_si128((const __m128i *)(data + 48));
+  x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)running));
+  data += 64;
+  length -= 64;
+
+  for (; length >= 64; data += 64, length -= 64) {
+    __m128i y1 = _mm_clmulepi64_si128(x1, k1k2, 0x00), y2 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+    __m128i y3 = _mm_clmulepi64_si128(x3, k1k2, 0x00), y4 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+    x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k1k2, 0x11), y1);
+    x2 = _mm_xor_si128(_mm_clmulepi64_si128(x2, k1k2, 0x11), y2);
+    x3 = _mm_xor_si128(_mm_clmulepi64_si128(x3, k1k2, 0x11), y3);
+    x4 = _mm_xor_si128(_mm_clmulepi64_si128(x4, k1k2, 0x11), y4);
+    x1 = _mm_xor_si128(x1, _mm_loadu_si128((const __m128i *)data));
+    x2 = _mm_xor_si128(x2, _mm_loadu_si128((const __m128i *)(data + 16)));
+    x3 = _mm_xor_si128(x3, _mm_loadu_si128((const __m128i *)(data + 32)));
+    x4 = _mm_xor_si128(x4, _mm_loadu_si128((const __m128i *)(data + 48)));
+  }
+
+  // four 128 bit values down to one
+  t = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+  x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x2), t);
+  t = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+  x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x3), t);
+  t = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+  x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x4), t);
+  for (; length >= 16; data += 16, length -= 16) {
+    t = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), t);
+    x1 = _mm_xor_si128(x1, _mm_loadu_si128((const __m128i *)data));
+  }
+
+  // 128 bits to 64
+  t = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+  x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), t);
+  t = _mm_srli_si128(x1, 4);
+  x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, low32), k5, 0x00);
+  x1 = _mm_xor_si128(x1, t);
+
+  // Barrett reduction to 32
+  t = _mm_clmulepi64_si128(_mm_and_si128(x1, low32), poly, 0x10);
+  t = _mm_clmulepi64_si128(_mm_and_si128(t, low32), poly, 0x00);
+  x1 = _mm_xor_si128(x1, t);
+  return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+
+static uint32_t UpdateHardware32(const struct sCrc *crc, uint32_t running, const uint8_t *data,
+                                 size_t length)
+{
+  if (length >= 64) {
+    size_t folded = length & ~(size_t)15;
+    running = Fold32(running, data, folded);
+    data += folded;
+    length -= folded;
+  }
+  return UpdateSlice8(crc, running, data, length);
+}
+
+static int HasHardware(enum eCrcType type)
+{
+  __builtin_cpu_init();
+  if (type == CRC_32C) {
+    return __builtin_cpu_supports("sse4.2");
+  }
+  if (type == CRC_32) {
+    return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+  }
+  return 0;
+}
+#else
+static int HasHardware(enum eCrcType type)
+{
+  (void)type;
+  return 0;
+}
+#endif // CRC_X86
+
+/******************************************************************************************************
+ * Moving a CRC past zeros
+*******************************************************************************************************/
+// result = matrix * vector over GF(2): column i is what bit i turns into
+static uint32_t MatrixTimes(const uint32_t *matrix, uint32_t vector)
+{
+  uint32_t result = 0;
+
+  for (; vector != 0; vector &= vector - 1) {
+    result ^= matrix[__builtin_ctz(vector)];
+  }
+  return result;
+}
+
+static void MatrixSquare(uint32_t *square, const uint32_t *matrix)
+{
+  int i;
+
+  for (i = 0; i < 32; i++) {
+    square[i] = MatrixTimes(matrix, matrix[i]);
+  }
+}
+
+// The matrix that moves a running CRC past length zero bytes
+static void ZerosMatrix(const struct sCrc *crc, uint32_t *matrix, size_t length)
+{
+  static const uint8_t zero = 0;
+  uint32_t power[32], square[32];
+  int i, first = 1;
+
+  for (i = 0; i < 32; i++) {
+    power[i] = UpdateBitwise(crc, 1u << i, &zero, 1);
+  }
+  for (i = 0; i < 32; i++) {
+    matrix[i] = 1u << i;
+  }
+  while (length != 0) {
+    if (length & 1) {
+      if (first) {
+        memcpy(matrix, power, sizeof(power));
+        first = 0;
+      } else {
+        for (i = 0; i < 32; i++) {
+          square[i] = MatrixTimes(power, matrix[i]);
+        }
+        memcpy(matrix, square, sizeof(square));
+      }
+    }
+    length >>= 1;
+    if (length != 0) {
+      MatrixSquare(square, power);
+      memcpy(power, square, sizeof(square));
+    }
+  }
+}
+
+uint32_t CrcCombine(const struct sCrc *crc, uint32_t crcA, uint32_t crcB, size_t lengthB)
+{
+  const struct sCrcModel *model = crc->model;
+  uint32_t matrix[32];
+  // crcB started from init, not from where A left off: moving A's CRC
+  // (less init) past B's length and adding it in makes up the difference
+  uint32_t a = crcA ^ model->xorOut ^ model->init;
+
+  if (!model->reflected) {
+    a <<= Shift(crc);
+  }
+  ZerosMatrix(crc, matrix, lengthB);
+  a = MatrixTimes(matrix, a);
+  return (model->reflected ? a : a >> Shift(crc)) ^ crcB;
+}
+
+/******************************************************************************************************
+ * Setup and use
+*******************************************************************************************************/
+int CrcSetup(struct sCrc *crc, enum eCrcType type, enum eCrcMethod method)
+{
+  const struct sCrcModel *model = &kCrcModels[type];
+  uint32_t i, k;
+
+  memset(crc, 0, sizeof(*crc));
+  crc->model = model;
+  crc->poly = model->reflected ? Reflect(model->poly, model->width)
+                               : model->poly << (32 - model->width);
+  if (method == CRC_BEST) {
+    method = HasHardware(type) ? CRC_HARDWARE : CRC_SLICE8;
+  } else if (method == CRC_HARDWARE && !HasHardware(type)) {
+    return -1;
+  }
+  crc->method = method;
+
+  for (i = 0; i < 256; i++) {
+    uint8_t byte = (uint8_t)i;
+    // the table entry is what the byte does to a zero CRC
+    crc->table[0][i] = UpdateBitwise(crc, 0, &byte, 1);
+  }
+  for (k = 1; k < 8; k++) {
+    for (i = 0; i < 256; i++) {
+      uint32_t last = crc->table[k - 1][i];
+      crc->table[k][i] = model->reflected ? (last >> 8) ^ crc->table[0][last & 0xFF]
+                                          : (last << 8) ^ crc->table[0][last >> 24];
+    }
+  }
+  if (type == CRC_32C && method == CRC_HARDWARE) {
+    uint32_t matrix[32];
+    ZerosMatrix(crc, matrix, CRC_LANE);
+    for (k = 0; k < 4; k++) {
+      for (i = 0; i < 256; i++) {
+        crc->laneShift[k][i] = MatrixTimes(matrix, i << (8 * k));
+      }
+    }
+  }
+  return 0;
+}
+
+uint32_t CrcStart(const struct sCrc *crc)
+{
+  return crc->model->reflected ? crc->model->init : crc->model->init << Shift(crc);
+}
+
+uint32_t CrcFinish(const struct sCrc *crc, uint32_t running)
+{
+  return (crc->model->reflected ? running : running >> Shift(crc)) ^ crc->model->xorOut;
+}
+
+uint32_t CrcUpdate(const struct sCrc *crc, uint32_t running, const void *data, size_t length)
+{
+  switch (crc->method) {
+  case CRC_BITWISE:
+    return UpdateBitwise(crc, running, data, length);
+  case CRC_TABLE:
+    return UpdateTable(crc, running, data, length);
+#ifdef CRC_X86
+  case CRC_HARDWARE:
+    return crc->model == &kCrcModels[CRC_32C] ? UpdateHardware32C(crc, running, data, length)
+                                              : UpdateHardware32(crc, running, data, length);
+#endif
+  default:
+    return UpdateSlice8(crc, running, data, length);
+  }
+}
+
+uint32_t CrcCompute(const struct sCrc *crc, const void *data, size_t length)
+{
+  return CrcFinish(crc, CrcUpdate(crc, CrcStart(crc), data, length));
+}
+
+const char *CrcMethodName(enum eCrcMethod method)
+{
+  switch (method) {
+  case CRC_BITWISE:  return "bitwise";
+  case CRC_TABLE:    return "table";
+  case CRC_SLICE8:   return "slice-8";
+  case CRC_HARDWARE: return "hardware";
+  case CRC_BEST:     return "best";
+  default:           return "unknown";
+  }
+}
@@ -0,0 +1,81 @@
+/*
+ * crc.h
+ *
+ * CRCs for checking messages, firmware images and anything stored:
+ *
+ *   CRC-8          poly 0x07, the SMBus one
+ *   CRC-16/CCITT   poly 0x1021, start 0xFFFF (the "CCITT-FALSE" variant)
+ *   CRC-32         poly 0x04C11DB7 reflected: Ethernet, zip, PNG
+ *   CRC-32C        poly 0x1EDC6F41 reflected: Castagnoli, better at catching
+ *                  errors than CRC-32 and has an x86 instruction
+ *
+ * Each can be worked out several ways, from small and slow to big and fast:
+ *   bitwise    a bit at a time, no table: the one to use in a fault handler
+ *              or a bootloader where there is no room
+ *   table      a byte at a time with a 256 entry table (1 KB here, 256 or
+ *              512 bytes if you cut it down to the CRC's width)
+ *   slice-8    8 bytes at a time with eight tables (8 KB)
+ *   hardware   x86 only: CRC-32C with the SSE4.2 crc32 instruction, three
+ *              streams at once; CRC-32 by folding with PCLMULQDQ. Many
+ *              micros have a CRC peripheral for the same job.
+ * CRC_BEST picks the fastest that this CPU has when CrcSetup runs.
+ *
+ * Usage, all at once or in pieces as the data arrives:
+ *
+ *   static struct sCrc crc32c;
+ *   CrcSetup(&crc32c, CRC_32C, CRC_BEST);
+ *   uint32_t check = CrcCompute(&crc32c, image, imageLength);
+ *
+ *   uint32_t running = CrcStart(&crc32c);
+ *   running = CrcUpdate(&crc32c, running, packet, packetLength);   // repeat
+ *   uint32_t check = CrcFinish(&crc32c, running);
+ *
+ * CrcCombine gives the CRC of A then B from the CRCs of A and B and the
+ * length of B, so pieces can be checked separately (or in parallel) and
+ * joined, without going over the data again.
+ */
+#ifndef CRC_H
+#define CRC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+enum eCrcType { CRC_8, CRC_16_CCITT, CRC_32, CRC_32C, NUM_CRC_TYPES };
+enum eCrcMethod { CRC_BITWISE, CRC_TABLE, CRC_SLICE8, CRC_HARDWARE, CRC_BEST };
+
+#define CRC_LANE 512    // bytes per stream for the three stream CRC-32C
+
+struct sCrcModel {
+  const char *name;
+  uint8_t width;
+  uint8_t reflected;        // least significant bit first
+  uint32_t poly;            // as written, not reflected
+  uint32_t init;
+  uint32_t xorOut;
+  uint32_t check;           // the CRC of "123456789"
+};
+
+extern const struct sCrcModel kCrcModels[NUM_CRC_TYPES];
+
+struct sCrc {
+  const struct sCrcModel *model;
+  enum eCrcMethod method;   // what CrcSetup chose for CRC_BEST
+  uint32_t poly;            // reflected, or moved up to the top bits
+  uint32_t table[8][256];   // table uses the first, slice-8 all of them
+  uint32_t laneShift[4][256];   // hardware CRC-32C: a CRC moved past CRC_LANE zeros
+};
+
+// Returns 0, or -1 if this CPU doesn't have the hardware for this CRC
+int CrcSetup(struct sCrc *crc, enum eCrcType type, enum eCrcMethod method);
+
+uint32_t CrcStart(const struct sCrc *crc);
+uint32_t CrcUpdate(const struct sCrc *crc, uint32_t running, const void *data, size_t length);
+uint32_t CrcFinish(const struct sCrc *crc, uint32_t running);
+uint32_t CrcCompute(const struct sCrc *crc, const void *data, size_t length);
+
+// The CRC of A followed by B, from the finished CRCs of each
+uint32_t CrcCombine(const struct sCrc *crc, uint32_t crcA, uint32_t crcB, size_t lengthB);
+
+const char *CrcMethodName(enum eCrcMethod method);
+
+#endif // CRC_H
@@ -0,0 +1,227 @@
+/*
+ * Generated by tlmgen.c from telemetry.csv, edit that instead.
+ *
+ * 2 messages. The format is described in tlm.h.
+ */
+#ifndef TELEMETRY_MSG_H
+#define TELEMETRY_MSG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "tlm.h"
+
+enum eTelemetryMessage {
+  TELEMETRY_SENSOR_STATS = 1,
+  TELEMETRY_HEARTBEAT = 2,
+};
+
+/******************************************************************************************************
+ * SensorStats
+*******************************************************************************************************/
+#define SENSOR_STATS_MAX_SIZE 50
+
+struct sSensorStats {
+  uint32_t timestampMs;            // since boot
+  uint8_t sensor;
+  uint16_t samples;
+  int16_t minimum;                 // raw counts
+  int16_t maximum;                 // raw counts
+  struct sFakeFloat40 mean;        // raw counts
+  struct sFakeFloat40 variance;
+  int32_t gain;                    // Q31, calibration
+  const uint8_t *label;
+  uint16_t labelLength;            // up to 16
+};
+
+static inline size_t SensorStatsEncode(const struct sSensorStats *message, uint8_t *out)
+{
+  uint8_t *p = out;
+
+  p += TlmPutVarint(p, TELEMETRY_SENSOR_STATS);
+  p += TlmPutVarint(p, message->timestampMs);
+  p += TlmPutVarint(p, message->sensor);
+  p += TlmPutVarint(p, message->samples);
+  p += TlmPutVarint(p, TlmZigzag(message->minimum));
+  p += TlmPutVarint(p, TlmZigzag(message->maximum));
+  p += TlmPutFakeFloat40(p, message->mean);
+  p += TlmPutFakeFloat40(p, message->variance);
+  p += TlmPutFixed(p, (uint32_t)message->gain, 4);
+  p += TlmPutBytes(p, message->label, message->labelLength, 16);
+  return (size_t)(p - out);
+}
+
+struct sSensorStatsView {
+  const uint8_t *field[9];
+};
+
+// Returns 0, or -1 if it isn't a whole SensorStats record
+static inline int SensorStatsOpen(struct sSensorStatsView *view, const uint8_t *data, size_t length)
+{
+  const uint8_t *p = data, *end = data + length;
+
+  if (TlmMessageId(data, length) != TELEMETRY_SENSOR_STATS) {
+    return -1;
+  }
+  TlmSkipVarint(&p, end, TLM_VARINT_BYTES(16));
+  view->field[0] = p;
+  if (TlmSkipVarint(&p, end, TLM_VARINT_BYTES(32)) != 0) {
+    return -1;
+  }
+  view->field[1] = p;
+  if (TlmSkipVarint(&p, end, TLM_VARINT_BYTES(8)) != 0) {
+    return -1;
+  }
+  view->field[2] = p;
+  if (TlmSkipVarint(&p, end, TLM_VARINT_BYTES(16)) != 0) {
+    return -1;
+  }
+  view->field[3] = p;
+  if (TlmSkipVarint(&p, end, TLM_VARINT_BYTES(16)) != 0) {
+    return -1;
+  }
+  view->field[4] = p;
+  if (TlmSkipVarint(&p, end, TLM_VARINT_BYTES(16)) != 0) {
+    return -1;
+  }
+  view->field[5] = p;
+  if (TlmSkipFakeFloat40(&p, end) != 0) {
+    return -1;
+  }
+  view->field[6] = p;
+  if (TlmSkipFakeFloat40(&p, end) != 0) {
+    return -1;
+  }
+  view->field[7] = p;
+  if (TlmSkipFixed(&p, end, 4) != 0) {
+    return -1;
+  }
+  view->field[8] = p;
+  if (TlmSkipBytes(&p, end, 16) != 0) {
+    return -1;
+  }
+  return 0;
+}
+
+static inline uint32_t SensorStatsTimestampMs(const struct sSensorStatsView *view)
+{
+  return (uint32_t)TlmVarint(view->field[0]);
+}
+
+static inline uint8_t SensorStatsSensor(const struct sSensorStatsView *view)
+{
+  return (uint8_t)TlmVarint(view->field[1]);
+}
+
+static inline uint16_t SensorStatsSamples(const struct sSensorStatsView *view)
+{
+  return (uint16_t)TlmVarint(view->field[2]);
+}
+
+static inline int16_t SensorStatsMinimum(const struct sSensorStatsView *view)
+{
+  return (int16_t)TlmUnzigzag(TlmVarint(view->field[3]));
+}
+
+static inline int16_t SensorStatsMaximum(const struct sSensorStatsView *view)
+{
+  return (int16_t)TlmUnzigzag(TlmVarint(view->field[4]));
+}
+
+static inline struct sFakeFloat40 SensorStatsMean(const struct sSensorStatsView *view)
+{
+  return TlmFakeFloat40(view->field[5]);
+}
+
+static inline struct sFakeFloat40 SensorStatsVariance(const struct sSensorStatsView *view)
+{
+  return TlmFakeFloat40(view->field[6]);
+}
+
+static inline int32_t SensorStatsGain(const struct sSensorStatsView *view)
+{
+  return (int32_t)TlmFixed(view->field[7], 4);
+}
+
+// Points into the record, not a copy and not zero terminated
+static inline const uint8_t *SensorStatsLabel(const struct sSensorStatsView *view, size_t *length)
+{
+  return TlmBytes(view->field[8], length);
+}
+
+/******************************************************************************************************
+ * Heartbeat
+*******************************************************************************************************/
+#define HEARTBEAT_MAX_SIZE 16
+
+struct sHeartbeat {
+  uint32_t uptimeS;
+  uint16_t batteryMv;
+  uint8_t resets;
+  uint32_t freeHeap;               // bytes
+};
+
+static inline size_t HeartbeatEncode(const struct sHeartbeat *message, uint8_t *out)
+{
+  uint8_t *p = out;
+
+  p += TlmPutVarint(p, TELEMETRY_HEARTBEAT);
+  p += TlmPutVarint(p, message->uptimeS);
+  p += TlmPutVarint(p, message->batteryMv);
+  p += TlmPutVarint(p, message->resets);
+  p += TlmPutVarint(p, message->freeHeap);
+  return (size_t)(p - out);
+}
+
+struct sHeartbeatView {
+  const uint8_t *field[4];
+};
+
+// Returns 0, or -1 if it isn't a whole Heartbeat record
+static inline int HeartbeatOpen(struct sHeartbeatView *view, const uint8_t *data, size_t length)
+{
+  const uint8_t *p = data, *end = data + length;
+
+  if (TlmMessageId(data, length) != TELEMETRY_HEARTBEAT) {
+    return -1;
+  }
+  TlmSkipVarint(&p, end, TLM_VARINT_BYTES(16));
+  view->field[0] = p;
+  if (TlmSkipVarint(&p, end, TLM_VARINT_BYTES(32)) != 0) {
+    return -1;
+  }
+  view->field[1] = p;
+  if (TlmSkipVarint(&p, end, TLM_VARINT_BYTES(16)) != 0) {
+    return -1;
+  }
+  view->field[2] = p;
+  if (TlmSkipVarint(&p, end, TLM_VARINT_BYTES(8)) != 0) {
+    return -1;
+  }
+  view->field[3] = p;
+  if (TlmSkipVarint(&p, end, TLM_VARINT_BYTES(32)) != 0) {
+    return -1;
+  }
+  return 0;
+}
+
+static inline uint32_t HeartbeatUptimeS(const struct sHeartbeatView *view)
+{
+  return (uint32_t)TlmVarint(view->field[0]);
+}
+
+static inline uint16_t HeartbeatBatteryMv(const struct sHeartbeatView *view)
+{
+  return (uint16_t)TlmVarint(view->field[1]);
+}
+
+static inline uint8_t HeartbeatResets(const struct sHeartbeatView *view)
+{
+  return (uint8_t)TlmVarint(view->field[2]);
+}
+
+static inline uint32_t HeartbeatFreeHeap(const struct sHeartbeatView *view)
+{
+  return (uint32_t)TlmVarint(view->field[3]);
+}
+
+#endif // TELEMETRY_MSG_H
@@ -0,0 +1,211 @@
+/*
+ * tlm.h
+ *
+ * A small binary format for telemetry records, the pieces that the code
+ * generated by tlmgen.c is made of. A record is its message id and then
+ * each field in the order the schema (telemetry.csv) lists them, with no
+ * names or tags on the wire: both ends have the schema.
+ *
+ *   unsigned      varint: 7 bits a byte, least significant first, the top
+ *                 bit set on all but the last. 0 to 127 is one byte.
+ *   signed        zigzag (0, -1, 1, -2, ... become 0, 1, 2, 3, ...) then
+ *                 varint, so small negative numbers are short too
+ *   q31, q15      fixed point fractions as they are, 4 or 2 bytes little
+ *                 endian (they use all their bits, a varint would be longer)
+ *   ff40          a fake float (../Ch12_Math/fakefloat.h): zigzag varint
+ *                 num, then the shift as a byte. The trailing zero bits of
+ *                 num are dropped first (and the shift lowered to match),
+ *                 so round numbers like 0.5 are two bytes. The value is
+ *                 the same; num and shift may come back different.
+ *   bytes, str    varint length, then the bytes
+ *
+ * Reading is in place: the generated <Message>Open checks a record and
+ * notes where each field starts, then an accessor per field decodes just
+ * that field from the buffer, and bytes fields come back as a pointer into
+ * it. Nothing is copied out unless you ask for it.
+ *
+ * New fields go at the end of a message. Open ignores anything after the
+ * fields it knows, so old readers can take records from newer senders.
+ */
+#ifndef TLM_H
+#define TLM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "fakefloat.h"
+
+#define TLM_VARINT_BYTES(bits) (((bits) + 6) / 7)
+
+static inline uint64_t TlmZigzag(int64_t value)
+{
+  return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t TlmUnzigzag(uint64_t value)
+{
+  return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+/******************************************************************************************************
+ * Writing. The buffer must have room: the generated <MESSAGE>_MAX_SIZE is
+ * the most a record can take. Each returns the bytes written.
+*******************************************************************************************************/
+static inline size_t TlmPutVarint(uint8_t *out, uint64_t value)
+{
+  size_t n = 0;
+  while (value >= 0x80) {
+    out[n++] = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  out[n++] = (uint8_t)value;
+  return n;
+}
+
+static inline size_t TlmPutFixed(uint8_t *out, uint32_t value, size_t bytes)
+{
+  size_t i;
+  for (i = 0; i < bytes; i++) {
+    out[i] = (uint8_t)(value >> (8 * i));
+  }
+  return bytes;
+}
+
+static inline size_t TlmPutFakeFloat40(uint8_t *out, struct sFakeFloat40 value)
+{
+  size_t n;
+  if (value.num == 0) {
+    value.shift = 0;
+  } else {
+    int drop = __builtin_ctz((uint32_t)value.num);
+    if (drop > value.shift - INT8_MIN) {
+      drop = value.shift - INT8_MIN;
+    }
+    value.num >>= drop;
+    value.shift = (int8_t)(value.shift - drop);
+  }
+  n = TlmPutVarint(out, TlmZigzag(value.num));
+  out[n++] = (uint8_t)value.shift;
+  return n;
+}
+
+// At most max bytes are sent
+static inline size_t TlmPutBytes(uint8_t *out, const void *data, size_t length, size_t max)
+{
+  size_t n;
+  if (length > max) {
+    length = max;
+  }
+  n = TlmPutVarint(out, length);
+  memcpy(out + n, data, length);
+  return n + length;
+}
+
+/******************************************************************************************************
+ * Checking, for Open. Each moves *at past a field, or returns -1 if the
+ * field runs past end or is longer than its type allows.
+*******************************************************************************************************/
+static inline int TlmSkipVarint(const uint8_t **at, const uint8_t *end, size_t maxBytes)
+{
+  const uint8_t *p = *at;
+  size_t n = 0;
+  do {
+    if (p == end || n++ == maxBytes) {
+      return -1;
+    }
+  } while (*p++ & 0x80);
+  *at = p;
+  return 0;
+}
+
+static inline int TlmSkipFixed(const uint8_t **at, const uint8_t *end, size_t bytes)
+{
+  if ((size_t)(end - *at) < bytes) {
+    return -1;
+  }
+  *at += bytes;
+  return 0;
+}
+
+static inline int TlmSkipFakeFloat40(const uint8_t **at, const uint8_t *end)
+{
+  if (TlmSkipVarint(at, end, TLM_VARINT_BYTES(32)) != 0) {
+    return -1;
+  }
+  return TlmSkipFixed(at, end, 1);
+}
+
+static inline int TlmSkipBytes(const uint8_t **at, const uint8_t *end, size_t max)
+{
+  const uint8_t *p = *at;
+  uint64_t length = 0;
+  int shift = 0;
+
+  if (TlmSkipVarint(at, end, TLM_VARINT_BYTES(16)) != 0) {
+    return -1;
+  }
+  for (; p < *at; p++, shift += 7) {
+    length |= (uint64_t)(*p & 0x7F) << shift;
+  }
+  if (length > max) {
+    return -1;
+  }
+  return TlmSkipFixed(at, end, (size_t)length);
+}
+
+/******************************************************************************************************
+ * Reading a field that Open has already checked
+*******************************************************************************************************/
+static inline uint64_t TlmVarint(const uint8_t *at)
+{
+  uint64_t value = 0;
+  int shift = 0;
+  for (;; shift += 7) {
+    value |= (uint64_t)(*at & 0x7F) << shift;
+    if ((*at++ & 0x80) == 0) {
+      return value;
+    }
+  }
+}
+
+static inline uint32_t TlmFixed(const uint8_t *at, size_t bytes)
+{
+  uint32_t value = 0;
+  size_t i;
+  for (i = 0; i < bytes; i++) {
+    value |= (uint32_t)at[i] << (8 * i);
+  }
+  return value;
+}
+
+static inline struct sFakeFloat40 TlmFakeFloat40(const uint8_t *at)
+{
+  struct sFakeFloat40 value;
+  const uint8_t *shift = at;
+
+  while (*shift++ & 0x80) {
+  }
+  value.num = (int32_t)TlmUnzigzag(TlmVarint(at));
+  value.shift = (int8_t)*shift;
+  return value;
+}
+
+static inline const uint8_t *TlmBytes(const uint8_t *at, size_t *length)
+{
+  *length = (size_t)TlmVarint(at);
+  while (*at++ & 0x80) {
+  }
+  return at;
+}
+
+// The message id at the start of a record, or -1 if there isn't one
+static inline int32_t TlmMessageId(const uint8_t *data, size_t length)
+{
+  const uint8_t *p = data;
+  if (TlmSkipVarint(&p, data + length, TLM_VARINT_BYTES(16)) != 0) {
+    return -1;
+  }
+  return (int32_t)TlmVarint(data);
+}
+
+#endif // TLM_H
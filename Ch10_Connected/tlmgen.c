@@ -0,0 +1,382 @@
+/*
+ * tlmgen.c
+ *
+ * Generates encoders and in place readers for telemetry records from a
+ * schema CSV (see telemetry.csv for the format). The wire format and the
+ * helpers the generated code calls are in tlm.h.
+ *
+ * gcc -O2 tlmgen.c -o tlmgen
+ * ./tlmgen telemetry.csv Telemetry > telemetry_msg.h
+ *
+ * For each message the header has:
+ *   struct s<Message>           the record as C fields, to fill in and encode
+ *   <MESSAGE>_MAX_SIZE          the most bytes a record can take
+ *   <Message>Encode()           writes a record, returns its length
+ *   struct s<Message>View       where each field starts in a received record
+ *   <Message>Open()             checks a record and fills in a view
+ *   <Message><Field>()          reads one field from the record in place
+ *
+ * Everything is static inline with the field list unrolled, so there are no
+ * descriptor tables to walk at run time and the compiler can drop accessors
+ * that aren't used.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define MAX_MESSAGES 64
+#define MAX_FIELDS_PER_MESSAGE 32
+#define MAX_FIELDS 4
+#define MAX_BYTES 65535
+
+enum eKind { KIND_UNSIGNED, KIND_SIGNED, KIND_Q31, KIND_Q15, KIND_FF40, KIND_BYTES };
+
+struct sField {
+  char name[64];
+  char comment[128];
+  enum eKind kind;
+  int bits;              // integers
+  int max;               // bytes
+};
+
+struct sMessage {
+  char name[64];
+  int id;
+  struct sField fields[MAX_FIELDS_PER_MESSAGE];
+  int numFields;
+};
+
+static struct sMessage gMessages[MAX_MESSAGES];
+static int gNumMessages;
+
+static void Fail(int line, const char *message, const char *detail)
+{
+  fprintf(stderr, "line %d: %s %s\n", line, message, detail);
+  exit(1);
+}
+
+// Splits a CSV line in place, trimming spaces. No quoting: names are C
+// identifiers and the comment is everything after the third comma.
+static void SplitFields(char *line, char *fields[MAX_FIELDS])
+{
+  int n = 0;
+  char *p = line;
+
+  while (n < MAX_FIELDS) {
+    char *end;
+    while (*p == ' ' || *p == '\t') {
+      p++;
+    }
+    fields[n++] = p;
+    end = p + (n == MAX_FIELDS ? strcspn(p, "\r\n") : strcspn(p, ",\r\n"));
+    p = *end == ',' ? end + 1 : NULL;
+    *end = '\0';
+    while (end > fields[n - 1] && isspace((unsigned char)end[-1])) {
+      *--end = '\0';
+    }
+    if (p == NULL) {
+      break;
+    }
+  }
+  while (n < MAX_FIELDS) {
+    fields[n++] = "";
+  }
+}
+
+static int ParseType(struct sField *field, const char *type)
+{
+  char *end;
+
+  if ((type[0] == 'u' || type[0] == 'i') && isdigit((unsigned char)type[1])) {
+    field->kind = type[0] == 'u' ? KIND_UNSIGNED : KIND_SIGNED;
+    field->bits = (int)strtol(type + 1, &end, 10);
+    return *end == '\0' && (field->bits == 8 || field->bits == 16 || field->bits == 32 ||
+                            field->bits == 64) ? 0 : -1;
+  }
+  if (strcmp(type, "q31") == 0 || strcmp(type, "q15") == 0) {
+    field->kind = type[1] == '3' ? KIND_Q31 : KIND_Q15;
+    return 0;
+  }
+  if (strcmp(type, "ff40") == 0) {
+    field->kind = KIND_FF40;
+    return 0;
+  }
+  if (strncmp(type, "bytes", 5) == 0 || strncmp(type, "str", 3) == 0) {
+    field->kind = KIND_BYTES;
+    field->max = (int)strtol(type + (type[0] == 'b' ? 5 : 3), &end, 10);
+    return *end == '\0' && field->max > 0 && field->max <= MAX_BYTES ? 0 : -1;
+  }
+  return -1;
+}
+
+static void ReadCsv(FILE *file)
+{
+  char line[512], *f[MAX_FIELDS];
+  struct sMessage *message = NULL;
+  int lineNumber = 0, i;
+
+  while (fgets(line, sizeof(line), file)) {
+    lineNumber++;
+    SplitFields(line, f);
+    if (f[0][0] == '#' || f[0][0] == '\0') {
+      continue;
+    }
+    if (strcmp(f[0], "message") == 0) {
+      if (gNumMessages >= MAX_MESSAGES) {
+        Fail(lineNumber, "too many messages at", f[1]);
+      }
+      message = &gMessages[gNumMessages++];
+      strncpy(message->name, f[1], 63);
+      message->id = atoi(f[2]);
+      if (message->id <= 0 || message->id > 0xFFFF) {
+        Fail(lineNumber, "message ids are 1 to 65535:", f[2]);
+      }
+      for (i = 0; i < gNumMessages - 1; i++) {
+        if (gMessages[i].id == message->id || strcmp(gMessages[i].name, message->name) == 0) {
+          Fail(lineNumber, "duplicate message name or id:", f[1]);
+        }
+      }
+    } else if (strcmp(f[0], "field") == 0) {
+      struct sField *field;
+      if (message == NULL || message->numFields >= MAX_FIELDS_PER_MESSAGE) {
+        Fail(lineNumber, "field before any message, or too many fields:", f[1]);
+      }
+      field = &message->fields[message->numFields++];
+      strncpy(field->name, f[1], 63);
+      strncpy(field->comment, f[3], 127);
+      if (ParseType(field, f[2]) != 0) {
+        Fail(lineNumber, "unknown type", f[2]);
+      }
+    } else {
+      Fail(lineNumber, "unknown row type", f[0]);
+    }
+  }
+}
+
+/******************************************************************************************************
+ * Output
+*******************************************************************************************************/
+// SensorStats -> SENSOR_STATS
+static char *UpperSnake(const char *name)
+{
+  static char buffers[2][128];
+  static int which;
+  char *upper = buffers[which ^= 1];
+  int i, n = 0;
+  for (i = 0; name[i] && n < 126; i++) {
+    if (i > 0 && isupper((unsigned char)name[i]) && !isupper((unsigned char)name[i - 1])) {
+      upper[n++] = '_';
+    }
+    upper[n++] = (char)toupper((unsigned char)name[i]);
+  }
+  upper[n] = '\0';
+  return upper;
+}
+
+// timestampMs -> TimestampMs
+static char *Capitalized(const char *name)
+{
+  static char buffer[64];
+  strncpy(buffer, name, 63);
+  buffer[0] = (char)toupper((unsigned char)buffer[0]);
+  return buffer;
+}
+
+static int MaxSize(const struct sField *field)
+{
+  switch (field->kind) {
+  case KIND_UNSIGNED:
+  case KIND_SIGNED: return (field->bits + 6) / 7;
+  case KIND_Q31: return 4;
+  case KIND_Q15: return 2;
+  case KIND_FF40: return 5 + 1;
+  case KIND_BYTES: return (field->max > 127 ? 2 : 1) + (field->max > 16383 ? 1 : 0) + field->max;
+  }
+  return 0;
+}
+
+static const char *CType(const struct sField *field)
+{
+  static char buffer[32];
+  switch (field->kind) {
+  case KIND_UNSIGNED: snprintf(buffer, sizeof(buffer), "uint%d_t", field->bits); return buffer;
+  case KIND_SIGNED: snprintf(buffer, sizeof(buffer), "int%d_t", field->bits); return buffer;
+  case KIND_Q31: return "int32_t";
+  case KIND_Q15: return "int16_t";
+  case KIND_FF40: return "struct sFakeFloat40";
+  case KIND_BYTES: return "const uint8_t *";
+  }
+  return "";
+}
+
+static void PrintStruct(const struct sMessage *message)
+{
+  int i;
+
+  printf("struct s%s {\n", message->name);
+  for (i = 0; i < message->numFields; i++) {
+    const struct sField *field = &message->fields[i];
+    const char *type = CType(field);
+    char declaration[160], comment[160];
+
+    snprintf(declaration, sizeof(declaration), "%s%s%s;", type,
+             type[strlen(type) - 1] == '*' ? "" : " ", field->name);
+    if (field->kind == KIND_Q31 || field->kind == KIND_Q15) {
+      snprintf(comment, sizeof(comment), "%s%s%s", field->kind == KIND_Q31 ? "Q31" : "Q15",
+               field->comment[0] ? ", " : "", field->comment);
+    } else {
+      snprintf(comment, sizeof(comment), "%s", field->comment);
+    }
+    if (comment[0]) {
+      printf("  %-32s // %s\n", declaration, comment);
+    } else {
+      printf("  %s\n", declaration);
+    }
+    if (field->kind == KIND_BYTES) {
+      snprintf(declaration, sizeof(declaration), "uint16_t %sLength;", field->name);
+      printf("  %-32s // up to %d\n", declaration, field->max);
+    }
+  }
+  printf("};\n\n");
+}
+
+static void PrintEncode(const struct sMessage *message, const char *prefix)
+{
+  int i;
+
+  printf("static inline size_t %sEncode(const struct s%s *message, uint8_t *out)\n{\n",
+         message->name, message->name);
+  printf("  uint8_t *p = out;\n\n");
+  printf("  p += TlmPutVarint(p, %s_%s);\n", prefix, UpperSnake(message->name));
+  for (i = 0; i < message->numFields; i++) {
+    const struct sField *field = &message->fields[i];
+    const char *name = field->name;
+    switch (field->kind) {
+    case KIND_UNSIGNED: printf("  p += TlmPutVarint(p, message->%s);\n", name); break;
+    case KIND_SIGNED: printf("  p += TlmPutVarint(p, TlmZigzag(message->%s));\n", name); break;
+    case KIND_Q31: printf("  p += TlmPutFixed(p, (uint32_t)message->%s, 4);\n", name); break;
+    case KIND_Q15: printf("  p += TlmPutFixed(p, (uint16_t)message->%s, 2);\n", name); break;
+    case KIND_FF40: printf("  p += TlmPutFakeFloat40(p, message->%s);\n", name); break;
+    case KIND_BYTES:
+      printf("  p += TlmPutBytes(p, message->%s, message->%sLength, %d);\n", name, name,
+             field->max);
+      break;
+    }
+  }
+  printf("  return (size_t)(p - out);\n}\n\n");
+}
+
+static void PrintView(const struct sMessage *message, const char *prefix)
+{
+  int i;
+
+  printf("struct s%sView {\n  const uint8_t *field[%d];\n};\n\n", message->name,
+         message->numFields);
+  printf("// Returns 0, or -1 if it isn't a whole %s record\n", message->name);
+  printf("static inline int %sOpen(struct s%sView *view, const uint8_t *data, size_t length)\n{\n",
+         message->name, message->name);
+  printf("  const uint8_t *p = data, *end = data + length;\n\n");
+  printf("  if (TlmMessageId(data, length) != %s_%s) {\n    return -1;\n  }\n",
+         prefix, UpperSnake(message->name));
+  printf("  TlmSkipVarint(&p, end, TLM_VARINT_BYTES(16));\n");
+  for (i = 0; i < message->numFields; i++) {
+    const struct sField *field = &message->fields[i];
+    char call[96];
+    switch (field->kind) {
+    case KIND_UNSIGNED:
+    case KIND_SIGNED:
+      snprintf(call, sizeof(call), "TlmSkipVarint(&p, end, TLM_VARINT_BYTES(%d))", field->bits);
+      break;
+    case KIND_Q31: snprintf(call, sizeof(call), "TlmSkipFixed(&p, end, 4)"); break;
+    case KIND_Q15: snprintf(call, sizeof(call), "TlmSkipFixed(&p, end, 2)"); break;
+    case KIND_FF40: snprintf(call, sizeof(call), "TlmSkipFakeFloat40(&p, end)"); break;
+    case KIND_BYTES: snprintf(call, sizeof(call), "TlmSkipBytes(&p, end, %d)", field->max); break;
+    }
+    printf("  view->field[%d] = p;\n  if (%s != 0) {\n    return -1;\n  }\n", i, call);
+  }
+  printf("  return 0;\n}\n\n");
+
+  for (i = 0; i < message->numFields; i++) {
+    const struct sField *field = &message->fields[i];
+    const char *type = CType(field);
+    char head[192];
+    snprintf(head, sizeof(head), "static inline %s%s%s%s(const struct s%sView *view", type,
+             type[strlen(type) - 1] == '*' ? "" : " ", message->name, Capitalized(field->name),
+             message->name);
+    switch (field->kind) {
+    case KIND_UNSIGNED:
+      printf("%s)\n{\n  return (%s)TlmVarint(view->field[%d]);\n}\n\n", head, type, i);
+      break;
+    case KIND_SIGNED:
+      printf("%s)\n{\n  return (%s)TlmUnzigzag(TlmVarint(view->field[%d]));\n}\n\n", head, type,
+             i);
+      break;
+    case KIND_Q31:
+    case KIND_Q15:
+      printf("%s)\n{\n  return (%s)TlmFixed(view->field[%d], %d);\n}\n\n", head, type, i,
+             field->kind == KIND_Q31 ? 4 : 2);
+      break;
+    case KIND_FF40:
+      printf("%s)\n{\n  return TlmFakeFloat40(view->field[%d]);\n}\n\n", head, i);
+      break;
+    case KIND_BYTES:
+      printf("// Points into the record, not a copy and not zero terminated\n");
+      printf("%s, size_t *length)\n{\n  return TlmBytes(view->field[%d], length);\n}\n\n", head,
+             i);
+      break;
+    }
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  char prefix[128], guard[128];
+  const char *name;
+  FILE *file;
+  int m, i;
+
+  if (argc < 3) {
+    fprintf(stderr, "usage: tlmgen schema.csv Name > name_msg.h\n");
+    return 2;
+  }
+  name = argv[2];
+  strcpy(prefix, UpperSnake(name));
+  snprintf(guard, sizeof(guard), "%s_MSG_H", prefix);
+  file = fopen(argv[1], "r");
+  if (file == NULL) {
+    perror(argv[1]);
+    return 1;
+  }
+  ReadCsv(file);
+  fclose(file);
+
+  printf("/*\n * Generated by tlmgen.c from %s, edit that instead.\n *\n", argv[1]);
+  printf(" * %d messages. The format is described in tlm.h.\n */\n", gNumMessages);
+  printf("#ifndef %s\n#define %s\n\n#include <stdint.h>\n#include <stddef.h>\n"
+         "#include \"tlm.h\"\n\n", guard, guard);
+
+  printf("enum e%sMessage {\n", name);
+  for (m = 0; m < gNumMessages; m++) {
+    printf("  %s_", prefix);
+    printf("%s = %d,\n", UpperSnake(gMessages[m].name), gMessages[m].id);
+  }
+  printf("};\n\n");
+
+  for (m = 0; m < gNumMessages; m++) {
+    const struct sMessage *message = &gMessages[m];
+    int size = message->id > 127 ? (message->id > 16383 ? 3 : 2) : 1;
+    for (i = 0; i < message->numFields; i++) {
+      size += MaxSize(&message->fields[i]);
+    }
+    printf("/******************************************************************************************************\n");
+    printf(" * %s\n", message->name);
+    printf("*******************************************************************************************************/\n");
+    printf("#define %s_MAX_SIZE %d\n\n", UpperSnake(message->name), size);
+    PrintStruct(message);
+    PrintEncode(message, prefix);
+    PrintView(message, prefix);
+  }
+  printf("#endif // %s\n", guard);
+  return 0;
+}
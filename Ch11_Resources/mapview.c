@@ -0,0 +1,1415 @@
+/*
+ * mapview.c
+ *
+ * Where did all the flash and RAM go? This reads the map file the GNU linker
+ * writes (-Wl,-Map=firmware.map) or the firmware ELF itself, and adds up
+ * the sizes by memory region, output section, object file and symbol.
+ *
+ * gcc -O2 mapview.c -o mapview
+ *
+ * ./mapview firmware.map                      size report
+ * ./mapview firmware.map --html size.html     plus a treemap you can open in a browser
+ * ./mapview firmware.elf                      the same from the ELF symbol table
+ * ./mapview --diff old.map new.map [--threshold 256]
+ *                                             what changed between two builds, exits
+ *                                             with 1 if flash or RAM grew by more
+ *                                             than threshold bytes, by default any
+ *                                             growth at all (for a build server)
+ * ./mapview --check firmware.map firmware.elf  checks that the two give the same
+ *                                             section totals, exits with 1 if not
+ *
+ * The file is read into memory in one go and parsed in place: tokens are
+ * terminated where they sit in the buffer and names are interned in a hash
+ * table, so maps with hundreds of thousands of lines take a fraction of a
+ * second.
+ *
+ * See https://embedded.fm/blog/mapfiles for a tour of what is in a map file.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <elf.h>
+
+#define MAX_REGIONS     32
+#define TOP_N           20
+#define TREEMAP_WIDTH   1200
+#define TREEMAP_HEIGHT  800
+#define NO_ID           0xFFFFFFFFu
+
+enum eMemory { IN_FLASH = 1, IN_RAM = 2 };
+
+struct sRegion {
+  const char *name;
+  uint64_t origin;
+  uint64_t length;
+  uint8_t memory;     // IN_FLASH or IN_RAM
+  uint64_t used;
+};
+
+// One piece of a section: a symbol, or an input section with no symbols
+struct sEntry {
+  uint32_t section;   // interned names
+  uint32_t object;
+  uint32_t symbol;
+  uint64_t size;
+  uint8_t memory;     // IN_FLASH, IN_RAM or both (initialized data)
+};
+
+/******************************************************************************************************
+ * Interned strings
+ * Every name is stored once and referred to by a 32 bit id, which keeps the
+ * entries small and makes comparing names cheap.
+*******************************************************************************************************/
+struct sStrings {
+  const char **names;
+  uint32_t count;
+  uint32_t capacity;
+  uint32_t *table;     // open addressing, ids
+  uint32_t tableSize;  // power of two
+};
+
+static uint32_t HashString(const char *s)
+{
+  uint32_t h = 2166136261u; // FNV-1a
+  while (*s) {
+    h = (h ^ (uint8_t)*s++) * 16777619u;
+  }
+  return h;
+}
+
+static void *CheckedRealloc(void *p, size_t size)
+{
+  p = realloc(p, size);
+  if (p == NULL) {
+    fprintf(stderr, "out of memory\n");
+    exit(2);
+  }
+  return p;
+}
+
+static void StringsGrow(struct sStrings *strings)
+{
+  uint32_t i, newSize = strings->tableSize ? strings->tableSize * 2 : 4096;
+  uint32_t *table = CheckedRealloc(NULL, newSize * sizeof(uint32_t));
+
+  memset(table, 0xFF, newSize * sizeof(uint32_t));
+  for (i = 0; i < strings->count; i++) {
+    uint32_t slot = HashString(strings->names[i]) & (newSize - 1);
+    while (table[slot] != NO_ID) {
+      slot = (slot + 1) & (newSize - 1);
+    }
+    table[slot] = i;
+  }
+  free(strings->table);
+  strings->table = table;
+  strings->tableSize = newSize;
+}
+
+// name must stay valid (it points into the file buffer)
+static uint32_t Intern(struct sStrings *strings, const char *name)
+{
+  uint32_t slot;
+
+  if (strings->count * 2 >= strings->tableSize) {
+    StringsGrow(strings);
+  }
+  slot = HashString(name) & (strings->tableSize - 1);
+  while (strings->table[slot] != NO_ID) {
+    if (strcmp(strings->names[strings->table[slot]], name) == 0) {
+      return strings->table[slot];
+    }
+    slot = (slot + 1) & (strings->tableSize - 1);
+  }
+  if (strings->count == strings->capacity) {
+    strings->capacity = strings->capacity ? strings->capacity * 2 : 4096;
+    strings->names = CheckedRealloc(strings->names, strings->capacity * sizeof(char *));
+  }
+  strings->names[strings->count] = name;
+  strings->table[slot] = strings->count;
+  return strings->count++;
+}
+
+/******************************************************************************************************
+ * A parsed build
+*******************************************************************************************************/
+struct sBuild {
+  const char *path;
+  char *text;
+  size_t length;
+  struct sStrings strings;
+  struct sRegion regions[MAX_REGIONS];
+  int numRegions;
+  struct sEntry *entries;
+  size_t numEntries;
+  size_t capEntries;
+  uint64_t total[3];  // indexed by IN_FLASH, IN_RAM
+};
+
+static void AddEntry(struct sBuild *build, uint32_t section, uint32_t object,
+                     uint32_t symbol, uint64_t size, uint8_t memory)
+{
+  struct sEntry *entry;
+  if (size == 0 || memory == 0) {
+    return;
+  }
+  if (build->numEntries == build->capEntries) {
+    build->capEntries = build->capEntries ? build->capEntries * 2 : 65536;
+    build->entries = CheckedRealloc(build->entries, build->capEntries * sizeof(struct sEntry));
+  }
+  entry = &build->entries[build->numEntries++];
+  entry->section = section;
+  entry->object = object;
+  entry->symbol = symbol;
+  entry->size = size;
+  entry->memory = memory;
+  if (memory & IN_FLASH) build->total[IN_FLASH] += size;
+  if (memory & IN_RAM) build->total[IN_RAM] += size;
+}
+
+static const struct sRegion *FindRegion(const struct sBuild *build, uint64_t address)
+{
+  int i;
+  for (i = 0; i < build->numRegions; i++) {
+    const struct sRegion *r = &build->regions[i];
+    if (address >= r->origin && address - r->origin < r->length) {
+      return r;
+    }
+  }
+  return NULL;
+}
+
+static int StartsWith(const char *s, const char *prefix)
+{
+  return strncmp(s, prefix, strlen(prefix)) == 0;
+}
+
+// Without a memory configuration (host builds, or scripts that don't use
+// MEMORY), guess from the section name
+static uint8_t GuessMemory(const char *section, uint64_t vma)
+{
+  if (vma == 0) {
+    return 0; // not allocated: debug info, comments
+  }
+  if (StartsWith(section, ".bss") || StartsWith(section, ".tbss") ||
+      StartsWith(section, ".noinit") || StartsWith(section, ".heap") ||
+      StartsWith(section, ".stack")) {
+    return IN_RAM;
+  }
+  if (StartsWith(section, ".data") || StartsWith(section, ".tdata")) {
+    return IN_RAM | IN_FLASH; // the initial values are stored in flash
+  }
+  return IN_FLASH;
+}
+
+static uint8_t SectionMemory(struct sBuild *build, const char *section,
+                             uint64_t vma, uint64_t lma, int hasLma)
+{
+  const struct sRegion *region;
+  uint8_t memory;
+
+  if (build->numRegions == 0) {
+    return GuessMemory(section, vma);
+  }
+  region = FindRegion(build, vma);
+  if (region == NULL) {
+    return 0;
+  }
+  memory = region->memory;
+  if (hasLma && lma != vma) {
+    region = FindRegion(build, lma);
+    if (region) {
+      memory |= region->memory;
+    }
+  }
+  return memory;
+}
+
+/******************************************************************************************************
+ * Map file parsing
+ * The interesting part of a GNU ld map is after "Linker script and memory map":
+ *
+ * .text           0x08000000     0x1234                       output section
+ *  .text.main     0x08000100       0x40 build/main.o          input section
+ *                 0x08000100                main              symbol
+ *  .text.a_very_long_section_name                             names that don't fit
+ *                 0x08000140       0x20 build/other.o         wrap to the next line
+ *  *fill*         0x08000160        0x4                       alignment padding
+ * .data           0x20000000      0x100 load address 0x08001234
+ *
+ * Each input section's size is split between its symbols by address.
+ * Merged sections (.rodata.str1.1, .rodata.cst8) are listed with the size
+ * they had before the linker dropped the duplicates, on top of each other,
+ * so only what goes past the end of the ones before is counted.
+*******************************************************************************************************/
+struct sSymbol {
+  uint64_t address;
+  uint32_t name;
+};
+
+struct sParser {
+  struct sBuild *build;
+  // current output section
+  uint32_t section;
+  uint8_t memory;
+  uint64_t countedTo;   // end of the input sections so far
+  // current input section, waiting for its symbols
+  int haveInput;
+  uint32_t inputName;
+  uint32_t object;
+  uint64_t inputAddress;
+  uint64_t inputSize;
+  struct sSymbol *symbols;
+  size_t numSymbols;
+  size_t capSymbols;
+  // names on a line of their own, the numbers are on the next line
+  char *pendingOutput;
+  char *pendingInput;
+};
+
+static char *SkipSpaces(char *p)
+{
+  while (*p == ' ' || *p == '\t') {
+    p++;
+  }
+  return p;
+}
+
+// Terminates the token in place and returns the start of the next one
+static char *Token(char *p, char **token)
+{
+  *token = p;
+  while (*p && *p != ' ' && *p != '\t') {
+    p++;
+  }
+  if (*p) {
+    *p++ = '\0';
+  }
+  return SkipSpaces(p);
+}
+
+static int IsHex(const char *p)
+{
+  return p[0] == '0' && p[1] == 'x';
+}
+
+static uint64_t ParseHex(const char *p)
+{
+  uint64_t value = 0;
+  p += 2;
+  while (isxdigit((unsigned char)*p)) {
+    value = value * 16 + (uint64_t)(isdigit((unsigned char)*p) ? *p - '0' : (tolower(*p) - 'a' + 10));
+    p++;
+  }
+  return value;
+}
+
+static void TrimEnd(char *p)
+{
+  size_t n = strlen(p);
+  while (n > 0 && (p[n - 1] == ' ' || p[n - 1] == '\t' || p[n - 1] == '\r')) {
+    p[--n] = '\0';
+  }
+}
+
+static int CompareSymbols(const void *a, const void *b)
+{
+  const struct sSymbol *x = a, *y = b;
+  return (x->address > y->address) - (x->address < y->address);
+}
+
+// The input section is complete: hand its bytes out to its symbols
+static void FlushInput(struct sParser *parser)
+{
+  struct sBuild *build = parser->build;
+  uint64_t end = parser->inputAddress + parser->inputSize;
+  uint64_t covered = 0;
+  size_t i;
+
+  if (!parser->haveInput) {
+    return;
+  }
+  parser->haveInput = 0;
+  if (parser->inputAddress < parser->countedTo) {
+    parser->inputAddress = parser->countedTo < end ? parser->countedTo : end;
+    parser->inputSize = end - parser->inputAddress;
+  }
+  if (end > parser->countedTo) {
+    parser->countedTo = end;
+  }
+  if (parser->memory == 0 || parser->inputSize == 0) {
+    parser->numSymbols = 0;
+    return;
+  }
+  qsort(parser->symbols, parser->numSymbols, sizeof(struct sSymbol), CompareSymbols);
+  for (i = 0; i < parser->numSymbols; i++) {
+    uint64_t start = parser->symbols[i].address;
+    uint64_t next = i + 1 < parser->numSymbols ? parser->symbols[i + 1].address : end;
+    if (start < parser->inputAddress || start >= end) {
+      continue;
+    }
+    if (i == 0 || covered == 0) {
+      start = parser->inputAddress; // leading alignment goes with the first symbol
+    }
+    AddEntry(build, parser->section, parser->object, parser->symbols[i].name,
+             next - start, parser->memory);
+    covered += next - start;
+  }
+  if (covered == 0) {
+    // static functions don't get symbol lines, but with -ffunction-sections
+    // the input section name says which function it is
+    AddEntry(build, parser->section, parser->object, parser->inputName,
+             parser->inputSize, parser->memory);
+  }
+  parser->numSymbols = 0;
+}
+
+static void StartOutput(struct sParser *parser, char *name, char *rest)
+{
+  char *addr, *size, *word;
+  uint64_t vma, lma = 0;
+  int hasLma = 0;
+
+  FlushInput(parser);
+  rest = Token(rest, &addr);
+  rest = Token(rest, &size);
+  vma = ParseHex(addr);
+  parser->countedTo = vma;
+  // "load address 0x..." for sections that are copied at startup
+  while (*rest) {
+    rest = Token(rest, &word);
+    if (IsHex(word)) {
+      lma = ParseHex(word);
+      hasLma = 1;
+    }
+  }
+  parser->section = Intern(&parser->build->strings, name);
+  parser->memory = strcmp(name, "/DISCARD/") == 0 ? 0 :
+                   SectionMemory(parser->build, name, vma, lma, hasLma);
+  if (parser->memory) {
+    struct sRegion *region = (struct sRegion *)FindRegion(parser->build, vma);
+    if (region) {
+      region->used += ParseHex(size);
+    }
+    region = hasLma && lma != vma ? (struct sRegion *)FindRegion(parser->build, lma) : NULL;
+    if (region) {
+      region->used += ParseHex(size);
+    }
+  }
+}
+
+static void StartInput(struct sParser *parser, char *name, char *rest)
+{
+  char *addr, *size;
+
+  FlushInput(parser);
+  rest = Token(rest, &addr);
+  rest = Token(rest, &size);
+  TrimEnd(rest);
+  parser->haveInput = 1;
+  parser->inputName = Intern(&parser->build->strings, name);
+  parser->inputAddress = ParseHex(addr);
+  parser->inputSize = ParseHex(size);
+  parser->object = Intern(&parser->build->strings,
+                          strcmp(name, "*fill*") == 0 ? "(fill)" : (*rest ? rest : "(linker)"));
+}
+
+static void AddSymbol(struct sParser *parser, char *addr, char *name)
+{
+  // assignments like ". = ALIGN (0x4)" or "PROVIDE (end = .)" aren't symbols
+  if (!parser->haveInput || strchr(name, '=') || StartsWith(name, "PROVIDE") ||
+      StartsWith(name, "ASSERT")) {
+    return;
+  }
+  TrimEnd(name);
+  if (parser->numSymbols == parser->capSymbols) {
+    parser->capSymbols = parser->capSymbols ? parser->capSymbols * 2 : 256;
+    parser->symbols = CheckedRealloc(parser->symbols, parser->capSymbols * sizeof(struct sSymbol));
+  }
+  parser->symbols[parser->numSymbols].address = ParseHex(addr);
+  parser->symbols[parser->numSymbols].name = Intern(&parser->build->strings, name);
+  parser->numSymbols++;
+}
+
+// "Name  Origin  Length  Attributes" lines
+static void ParseRegion(struct sBuild *build, char *line)
+{
+  char *name, *origin, *length, *attributes, *upper;
+  struct sRegion *region;
+  int hasWrite;
+
+  line = Token(line, &name);
+  line = Token(line, &origin);
+  line = Token(line, &length);
+  line = Token(line, &attributes);
+  if (!IsHex(origin) || !IsHex(length) || strcmp(name, "*default*") == 0 ||
+      build->numRegions >= MAX_REGIONS) {
+    return;
+  }
+  region = &build->regions[build->numRegions++];
+  region->name = name;
+  region->origin = ParseHex(origin);
+  region->length = ParseHex(length);
+  region->used = 0;
+
+  // writable is RAM, unless the name says otherwise
+  hasWrite = strchr(attributes, 'w') != NULL && strchr(attributes, '!') == NULL;
+  region->memory = hasWrite ? IN_RAM : IN_FLASH;
+  for (upper = name; *upper; upper++) {
+    if (strncasecmp(upper, "FLASH", 5) == 0 || strncasecmp(upper, "ROM", 3) == 0) {
+      region->memory = IN_FLASH;
+    } else if (strncasecmp(upper, "RAM", 3) == 0) {
+      region->memory = IN_RAM;
+    }
+  }
+}
+
+static void ParseMap(struct sBuild *build)
+{
+  struct sParser parser;
+  enum { BEFORE, MEMORY_CONFIG, MEMORY_MAP, DONE } state = BEFORE;
+  char *line = build->text;
+  char *end = build->text + build->length;
+
+  memset(&parser, 0, sizeof(parser));
+  parser.build = build;
+
+  while (line < end && state != DONE) {
+    char *next = memchr(line, '\n', end - line);
+    char *p, *first, *second;
+    next = next ? next : end;
+    *next = '\0';
+    if (next > line && next[-1] == '\r') {
+      next[-1] = '\0';
+    }
+
+    switch (state) {
+      case BEFORE:
+        if (StartsWith(line, "Memory Configuration")) {
+          state = MEMORY_CONFIG;
+        } else if (StartsWith(line, "Linker script and memory map")) {
+          state = MEMORY_MAP;
+        }
+        break;
+
+      case MEMORY_CONFIG:
+        if (StartsWith(line, "Linker script and memory map")) {
+          state = MEMORY_MAP;
+        } else if (*line && !StartsWith(line, "Name ")) {
+          ParseRegion(build, line);
+        }
+        break;
+
+      case MEMORY_MAP:
+        if (StartsWith(line, "Cross Reference Table")) {
+          state = DONE;
+          break;
+        }
+        if (*line == '\0') {
+          break;
+        }
+        if (*line != ' ') {
+          // output section, or LOAD/OUTPUT/START GROUP lines
+          p = Token(line, &first);
+          parser.pendingInput = NULL;
+          parser.pendingOutput = NULL;
+          // (a name on its own, which isn't always .something: glibc has
+          // __libc_IO_vtables and the like)
+          if (*p == '\0' && strchr(first, '(') == NULL) {
+            parser.pendingOutput = first;
+          } else if (IsHex(p)) {
+            StartOutput(&parser, first, p);
+          }
+        } else if (line[1] != ' ') {
+          // input section (one space in)
+          p = Token(line + 1, &first);
+          if (first[0] == '*' && strcmp(first, "*fill*") != 0) {
+            break; // a pattern from the linker script like *(.text*)
+          }
+          parser.pendingOutput = NULL;
+          if (*p == '\0') {
+            parser.pendingInput = first;
+          } else if (IsHex(p)) {
+            parser.pendingInput = NULL;
+            StartInput(&parser, first, p);
+          }
+        } else {
+          // numbers for a wrapped name, or a symbol
+          p = SkipSpaces(line);
+          if (!IsHex(p)) {
+            break;
+          }
+          if (parser.pendingOutput) {
+            StartOutput(&parser, parser.pendingOutput, p);
+            parser.pendingOutput = NULL;
+          } else if (parser.pendingInput) {
+            StartInput(&parser, parser.pendingInput, p);
+            parser.pendingInput = NULL;
+          } else {
+            p = Token(p, &first);
+            if (*p && !IsHex(p)) {
+              second = p;
+              AddSymbol(&parser, first, second);
+            }
+          }
+        }
+        break;
+
+      case DONE:
+        break;
+    }
+    line = next + 1;
+  }
+  FlushInput(&parser);
+  free(parser.symbols);
+}
+
+/******************************************************************************************************
+ * ELF parsing
+ * The symbol table has exact sizes but no object file names, except for
+ * local symbols which follow an STT_FILE entry naming their source file.
+ * Each allocated section's size is handed out to its symbols by address, as
+ * the map parser does for input sections. What no symbol covers (string
+ * literals, padding, linker-made tables) goes to "(unattributed)" so the
+ * totals match the map's.
+*******************************************************************************************************/
+#define ELF_FIELD(is64, hdr, field) ((is64) ? ((Elf64_##hdr *)p)->field : ((Elf32_##hdr *)p)->field)
+
+// Nothing in the file is trusted: a truncated or damaged ELF must not make
+// us read past the end of the buffer
+static int InFile(const struct sBuild *build, uint64_t offset, uint64_t size)
+{
+  return offset <= build->length && size <= build->length - offset;
+}
+
+// name at index in a string table section, "" if it doesn't end inside it
+static const char *TableString(const char *table, uint64_t tableSize, uint64_t index)
+{
+  if (index >= tableSize || memchr(table + index, '\0', tableSize - index) == NULL) {
+    return "";
+  }
+  return table + index;
+}
+
+struct sElfSymbol {
+  uint64_t section;   // header index
+  uint64_t offset;    // from the start of the section
+  uint64_t size;
+  uint32_t object;
+  uint32_t name;
+};
+
+static int CompareElfSymbols(const void *a, const void *b)
+{
+  const struct sElfSymbol *x = a, *y = b;
+  if (x->section != y->section) {
+    return (x->section > y->section) - (x->section < y->section);
+  }
+  if (x->offset != y->offset) {
+    return (x->offset > y->offset) - (x->offset < y->offset);
+  }
+  return (x->size < y->size) - (x->size > y->size);   // an alias's bigger twin first
+}
+
+// Hands each section's bytes to its symbols (sorted by section then offset),
+// skipping overlaps, and the gaps to (unattributed)
+static void AddElfSections(struct sBuild *build, const struct sElfSymbol *symbols, size_t numSymbols,
+                           const uint64_t *sectionSizes, const uint8_t *sectionMemory,
+                           const uint32_t *sectionIds, uint64_t shnum)
+{
+  uint32_t unattributed = Intern(&build->strings, "(unattributed)");
+  size_t next = 0;
+  uint64_t i;
+
+  for (i = 0; i < shnum; i++) {
+    uint64_t covered = 0, gaps = 0;
+    for (; next < numSymbols && symbols[next].section == i; next++) {
+      const struct sElfSymbol *symbol = &symbols[next];
+      uint64_t end = symbol->offset + symbol->size;
+      if (end > sectionSizes[i] || end < symbol->offset) {
+        end = sectionSizes[i];
+      }
+      if (end <= covered) {
+        continue;
+      }
+      if (symbol->offset > covered) {
+        gaps += symbol->offset - covered;
+        covered = symbol->offset;
+      }
+      AddEntry(build, sectionIds[i], symbol->object, symbol->name, end - covered, sectionMemory[i]);
+      covered = end;
+    }
+    gaps += sectionSizes[i] - covered;
+    AddEntry(build, sectionIds[i], unattributed, unattributed, gaps, sectionMemory[i]);
+  }
+}
+
+static int ParseElf(struct sBuild *build)
+{
+  const uint8_t *data = (const uint8_t *)build->text;
+  int is64 = data[EI_CLASS] == ELFCLASS64;
+  uint64_t align = is64 ? 8 : 4;  // the headers are read in place
+  uint64_t shoff, shnum, shentsize, shstrndx, namesSize, strSize;
+  uint64_t symOffset = 0, symSize = 0, symEntSize = 0, strIndex = 0;
+  const char *sectionNames;
+  uint8_t *sectionMemory;
+  uint32_t *sectionIds;
+  uint64_t *sectionAddresses, *sectionSizes;
+  struct sElfSymbol *symbols = NULL;
+  size_t numSymbols = 0;
+  uint32_t fileName;
+  uint64_t tlsStart = UINT64_MAX;
+  int relocatable, thumb;
+  const void *p = data;
+  uint64_t i;
+
+  if (data[EI_DATA] != ELFDATA2LSB) {
+    fprintf(stderr, "%s: only little endian ELF files are supported\n", build->path);
+    return -1;
+  }
+  if ((data[EI_CLASS] != ELFCLASS32 && !is64) ||
+      !InFile(build, 0, is64 ? sizeof(Elf64_Ehdr) : sizeof(Elf32_Ehdr))) {
+    fprintf(stderr, "%s: bad ELF header\n", build->path);
+    return -1;
+  }
+  shoff = ELF_FIELD(is64, Ehdr, e_shoff);
+  shnum = ELF_FIELD(is64, Ehdr, e_shnum);
+  shentsize = ELF_FIELD(is64, Ehdr, e_shentsize);
+  shstrndx = ELF_FIELD(is64, Ehdr, e_shstrndx);
+  relocatable = ELF_FIELD(is64, Ehdr, e_type) == ET_REL;   // symbol values are offsets already
+  thumb = ELF_FIELD(is64, Ehdr, e_machine) == EM_ARM;      // function addresses have bit 0 set
+  if (shentsize < (is64 ? sizeof(Elf64_Shdr) : sizeof(Elf32_Shdr)) || (shoff | shentsize) % align ||
+      !InFile(build, shoff, shnum * shentsize) || shstrndx >= shnum) {
+    fprintf(stderr, "%s: bad section headers\n", build->path);
+    return -1;
+  }
+  p = data + shoff + shstrndx * shentsize;
+  namesSize = ELF_FIELD(is64, Shdr, sh_size);
+  if (!InFile(build, ELF_FIELD(is64, Shdr, sh_offset), namesSize)) {
+    fprintf(stderr, "%s: bad section name table\n", build->path);
+    return -1;
+  }
+  sectionNames = (const char *)data + ELF_FIELD(is64, Shdr, sh_offset);
+
+  sectionMemory = calloc(shnum, 1);
+  sectionIds = calloc(shnum, sizeof(uint32_t));
+  sectionAddresses = calloc(shnum, sizeof(uint64_t));
+  sectionSizes = calloc(shnum, sizeof(uint64_t));
+  for (i = 0; i < shnum; i++) {
+    uint64_t flags, type;
+    p = data + shoff + i * shentsize;
+    flags = ELF_FIELD(is64, Shdr, sh_flags);
+    type = ELF_FIELD(is64, Shdr, sh_type);
+    sectionIds[i] = Intern(&build->strings,
+                           TableString(sectionNames, namesSize, ELF_FIELD(is64, Shdr, sh_name)));
+    if (type == SHT_SYMTAB) {
+      symOffset = ELF_FIELD(is64, Shdr, sh_offset);
+      symSize = ELF_FIELD(is64, Shdr, sh_size);
+      symEntSize = ELF_FIELD(is64, Shdr, sh_entsize);
+      strIndex = ELF_FIELD(is64, Shdr, sh_link);
+    }
+    if (flags & SHF_ALLOC) {
+      sectionMemory[i] = (flags & SHF_WRITE) ?
+        (type == SHT_NOBITS ? IN_RAM : IN_RAM | IN_FLASH) : IN_FLASH;
+      sectionAddresses[i] = ELF_FIELD(is64, Shdr, sh_addr);
+      sectionSizes[i] = ELF_FIELD(is64, Shdr, sh_size);
+      if ((flags & SHF_TLS) && sectionAddresses[i] < tlsStart) {
+        tlsStart = sectionAddresses[i];
+      }
+    }
+  }
+  if (symEntSize == 0) {
+    fprintf(stderr, "%s: no symbol table (stripped?)\n", build->path);
+    free(sectionMemory);
+    free(sectionIds);
+    free(sectionAddresses);
+    free(sectionSizes);
+    return -1;
+  }
+  p = data + shoff + (strIndex < shnum ? strIndex : 0) * shentsize;
+  strSize = ELF_FIELD(is64, Shdr, sh_size);
+  if (symEntSize < (is64 ? sizeof(Elf64_Sym) : sizeof(Elf32_Sym)) || (symOffset | symEntSize) % align ||
+      !InFile(build, symOffset, symSize) || strIndex >= shnum ||
+      !InFile(build, ELF_FIELD(is64, Shdr, sh_offset), strSize)) {
+    fprintf(stderr, "%s: bad symbol table\n", build->path);
+    free(sectionMemory);
+    free(sectionIds);
+    free(sectionAddresses);
+    free(sectionSizes);
+    return -1;
+  }
+
+  {
+    const char *strtab = (const char *)data + ELF_FIELD(is64, Shdr, sh_offset);
+    size_t capSymbols = 0;
+    fileName = Intern(&build->strings, "(global)");
+    for (i = 0; i < symSize / symEntSize; i++) {
+      uint64_t size, shndx, value;
+      uint8_t info;
+      p = data + symOffset + i * symEntSize;
+      info = ELF_FIELD(is64, Sym, st_info);
+      size = ELF_FIELD(is64, Sym, st_size);
+      shndx = ELF_FIELD(is64, Sym, st_shndx);
+      if (ELF32_ST_TYPE(info) == STT_FILE) {
+        fileName = Intern(&build->strings, TableString(strtab, strSize, ELF_FIELD(is64, Sym, st_name)));
+        continue;
+      }
+      if (ELF32_ST_BIND(info) != STB_LOCAL) {
+        fileName = Intern(&build->strings, "(global)"); // globals come after all the locals
+      }
+      if (size == 0 || shndx == SHN_UNDEF || shndx >= shnum || sectionMemory[shndx] == 0) {
+        continue;
+      }
+      value = ELF_FIELD(is64, Sym, st_value);
+      if (thumb && ELF32_ST_TYPE(info) == STT_FUNC) {
+        value &= ~(uint64_t)1;
+      }
+      if (ELF32_ST_TYPE(info) == STT_TLS && tlsStart != UINT64_MAX) {
+        value += tlsStart;      // thread locals are offsets into the TLS segment
+      }
+      if (!relocatable) {
+        if (value < sectionAddresses[shndx]) {
+          continue;
+        }
+        value -= sectionAddresses[shndx];
+      }
+      if (numSymbols == capSymbols) {
+        capSymbols = capSymbols ? capSymbols * 2 : 4096;
+        symbols = CheckedRealloc(symbols, capSymbols * sizeof(struct sElfSymbol));
+      }
+      symbols[numSymbols].section = shndx;
+      symbols[numSymbols].offset = value;
+      symbols[numSymbols].size = size;
+      symbols[numSymbols].object = fileName;
+      symbols[numSymbols].name =
+        Intern(&build->strings, TableString(strtab, strSize, ELF_FIELD(is64, Sym, st_name)));
+      numSymbols++;
+    }
+  }
+  if (numSymbols > 0) {
+    qsort(symbols, numSymbols, sizeof(struct sElfSymbol), CompareElfSymbols);
+  }
+  AddElfSections(build, symbols, numSymbols, sectionSizes, sectionMemory, sectionIds, shnum);
+  free(symbols);
+  free(sectionMemory);
+  free(sectionIds);
+  free(sectionAddresses);
+  free(sectionSizes);
+  return 0;
+}
+
+static int LoadBuild(struct sBuild *build, const char *path)
+{
+  FILE *file = fopen(path, "rb");
+  long length;
+
+  memset(build, 0, sizeof(*build));
+  build->path = path;
+  if (file == NULL) {
+    perror(path);
+    return -1;
+  }
+  if (fseek(file, 0, SEEK_END) != 0 || (length = ftell(file)) < 0 ||
+      fseek(file, 0, SEEK_SET) != 0) {
+    perror(path);
+    fclose(file);
+    return -1;
+  }
+  build->text = CheckedRealloc(NULL, length + 1);
+  build->length = fread(build->text, 1, length, file);
+  build->text[build->length] = '\0';
+  fclose(file);
+
+  if (build->length > EI_NIDENT && memcmp(build->text, ELFMAG, SELFMAG) == 0) {
+    return ParseElf(build);
+  }
+  ParseMap(build);
+  return 0;
+}
+
+/******************************************************************************************************
+ * Totals by name
+ * Adds entry sizes up by section, object, or symbol (keyed by interned id)
+*******************************************************************************************************/
+enum eGroupBy { BY_SECTION, BY_OBJECT, BY_SYMBOL };
+
+struct sTotal {
+  const char *name;
+  const char *section;   // for symbols, where they live
+  int64_t size;
+  int64_t oldSize;       // for diffs
+  uint8_t memory;
+};
+
+static uint32_t EntryKey(const struct sEntry *entry, enum eGroupBy by)
+{
+  return by == BY_SECTION ? entry->section : by == BY_OBJECT ? entry->object : entry->symbol;
+}
+
+// totals[id] for every interned id, returns the number with a size
+static struct sTotal *Totals(const struct sBuild *build, enum eGroupBy by)
+{
+  struct sTotal *totals = calloc(build->strings.count, sizeof(struct sTotal));
+  size_t i;
+  for (i = 0; i < build->numEntries; i++) {
+    const struct sEntry *entry = &build->entries[i];
+    struct sTotal *total = &totals[EntryKey(entry, by)];
+    total->name = build->strings.names[EntryKey(entry, by)];
+    total->section = build->strings.names[entry->section];
+    total->size += entry->size;
+    total->memory |= entry->memory;
+  }
+  return totals;
+}
+
+static int CompareBySize(const void *a, const void *b)
+{
+  const struct sTotal *x = a, *y = b;
+  return (y->size > x->size) - (y->size < x->size);
+}
+
+static const char *MemoryName(uint8_t memory)
+{
+  return memory == (IN_FLASH | IN_RAM) ? "flash+ram" : memory == IN_RAM ? "ram" : "flash";
+}
+
+static void PrintTop(const struct sBuild *build, enum eGroupBy by, const char *title)
+{
+  struct sTotal *totals = Totals(build, by);
+  uint32_t i, n = 0;
+
+  for (i = 0; i < build->strings.count; i++) {
+    if (totals[i].size) {
+      totals[n++] = totals[i];
+    }
+  }
+  qsort(totals, n, sizeof(struct sTotal), CompareBySize);
+  printf("\nLargest %s:\n", title);
+  for (i = 0; i < n && i < TOP_N; i++) {
+    printf("  %10lld  %-9s  %s", (long long)totals[i].size, MemoryName(totals[i].memory),
+           totals[i].name);
+    if (by == BY_SYMBOL) {
+      printf("  (%s)", totals[i].section);
+    }
+    printf("\n");
+  }
+  free(totals);
+}
+
+static void Report(struct sBuild *build)
+{
+  int r;
+
+  printf("%s: %zu pieces, flash %llu bytes, RAM %llu bytes\n", build->path, build->numEntries,
+         (unsigned long long)build->total[IN_FLASH], (unsigned long long)build->total[IN_RAM]);
+  for (r = 0; r < build->numRegions; r++) {
+    const struct sRegion *region = &build->regions[r];
+    printf("  %-12s %-5s %10llu of %10llu bytes used (%.1f%%)\n", region->name,
+           region->memory == IN_RAM ? "ram" : "flash", (unsigned long long)region->used,
+           (unsigned long long)region->length,
+           region->length ? 100.0 * region->used / region->length : 0.0);
+  }
+  PrintTop(build, BY_SECTION, "sections");
+  PrintTop(build, BY_OBJECT, "object files");
+  PrintTop(build, BY_SYMBOL, "symbols");
+}
+
+/******************************************************************************************************
+ * Treemap
+ * memory -> section -> object -> symbol, laid out with the squarified
+ * algorithm (Bruls, Huizing, van Wijk) so the boxes stay close to square
+ * and are easy to compare. The output is plain HTML with positioned divs,
+ * hover over a box for its name and size.
+*******************************************************************************************************/
+struct sNode {
+  const char *name;
+  uint64_t size;
+  uint32_t firstChild;
+  uint32_t nextSibling;
+};
+
+struct sTree {
+  struct sNode *nodes;
+  uint32_t count;
+  uint32_t capacity;
+  uint64_t *childTable;  // (parent, name id) -> node, open addressing
+  uint32_t tableSize;
+};
+
+static uint32_t NewNode(struct sTree *tree, uint32_t parent, const char *name)
+{
+  struct sNode *node;
+  if (tree->count == tree->capacity) {
+    tree->capacity = tree->capacity ? tree->capacity * 2 : 1024;
+    tree->nodes = CheckedRealloc(tree->nodes, tree->capacity * sizeof(struct sNode));
+  }
+  node = &tree->nodes[tree->count];
+  node->name = name;
+  node->size = 0;
+  node->firstChild = NO_ID;
+  node->nextSibling = NO_ID;
+  if (parent != NO_ID) {
+    node->nextSibling = tree->nodes[parent].firstChild;
+    tree->nodes[parent].firstChild = tree->count;
+  }
+  return tree->count++;
+}
+
+// Find or make the child of parent for name id, the table holds (key, node)
+static uint32_t Child(struct sTree *tree, uint32_t parent, uint32_t nameId, const char *name)
+{
+  uint64_t key = ((uint64_t)parent << 32) | nameId;
+  uint32_t slot = (uint32_t)((key * 0x9E3779B97F4A7C15ull) >> 40) & (tree->tableSize - 1);
+  uint32_t node;
+
+  while (tree->childTable[2 * slot] != UINT64_MAX) {
+    if (tree->childTable[2 * slot] == key) {
+      return (uint32_t)tree->childTable[2 * slot + 1];
+    }
+    slot = (slot + 1) & (tree->tableSize - 1);
+  }
+  node = NewNode(tree, parent, name);
+  tree->childTable[2 * slot] = key;
+  tree->childTable[2 * slot + 1] = node;
+  return node;
+}
+
+static void BuildTree(struct sTree *tree, const struct sBuild *build)
+{
+  uint32_t root, memory[3];
+  size_t i;
+  int m;
+
+  memset(tree, 0, sizeof(*tree));
+  tree->tableSize = 1;
+  while (tree->tableSize < build->numEntries * 8 + 1024) {
+    tree->tableSize *= 2;
+  }
+  tree->childTable = CheckedRealloc(NULL, tree->tableSize * 2 * sizeof(uint64_t));
+  memset(tree->childTable, 0xFF, tree->tableSize * 2 * sizeof(uint64_t));
+
+  root = NewNode(tree, NO_ID, build->path);
+  memory[IN_RAM] = NewNode(tree, root, "RAM");
+  memory[IN_FLASH] = NewNode(tree, root, "Flash");
+
+  for (i = 0; i < build->numEntries; i++) {
+    const struct sEntry *entry = &build->entries[i];
+    for (m = IN_FLASH; m <= IN_RAM; m++) {
+      uint32_t section, object, symbol;
+      if (!(entry->memory & m)) {
+        continue;
+      }
+      section = Child(tree, memory[m], entry->section, build->strings.names[entry->section]);
+      object = Child(tree, section, entry->object, build->strings.names[entry->object]);
+      symbol = Child(tree, object, entry->symbol, build->strings.names[entry->symbol]);
+      tree->nodes[root].size += entry->size;
+      tree->nodes[memory[m]].size += entry->size;
+      tree->nodes[section].size += entry->size;
+      tree->nodes[object].size += entry->size;
+      tree->nodes[symbol].size += entry->size;
+    }
+  }
+}
+
+static void HtmlEscaped(FILE *out, const char *s)
+{
+  for (; *s; s++) {
+    switch (*s) {
+      case '<': fputs("&lt;", out); break;
+      case '>': fputs("&gt;", out); break;
+      case '&': fputs("&amp;", out); break;
+      case '"': fputs("&quot;", out); break;
+      default: fputc(*s, out); break;
+    }
+  }
+}
+
+static int CompareNodeSize(const void *a, const void *b)
+{
+  const struct sNode *x = *(const struct sNode * const *)a;
+  const struct sNode *y = *(const struct sNode * const *)b;
+  return (y->size > x->size) - (y->size < x->size);
+}
+
+static void DrawNode(FILE *out, const struct sTree *tree, uint32_t id,
+                     double x, double y, double w, double h, int depth);
+
+// worst aspect ratio if these sizes were laid in a strip of the given length
+static double WorstRatio(struct sNode **row, int n, double scale, double length)
+{
+  double sum = 0, worst = 0, thickness;
+  int i;
+  for (i = 0; i < n; i++) {
+    sum += row[i]->size * scale;
+  }
+  thickness = sum / length;
+  for (i = 0; i < n; i++) {
+    double along = row[i]->size * scale / thickness;
+    double ratio = along > thickness ? along / thickness : thickness / along;
+    if (ratio > worst) {
+      worst = ratio;
+    }
+  }
+  return worst;
+}
+
+static void Squarify(FILE *out, const struct sTree *tree, struct sNode **kids, int numKids,
+                     double x, double y, double w, double h, int depth)
+{
+  double total = 0, scale;
+  int start = 0, i;
+
+  for (i = 0; i < numKids; i++) {
+    total += kids[i]->size;
+  }
+  if (total <= 0) {
+    return;
+  }
+  scale = (w * h) / total; // pixels per byte
+
+  while (start < numKids && w >= 1 && h >= 1) {
+    double length = w < h ? w : h;
+    double rowArea = 0, thickness, offset = 0;
+    int end = start + 1;
+
+    while (end < numKids &&
+           WorstRatio(kids + start, end + 1 - start, scale, length) <=
+           WorstRatio(kids + start, end - start, scale, length)) {
+      end++;
+    }
+    for (i = start; i < end; i++) {
+      rowArea += kids[i]->size * scale;
+    }
+    thickness = rowArea / length;
+    for (i = start; i < end; i++) {
+      double along = kids[i]->size * scale / thickness;
+      uint32_t id = (uint32_t)(kids[i] - tree->nodes);
+      if (w < h) {
+        DrawNode(out, tree, id, x + offset, y, along, thickness, depth + 1);
+      } else {
+        DrawNode(out, tree, id, x, y + offset, thickness, along, depth + 1);
+      }
+      offset += along;
+    }
+    if (w < h) {
+      y += thickness; h -= thickness;
+    } else {
+      x += thickness; w -= thickness;
+    }
+    start = end;
+  }
+}
+
+static void DrawNode(FILE *out, const struct sTree *tree, uint32_t id,
+                     double x, double y, double w, double h, int depth)
+{
+  static const char *colors[] = { "#f4f4f4", "#dbe9f6", "#b7d3ec", "#f6e3c5", "#d4ecd0" };
+  const struct sNode *node = &tree->nodes[id];
+  struct sNode **kids;
+  uint32_t child;
+  int numKids = 0;
+
+  if (w < 2 || h < 2) {
+    return; // too small to see, it is still counted in its parent
+  }
+  fprintf(out, "<div style=\"left:%.1fpx;top:%.1fpx;width:%.1fpx;height:%.1fpx;background:%s\" title=\"",
+          x, y, w - 1, h - 1, colors[depth % 5]);
+  HtmlEscaped(out, node->name);
+  fprintf(out, " %llu bytes\">", (unsigned long long)node->size);
+  if (w > 40 && h > 14) {
+    HtmlEscaped(out, node->name);
+  }
+  fputs("</div>\n", out);
+
+  for (child = node->firstChild; child != NO_ID; child = tree->nodes[child].nextSibling) {
+    numKids++;
+  }
+  if (numKids == 0) {
+    return;
+  }
+  kids = malloc(numKids * sizeof(struct sNode *));
+  numKids = 0;
+  for (child = node->firstChild; child != NO_ID; child = tree->nodes[child].nextSibling) {
+    kids[numKids++] = &tree->nodes[child];
+  }
+  qsort(kids, numKids, sizeof(struct sNode *), CompareNodeSize);
+  // leave room for the label
+  Squarify(out, tree, kids, numKids, x + 2, y + 14, w - 4, h - 16, depth);
+  free(kids);
+}
+
+static int WriteTreemap(const struct sBuild *build, const char *path)
+{
+  struct sTree tree;
+  FILE *out = fopen(path, "w");
+  int m;
+
+  if (out == NULL) {
+    perror(path);
+    return -1;
+  }
+  BuildTree(&tree, build);
+  fputs("<!DOCTYPE html>\n<html><head><meta charset=\"utf-8\"><title>", out);
+  HtmlEscaped(out, build->path);
+  fputs("</title><style>\n"
+        "body{font:12px sans-serif}\n"
+        "div{position:absolute;overflow:hidden;box-sizing:border-box;border:1px solid #888;"
+        "white-space:nowrap;padding:0 2px}\n"
+        ".map{position:relative}\n"
+        "</style></head><body>\n<h2>", out);
+  HtmlEscaped(out, build->path);
+  fprintf(out, "</h2><p>Flash %llu bytes, RAM %llu bytes. Hover for names and sizes.</p>\n",
+          (unsigned long long)build->total[IN_FLASH], (unsigned long long)build->total[IN_RAM]);
+
+  // flash and RAM side by side, each scaled on its own
+  for (m = 1; m <= 2; m++) {
+    uint32_t memory = tree.nodes[0].firstChild;
+    while (memory != NO_ID && strcmp(tree.nodes[memory].name, m == 1 ? "Flash" : "RAM") != 0) {
+      memory = tree.nodes[memory].nextSibling;
+    }
+    fprintf(out, "<div class=\"map\" style=\"position:relative;display:inline-block;border:none;"
+            "width:%dpx;height:%dpx;margin-right:8px\">\n", TREEMAP_WIDTH / 2, TREEMAP_HEIGHT);
+    if (memory != NO_ID) {
+      DrawNode(out, &tree, memory, 0, 0, TREEMAP_WIDTH / 2, TREEMAP_HEIGHT, 0);
+    }
+    fputs("</div>\n", out);
+  }
+  fputs("</body></html>\n", out);
+  fclose(out);
+  free(tree.nodes);
+  free(tree.childTable);
+  return 0;
+}
+
+/******************************************************************************************************
+ * Diff
+ * Match sections, objects and symbols by name between two builds. Objects are
+ * matched by file name only so builds from different directories compare.
+*******************************************************************************************************/
+struct sDiffTable {
+  struct sTotal *rows;
+  uint32_t count;
+  uint32_t capacity;
+  uint32_t *index;     // open addressing on name
+  uint32_t indexSize;
+};
+
+static const char *BaseName(const char *path)
+{
+  const char *slash = strrchr(path, '/');
+  return slash ? slash + 1 : path;
+}
+
+static struct sTotal *DiffRow(struct sDiffTable *table, const char *name)
+{
+  uint32_t slot = HashString(name) & (table->indexSize - 1);
+  struct sTotal *row;
+
+  while (table->index[slot] != NO_ID) {
+    if (strcmp(table->rows[table->index[slot]].name, name) == 0) {
+      return &table->rows[table->index[slot]];
+    }
+    slot = (slot + 1) & (table->indexSize - 1);
+  }
+  if (table->count == table->capacity) {
+    table->capacity = table->capacity ? table->capacity * 2 : 1024;
+    table->rows = CheckedRealloc(table->rows, table->capacity * sizeof(struct sTotal));
+  }
+  row = &table->rows[table->count];
+  memset(row, 0, sizeof(*row));
+  row->name = name;
+  table->index[slot] = table->count++;
+  return row;
+}
+
+static void DiffAdd(struct sDiffTable *table, const struct sBuild *build, enum eGroupBy by, int isOld)
+{
+  size_t i;
+  for (i = 0; i < build->numEntries; i++) {
+    const struct sEntry *entry = &build->entries[i];
+    const char *name = build->strings.names[EntryKey(entry, by)];
+    struct sTotal *row = DiffRow(table, by == BY_OBJECT ? BaseName(name) : name);
+    if (isOld) {
+      row->oldSize += entry->size;
+    } else {
+      row->size += entry->size;
+    }
+    row->section = build->strings.names[entry->section];
+    row->memory |= entry->memory;
+  }
+}
+
+static int CompareByChange(const void *a, const void *b)
+{
+  const struct sTotal *x = a, *y = b;
+  int64_t dx = x->size - x->oldSize, dy = y->size - y->oldSize;
+  dx = dx < 0 ? -dx : dx;
+  dy = dy < 0 ? -dy : dy;
+  return (dy > dx) - (dy < dx);
+}
+
+static void PrintChanges(const struct sBuild *oldBuild, const struct sBuild *newBuild,
+                         enum eGroupBy by, const char *title, int64_t threshold)
+{
+  struct sDiffTable table;
+  uint32_t i, shown = 0;
+
+  memset(&table, 0, sizeof(table));
+  table.indexSize = 1;
+  while (table.indexSize < 2 * (oldBuild->strings.count + newBuild->strings.count) + 16) {
+    table.indexSize *= 2;
+  }
+  table.index = CheckedRealloc(NULL, table.indexSize * sizeof(uint32_t));
+  memset(table.index, 0xFF, table.indexSize * sizeof(uint32_t));
+  DiffAdd(&table, oldBuild, by, 1);
+  DiffAdd(&table, newBuild, by, 0);
+  qsort(table.rows, table.count, sizeof(struct sTotal), CompareByChange);
+
+  printf("\nBiggest changes in %s:\n", title);
+  for (i = 0; i < table.count && shown < TOP_N; i++) {
+    const struct sTotal *row = &table.rows[i];
+    int64_t delta = row->size - row->oldSize;
+    if (delta == 0) {
+      break;
+    }
+    printf("  %+9lld  %9lld -> %-9lld %-9s %s%s%s\n", (long long)delta, (long long)row->oldSize,
+           (long long)row->size, MemoryName(row->memory), row->name,
+           row->oldSize == 0 ? " (new)" : row->size == 0 ? " (removed)" : "",
+           delta > threshold ? "  <-- over threshold" : "");
+    shown++;
+  }
+  if (shown == 0) {
+    printf("  (none)\n");
+  }
+  free(table.rows);
+  free(table.index);
+}
+
+static int Diff(struct sBuild *oldBuild, struct sBuild *newBuild, int64_t threshold)
+{
+  int64_t flash = (int64_t)newBuild->total[IN_FLASH] - (int64_t)oldBuild->total[IN_FLASH];
+  int64_t ram = (int64_t)newBuild->total[IN_RAM] - (int64_t)oldBuild->total[IN_RAM];
+  int regression = flash > threshold || ram > threshold;
+
+  printf("%s -> %s\n", oldBuild->path, newBuild->path);
+  printf("  flash %10llu -> %-10llu (%+lld)\n", (unsigned long long)oldBuild->total[IN_FLASH],
+         (unsigned long long)newBuild->total[IN_FLASH], (long long)flash);
+  printf("  RAM   %10llu -> %-10llu (%+lld)\n", (unsigned long long)oldBuild->total[IN_RAM],
+         (unsigned long long)newBuild->total[IN_RAM], (long long)ram);
+  PrintChanges(oldBuild, newBuild, BY_SECTION, "sections", threshold);
+  PrintChanges(oldBuild, newBuild, BY_OBJECT, "object files", threshold);
+  PrintChanges(oldBuild, newBuild, BY_SYMBOL, "symbols", threshold);
+  if (regression) {
+    printf("\nSIZE REGRESSION: grew by more than %lld bytes\n", (long long)threshold);
+  }
+  return regression;
+}
+
+// The map and the ELF of one build should agree section by section: a
+// difference means one of the parsers missed something
+static int Check(struct sBuild *mapBuild, struct sBuild *elfBuild)
+{
+  struct sDiffTable table;
+  uint32_t i, differ = 0;
+
+  memset(&table, 0, sizeof(table));
+  table.indexSize = 1;
+  while (table.indexSize < 2 * (mapBuild->strings.count + elfBuild->strings.count) + 16) {
+    table.indexSize *= 2;
+  }
+  table.index = CheckedRealloc(NULL, table.indexSize * sizeof(uint32_t));
+  memset(table.index, 0xFF, table.indexSize * sizeof(uint32_t));
+  DiffAdd(&table, mapBuild, BY_SECTION, 1);
+  DiffAdd(&table, elfBuild, BY_SECTION, 0);
+
+  printf("%s against %s, %u sections\n", mapBuild->path, elfBuild->path, table.count);
+  for (i = 0; i < table.count; i++) {
+    const struct sTotal *row = &table.rows[i];
+    if (row->size != row->oldSize) {
+      printf("  %-24s %9lld != %-9lld\n", row->name, (long long)row->oldSize, (long long)row->size);
+      differ++;
+    }
+  }
+  if (differ) {
+    printf("SECTIONS DIFFER: %u\n", differ);
+  } else {
+    printf("  all the same\n");
+  }
+  free(table.rows);
+  free(table.index);
+  return differ != 0;
+}
+
+static void FreeBuild(struct sBuild *build)
+{
+  free(build->text);
+  free(build->entries);
+  free(build->strings.names);
+  free(build->strings.table);
+}
+
+static void Usage(void)
+{
+  printf("usage: mapview file.map|file.elf [--html out.html]\n"
+         "       mapview --diff old.map new.map [--threshold bytes]\n"
+         "       mapview --check firmware.map firmware.elf\n");
+}
+
+int main(int argc, char *argv[])
+{
+  struct sBuild build, oldBuild;
+  const char *html = NULL;
+  int64_t threshold = 0;
+  int result = 0;
+
+  if (argc < 2) {
+    Usage();
+    return 2;
+  }
+  if (strcmp(argv[1], "--check") == 0) {
+    if (argc < 4) {
+      Usage();
+      return 2;
+    }
+    if (LoadBuild(&oldBuild, argv[2]) != 0 || LoadBuild(&build, argv[3]) != 0) {
+      return 2;
+    }
+    result = Check(&oldBuild, &build);
+    FreeBuild(&oldBuild);
+    FreeBuild(&build);
+    return result;
+  }
+  if (strcmp(argv[1], "--diff") == 0) {
+    if (argc < 4) {
+      Usage();
+      return 2;
+    }
+    if (argc > 5 && strcmp(argv[4], "--threshold") == 0) {
+      threshold = atoll(argv[5]);
+    }
+    if (LoadBuild(&oldBuild, argv[2]) != 0 || LoadBuild(&build, argv[3]) != 0) {
+      return 2;
+    }
+    result = Diff(&oldBuild, &build, threshold);
+    FreeBuild(&oldBuild);
+    FreeBuild(&build);
+    return result;
+  }
+
+  if (argc > 3 && strcmp(argv[2], "--html") == 0) {
+    html = argv[3];
+  }
+  if (LoadBuild(&build, argv[1]) != 0) {
+    return 2;
+  }
+  Report(&build);
+  if (html) {
+    result = WriteTreemap(&build, html) == 0 ? 0 : 2;
+    if (result == 0) {
+      printf("\nTreemap written to %s\n", html);
+    }
+  }
+  FreeBuild(&build);
+  return result;
+}
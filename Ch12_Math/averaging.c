@@ -3,23 +3,43 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <time.h>
+#include "fastdiv.h"
 
+// The divide in GetAverage uses a precomputed multiply-shift (fastdiv.h).
+// Blocks are usually the same length so it is only remade when the number
+// of samples changes. ClearAverage throws it away (so code that only ever
+// called ClearAverage still works), RestartAverage keeps it for the next
+// block of an sAve that was set up with ClearAverage or InitAverage.
 struct sAve {
   int32_t blockSum;
   uint16_t numSamples;
+  struct sFastDiv div;
 };
 
-void ClearAverage(struct sAve *ave) {
+void RestartAverage(struct sAve *ave) {
   ave->blockSum = 0;
   ave->numSamples = 0;
 }
+void ClearAverage(struct sAve *ave) {
+  RestartAverage(ave);
+  ave->div.divisor = UINT32_MAX;  // numSamples never matches, GetAverage remakes it
+}
+void InitAverage(struct sAve *ave) {
+  RestartAverage(ave);
+  ave->div = FastDivInit(0);
+}
 void AddSampleToAverage(struct sAve *ave, int16_t newSample) {
   ave->blockSum += newSample;
   ave->numSamples++;
 }
 
+// no samples gives 0 instead of a divide by zero fault
 int16_t GetAverage(struct sAve *ave) {
-  int16_t average = ave->blockSum/ave->numSamples;
+  if (ave->div.divisor != ave->numSamples) {
+    ave->div = FastDivInit(ave->numSamples);
+  }
+  int16_t average = FastDivS32(ave->blockSum, &ave->div);
   return average;
 }
 
@@ -37,6 +57,9 @@ int16_t PlainOldAverage(int16_t* samples, uint16_t sampleLength)
   {
     sum += samples[i];
   }
+  if (sampleLength == 0) {
+    return 0;
+  }
   return sum/sampleLength;
 }
 
@@ -45,7 +68,7 @@ int16_t averageWithStruct(int16_t* samples, uint16_t sampleLength)
 {
   int i;
   struct sAve ave;
-  ClearAverage(&ave);
+  InitAverage(&ave);
   for (i = 0; i < sampleLength; i++)
   {
     AddSampleToAverage(&ave, samples[i]);
@@ -57,7 +80,7 @@ float averageWithStructF(int16_t* samples, uint16_t sampleLength)
 {
   int i;
   struct sAve ave;
-  ClearAverage(&ave);
+  InitAverage(&ave);
   for (i = 0; i < sampleLength; i++)
   {
     AddSampleToAverage(&ave, samples[i]);
@@ -93,6 +116,10 @@ void AddSampleToVariance (struct sVar *var, int16_t newSample) {
 }
 float GetVariance(struct sVar *var, float *average) {
   float variance;
+  if (var->numSamples < 2) { // (numSamples-1) would be zero or wrap around
+    *average = var->numSamples ? var->sum : 0;
+    return 0;
+  }
   *average = (float) var->sum/var->numSamples;  
   variance = (var->sumSquares - (var->sum * (*average))) 
                        /(var->numSamples-1);  
@@ -129,7 +156,8 @@ void AddSampleToWelfordVariance(struct sWelfordVar *var, int16_t newSample) {
   var->M2 += delta * (newSample - var->mean); // uses the new mean
 }
 uint16_t GetWelfordVariance(struct sWelfordVar *var, int16_t *average) {
-  uint16_t variance = var->M2/var->numSamples;
+  struct sFastDiv div = FastDivInit(var->numSamples); // zero safe
+  uint16_t variance = FastDivS32(var->M2, &div);
   *average = var->mean; // running average already calculated
   return variance;
 }
@@ -184,8 +212,58 @@ void TestAverages()
 }
 
 
+// Average many blocks of the same length: the multiply-shift is set up once
+// and reused, compared with dividing every time. (On a host with a fast
+// divider the difference is smaller than on a Cortex-M0, which has none.)
+#define NUM_BLOCKS 1000000
+#define BLOCK_LENGTH 20
+void TestFastDivide()
+{
+  struct sAve ave;
+  int16_t samples[BLOCK_LENGTH];
+  int32_t plainSum = 0, fastSum = 0;
+  volatile uint16_t blockLength = BLOCK_LENGTH; // keep the compiler from doing this for us
+  clock_t start;
+  double plainTime, fastTime;
+  int block, i;
+
+  for (i = 0; i < BLOCK_LENGTH; i++) {
+    samples[i] = (i * 1237) % 2000 - 1000;
+  }
+
+  InitAverage(&ave);
+  start = clock();
+  for (block = 0; block < NUM_BLOCKS; block++) {
+    RestartAverage(&ave);
+    ave.blockSum = block % 1000; // so each block is a little different
+    for (i = 0; i < blockLength; i++) {
+      AddSampleToAverage(&ave, samples[i]);
+    }
+    plainSum += ave.blockSum/ave.numSamples;
+  }
+  plainTime = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+  start = clock();
+  for (block = 0; block < NUM_BLOCKS; block++) {
+    RestartAverage(&ave);
+    ave.blockSum = block % 1000;
+    for (i = 0; i < blockLength; i++) {
+      AddSampleToAverage(&ave, samples[i]);
+    }
+    fastSum += GetAverage(&ave);
+  }
+  fastTime = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+  printf("%d block averages: divide %.3fs, multiply-shift %.3fs (%s)\n", NUM_BLOCKS,
+    plainTime, fastTime, plainSum == fastSum ? "same answers" : "DIFFERENT answers");
+
+  InitAverage(&ave);
+  printf("GetAverage with no samples: %d (no divide by zero fault)\n", GetAverage(&ave));
+}
+
 int main()
 { 
   TestAverages();
+  TestFastDivide();
   return 1;
 }
\ No newline at end of file
@@ -0,0 +1,23 @@
+/*
+ * fakefloat.h
+ *
+ * The fake floating point types from fakefloats.c: an integer and how far
+ * to shift it, so the value is num / 2^shift. Split out so other code
+ * (the telemetry format in ../Ch10_Connected) can use the same types.
+ */
+#ifndef FAKEFLOAT_H
+#define FAKEFLOAT_H
+
+#include <stdint.h>
+
+struct sFakeFloat16 {
+  int8_t num;
+  int8_t shift;
+};
+
+struct sFakeFloat40 {
+  int32_t num;
+  int8_t shift;
+};
+
+#endif // FAKEFLOAT_H
@@ -1,11 +1,7 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <assert.h>
-
-struct sFakeFloat16 {
-  int8_t num;
-  int8_t shift;
-};
+#include "fakefloat.h"
 
 struct sFakeFloat16 ff16Add (struct sFakeFloat16 a, struct sFakeFloat16 b)
 {
@@ -38,11 +34,6 @@ void ff16Print(char* note, struct sFakeFloat16 f)
     printf("%s %d/(2^(%d)) = %0.4f\r\n", note, f.num, f.shift, ff);
 }
 
-struct sFakeFloat40 {
-  int32_t num;
-  int8_t shift;
-} ;
-
 struct sFakeFloat40 ff40Mult(struct sFakeFloat40 a, struct sFakeFloat40 b)
 {
     struct sFakeFloat40 result;
@@ -0,0 +1,77 @@
+/*
+ * fastdiv.h
+ *
+ * Division by a number that doesn't change often, done with a multiply and
+ * shifts instead of a divide instruction.
+ *
+ * A Cortex-M0 has no divide instruction so every / is a library call that
+ * takes dozens of cycles. Even with hardware divide (M3/M4), it is one of
+ * the slowest instructions. If you divide by the same number over and over
+ * (the number of samples in a fixed size block, for example), work out a
+ * "magic" multiplier once and each divide becomes a multiply, an add and
+ * two shifts.
+ *
+ * The math is from Granlund and Montgomery, "Division by Invariant Integers
+ * using Multiplication" (1994), the same idea as the libdivide library.
+ * For divisor d, with l = ceil(log2(d)):
+ *     m = floor(2^32 * (2^l - d) / d) + 1
+ *     t = (m * n) >> 32
+ *     n / d = (t + ((n - t) >> 1)) >> (l - 1)
+ * The shifts are split so d = 1 works too.
+ *
+ * Dividing by zero doesn't trap: the result is 0. Check for that yourself
+ * if 0 isn't a sensible answer.
+ */
+#ifndef FASTDIV_H
+#define FASTDIV_H
+
+#include <stdint.h>
+
+struct sFastDiv {
+  uint32_t divisor;   // what this was made for, to know when to remake it
+  uint32_t magic;
+  uint32_t zeroMask;  // 0 when dividing by zero, all ones otherwise
+  uint8_t shift1;
+  uint8_t shift2;
+};
+
+// The setup has a real (64 bit) divide in it so only do it when the divisor changes
+static inline struct sFastDiv FastDivInit(uint32_t divisor)
+{
+  struct sFastDiv div;
+  uint32_t l = 0;
+
+  while (l < 32 && ((uint64_t)1 << l) < divisor) { // l = ceil(log2(divisor))
+    l++;
+  }
+  div.divisor = divisor;
+  if (divisor == 0) {
+    div.magic = 0;
+    div.zeroMask = 0;
+    div.shift1 = 0;
+    div.shift2 = 0;
+  } else {
+    div.magic = (uint32_t)((((uint64_t)1 << 32) * (((uint64_t)1 << l) - divisor)) / divisor + 1);
+    div.zeroMask = 0xFFFFFFFF;
+    div.shift1 = l > 0 ? 1 : 0;
+    div.shift2 = l > 0 ? l - 1 : 0;
+  }
+  return div;
+}
+
+static inline uint32_t FastDivU32(uint32_t n, const struct sFastDiv *div)
+{
+  uint32_t t = (uint32_t)(((uint64_t)div->magic * n) >> 32);
+  return ((t + ((n - t) >> div->shift1)) >> div->shift2) & div->zeroMask;
+}
+
+// Rounds toward zero like C does for negative numbers
+static inline int32_t FastDivS32(int32_t n, const struct sFastDiv *div)
+{
+  uint32_t magnitude = n < 0 ? 0u - (uint32_t)n : (uint32_t)n;
+  uint32_t q = FastDivU32(magnitude, div);
+  // negate unsigned: INT32_MIN / 1 has no positive int32_t to negate
+  return n < 0 ? (int32_t)(0u - q) : (int32_t)q;
+}
+
+#endif // FASTDIV_H
@@ -0,0 +1,166 @@
+/*
+ * tickless_demo.c
+ *
+ * How much sleep does a tickless main loop buy?
+ *
+ * gcc -O2 -I../Ch06_Flow tickless_demo.c ../Ch06_Flow/scheduler.c -o tickless_demo
+ * ./tickless_demo [seconds per run]
+ *
+ * The tasks are roughly the Wordy ring's: read the accelerometer every
+ * 100 ms, scroll the word every 200 ms, blink a heartbeat every second and
+ * check the battery every 10 seconds, each with 30 us of work. They run on
+ * the scheduler from Ch06_Flow with a 1 ms tick, two ways:
+ *
+ *   ticked:   wake every tick, like Main 3 (timer interrupt for the LED),
+ *             and ask the scheduler if anything is due
+ *   tickless: ask the scheduler when the next task is due
+ *             (SchedulerNextDeadline) and sleep until then
+ *
+ * It reports wake ups per second, the fraction of time spent asleep, and
+ * how late the tasks ran, which should be the same both ways.
+ *
+ * The host's idle fraction is dominated by the system call to sleep and
+ * wake, so it also estimates the average current on the ring itself: each
+ * wake up costs WAKE_US awake, each task TASK_US, and the on and asleep
+ * currents are the totals from Power_consumption_Wordy_ring.xlsx. Those are
+ * assumptions; change them for your system.
+ *
+ * On a host, clock_nanosleep with an absolute time is the simplest way to
+ * sleep until a deadline; a loop that also waits on file descriptors would
+ * set a timerfd to the deadline and poll it with the rest. On a micro, set
+ * the compare register of a low power timer and go to sleep (WFI).
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "scheduler.h"
+
+#define TICK_NS 1000000u          // 1 ms
+#define TASK_US 30
+#define WAKE_US 20                // ring: wake up, tick interrupt, look at the wheel
+#define ON_MA 13.315              // ring: everything awake
+#define ASLEEP_MA 0.177           // ring: asleep
+#define BATTERY_MAH 40.0
+
+struct sRingTask {
+  const char *name;
+  uint32_t periodMs;
+  uint32_t runs;
+};
+
+static struct sRingTask gTasks[] = {
+  { "accelerometer", 100, 0 },
+  { "scroll word", 200, 0 },
+  { "heartbeat", 1000, 0 },
+  { "battery", 10000, 0 },
+};
+#define NUM_TASKS (sizeof(gTasks) / sizeof(gTasks[0]))
+
+static struct sScheduler gScheduler;
+static uint64_t gStartNs, gMaxLateNs, gTotalLateNs;
+static uint32_t gRuns;
+
+static uint64_t NowNs(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+static uint32_t CurrentTick(void)
+{
+  return (uint32_t)((NowNs() - gStartNs) / TICK_NS);
+}
+
+// Returns how long it slept
+static uint64_t SleepUntilTick(uint32_t tick)
+{
+  uint64_t when = gStartNs + (uint64_t)tick * TICK_NS;
+  uint64_t before = NowNs();
+  struct timespec until;
+  int error;
+
+  until.tv_sec = when / 1000000000u;
+  until.tv_nsec = when % 1000000000u;
+  // it returns the error rather than setting errno; only a signal is worth a retry
+  while ((error = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL)) == EINTR) {
+  }
+  if (error != 0) {
+    fprintf(stderr, "clock_nanosleep: %s\n", strerror(error));
+    exit(2);
+  }
+  return NowNs() - before;
+}
+
+static void RingTask(void *context)
+{
+  struct sRingTask *task = context;
+  uint64_t start = NowNs();
+  uint64_t late = start - (gStartNs + (uint64_t)gScheduler.now * TICK_NS);
+
+  if (late > gMaxLateNs) {
+    gMaxLateNs = late;
+  }
+  gTotalLateNs += late;
+  task->runs++;
+  gRuns++;
+  while (NowNs() - start < TASK_US * 1000u) {
+  }
+}
+
+static void Run(int tickless, uint32_t seconds)
+{
+  uint32_t endTick = seconds * (1000000000u / TICK_NS);
+  uint64_t asleepNs = 0, elapsedNs;
+  uint32_t wakes = 0, i;
+  double awake, microAwake, mA;
+
+  gMaxLateNs = gTotalLateNs = 0;
+  gRuns = 0;
+  SchedulerInit(&gScheduler, 0);
+  for (i = 0; i < NUM_TASKS; i++) {
+    gTasks[i].runs = 0;
+    SchedulerAdd(&gScheduler, RingTask, &gTasks[i], gTasks[i].periodMs, gTasks[i].periodMs);
+  }
+  gStartNs = NowNs();
+
+  while (gScheduler.now < endTick) {
+    uint32_t next = gScheduler.now + 1;
+    if (tickless) {
+      uint32_t ticks = SchedulerNextDeadline(&gScheduler);
+      next = ticks == SCHEDULER_NONE ? endTick : gScheduler.now + ticks;
+    }
+    asleepNs += SleepUntilTick(next);
+    wakes++;
+    SchedulerRun(&gScheduler, CurrentTick());
+  }
+  elapsedNs = NowNs() - gStartNs;
+
+  awake = 1.0 - (double)asleepNs / elapsedNs;
+  microAwake = ((double)wakes * WAKE_US + (double)gRuns * TASK_US) / (elapsedNs / 1000.0);
+  mA = ASLEEP_MA + (ON_MA - ASLEEP_MA) * microAwake;
+  printf("%s:\n", tickless ? "Tickless, sleep until the next deadline" : "Ticked, wake every 1 ms");
+  printf("  %8.1f wake ups/s, host asleep %6.2f%% of the time\n",
+         wakes / (elapsedNs / 1e9), 100.0 * (1.0 - awake));
+  printf("  %u task runs (", gRuns);
+  for (i = 0; i < NUM_TASKS; i++) {
+    printf("%s%s %u", i ? ", " : "", gTasks[i].name, gTasks[i].runs);
+  }
+  printf("), late by %.1f us average, %.1f us worst\n",
+         gRuns ? gTotalLateNs / 1e3 / gRuns : 0.0, gMaxLateNs / 1e3);
+  printf("  ring estimate: awake %.3f%%, %.3f mA average, %.1f days on a %.0f mAh battery\n",
+         100.0 * microAwake, mA, BATTERY_MAH / mA / 24.0, BATTERY_MAH);
+}
+
+int main(int argc, char *argv[])
+{
+  uint32_t seconds = argc > 1 ? (uint32_t)atoi(argv[1]) : 10;
+
+  Run(0, seconds);
+  Run(1, seconds);
+  return 0;
+}